@@ -0,0 +1,254 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "cinnamon-settings-bus.h"
+
+/* A pool of D-Bus proxies shared by the daemon and all of its plugins.
+ *
+ * Proxies are created asynchronously the first time somebody asks for
+ * one, and requests that come in while that is happening wait for the
+ * same proxy instead of creating their own. Once created, a proxy stays
+ * in the pool, so later requests complete right away and everybody
+ * shares its property cache and name owner tracking. */
+
+typedef struct {
+        GDBusProxy *proxy;
+        GList      *waiters; /* GTask */
+} PoolEntry;
+
+typedef struct {
+        gchar          *method_name;
+        GVariant       *parameters;
+        GDBusCallFlags  call_flags;
+        gint            timeout_msec;
+} CallData;
+
+static GHashTable *pool = NULL; /* key = bus:flags:name:path:interface, value = PoolEntry */
+
+static void
+pool_entry_free (PoolEntry *entry)
+{
+        g_clear_object (&entry->proxy);
+        g_free (entry);
+}
+
+static void
+call_data_free (CallData *data)
+{
+        g_free (data->method_name);
+        if (data->parameters != NULL)
+                g_variant_unref (data->parameters);
+        g_free (data);
+}
+
+static void
+pool_proxy_ready (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+        gchar *key = user_data;
+        PoolEntry *entry;
+        GDBusProxy *proxy;
+        GError *error = NULL;
+        GList *waiters, *l;
+
+        proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+
+        entry = g_hash_table_lookup (pool, key);
+        waiters = entry->waiters;
+        entry->waiters = NULL;
+
+        if (proxy == NULL) {
+                g_debug ("Could not create proxy for %s: %s", key, error->message);
+                /* Let the next request try again */
+                g_hash_table_remove (pool, key);
+        } else {
+                entry->proxy = proxy;
+        }
+
+        for (l = waiters; l != NULL; l = l->next) {
+                GTask *task = l->data;
+
+                if (proxy != NULL)
+                        g_task_return_pointer (task, g_object_ref (proxy), g_object_unref);
+                else
+                        g_task_return_error (task, g_error_copy (error));
+                g_object_unref (task);
+        }
+
+        g_list_free (waiters);
+        g_clear_error (&error);
+        g_free (key);
+}
+
+void
+cinnamon_settings_bus_get_proxy (GBusType             bus_type,
+                                 GDBusProxyFlags      flags,
+                                 const gchar         *name,
+                                 const gchar         *object_path,
+                                 const gchar         *interface_name,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+        PoolEntry *entry;
+        GTask *task;
+        gchar *key;
+
+        if (pool == NULL)
+                pool = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, (GDestroyNotify) pool_entry_free);
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+
+        key = g_strdup_printf ("%d:%u:%s:%s:%s", bus_type, flags,
+                               name, object_path, interface_name);
+        entry = g_hash_table_lookup (pool, key);
+
+        if (entry != NULL && entry->proxy != NULL) {
+                g_task_return_pointer (task, g_object_ref (entry->proxy), g_object_unref);
+                g_object_unref (task);
+                g_free (key);
+                return;
+        }
+
+        if (entry == NULL) {
+                entry = g_new0 (PoolEntry, 1);
+                g_hash_table_insert (pool, g_strdup (key), entry);
+
+                g_dbus_proxy_new_for_bus (bus_type,
+                                          flags,
+                                          NULL,
+                                          name,
+                                          object_path,
+                                          interface_name,
+                                          NULL,
+                                          pool_proxy_ready,
+                                          g_strdup (key));
+        }
+
+        entry->waiters = g_list_append (entry->waiters, task);
+        g_free (key);
+}
+
+GDBusProxy *
+cinnamon_settings_bus_get_proxy_finish (GAsyncResult  *result,
+                                        GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+call_done (GObject      *source_object,
+           GAsyncResult *res,
+           gpointer      user_data)
+{
+        GTask *task = user_data;
+        GVariant *ret;
+        GError *error = NULL;
+
+        ret = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (ret == NULL)
+                g_task_return_error (task, error);
+        else
+                g_task_return_pointer (task, ret, (GDestroyNotify) g_variant_unref);
+        g_object_unref (task);
+}
+
+static void
+call_proxy_ready (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+        GTask *task = user_data;
+        CallData *data = g_task_get_task_data (task);
+        GDBusProxy *proxy;
+        GError *error = NULL;
+
+        proxy = cinnamon_settings_bus_get_proxy_finish (res, &error);
+        if (proxy == NULL) {
+                g_task_return_error (task, error);
+                g_object_unref (task);
+                return;
+        }
+
+        g_dbus_proxy_call (proxy,
+                           data->method_name,
+                           data->parameters,
+                           data->call_flags,
+                           data->timeout_msec,
+                           g_task_get_cancellable (task),
+                           call_done,
+                           task);
+        g_object_unref (proxy);
+}
+
+/* Like g_dbus_proxy_call(), on the pooled proxy for the given object;
+ * the call is queued until the proxy is ready. @callback may be %NULL
+ * if the reply doesn't matter. */
+void
+cinnamon_settings_bus_call (GBusType             bus_type,
+                            const gchar         *name,
+                            const gchar         *object_path,
+                            const gchar         *interface_name,
+                            const gchar         *method_name,
+                            GVariant            *parameters,
+                            GDBusCallFlags       call_flags,
+                            gint                 timeout_msec,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             user_data)
+{
+        CallData *data;
+        GTask *task;
+
+        data = g_new0 (CallData, 1);
+        data->method_name = g_strdup (method_name);
+        data->parameters = parameters ? g_variant_ref_sink (parameters) : NULL;
+        data->call_flags = call_flags;
+        data->timeout_msec = timeout_msec;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_task_data (task, data, (GDestroyNotify) call_data_free);
+
+        cinnamon_settings_bus_get_proxy (bus_type,
+                                         G_DBUS_PROXY_FLAGS_NONE,
+                                         name,
+                                         object_path,
+                                         interface_name,
+                                         cancellable,
+                                         call_proxy_ready,
+                                         task);
+}
+
+GVariant *
+cinnamon_settings_bus_call_finish (GAsyncResult  *result,
+                                   GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+        return g_task_propagate_pointer (G_TASK (result), error);
+}
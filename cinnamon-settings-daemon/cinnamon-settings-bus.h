@@ -0,0 +1,55 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __CINNAMON_SETTINGS_BUS_H__
+#define __CINNAMON_SETTINGS_BUS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void        cinnamon_settings_bus_get_proxy        (GBusType             bus_type,
+                                                    GDBusProxyFlags      flags,
+                                                    const gchar         *name,
+                                                    const gchar         *object_path,
+                                                    const gchar         *interface_name,
+                                                    GCancellable        *cancellable,
+                                                    GAsyncReadyCallback  callback,
+                                                    gpointer             user_data);
+GDBusProxy *cinnamon_settings_bus_get_proxy_finish (GAsyncResult        *result,
+                                                    GError             **error);
+
+void        cinnamon_settings_bus_call             (GBusType             bus_type,
+                                                    const gchar         *name,
+                                                    const gchar         *object_path,
+                                                    const gchar         *interface_name,
+                                                    const gchar         *method_name,
+                                                    GVariant            *parameters,
+                                                    GDBusCallFlags       call_flags,
+                                                    gint                 timeout_msec,
+                                                    GCancellable        *cancellable,
+                                                    GAsyncReadyCallback  callback,
+                                                    gpointer             user_data);
+GVariant   *cinnamon_settings_bus_call_finish      (GAsyncResult        *result,
+                                                    GError             **error);
+
+G_END_DECLS
+
+#endif /* __CINNAMON_SETTINGS_BUS_H__ */
@@ -34,8 +34,11 @@
 #include <libcinnamon-desktop/gnome-pnp-ids.h>
 
 #include "cinnamon-settings-plugin-info.h"
+#include "cinnamon-settings-plugin-cache.h"
+#include "cinnamon-settings-plugin-trigger.h"
 #include "cinnamon-settings-manager.h"
 #include "cinnamon-settings-profile.h"
+#include "cinnamon-settings-watchdog.h"
 
 #define CSD_MANAGER_DBUS_PATH "/org/cinnamon/SettingsDaemon"
 #define CSD_MANAGER_DBUS_NAME "org.cinnamon.SettingsDaemon"
@@ -56,6 +59,15 @@ static const gchar introspection_xml[] =
 "    <signal name='PluginDeactivated'>"
 "      <arg name='name' type='s'/>"
 "    </signal>"
+"    <method name='GetStartupTrace'>"
+"      <arg name='trace' direction='out' type='s'/>"
+"    </method>"
+"    <method name='GetPluginHosts'>"
+"      <arg name='hosts' direction='out' type='a(siuttxx)'/>"
+"    </method>"
+"    <method name='GetMainLoopLatency'>"
+"      <arg name='latency' direction='out' type='a(sttttta(tt))'/>"
+"    </method>"
 "  </interface>"
 "</node>";
 
@@ -67,8 +79,31 @@ struct CinnamonSettingsManagerPrivate
         GSettings                  *settings;
         GnomePnpIds                *pnp_ids;
         GSList                     *plugins;
+
+        /* Enabled plugins still waiting to be activated, by priority */
+        GSList                     *pending;
+        guint                       activate_idle_id;
+        gint64                      load_start;
+
+        /* Enabled plugins waiting for one of their triggers */
+        GSList                     *lazy;
 };
 
+typedef struct
+{
+        CinnamonSettingsManager    *manager;
+        CinnamonSettingsPluginInfo *info;
+        CinnamonSettingsTriggers   *triggers;
+} LazyPlugin;
+
+typedef struct
+{
+        char                       *filename;
+        CinnamonSettingsPluginInfo *info;
+        char                       *key_name;
+        gboolean                    has_schema;
+} PluginLoadJob;
+
 static void     cinnamon_settings_manager_class_init  (CinnamonSettingsManagerClass *klass);
 static void     cinnamon_settings_manager_init        (CinnamonSettingsManager      *settings_manager);
 static void     cinnamon_settings_manager_finalize    (GObject                   *object);
@@ -95,7 +130,9 @@ maybe_activate_plugin (CinnamonSettingsPluginInfo *info, gpointer user_data)
                 gboolean res;
                 res = cinnamon_settings_plugin_info_activate (info);
                 if (res) {
-                        g_debug ("Plugin %s: active", cinnamon_settings_plugin_info_get_location (info));
+                        g_debug ("Plugin %s: active (%.1f ms)",
+                                 cinnamon_settings_plugin_info_get_location (info),
+                                 cinnamon_settings_plugin_info_get_activation_time (info) / 1000.0);
                 } else {
                         g_debug ("Plugin %s: activation failed", cinnamon_settings_plugin_info_get_location (info));
                 }
@@ -195,63 +232,143 @@ contained (const char * const *items,
 }
 
 static gboolean
-is_schema (const char *schema)
+is_schema (GSettingsSchemaSource *source,
+           const char            *schema)
 {
-        return contained (g_settings_list_schemas (), schema);
+        GSettingsSchema *found;
+
+        if (source == NULL) {
+                return FALSE;
+        }
+
+        found = g_settings_schema_source_lookup (source, schema, TRUE);
+        if (found == NULL) {
+                return FALSE;
+        }
+
+        g_settings_schema_unref (found);
+
+        return TRUE;
 }
 
+static void
+plugin_load_job_free (PluginLoadJob *job)
+{
+        g_free (job->filename);
+        g_free (job->key_name);
+        if (job->info != NULL) {
+                g_object_unref (job->info);
+        }
+        g_free (job);
+}
 
+/* Runs in a worker thread: parse the plugin file and check that its
+ * settings schema is installed. Nothing here may touch GSettings
+ * instances, signals or the display. */
 static void
-_load_file (CinnamonSettingsManager *manager,
-            const char           *filename)
+load_file_thread (PluginLoadJob         *job,
+                  GSettingsSchemaSource *source)
 {
-        CinnamonSettingsPluginInfo *info;
-        char                    *key_name;
-        GSList                  *l;
+        g_debug ("Loading plugin: %s", job->filename);
 
-        g_debug ("Loading plugin: %s", filename);
-        cinnamon_settings_profile_start ("%s", filename);
+        job->info = cinnamon_settings_plugin_info_new_from_file (job->filename);
+        if (job->info == NULL) {
+                return;
+        }
 
-        info = cinnamon_settings_plugin_info_new_from_file (filename);
-        if (info == NULL) {
-                goto out;
+        job->key_name = g_strdup_printf ("%s.plugins.%s",
+                                         DEFAULT_SETTINGS_PREFIX,
+                                         cinnamon_settings_plugin_info_get_location (job->info));
+        job->has_schema = is_schema (source, job->key_name);
+}
+
+static void
+preload_thread (CinnamonSettingsPluginInfo *info,
+                gpointer                    user_data)
+{
+        cinnamon_settings_plugin_info_preload (info);
+}
+
+static GThreadPool *
+new_load_pool (GFunc    func,
+               gpointer user_data)
+{
+        GThreadPool *pool;
+        GError      *error = NULL;
+
+        pool = g_thread_pool_new (func,
+                                  user_data,
+                                  MAX (1, (int) g_get_num_processors ()),
+                                  TRUE,
+                                  &error);
+        if (pool == NULL) {
+                g_warning ("Could not create plugin loader threads: %s", error->message);
+                g_error_free (error);
         }
 
+        return pool;
+}
+
+static void
+_register_plugin (CinnamonSettingsManager    *manager,
+                  CinnamonSettingsPluginInfo *info)
+{
+        char                    *key_name;
+        char                   **out_of_process;
+        GSList                  *l;
+
         l = g_slist_find_custom (manager->priv->plugins,
                                  info,
                                  (GCompareFunc) compare_location);
         if (l != NULL) {
-                goto out;
+                return;
         }
 
         key_name = g_strdup_printf ("%s.plugins.%s",
                                     DEFAULT_SETTINGS_PREFIX,
                                     cinnamon_settings_plugin_info_get_location (info));
 
-        /* Ignore unknown schemas or else we'll assert */
-        if (is_schema (key_name)) {
-                manager->priv->plugins = g_slist_prepend (manager->priv->plugins,
-                                                          g_object_ref (info));
+        manager->priv->plugins = g_slist_prepend (manager->priv->plugins,
+                                                  g_object_ref (info));
 
-                g_signal_connect (info, "activated",
-                                  G_CALLBACK (on_plugin_activated), manager);
-                g_signal_connect (info, "deactivated",
-                                  G_CALLBACK (on_plugin_deactivated), manager);
+        g_signal_connect (info, "activated",
+                          G_CALLBACK (on_plugin_activated), manager);
+        g_signal_connect (info, "deactivated",
+                          G_CALLBACK (on_plugin_deactivated), manager);
 
-                cinnamon_settings_plugin_info_set_settings_prefix (info, key_name);
-        } else {
-                g_warning ("Ignoring unknown module '%s'", key_name);
+        /* Priority is set in the call below */
+        cinnamon_settings_plugin_info_set_settings_prefix (info, key_name);
+
+        out_of_process = g_settings_get_strv (manager->priv->settings, "out-of-process");
+        if (contained ((const char * const *) out_of_process, cinnamon_settings_plugin_info_get_location (info))) {
+                cinnamon_settings_plugin_info_set_out_of_process (info,
+                                                                  TRUE,
+                                                                  g_settings_get_int (manager->priv->settings, "out-of-process-memory-limit"));
         }
+        g_strfreev (out_of_process);
 
-        /* Priority is set in the call above */
         g_free (key_name);
+}
 
- out:
-        if (info != NULL) {
-                g_object_unref (info);
+static void
+_load_file (CinnamonSettingsManager *manager,
+            PluginLoadJob           *job)
+{
+        cinnamon_settings_profile_start ("%s", job->filename);
+
+        if (job->info == NULL) {
+                goto out;
+        }
+
+        /* Ignore unknown schemas or else we'll assert */
+        if (job->has_schema) {
+                _register_plugin (manager, job->info);
+        } else {
+                g_warning ("Ignoring unknown module '%s'", job->key_name);
         }
 
-        cinnamon_settings_profile_end ("%s", filename);
+ out:
+        cinnamon_settings_profile_end ("%s", job->filename);
 }
 
 static void
@@ -261,6 +378,11 @@ _load_dir (CinnamonSettingsManager *manager,
         GError     *error;
         GDir       *d;
         const char *name;
+        GPtrArray  *jobs;
+        GThreadPool *pool;
+        GSettingsSchemaSource *source;
+        GSList     *valid = NULL;
+        guint       i;
 
         g_debug ("Loading settings plugins from dir: %s", path);
         cinnamon_settings_profile_start (NULL);
@@ -273,7 +395,10 @@ _load_dir (CinnamonSettingsManager *manager,
                 return;
         }
 
+        jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) plugin_load_job_free);
+
         while ((name = g_dir_read_name (d))) {
+                PluginLoadJob *job;
                 char *filename;
 
                 if (!g_str_has_suffix (name, PLUGIN_EXT)) {
@@ -281,27 +406,250 @@ _load_dir (CinnamonSettingsManager *manager,
                 }
 
                 filename = g_build_filename (path, name, NULL);
-                if (g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
-                        _load_file (manager, filename);
+                if (!g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+                        g_free (filename);
+                        continue;
                 }
-                g_free (filename);
+
+                job = g_new0 (PluginLoadJob, 1);
+                job->filename = filename;
+                g_ptr_array_add (jobs, job);
         }
 
         g_dir_close (d);
 
+        /* Parse the plugin files and check the schemas in parallel, then
+         * register the results here in directory order */
+        source = g_settings_schema_source_get_default ();
+        pool = new_load_pool ((GFunc) load_file_thread, source);
+
+        for (i = 0; i < jobs->len; i++) {
+                PluginLoadJob *job = g_ptr_array_index (jobs, i);
+
+                if (pool == NULL) {
+                        load_file_thread (job, source);
+                } else {
+                        g_thread_pool_push (pool, job, NULL);
+                }
+        }
+
+        if (pool != NULL) {
+                g_thread_pool_free (pool, FALSE, TRUE);
+        }
+
+        /* Save the plugin files as parsed, before the settings get to
+         * override their priority */
+        for (i = jobs->len; i > 0; i--) {
+                PluginLoadJob *job = g_ptr_array_index (jobs, i - 1);
+
+                if (job->info != NULL && job->has_schema) {
+                        valid = g_slist_prepend (valid, job->info);
+                }
+        }
+        cinnamon_settings_plugin_cache_save (path, valid);
+        g_slist_free (valid);
+
+        for (i = 0; i < jobs->len; i++) {
+                _load_file (manager, g_ptr_array_index (jobs, i));
+        }
+
+        g_ptr_array_unref (jobs);
+
         cinnamon_settings_profile_end (NULL);
 }
 
+static void
+_preload_enabled (CinnamonSettingsManager *manager)
+{
+        GThreadPool *pool;
+        GSList      *l;
+
+        cinnamon_settings_profile_start (NULL);
+
+        pool = new_load_pool ((GFunc) preload_thread, NULL);
+        if (pool == NULL) {
+                goto out;
+        }
+
+        for (l = manager->priv->pending; l != NULL; l = l->next) {
+                g_thread_pool_push (pool, l->data, NULL);
+        }
+
+        g_thread_pool_free (pool, FALSE, TRUE);
+ out:
+        cinnamon_settings_profile_end (NULL);
+}
+
+/* A plugin is ready to start once none of the plugins it depends on
+ * are still waiting. Dependencies on plugins that are missing or
+ * disabled are ignored. */
+static gboolean
+plugin_is_ready (CinnamonSettingsManager    *manager,
+                 CinnamonSettingsPluginInfo *info)
+{
+        const char * const *deps;
+        GSList             *l;
+        guint               i;
+
+        deps = cinnamon_settings_plugin_info_get_dependencies (info);
+        if (deps == NULL) {
+                return TRUE;
+        }
+
+        for (i = 0; deps[i] != NULL; i++) {
+                for (l = manager->priv->pending; l != NULL; l = l->next) {
+                        if (g_strcmp0 (cinnamon_settings_plugin_info_get_location (l->data), deps[i]) == 0) {
+                                return FALSE;
+                        }
+                }
+        }
+
+        return TRUE;
+}
+
+static CinnamonSettingsPluginInfo *
+pop_ready_plugin (CinnamonSettingsManager *manager,
+                  gboolean                 early_only)
+{
+        CinnamonSettingsPluginInfo *info;
+        GSList                     *l;
+
+        for (l = manager->priv->pending; l != NULL; l = l->next) {
+                info = l->data;
+
+                if (early_only && !cinnamon_settings_plugin_info_get_start_early (info)) {
+                        continue;
+                }
+
+                if (plugin_is_ready (manager, info)) {
+                        manager->priv->pending = g_slist_delete_link (manager->priv->pending, l);
+                        return info;
+                }
+        }
+
+        return NULL;
+}
+
+static gboolean
+activate_next_plugin_idle (CinnamonSettingsManager *manager)
+{
+        CinnamonSettingsPluginInfo *info;
+
+        info = pop_ready_plugin (manager, FALSE);
+        if (info == NULL && manager->priv->pending != NULL) {
+                info = manager->priv->pending->data;
+                g_warning ("Plugin %s: dependencies cannot be satisfied, starting it anyway",
+                           cinnamon_settings_plugin_info_get_location (info));
+                manager->priv->pending = g_slist_delete_link (manager->priv->pending,
+                                                              manager->priv->pending);
+        }
+
+        if (info != NULL) {
+                cinnamon_settings_profile_start (NULL);
+                maybe_activate_plugin (info, manager);
+                cinnamon_settings_profile_end (NULL);
+        }
+
+        if (manager->priv->pending != NULL) {
+                return TRUE;
+        }
+
+        g_debug ("All plugins started in %.1f ms",
+                 (g_get_monotonic_time () - manager->priv->load_start) / 1000.0);
+        manager->priv->activate_idle_id = 0;
+
+        return FALSE;
+}
+
+static void
+lazy_plugin_free (LazyPlugin *lazy)
+{
+        cinnamon_settings_triggers_free (lazy->triggers);
+        g_free (lazy);
+}
+
+static void
+on_lazy_plugin_triggered (LazyPlugin *lazy)
+{
+        CinnamonSettingsManager    *manager = lazy->manager;
+        CinnamonSettingsPluginInfo *info = lazy->info;
+
+        manager->priv->lazy = g_slist_remove (manager->priv->lazy, lazy);
+        lazy_plugin_free (lazy);
+
+        cinnamon_settings_profile_start ("%s", cinnamon_settings_plugin_info_get_location (info));
+        maybe_activate_plugin (info, manager);
+        cinnamon_settings_profile_end ("%s", cinnamon_settings_plugin_info_get_location (info));
+}
+
+/* Plugins with an ActivateOn key are not loaded at all until one of
+ * their triggers fires */
+static void
+_watch_plugin_triggers (CinnamonSettingsManager    *manager,
+                        CinnamonSettingsPluginInfo *info)
+{
+        LazyPlugin *lazy;
+
+        g_debug ("Plugin %s: waiting for trigger", cinnamon_settings_plugin_info_get_location (info));
+
+        lazy = g_new0 (LazyPlugin, 1);
+        lazy->manager = manager;
+        lazy->info = info;
+        manager->priv->lazy = g_slist_prepend (manager->priv->lazy, lazy);
+
+        lazy->triggers = cinnamon_settings_triggers_new (cinnamon_settings_plugin_info_get_triggers (info),
+                                                         (CinnamonSettingsTriggerFunc) on_lazy_plugin_triggered,
+                                                         lazy);
+}
+
 static void
 _load_all (CinnamonSettingsManager *manager)
 {
+        CinnamonSettingsPluginInfo *info;
+        GSList *cached;
+        GSList *l;
+
         cinnamon_settings_profile_start (NULL);
 
-        /* load system plugins */
-        _load_dir (manager, CINNAMON_SETTINGS_PLUGINDIR G_DIR_SEPARATOR_S);
+        manager->priv->load_start = g_get_monotonic_time ();
+
+        /* load system plugins, from the index if it is still valid */
+        if (cinnamon_settings_plugin_cache_load (CINNAMON_SETTINGS_PLUGINDIR G_DIR_SEPARATOR_S, &cached)) {
+                g_debug ("Loading settings plugins from cache");
+                for (l = cached; l != NULL; l = l->next) {
+                        _register_plugin (manager, l->data);
+                }
+                g_slist_free_full (cached, g_object_unref);
+        } else {
+                _load_dir (manager, CINNAMON_SETTINGS_PLUGINDIR G_DIR_SEPARATOR_S);
+        }
 
         manager->priv->plugins = g_slist_sort (manager->priv->plugins, (GCompareFunc) compare_priority);
-        g_slist_foreach (manager->priv->plugins, (GFunc) maybe_activate_plugin, NULL);
+
+        for (l = manager->priv->plugins; l != NULL; l = l->next) {
+                info = l->data;
+
+                if (!cinnamon_settings_plugin_info_get_enabled (info)) {
+                        g_debug ("Plugin %s: inactive", cinnamon_settings_plugin_info_get_location (info));
+                } else if (cinnamon_settings_plugin_info_get_triggers (info) != NULL) {
+                        _watch_plugin_triggers (manager, info);
+                } else {
+                        manager->priv->pending = g_slist_append (manager->priv->pending, info);
+                }
+        }
+
+        _preload_enabled (manager);
+
+        /* Plugins that need to be up before the session continues are
+         * started right away, everything else one per main loop iteration */
+        while ((info = pop_ready_plugin (manager, TRUE)) != NULL) {
+                maybe_activate_plugin (info, manager);
+        }
+
+        if (manager->priv->pending != NULL) {
+                manager->priv->activate_idle_id = g_idle_add ((GSourceFunc) activate_next_plugin_idle, manager);
+        }
+
         cinnamon_settings_profile_end (NULL);
 }
 
@@ -317,11 +665,82 @@ _unload_plugin (CinnamonSettingsPluginInfo *info, gpointer user_data)
 static void
 _unload_all (CinnamonSettingsManager *manager)
 {
+         if (manager->priv->activate_idle_id != 0) {
+                 g_source_remove (manager->priv->activate_idle_id);
+                 manager->priv->activate_idle_id = 0;
+         }
+         g_slist_free (manager->priv->pending);
+         manager->priv->pending = NULL;
+         g_slist_free_full (manager->priv->lazy, (GDestroyNotify) lazy_plugin_free);
+         manager->priv->lazy = NULL;
+
          g_slist_foreach (manager->priv->plugins, (GFunc) _unload_plugin, NULL);
          g_slist_free (manager->priv->plugins);
          manager->priv->plugins = NULL;
 }
 
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        CinnamonSettingsManager *manager = user_data;
+
+        g_debug ("Calling method '%s' for settings manager", method_name);
+
+        if (g_strcmp0 (method_name, "GetStartupTrace") == 0) {
+                char *trace;
+
+                trace = cinnamon_settings_profile_dump_json ();
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(s)", trace));
+                g_free (trace);
+        } else if (g_strcmp0 (method_name, "GetPluginHosts") == 0) {
+                GVariantBuilder builder;
+                GSList         *l;
+
+                g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(siuttxx)"));
+                for (l = manager->priv->plugins; l != NULL; l = l->next) {
+                        CinnamonSettingsPluginHost     *host;
+                        CinnamonSettingsPluginHostStats stats;
+
+                        host = cinnamon_settings_plugin_info_get_host (l->data);
+                        if (host == NULL) {
+                                continue;
+                        }
+
+                        cinnamon_settings_plugin_host_get_stats (host, &stats);
+                        g_variant_builder_add (&builder, "(siuttxx)",
+                                               cinnamon_settings_plugin_info_get_location (l->data),
+                                               (gint32) stats.pid,
+                                               stats.restarts,
+                                               stats.max_rss,
+                                               stats.cpu_time,
+                                               stats.ping_latency,
+                                               stats.max_ping_latency);
+                }
+
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(a(siuttxx))", &builder));
+        } else if (g_strcmp0 (method_name, "GetMainLoopLatency") == 0) {
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(@" CINNAMON_SETTINGS_WATCHDOG_STATS_TYPE ")",
+                                                                      cinnamon_settings_watchdog_get_stats ()));
+        }
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+        handle_method_call,
+        NULL, /* Get Property */
+        NULL, /* Set Property */
+};
+
 static void
 on_bus_gotten (GObject             *source_object,
                GAsyncResult        *res,
@@ -341,8 +760,8 @@ on_bus_gotten (GObject             *source_object,
         g_dbus_connection_register_object (connection,
                                            CSD_MANAGER_DBUS_PATH,
                                            manager->priv->introspection_data->interfaces[0],
-                                           NULL,
-                                           NULL,
+                                           &interface_vtable,
+                                           manager,
                                            NULL,
                                            NULL);
 }
@@ -359,6 +778,14 @@ register_manager (CinnamonSettingsManager *manager)
                    manager);
 }
 
+static void
+on_stall_threshold_changed (GSettings               *settings,
+                            const char              *key,
+                            CinnamonSettingsManager *manager)
+{
+        cinnamon_settings_watchdog_set_threshold (MAX (g_settings_get_int (settings, key), 0));
+}
+
 gboolean
 cinnamon_settings_manager_start (CinnamonSettingsManager *manager,
                               GError              **error)
@@ -387,6 +814,11 @@ cinnamon_settings_manager_start (CinnamonSettingsManager *manager,
         cinnamon_settings_profile_start ("initializing plugins");
         manager->priv->settings = g_settings_new (DEFAULT_SETTINGS_PREFIX ".plugins");
 
+        cinnamon_settings_watchdog_start (NULL);
+        on_stall_threshold_changed (manager->priv->settings, "stall-threshold", manager);
+        g_signal_connect (manager->priv->settings, "changed::stall-threshold",
+                          G_CALLBACK (on_stall_threshold_changed), manager);
+
         _load_all (manager);
         cinnamon_settings_profile_end ("initializing plugins");
 
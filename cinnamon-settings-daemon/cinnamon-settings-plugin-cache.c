@@ -0,0 +1,230 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "cinnamon-settings-plugin-cache.h"
+#include "cinnamon-settings-plugin-info.h"
+#include "cinnamon-settings-profile.h"
+
+/* The index is a serialized GVariant holding the plugin metadata of every
+ * plugin whose settings schema is installed, along with the modification
+ * times of the plugin directory and of the compiled schema files it was
+ * built against. It is mapped at startup and thrown away as soon as any
+ * of those change. */
+
+#define CACHE_VERSION 2
+#define CACHE_TYPE "(usa(st)a" CINNAMON_SETTINGS_PLUGIN_INFO_VARIANT_TYPE ")"
+
+static char *
+get_cache_path (void)
+{
+        return g_build_filename (g_get_user_cache_dir (),
+                                 "cinnamon-settings-daemon",
+                                 "plugins.cache",
+                                 NULL);
+}
+
+static void
+add_stamp (GVariantBuilder *builder,
+           const char      *path)
+{
+        GStatBuf buf;
+        guint64  mtime = 0;
+
+        if (g_stat (path, &buf) == 0) {
+                mtime = buf.st_mtime;
+        }
+
+        g_variant_builder_add (builder, "(st)", path, mtime);
+}
+
+static void
+add_schema_stamp (GVariantBuilder *builder,
+                  const char      *data_dir)
+{
+        char *path;
+
+        path = g_build_filename (data_dir, "glib-2.0", "schemas", "gschemas.compiled", NULL);
+        add_stamp (builder, path);
+        g_free (path);
+}
+
+/* Everything the contents of the index depend on, in the same order as
+ * GSettings searches for schemas */
+static GVariant *
+build_stamps (const char *plugin_dir)
+{
+        GVariantBuilder     builder;
+        const char * const *dirs;
+        const char         *schema_dir;
+        guint               i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(st)"));
+
+        add_stamp (&builder, plugin_dir);
+
+        schema_dir = g_getenv ("GSETTINGS_SCHEMA_DIR");
+        if (schema_dir != NULL) {
+                char **env_dirs;
+
+                env_dirs = g_strsplit (schema_dir, G_SEARCHPATH_SEPARATOR_S, 0);
+                for (i = 0; env_dirs[i] != NULL; i++) {
+                        char *path;
+
+                        path = g_build_filename (env_dirs[i], "gschemas.compiled", NULL);
+                        add_stamp (&builder, path);
+                        g_free (path);
+                }
+                g_strfreev (env_dirs);
+        }
+
+        add_schema_stamp (&builder, g_get_user_data_dir ());
+
+        dirs = g_get_system_data_dirs ();
+        for (i = 0; dirs[i] != NULL; i++) {
+                add_schema_stamp (&builder, dirs[i]);
+        }
+
+        return g_variant_builder_end (&builder);
+}
+
+gboolean
+cinnamon_settings_plugin_cache_load (const char  *plugin_dir,
+                                     GSList     **infos)
+{
+        GMappedFile  *mapped;
+        GBytes       *bytes;
+        GVariant     *cache;
+        GVariant     *stamps;
+        GVariant     *cached_stamps;
+        GVariant     *entries;
+        GVariantIter  iter;
+        GVariant     *entry;
+        const char   *locale;
+        char         *path;
+        guint32       version;
+        gboolean      ret;
+
+        g_return_val_if_fail (infos != NULL, FALSE);
+
+        ret = FALSE;
+        *infos = NULL;
+
+        cinnamon_settings_profile_start (NULL);
+
+        path = get_cache_path ();
+        mapped = g_mapped_file_new (path, FALSE, NULL);
+        g_free (path);
+        if (mapped == NULL) {
+                g_debug ("No plugin cache found");
+                goto out;
+        }
+
+        bytes = g_mapped_file_get_bytes (mapped);
+        g_mapped_file_unref (mapped);
+
+        cache = g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_TYPE), bytes, FALSE);
+        g_bytes_unref (bytes);
+
+        g_variant_get (cache, "(u&s@a(st)@a" CINNAMON_SETTINGS_PLUGIN_INFO_VARIANT_TYPE ")",
+                       &version, &locale, &cached_stamps, &entries);
+
+        stamps = build_stamps (plugin_dir);
+
+        if (version != CACHE_VERSION) {
+                g_debug ("Plugin cache has version %u, expected %u", version, CACHE_VERSION);
+        } else if (g_strcmp0 (locale, g_get_language_names ()[0]) != 0) {
+                g_debug ("Plugin cache was built for locale '%s'", locale);
+        } else if (!g_variant_equal (stamps, cached_stamps)) {
+                g_debug ("Plugin cache is out of date");
+        } else {
+                g_variant_iter_init (&iter, entries);
+                while ((entry = g_variant_iter_next_value (&iter)) != NULL) {
+                        CinnamonSettingsPluginInfo *info;
+
+                        info = cinnamon_settings_plugin_info_new_from_variant (entry);
+                        if (info != NULL) {
+                                *infos = g_slist_prepend (*infos, info);
+                        }
+                        g_variant_unref (entry);
+                }
+                *infos = g_slist_reverse (*infos);
+                ret = TRUE;
+        }
+
+        g_variant_unref (stamps);
+        g_variant_unref (cached_stamps);
+        g_variant_unref (entries);
+        g_variant_unref (cache);
+ out:
+        cinnamon_settings_profile_end (NULL);
+
+        return ret;
+}
+
+void
+cinnamon_settings_plugin_cache_save (const char *plugin_dir,
+                                     GSList     *infos)
+{
+        GVariantBuilder builder;
+        GVariant       *cache;
+        GError         *error = NULL;
+        GSList         *l;
+        char           *path;
+        char           *dirname;
+
+        cinnamon_settings_profile_start (NULL);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" CINNAMON_SETTINGS_PLUGIN_INFO_VARIANT_TYPE));
+        for (l = infos; l != NULL; l = l->next) {
+                g_variant_builder_add_value (&builder,
+                                             cinnamon_settings_plugin_info_serialize (l->data));
+        }
+
+        cache = g_variant_new ("(us@a(st)@a" CINNAMON_SETTINGS_PLUGIN_INFO_VARIANT_TYPE ")",
+                               CACHE_VERSION,
+                               g_get_language_names ()[0],
+                               build_stamps (plugin_dir),
+                               g_variant_builder_end (&builder));
+        g_variant_ref_sink (cache);
+
+        path = get_cache_path ();
+        dirname = g_path_get_dirname (path);
+
+        if (g_mkdir_with_parents (dirname, 0700) != 0 ||
+            !g_file_set_contents (path,
+                                  g_variant_get_data (cache),
+                                  g_variant_get_size (cache),
+                                  &error)) {
+                g_debug ("Could not write plugin cache %s: %s",
+                         path, error ? error->message : "cannot create directory");
+                g_clear_error (&error);
+        }
+
+        g_free (dirname);
+        g_free (path);
+        g_variant_unref (cache);
+
+        cinnamon_settings_profile_end (NULL);
+}
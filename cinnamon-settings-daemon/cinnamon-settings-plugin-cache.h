@@ -0,0 +1,35 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __CINNAMON_SETTINGS_PLUGIN_CACHE_H__
+#define __CINNAMON_SETTINGS_PLUGIN_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean         cinnamon_settings_plugin_cache_load           (const char  *plugin_dir,
+                                                             GSList     **infos);
+void             cinnamon_settings_plugin_cache_save           (const char  *plugin_dir,
+                                                             GSList      *infos);
+
+G_END_DECLS
+
+#endif  /* __CINNAMON_SETTINGS_PLUGIN_CACHE_H__ */
@@ -0,0 +1,387 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include "cinnamon-settings-plugin-host.h"
+
+#define HOST_PROGRAM LIBEXECDIR "/csd-plugin-host"
+
+/* How often the host is pinged, a late pong means its main loop stalled */
+#define PING_INTERVAL 5
+/* How long a host gets to deactivate its plugin before it is killed */
+#define STOP_TIMEOUT 5
+/* Crashing hosts are restarted with an exponential back-off, up to */
+#define MAX_RESTARTS 5
+
+struct CinnamonSettingsPluginHost
+{
+        char                            *name;
+        char                            *module_path;
+        guint                            memory_limit;  /* MiB, 0 for none */
+
+        GPid                             pid;
+        int                              child_fd;
+        GIOChannel                      *channel;
+        guint                            io_watch_id;
+        guint                            child_watch_id;
+        guint                            ping_id;
+        guint                            kill_id;
+        guint                            restart_id;
+        gboolean                         stopping;
+
+        gint64                           ping_sent;
+        CinnamonSettingsPluginHostStats  stats;
+};
+
+static void
+send_command (CinnamonSettingsPluginHost *host,
+              const char                 *command)
+{
+        int fd;
+
+        if (host->channel == NULL) {
+                return;
+        }
+
+        fd = g_io_channel_unix_get_fd (host->channel);
+        if (write (fd, command, strlen (command)) < 0 && errno != EAGAIN) {
+                g_debug ("Could not talk to plugin host for %s: %s",
+                         host->name, g_strerror (errno));
+        }
+}
+
+static void
+handle_line (CinnamonSettingsPluginHost *host,
+             const char                 *line)
+{
+        guint64 max_rss;
+        guint64 cpu_time;
+
+        if (g_strcmp0 (line, "ready") == 0) {
+                g_debug ("Plugin host for %s is ready", host->name);
+        } else if (g_strcmp0 (line, "pong") == 0 && host->ping_sent != 0) {
+                host->stats.ping_latency = g_get_monotonic_time () - host->ping_sent;
+                host->stats.max_ping_latency = MAX (host->stats.max_ping_latency,
+                                                    host->stats.ping_latency);
+                host->ping_sent = 0;
+        } else if (sscanf (line, "stats %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &max_rss, &cpu_time) == 2) {
+                host->stats.max_rss = max_rss;
+                host->stats.cpu_time = cpu_time;
+        } else if (g_str_has_prefix (line, "error ")) {
+                g_warning ("Plugin host for %s: %s", host->name, line + strlen ("error "));
+        } else {
+                g_debug ("Unexpected message from plugin host for %s: '%s'", host->name, line);
+        }
+}
+
+static gboolean
+host_io_cb (GIOChannel                 *channel,
+            GIOCondition                condition,
+            CinnamonSettingsPluginHost *host)
+{
+        GIOStatus  status;
+        char      *line;
+
+        if (condition & G_IO_IN) {
+                while ((status = g_io_channel_read_line (channel, &line, NULL, NULL, NULL)) == G_IO_STATUS_NORMAL) {
+                        handle_line (host, g_strchomp (line));
+                        g_free (line);
+                }
+
+                if (status == G_IO_STATUS_AGAIN) {
+                        return TRUE;
+                }
+        }
+
+        /* The host went away, the child watch takes care of the rest */
+        host->io_watch_id = 0;
+        return FALSE;
+}
+
+static gboolean
+ping_cb (CinnamonSettingsPluginHost *host)
+{
+        gint64 now;
+
+        now = g_get_monotonic_time ();
+
+        /* Still waiting for the last one, the host is stalled */
+        if (host->ping_sent != 0) {
+                host->stats.ping_latency = now - host->ping_sent;
+                host->stats.max_ping_latency = MAX (host->stats.max_ping_latency,
+                                                    host->stats.ping_latency);
+                return TRUE;
+        }
+
+        host->ping_sent = now;
+        send_command (host, "ping\n");
+
+        return TRUE;
+}
+
+static void
+disconnect_host (CinnamonSettingsPluginHost *host)
+{
+        if (host->io_watch_id != 0) {
+                g_source_remove (host->io_watch_id);
+                host->io_watch_id = 0;
+        }
+        if (host->ping_id != 0) {
+                g_source_remove (host->ping_id);
+                host->ping_id = 0;
+        }
+        if (host->kill_id != 0) {
+                g_source_remove (host->kill_id);
+                host->kill_id = 0;
+        }
+        if (host->channel != NULL) {
+                g_io_channel_unref (host->channel);
+                host->channel = NULL;
+        }
+        host->ping_sent = 0;
+}
+
+static gboolean
+restart_cb (CinnamonSettingsPluginHost *host)
+{
+        host->restart_id = 0;
+        cinnamon_settings_plugin_host_start (host);
+
+        return FALSE;
+}
+
+static void
+host_exited_cb (GPid                        pid,
+                gint                        status,
+                CinnamonSettingsPluginHost *host)
+{
+        g_spawn_close_pid (pid);
+
+        host->child_watch_id = 0;
+        host->pid = 0;
+        disconnect_host (host);
+
+        if (host->stopping) {
+                g_debug ("Plugin host for %s exited", host->name);
+                return;
+        }
+
+        if (WIFSIGNALED (status)) {
+                g_warning ("Plugin host for %s was killed by signal %d",
+                           host->name, WTERMSIG (status));
+        } else {
+                g_warning ("Plugin host for %s exited with status %d",
+                           host->name, WEXITSTATUS (status));
+        }
+
+        if (host->stats.restarts >= MAX_RESTARTS) {
+                g_warning ("Plugin host for %s keeps failing, not restarting it", host->name);
+                return;
+        }
+
+        host->restart_id = g_timeout_add_seconds (1 << host->stats.restarts,
+                                                  (GSourceFunc) restart_cb,
+                                                  host);
+        host->stats.restarts++;
+}
+
+/* Runs in the child between fork() and exec(), so only async-signal-safe
+ * calls are allowed here */
+static void
+host_child_setup (gpointer user_data)
+{
+        CinnamonSettingsPluginHost *host = user_data;
+
+        if (host->child_fd == CINNAMON_SETTINGS_PLUGIN_HOST_FD) {
+                fcntl (host->child_fd, F_SETFD, 0);
+        } else {
+                dup2 (host->child_fd, CINNAMON_SETTINGS_PLUGIN_HOST_FD);
+        }
+
+        if (host->memory_limit > 0) {
+                struct rlimit limit;
+
+                limit.rlim_cur = limit.rlim_max = (rlim_t) host->memory_limit * 1024 * 1024;
+                setrlimit (RLIMIT_AS, &limit);
+        }
+}
+
+gboolean
+cinnamon_settings_plugin_host_start (CinnamonSettingsPluginHost *host)
+{
+        GError *error = NULL;
+        char   *argv[3];
+        int     fds[2];
+
+        g_return_val_if_fail (host != NULL, FALSE);
+
+        host->stopping = FALSE;
+
+        if (host->pid != 0) {
+                return TRUE;
+        }
+
+        if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+                g_warning ("Could not create socket for plugin host for %s: %s",
+                           host->name, g_strerror (errno));
+                return FALSE;
+        }
+
+        argv[0] = (char *) HOST_PROGRAM;
+        argv[1] = host->module_path;
+        argv[2] = NULL;
+
+        host->child_fd = fds[1];
+        if (!g_spawn_async (NULL, argv, NULL,
+                            G_SPAWN_DO_NOT_REAP_CHILD,
+                            host_child_setup, host,
+                            &host->pid, &error)) {
+                g_warning ("Could not start plugin host for %s: %s",
+                           host->name, error->message);
+                g_error_free (error);
+                close (fds[0]);
+                close (fds[1]);
+                return FALSE;
+        }
+        close (fds[1]);
+
+        g_debug ("Started plugin host for %s as pid %d", host->name, (int) host->pid);
+
+        host->channel = g_io_channel_unix_new (fds[0]);
+        g_io_channel_set_close_on_unref (host->channel, TRUE);
+        g_io_channel_set_encoding (host->channel, NULL, NULL);
+        g_io_channel_set_flags (host->channel, G_IO_FLAG_NONBLOCK, NULL);
+
+        host->io_watch_id = g_io_add_watch (host->channel,
+                                            G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                            (GIOFunc) host_io_cb,
+                                            host);
+        host->child_watch_id = g_child_watch_add (host->pid,
+                                                  (GChildWatchFunc) host_exited_cb,
+                                                  host);
+        host->ping_id = g_timeout_add_seconds (PING_INTERVAL,
+                                               (GSourceFunc) ping_cb,
+                                               host);
+
+        return TRUE;
+}
+
+static gboolean
+kill_cb (CinnamonSettingsPluginHost *host)
+{
+        host->kill_id = 0;
+
+        g_warning ("Plugin host for %s did not stop in time, killing it", host->name);
+        kill (host->pid, SIGKILL);
+
+        return FALSE;
+}
+
+void
+cinnamon_settings_plugin_host_stop (CinnamonSettingsPluginHost *host)
+{
+        g_return_if_fail (host != NULL);
+
+        if (host->restart_id != 0) {
+                g_source_remove (host->restart_id);
+                host->restart_id = 0;
+        }
+
+        if (host->pid == 0 || host->stopping) {
+                return;
+        }
+
+        host->stopping = TRUE;
+        send_command (host, "stop\n");
+
+        host->kill_id = g_timeout_add_seconds (STOP_TIMEOUT, (GSourceFunc) kill_cb, host);
+}
+
+CinnamonSettingsPluginHost *
+cinnamon_settings_plugin_host_new (const char *name,
+                                   const char *module_path,
+                                   guint       memory_limit)
+{
+        CinnamonSettingsPluginHost *host;
+
+        g_return_val_if_fail (name != NULL, NULL);
+        g_return_val_if_fail (module_path != NULL, NULL);
+
+        host = g_new0 (CinnamonSettingsPluginHost, 1);
+        host->name = g_strdup (name);
+        host->module_path = g_strdup (module_path);
+        host->memory_limit = memory_limit;
+        host->child_fd = -1;
+
+        return host;
+}
+
+void
+cinnamon_settings_plugin_host_free (CinnamonSettingsPluginHost *host)
+{
+        if (host == NULL) {
+                return;
+        }
+
+        if (host->restart_id != 0) {
+                g_source_remove (host->restart_id);
+        }
+
+        disconnect_host (host);
+
+        if (host->child_watch_id != 0) {
+                g_source_remove (host->child_watch_id);
+        }
+
+        /* Closing the socket already asks it to quit */
+        if (host->pid != 0) {
+                kill (host->pid, SIGTERM);
+                g_spawn_close_pid (host->pid);
+        }
+
+        g_free (host->name);
+        g_free (host->module_path);
+        g_free (host);
+}
+
+void
+cinnamon_settings_plugin_host_get_stats (CinnamonSettingsPluginHost      *host,
+                                         CinnamonSettingsPluginHostStats *stats)
+{
+        g_return_if_fail (host != NULL);
+        g_return_if_fail (stats != NULL);
+
+        *stats = host->stats;
+        stats->pid = host->pid;
+}
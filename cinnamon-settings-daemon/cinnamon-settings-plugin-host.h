@@ -0,0 +1,60 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __CINNAMON_SETTINGS_PLUGIN_HOST_H__
+#define __CINNAMON_SETTINGS_PLUGIN_HOST_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The host process talks to the manager over a socket on this fd, one
+ * command per line:
+ *
+ *   manager -> host: "ping", "stop"
+ *   host -> manager: "ready", "pong", "stats <max rss kB> <cpu time us>",
+ *                    "error <message>"
+ */
+#define CINNAMON_SETTINGS_PLUGIN_HOST_FD 3
+
+typedef struct CinnamonSettingsPluginHost CinnamonSettingsPluginHost;
+
+typedef struct
+{
+        GPid    pid;
+        guint   restarts;
+        guint64 max_rss;                /* kB */
+        guint64 cpu_time;               /* us */
+        gint64  ping_latency;           /* us, last round trip */
+        gint64  max_ping_latency;       /* us */
+} CinnamonSettingsPluginHostStats;
+
+CinnamonSettingsPluginHost *cinnamon_settings_plugin_host_new       (const char                      *name,
+                                                                     const char                      *module_path,
+                                                                     guint                            memory_limit);
+gboolean                    cinnamon_settings_plugin_host_start     (CinnamonSettingsPluginHost      *host);
+void                        cinnamon_settings_plugin_host_stop      (CinnamonSettingsPluginHost      *host);
+void                        cinnamon_settings_plugin_host_free      (CinnamonSettingsPluginHost      *host);
+void                        cinnamon_settings_plugin_host_get_stats (CinnamonSettingsPluginHost      *host,
+                                                                     CinnamonSettingsPluginHostStats *stats);
+
+G_END_DECLS
+
+#endif  /* __CINNAMON_SETTINGS_PLUGIN_HOST_H__ */
@@ -30,6 +30,7 @@
 #include "cinnamon-settings-plugin-info.h"
 #include "cinnamon-settings-module.h"
 #include "cinnamon-settings-plugin.h"
+#include "cinnamon-settings-plugin-host.h"
 #include "cinnamon-settings-profile.h"
 
 #define CINNAMON_SETTINGS_PLUGIN_INFO_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CINNAMON_TYPE_SETTINGS_PLUGIN_INFO, CinnamonSettingsPluginInfoPrivate))
@@ -52,9 +53,19 @@ struct CinnamonSettingsPluginInfoPrivate
         char                   **authors;
         char                    *copyright;
         char                    *website;
+        char                   **dependencies;
+        char                   **triggers;
 
         CinnamonSettingsPlugin     *plugin;
 
+        /* Set when the plugin runs in a csd-plugin-host process instead */
+        CinnamonSettingsPluginHost *host;
+        guint                    memory_limit;
+
+        /* Handle held on the plugin library while it is being mapped
+         * ahead of activation, see cinnamon_settings_plugin_info_preload() */
+        GModule                 *preload;
+
         int                      enabled : 1;
         int                      active : 1;
 
@@ -63,9 +74,19 @@ struct CinnamonSettingsPluginInfoPrivate
            when the interpreter has not been correctly initializated) */
         int                      available : 1;
 
+        /* Plugins that can start early are activated before the main
+         * loop runs, the others are started from idle once their
+         * dependencies are up. */
+        int                      start_early : 1;
+
+        int                      out_of_process : 1;
+
         /* Priority determines the order in which plugins are started and
          * stopped. A lower number means higher priority. */
         guint                    priority;
+
+        /* Wall-clock time spent in the last activation, in microseconds */
+        gint64                   activation_time;
 };
 
 
@@ -100,6 +121,12 @@ cinnamon_settings_plugin_info_finalize (GObject *object)
                  * a type module */
         }
 
+        if (info->priv->preload != NULL) {
+                g_module_close (info->priv->preload);
+        }
+
+        cinnamon_settings_plugin_host_free (info->priv->host);
+
         g_free (info->priv->file);
         g_free (info->priv->location);
         g_free (info->priv->name);
@@ -107,6 +134,8 @@ cinnamon_settings_plugin_info_finalize (GObject *object)
         g_free (info->priv->website);
         g_free (info->priv->copyright);
         g_strfreev (info->priv->authors);
+        g_strfreev (info->priv->dependencies);
+        g_strfreev (info->priv->triggers);
 
         if (info->priv->settings != NULL) {
                 g_object_unref (info->priv->settings);
@@ -243,6 +272,15 @@ cinnamon_settings_plugin_info_fill_from_file (CinnamonSettingsPluginInfo *info,
                 g_debug ("Could not find 'Website' in %s", filename);
         }
 
+        /* Get Depends */
+        info->priv->dependencies = g_key_file_get_string_list (plugin_file, PLUGIN_GROUP, "Depends", NULL, NULL);
+
+        /* Get ActivateOn */
+        info->priv->triggers = g_key_file_get_string_list (plugin_file, PLUGIN_GROUP, "ActivateOn", NULL, NULL);
+
+        /* Get StartEarly */
+        info->priv->start_early = g_key_file_get_boolean (plugin_file, PLUGIN_GROUP, "StartEarly", NULL);
+
         /* Get Priority */
         priority = g_key_file_get_integer (plugin_file, PLUGIN_GROUP, "Priority", NULL);
         if (priority >= PLUGIN_PRIORITY_MAX) {
@@ -283,6 +321,79 @@ cinnamon_settings_plugin_info_new_from_file (const char *filename)
         return info;
 }
 
+CinnamonSettingsPluginInfo *
+cinnamon_settings_plugin_info_new_from_variant (GVariant *variant)
+{
+        CinnamonSettingsPluginInfo *info;
+        gboolean                 start_early;
+        gint32                   priority;
+
+        g_return_val_if_fail (g_variant_is_of_type (variant, G_VARIANT_TYPE (CINNAMON_SETTINGS_PLUGIN_INFO_VARIANT_TYPE)), NULL);
+
+        info = g_object_new (CINNAMON_TYPE_SETTINGS_PLUGIN_INFO, NULL);
+
+        g_variant_get (variant, "(sssms^asmsms^as^asbi)",
+                       &info->priv->file,
+                       &info->priv->location,
+                       &info->priv->name,
+                       &info->priv->desc,
+                       &info->priv->authors,
+                       &info->priv->copyright,
+                       &info->priv->website,
+                       &info->priv->dependencies,
+                       &info->priv->triggers,
+                       &start_early,
+                       &priority);
+
+        if (info->priv->location[0] == '\0') {
+                g_object_unref (info);
+                return NULL;
+        }
+
+        /* Missing lists are stored as empty ones */
+        if (info->priv->authors[0] == NULL) {
+                g_strfreev (info->priv->authors);
+                info->priv->authors = NULL;
+        }
+        if (info->priv->dependencies[0] == NULL) {
+                g_strfreev (info->priv->dependencies);
+                info->priv->dependencies = NULL;
+        }
+        if (info->priv->triggers[0] == NULL) {
+                g_strfreev (info->priv->triggers);
+                info->priv->triggers = NULL;
+        }
+
+        info->priv->start_early = start_early;
+        info->priv->priority = priority;
+        info->priv->available = TRUE;
+
+        debug_info (info);
+
+        return info;
+}
+
+GVariant *
+cinnamon_settings_plugin_info_serialize (CinnamonSettingsPluginInfo *info)
+{
+        static const char *empty[] = { NULL };
+
+        g_return_val_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info), NULL);
+
+        return g_variant_new ("(sssms^asmsms^as^asbi)",
+                              info->priv->file,
+                              info->priv->location,
+                              info->priv->name,
+                              info->priv->desc,
+                              info->priv->authors ? (const char **) info->priv->authors : empty,
+                              info->priv->copyright,
+                              info->priv->website,
+                              info->priv->dependencies ? (const char **) info->priv->dependencies : empty,
+                              info->priv->triggers ? (const char **) info->priv->triggers : empty,
+                              info->priv->start_early != FALSE,
+                              (gint32) info->priv->priority);
+}
+
 static void
 plugin_enabled_cb (GSettings               *settings,
                    const gchar             *key,
@@ -315,10 +426,25 @@ cinnamon_settings_plugin_info_set_settings_prefix (CinnamonSettingsPluginInfo *i
                           info);
 }
 
+void
+cinnamon_settings_plugin_info_set_out_of_process (CinnamonSettingsPluginInfo *info,
+                                                  gboolean                    out_of_process,
+                                                  guint                       memory_limit)
+{
+        g_return_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info));
+
+        info->priv->out_of_process = out_of_process;
+        info->priv->memory_limit = memory_limit;
+}
+
 static void
 _deactivate_plugin (CinnamonSettingsPluginInfo *info)
 {
-        cinnamon_settings_plugin_deactivate (info->priv->plugin);
+        if (info->priv->host != NULL) {
+                cinnamon_settings_plugin_host_stop (info->priv->host);
+        } else {
+                cinnamon_settings_plugin_deactivate (info->priv->plugin);
+        }
         g_signal_emit (info, signals [DEACTIVATED], 0);
 }
 
@@ -340,11 +466,52 @@ cinnamon_settings_plugin_info_deactivate (CinnamonSettingsPluginInfo *info)
 }
 
 
+static char *
+build_module_path (CinnamonSettingsPluginInfo *info)
+{
+        char *dirname;
+        char *path;
+
+        dirname = g_path_get_dirname (info->priv->file);
+        g_return_val_if_fail (dirname != NULL, NULL);
+
+        path = g_module_build_path (dirname, info->priv->location);
+        g_free (dirname);
+
+        return path;
+}
+
+/* This may be called from a worker thread: it only maps the plugin library
+ * so that the g_type_module_use() done on the main thread at activation
+ * time finds it already resident. */
+void
+cinnamon_settings_plugin_info_preload (CinnamonSettingsPluginInfo *info)
+{
+        char *path;
+
+        g_return_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info));
+
+        if (info->priv->preload != NULL || info->priv->plugin != NULL || info->priv->out_of_process) {
+                return;
+        }
+
+        path = build_module_path (info);
+        if (path == NULL) {
+                return;
+        }
+
+        info->priv->preload = g_module_open (path, 0);
+        if (info->priv->preload == NULL) {
+                g_debug ("Could not preload '%s': %s", path, g_module_error ());
+        }
+
+        g_free (path);
+}
+
 static gboolean
 load_plugin_module (CinnamonSettingsPluginInfo *info)
 {
         char    *path;
-        char    *dirname;
         gboolean ret;
 
         ret = FALSE;
@@ -357,11 +524,7 @@ load_plugin_module (CinnamonSettingsPluginInfo *info)
 
         cinnamon_settings_profile_start ("%s", info->priv->location);
 
-        dirname = g_path_get_dirname (info->priv->file);
-        g_return_val_if_fail (dirname != NULL, FALSE);
-
-        path = g_module_build_path (dirname, info->priv->location);
-        g_free (dirname);
+        path = build_module_path (info);
         g_return_val_if_fail (path != NULL, FALSE);
 
         info->priv->module = G_TYPE_MODULE (cinnamon_settings_module_new (path));
@@ -390,27 +553,72 @@ load_plugin_module (CinnamonSettingsPluginInfo *info)
         return ret;
 }
 
+static gboolean
+_activate_plugin_host (CinnamonSettingsPluginInfo *info,
+                       gint64                      start)
+{
+        gboolean res;
+
+        if (info->priv->host == NULL) {
+                char *path;
+
+                path = build_module_path (info);
+                info->priv->host = cinnamon_settings_plugin_host_new (info->priv->location,
+                                                                      path,
+                                                                      info->priv->memory_limit);
+                g_free (path);
+        }
+
+        res = cinnamon_settings_plugin_host_start (info->priv->host);
+        if (res) {
+                g_signal_emit (info, signals [ACTIVATED], 0);
+        } else {
+                g_warning ("Error activating plugin '%s' out of process", info->priv->name);
+        }
+
+        info->priv->activation_time = g_get_monotonic_time () - start;
+
+        return res;
+}
+
 static gboolean
 _activate_plugin (CinnamonSettingsPluginInfo *info)
 {
         gboolean res = TRUE;
+        gint64   start;
 
         if (!info->priv->available) {
                 /* Plugin is not available, don't try to activate/load it */
                 return FALSE;
         }
 
+        start = g_get_monotonic_time ();
+
+        if (info->priv->out_of_process) {
+                return _activate_plugin_host (info, start);
+        }
+
         if (info->priv->plugin == NULL) {
                 res = load_plugin_module (info);
         }
 
+        /* The type module holds its own reference on the library now */
+        if (info->priv->preload != NULL) {
+                g_module_close (info->priv->preload);
+                info->priv->preload = NULL;
+        }
+
         if (res) {
+                cinnamon_settings_profile_start ("%s", info->priv->location);
                 cinnamon_settings_plugin_activate (info->priv->plugin);
                 g_signal_emit (info, signals [ACTIVATED], 0);
+                cinnamon_settings_profile_end ("%s", info->priv->location);
         } else {
                 g_warning ("Error activating plugin '%s'", info->priv->name);
         }
 
+        info->priv->activation_time = g_get_monotonic_time () - start;
+
         return res;
 }
 
@@ -509,6 +717,46 @@ cinnamon_settings_plugin_info_get_location (CinnamonSettingsPluginInfo *info)
         return info->priv->location;
 }
 
+const char * const *
+cinnamon_settings_plugin_info_get_dependencies (CinnamonSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info), NULL);
+
+        return (const char * const *) info->priv->dependencies;
+}
+
+CinnamonSettingsPluginHost *
+cinnamon_settings_plugin_info_get_host (CinnamonSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info), NULL);
+
+        return info->priv->host;
+}
+
+const char * const *
+cinnamon_settings_plugin_info_get_triggers (CinnamonSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info), NULL);
+
+        return (const char * const *) info->priv->triggers;
+}
+
+gboolean
+cinnamon_settings_plugin_info_get_start_early (CinnamonSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info), FALSE);
+
+        return (info->priv->start_early != FALSE);
+}
+
+gint64
+cinnamon_settings_plugin_info_get_activation_time (CinnamonSettingsPluginInfo *info)
+{
+        g_return_val_if_fail (CINNAMON_IS_SETTINGS_PLUGIN_INFO (info), 0);
+
+        return info->priv->activation_time;
+}
+
 int
 cinnamon_settings_plugin_info_get_priority (CinnamonSettingsPluginInfo *info)
 {
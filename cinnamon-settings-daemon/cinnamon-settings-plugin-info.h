@@ -24,6 +24,8 @@
 #include <glib-object.h>
 #include <gmodule.h>
 
+#include "cinnamon-settings-plugin-host.h"
+
 G_BEGIN_DECLS
 #define CINNAMON_TYPE_SETTINGS_PLUGIN_INFO              (cinnamon_settings_plugin_info_get_type())
 #define CINNAMON_SETTINGS_PLUGIN_INFO(obj)              (G_TYPE_CHECK_INSTANCE_CAST((obj), CINNAMON_TYPE_SETTINGS_PLUGIN_INFO, CinnamonSettingsPluginInfo))
@@ -32,6 +34,10 @@ G_BEGIN_DECLS
 #define CINNAMON_IS_SETTINGS_PLUGIN_INFO_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE ((klass), CINNAMON_TYPE_SETTINGS_PLUGIN_INFO))
 #define CINNAMON_SETTINGS_PLUGIN_INFO_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS((obj),  CINNAMON_TYPE_SETTINGS_PLUGIN_INFO, CinnamonSettingsPluginInfoClass))
 
+/* file, location, name, description, authors, copyright, website,
+ * dependencies, triggers, start early, priority */
+#define CINNAMON_SETTINGS_PLUGIN_INFO_VARIANT_TYPE "(sssmsasmsmsasasbi)"
+
 typedef struct CinnamonSettingsPluginInfoPrivate CinnamonSettingsPluginInfoPrivate;
 
 typedef struct
@@ -51,8 +57,14 @@ typedef struct
 GType            cinnamon_settings_plugin_info_get_type           (void) G_GNUC_CONST;
 
 CinnamonSettingsPluginInfo *cinnamon_settings_plugin_info_new_from_file (const char *filename);
+CinnamonSettingsPluginInfo *cinnamon_settings_plugin_info_new_from_variant (GVariant *variant);
+GVariant        *cinnamon_settings_plugin_info_serialize       (CinnamonSettingsPluginInfo *info);
 
 void             cinnamon_settings_plugin_info_set_settings_prefix (CinnamonSettingsPluginInfo *info, const char *settings_prefix);
+void             cinnamon_settings_plugin_info_set_out_of_process (CinnamonSettingsPluginInfo *info,
+                                                                   gboolean                    out_of_process,
+                                                                   guint                       memory_limit);
+void             cinnamon_settings_plugin_info_preload         (CinnamonSettingsPluginInfo *info);
 gboolean         cinnamon_settings_plugin_info_activate        (CinnamonSettingsPluginInfo *info);
 gboolean         cinnamon_settings_plugin_info_deactivate      (CinnamonSettingsPluginInfo *info);
 
@@ -67,6 +79,11 @@ const char      *cinnamon_settings_plugin_info_get_website     (CinnamonSettings
 const char      *cinnamon_settings_plugin_info_get_copyright   (CinnamonSettingsPluginInfo *info);
 const char      *cinnamon_settings_plugin_info_get_location    (CinnamonSettingsPluginInfo *info);
 int              cinnamon_settings_plugin_info_get_priority    (CinnamonSettingsPluginInfo *info);
+const char * const *cinnamon_settings_plugin_info_get_dependencies (CinnamonSettingsPluginInfo *info);
+CinnamonSettingsPluginHost *cinnamon_settings_plugin_info_get_host (CinnamonSettingsPluginInfo *info);
+const char * const *cinnamon_settings_plugin_info_get_triggers (CinnamonSettingsPluginInfo *info);
+gboolean         cinnamon_settings_plugin_info_get_start_early (CinnamonSettingsPluginInfo *info);
+gint64           cinnamon_settings_plugin_info_get_activation_time (CinnamonSettingsPluginInfo *info);
 
 void             cinnamon_settings_plugin_info_set_priority    (CinnamonSettingsPluginInfo *info,
                                                              int                      priority);
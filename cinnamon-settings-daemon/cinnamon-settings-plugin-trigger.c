@@ -0,0 +1,325 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gdk/gdk.h>
+
+#ifdef HAVE_GUDEV
+#include <gudev/gudev.h>
+#endif
+
+#include "cinnamon-settings-plugin-trigger.h"
+
+struct CinnamonSettingsTriggers
+{
+        CinnamonSettingsTriggerFunc  func;
+        gpointer                     user_data;
+
+        gboolean                     fired;
+        guint                        idle_id;
+
+        GArray                      *bus_watch_ids;
+
+        GdkDeviceManager            *device_manager;
+        guint                        device_added_id;
+        guint                        input_sources;
+
+#ifdef HAVE_GUDEV
+        GUdevClient                 *udev_client;
+        GPtrArray                   *udev_matches;
+#endif
+};
+
+static const struct {
+        const char     *name;
+        GdkInputSource  source;
+} input_sources[] = {
+        { "mouse",       GDK_SOURCE_MOUSE },
+        { "pen",         GDK_SOURCE_PEN },
+        { "eraser",      GDK_SOURCE_ERASER },
+        { "cursor",      GDK_SOURCE_CURSOR },
+        { "keyboard",    GDK_SOURCE_KEYBOARD },
+        { "touchscreen", GDK_SOURCE_TOUCHSCREEN },
+        { "touchpad",    GDK_SOURCE_TOUCHPAD },
+};
+
+static gboolean
+fire_idle_cb (CinnamonSettingsTriggers *triggers)
+{
+        triggers->idle_id = 0;
+
+        /* This is allowed to free the triggers */
+        triggers->func (triggers->user_data);
+
+        return FALSE;
+}
+
+static void
+fire (CinnamonSettingsTriggers *triggers,
+      const char               *reason)
+{
+        if (triggers->fired) {
+                return;
+        }
+
+        g_debug ("Trigger fired: %s", reason);
+
+        triggers->fired = TRUE;
+        triggers->idle_id = g_idle_add ((GSourceFunc) fire_idle_cb, triggers);
+}
+
+static void
+name_appeared_cb (GDBusConnection          *connection,
+                  const gchar              *name,
+                  const gchar              *name_owner,
+                  CinnamonSettingsTriggers *triggers)
+{
+        fire (triggers, name);
+}
+
+static void
+watch_bus_name (CinnamonSettingsTriggers *triggers,
+                GBusType                  bus_type,
+                const char               *name)
+{
+        guint id;
+
+        if (!g_dbus_is_name (name)) {
+                g_warning ("Invalid D-Bus name in trigger: '%s'", name);
+                fire (triggers, name);
+                return;
+        }
+
+        id = g_bus_watch_name (bus_type,
+                               name,
+                               G_BUS_NAME_WATCHER_FLAGS_NONE,
+                               (GBusNameAppearedCallback) name_appeared_cb,
+                               NULL,
+                               triggers,
+                               NULL);
+        g_array_append_val (triggers->bus_watch_ids, id);
+}
+
+static void
+device_added_cb (GdkDeviceManager         *device_manager,
+                 GdkDevice                *device,
+                 CinnamonSettingsTriggers *triggers)
+{
+        if (triggers->input_sources & (1 << gdk_device_get_source (device))) {
+                fire (triggers, gdk_device_get_name (device));
+        }
+}
+
+static void
+watch_input_source (CinnamonSettingsTriggers *triggers,
+                    const char               *name)
+{
+        GList *devices, *l;
+        guint  i;
+
+        for (i = 0; i < G_N_ELEMENTS (input_sources); i++) {
+                if (g_strcmp0 (input_sources[i].name, name) == 0) {
+                        break;
+                }
+        }
+
+        if (i == G_N_ELEMENTS (input_sources)) {
+                g_warning ("Unknown input source in trigger: '%s'", name);
+                fire (triggers, name);
+                return;
+        }
+
+        triggers->input_sources |= 1 << input_sources[i].source;
+
+        if (triggers->device_manager == NULL) {
+                triggers->device_manager = gdk_display_get_device_manager (gdk_display_get_default ());
+                triggers->device_added_id = g_signal_connect (triggers->device_manager, "device-added",
+                                                              G_CALLBACK (device_added_cb), triggers);
+        }
+
+        devices = gdk_device_manager_list_devices (triggers->device_manager, GDK_DEVICE_TYPE_SLAVE);
+        for (l = devices; l != NULL; l = l->next) {
+                device_added_cb (triggers->device_manager, l->data, triggers);
+        }
+        g_list_free (devices);
+}
+
+#ifdef HAVE_GUDEV
+static gboolean
+udev_device_matches (GUdevDevice *device,
+                     const char  *match)
+{
+        const char *subsystem;
+        const char *property;
+
+        subsystem = g_udev_device_get_subsystem (device);
+        property = strchr (match, '/');
+
+        if (property == NULL) {
+                return g_strcmp0 (subsystem, match) == 0;
+        }
+
+        if (subsystem == NULL ||
+            strlen (subsystem) != (gsize) (property - match) ||
+            strncmp (subsystem, match, property - match) != 0) {
+                return FALSE;
+        }
+
+        return g_udev_device_get_property_as_boolean (device, property + 1);
+}
+
+static void
+uevent_cb (GUdevClient              *client,
+           const gchar              *action,
+           GUdevDevice              *device,
+           CinnamonSettingsTriggers *triggers)
+{
+        guint i;
+
+        if (g_strcmp0 (action, "add") != 0) {
+                return;
+        }
+
+        for (i = 0; i < triggers->udev_matches->len; i++) {
+                const char *match = g_ptr_array_index (triggers->udev_matches, i);
+
+                if (udev_device_matches (device, match)) {
+                        fire (triggers, g_udev_device_get_sysfs_path (device));
+                        return;
+                }
+        }
+}
+
+static void
+watch_udev (CinnamonSettingsTriggers *triggers)
+{
+        GPtrArray *subsystems;
+        guint      i;
+
+        subsystems = g_ptr_array_new_with_free_func (g_free);
+        for (i = 0; i < triggers->udev_matches->len; i++) {
+                const char *match = g_ptr_array_index (triggers->udev_matches, i);
+
+                g_ptr_array_add (subsystems, g_strndup (match, strcspn (match, "/")));
+        }
+        g_ptr_array_add (subsystems, NULL);
+
+        triggers->udev_client = g_udev_client_new ((const gchar * const *) subsystems->pdata);
+        g_signal_connect (triggers->udev_client, "uevent",
+                          G_CALLBACK (uevent_cb), triggers);
+
+        for (i = 0; g_ptr_array_index (subsystems, i) != NULL; i++) {
+                GList *devices, *l;
+
+                devices = g_udev_client_query_by_subsystem (triggers->udev_client,
+                                                            g_ptr_array_index (subsystems, i));
+                for (l = devices; l != NULL; l = l->next) {
+                        uevent_cb (triggers->udev_client, "add", l->data, triggers);
+                }
+                g_list_free_full (devices, g_object_unref);
+        }
+
+        g_ptr_array_unref (subsystems);
+}
+#endif
+
+CinnamonSettingsTriggers *
+cinnamon_settings_triggers_new (const char * const         *triggers_list,
+                                CinnamonSettingsTriggerFunc func,
+                                gpointer                    user_data)
+{
+        CinnamonSettingsTriggers *triggers;
+        guint                     i;
+
+        g_return_val_if_fail (func != NULL, NULL);
+
+        triggers = g_new0 (CinnamonSettingsTriggers, 1);
+        triggers->func = func;
+        triggers->user_data = user_data;
+        triggers->bus_watch_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+#ifdef HAVE_GUDEV
+        triggers->udev_matches = g_ptr_array_new_with_free_func (g_free);
+#endif
+
+        for (i = 0; triggers_list != NULL && triggers_list[i] != NULL; i++) {
+                const char *trigger = triggers_list[i];
+
+                if (g_str_has_prefix (trigger, "dbus-session:")) {
+                        watch_bus_name (triggers, G_BUS_TYPE_SESSION, trigger + strlen ("dbus-session:"));
+                } else if (g_str_has_prefix (trigger, "dbus-system:")) {
+                        watch_bus_name (triggers, G_BUS_TYPE_SYSTEM, trigger + strlen ("dbus-system:"));
+                } else if (g_str_has_prefix (trigger, "xinput:")) {
+                        watch_input_source (triggers, trigger + strlen ("xinput:"));
+#ifdef HAVE_GUDEV
+                } else if (g_str_has_prefix (trigger, "udev:")) {
+                        g_ptr_array_add (triggers->udev_matches, g_strdup (trigger + strlen ("udev:")));
+#endif
+                } else {
+                        g_debug ("Cannot watch trigger '%s'", trigger);
+                        fire (triggers, trigger);
+                }
+        }
+
+#ifdef HAVE_GUDEV
+        if (triggers->udev_matches->len > 0) {
+                watch_udev (triggers);
+        }
+#endif
+
+        return triggers;
+}
+
+void
+cinnamon_settings_triggers_free (CinnamonSettingsTriggers *triggers)
+{
+        guint i;
+
+        if (triggers == NULL) {
+                return;
+        }
+
+        if (triggers->idle_id != 0) {
+                g_source_remove (triggers->idle_id);
+        }
+
+        for (i = 0; i < triggers->bus_watch_ids->len; i++) {
+                g_bus_unwatch_name (g_array_index (triggers->bus_watch_ids, guint, i));
+        }
+        g_array_free (triggers->bus_watch_ids, TRUE);
+
+        if (triggers->device_manager != NULL) {
+                g_signal_handler_disconnect (triggers->device_manager, triggers->device_added_id);
+        }
+
+#ifdef HAVE_GUDEV
+        if (triggers->udev_client != NULL) {
+                g_signal_handlers_disconnect_by_data (triggers->udev_client, triggers);
+                g_object_unref (triggers->udev_client);
+        }
+        g_ptr_array_unref (triggers->udev_matches);
+#endif
+
+        g_free (triggers);
+}
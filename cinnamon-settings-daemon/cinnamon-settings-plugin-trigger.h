@@ -0,0 +1,53 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __CINNAMON_SETTINGS_PLUGIN_TRIGGER_H__
+#define __CINNAMON_SETTINGS_PLUGIN_TRIGGER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct CinnamonSettingsTriggers CinnamonSettingsTriggers;
+
+typedef void (*CinnamonSettingsTriggerFunc) (gpointer user_data);
+
+/* Watches for any of the given triggers, as listed in the ActivateOn key
+ * of a plugin file:
+ *
+ *   dbus-session:NAME    NAME is owned on the session bus
+ *   dbus-system:NAME     NAME is owned on the system bus
+ *   udev:SUBSYSTEM       a device of SUBSYSTEM exists
+ *   udev:SUBSYSTEM/PROP  ... and has the boolean udev property PROP set
+ *   xinput:SOURCE        an input device of the given source exists, one
+ *                        of mouse, pen, eraser, cursor, keyboard,
+ *                        touchscreen or touchpad
+ *
+ * func is called once from the main loop when the first trigger fires,
+ * which can be right away if the device or name is already there.
+ * Triggers that cannot be watched fire immediately. */
+CinnamonSettingsTriggers *cinnamon_settings_triggers_new  (const char * const         *triggers,
+                                                           CinnamonSettingsTriggerFunc func,
+                                                           gpointer                    user_data);
+void                      cinnamon_settings_triggers_free (CinnamonSettingsTriggers   *triggers);
+
+G_END_DECLS
+
+#endif  /* __CINNAMON_SETTINGS_PLUGIN_TRIGGER_H__ */
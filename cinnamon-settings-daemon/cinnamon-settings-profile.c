@@ -25,41 +25,158 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
-#include <signal.h>
-#include <time.h>
 #include <unistd.h>
 
 #include <glib.h>
-#include <glib/gstdio.h>
 
 #include "cinnamon-settings-profile.h"
 
+/* Marks are kept in a fixed ring so that recording one never allocates
+ * or makes a syscall; once it wraps only the latest events are kept. */
+#define PROFILE_RING_SIZE 4096
+#define PROFILE_NAME_SIZE 96
+
+typedef struct
+{
+        gint64 timestamp;
+        guint  thread_id;
+        char   phase;
+        char   name[PROFILE_NAME_SIZE];
+} ProfileEvent;
+
+static ProfileEvent ring[PROFILE_RING_SIZE];
+static guint64      ring_count = 0;
+static gint         next_thread_id = 1;
+
+G_LOCK_DEFINE_STATIC (ring);
+
+static GPrivate thread_id_key;
+
+static guint
+get_thread_id (void)
+{
+        guint id;
+
+        id = GPOINTER_TO_UINT (g_private_get (&thread_id_key));
+        if (id == 0) {
+                id = g_atomic_int_add (&next_thread_id, 1);
+                g_private_set (&thread_id_key, GUINT_TO_POINTER (id));
+        }
+
+        return id;
+}
+
 void
 _cinnamon_settings_profile_log (const char *func,
                              const char *note,
                              const char *format,
                              ...)
 {
-        va_list args;
-        char   *str;
-        char   *formatted;
+        ProfileEvent *event;
+        va_list       args;
+        gint64        now;
+        guint         thread_id;
+        char          phase;
+        int           len;
+
+        now = g_get_monotonic_time ();
+        thread_id = get_thread_id ();
 
-        if (format == NULL) {
-                formatted = g_strdup ("");
+        if (g_strcmp0 (note, "start") == 0) {
+                phase = 'B';
+        } else if (g_strcmp0 (note, "end") == 0) {
+                phase = 'E';
         } else {
+                phase = 'i';
+        }
+
+        G_LOCK (ring);
+
+        event = &ring[ring_count % PROFILE_RING_SIZE];
+        ring_count++;
+
+        event->timestamp = now;
+        event->thread_id = thread_id;
+        event->phase = phase;
+
+        len = g_snprintf (event->name, sizeof (event->name), "%s", func ? func : "");
+        if (format != NULL && len < (int) sizeof (event->name) - 1) {
+                if (len > 0) {
+                        event->name[len++] = ' ';
+                }
                 va_start (args, format);
-                formatted = g_strdup_vprintf (format, args);
+                g_vsnprintf (event->name + len, sizeof (event->name) - len, format, args);
                 va_end (args);
         }
 
-        if (func != NULL) {
-                str = g_strdup_printf ("MARK: %s %s: %s %s", g_get_prgname(), func, note ? note : "", formatted);
-        } else {
-                str = g_strdup_printf ("MARK: %s: %s %s", g_get_prgname(), note ? note : "", formatted);
+        G_UNLOCK (ring);
+}
+
+static void
+append_escaped (GString    *str,
+                const char *text)
+{
+        const char *p;
+
+        for (p = text; *p != '\0'; p++) {
+                switch (*p) {
+                case '"':
+                        g_string_append (str, "\\\"");
+                        break;
+                case '\\':
+                        g_string_append (str, "\\\\");
+                        break;
+                default:
+                        if ((guchar) *p < 0x20) {
+                                g_string_append_printf (str, "\\u%04x", (guchar) *p);
+                        } else {
+                                g_string_append_c (str, *p);
+                        }
+                        break;
+                }
+        }
+}
+
+/* Returns the recorded marks in the Chrome trace event format, which can
+ * be loaded in chrome://tracing or Perfetto. */
+char *
+cinnamon_settings_profile_dump_json (void)
+{
+        GString *str;
+        guint64  first;
+        guint64  i;
+        int      pid;
+
+        pid = getpid ();
+        str = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+        G_LOCK (ring);
+
+        first = ring_count > PROFILE_RING_SIZE ? ring_count - PROFILE_RING_SIZE : 0;
+        for (i = first; i < ring_count; i++) {
+                ProfileEvent *event = &ring[i % PROFILE_RING_SIZE];
+
+                if (i != first) {
+                        g_string_append_c (str, ',');
+                }
+
+                g_string_append (str, "{\"name\":\"");
+                append_escaped (str, event->name);
+                g_string_append_printf (str,
+                                        "\",\"cat\":\"csd\",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u",
+                                        event->phase,
+                                        event->timestamp,
+                                        pid,
+                                        event->thread_id);
+                if (event->phase == 'i') {
+                        g_string_append (str, ",\"s\":\"t\"");
+                }
+                g_string_append_c (str, '}');
         }
 
-        g_free (formatted);
+        G_UNLOCK (ring);
+
+        g_string_append (str, "]}");
 
-        g_access (str, F_OK);
-        g_free (str);
+        return g_string_free (str, FALSE);
 }
@@ -47,6 +47,7 @@ void            _cinnamon_settings_profile_log    (const char *func,
                                                 const char *note,
                                                 const char *format,
                                                 ...) G_GNUC_PRINTF (3, 4);
+char           *cinnamon_settings_profile_dump_json (void);
 
 G_END_DECLS
 
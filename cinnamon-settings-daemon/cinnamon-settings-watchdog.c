@@ -0,0 +1,383 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+
+#include <glib.h>
+
+#include "cinnamon-settings-watchdog.h"
+
+/* GLib has no hook around the dispatch of a single source, so the
+ * watchdog times whole main loop iterations instead: the poll function
+ * of the context is wrapped, and everything between poll() returning and
+ * the next call is time spent dispatching.
+ *
+ * When an iteration runs for longer than SAMPLE_AFTER, a helper thread
+ * interrupts the main thread and records its stack. The first frame that
+ * lies in a plugin module tells which plugin is holding the main loop,
+ * and the iteration is accounted to it. Shorter iterations are accounted
+ * to the daemon as a whole. */
+
+#define SAMPLE_AFTER       (10 * 1000)
+#define MAX_FRAMES         32
+
+#define SUB_BUCKET_BITS    3
+#define SUB_BUCKETS        (1 << SUB_BUCKET_BITS)
+#define N_BUCKETS          (SUB_BUCKETS * 40)
+
+#define DEFAULT_OWNER      "cinnamon-settings-daemon"
+
+typedef struct
+{
+        guint64 count;
+        guint64 total;
+        guint64 max;
+        guint64 buckets[N_BUCKETS];
+} LatencyHistogram;
+
+static GMutex      lock;
+static GCond       cond;
+static gint64      busy_since = 0;
+static guint       iteration = 0;
+static guint       sampled_iteration = 0;
+static guint       threshold = 0;
+
+static GPollFunc   real_poll = NULL;
+static pthread_t   main_thread;
+static GHashTable *histograms = NULL;
+
+/* Only written by the signal handler, on the main thread */
+static void                  *sample[MAX_FRAMES];
+static volatile sig_atomic_t  sample_frames = 0;
+static volatile guint         sample_iteration = 0;
+
+static guint
+bucket_for_value (guint64 value)
+{
+        guint shift;
+        guint index;
+
+        if (value < SUB_BUCKETS * 2) {
+                return value;
+        }
+
+        /* Keep the leading bit and SUB_BUCKET_BITS more */
+        shift = g_bit_storage (value) - SUB_BUCKET_BITS - 1;
+        index = shift * SUB_BUCKETS + (value >> shift);
+
+        return MIN (index, N_BUCKETS - 1);
+}
+
+static guint64
+bucket_upper_bound (guint index)
+{
+        guint shift;
+        guint64 top;
+
+        if (index < SUB_BUCKETS * 2) {
+                return index;
+        }
+
+        shift = (index - SUB_BUCKETS * 2) / SUB_BUCKETS + 1;
+        top = SUB_BUCKETS + (index - SUB_BUCKETS * 2) % SUB_BUCKETS;
+
+        return ((top + 1) << shift) - 1;
+}
+
+static guint64
+histogram_percentile (LatencyHistogram *histogram,
+                      gdouble           percentile)
+{
+        guint64 target;
+        guint64 seen = 0;
+        guint   i;
+
+        target = (guint64) (histogram->count * percentile / 100.0);
+
+        for (i = 0; i < N_BUCKETS; i++) {
+                seen += histogram->buckets[i];
+                if (seen > target) {
+                        return MIN (bucket_upper_bound (i), histogram->max);
+                }
+        }
+
+        return histogram->max;
+}
+
+static void
+histogram_add (const char *owner,
+               guint64     duration)
+{
+        LatencyHistogram *histogram;
+
+        histogram = g_hash_table_lookup (histograms, owner);
+        if (histogram == NULL) {
+                histogram = g_new0 (LatencyHistogram, 1);
+                g_hash_table_insert (histograms, g_strdup (owner), histogram);
+        }
+
+        histogram->count++;
+        histogram->total += duration;
+        histogram->max = MAX (histogram->max, duration);
+        histogram->buckets[bucket_for_value (duration)]++;
+}
+
+static char *
+find_owner (void * const *frames,
+            int           n_frames)
+{
+        int i;
+
+        for (i = 0; i < n_frames; i++) {
+                Dl_info     info;
+                const char *base;
+
+                if (dladdr (frames[i], &info) == 0 || info.dli_fname == NULL) {
+                        continue;
+                }
+
+                if (!g_str_has_prefix (info.dli_fname, CINNAMON_SETTINGS_PLUGINDIR)) {
+                        continue;
+                }
+
+                /* Plugin modules are named lib<location>.so */
+                base = strrchr (info.dli_fname, G_DIR_SEPARATOR);
+                base = base ? base + 1 : info.dli_fname;
+                if (g_str_has_prefix (base, "lib") && g_str_has_suffix (base, ".so")) {
+                        return g_strndup (base + 3, strlen (base) - 6);
+                }
+        }
+
+        return NULL;
+}
+
+static void
+report_stall (const char   *owner,
+              guint64       duration,
+              void * const *frames,
+              int           n_frames)
+{
+        GString  *report;
+        char    **symbols;
+        int       i;
+
+        report = g_string_new (NULL);
+        g_string_append_printf (report,
+                                "Main loop blocked for %" G_GUINT64_FORMAT " ms by %s",
+                                duration / 1000,
+                                owner);
+
+        symbols = n_frames > 0 ? backtrace_symbols (frames, n_frames) : NULL;
+        if (symbols != NULL) {
+                /* Skip the signal handler and the trampoline */
+                for (i = 2; i < n_frames; i++) {
+                        g_string_append_printf (report, "\n  #%d %s", i - 2, symbols[i]);
+                }
+                free (symbols);
+        }
+
+        g_warning ("%s", report->str);
+        g_string_free (report, TRUE);
+}
+
+static void
+iteration_finished (gint64 now)
+{
+        void   *frames[MAX_FRAMES];
+        int     n_frames = 0;
+        gint64  start;
+        guint64 duration;
+        char   *owner;
+
+        g_mutex_lock (&lock);
+        start = busy_since;
+        busy_since = 0;
+        g_mutex_unlock (&lock);
+
+        if (start == 0) {
+                return;
+        }
+
+        if (sample_frames > 0 && sample_iteration == iteration) {
+                n_frames = sample_frames;
+                memcpy (frames, sample, n_frames * sizeof (void *));
+        }
+        sample_frames = 0;
+
+        duration = now - start;
+        owner = n_frames > 0 ? find_owner (frames, n_frames) : NULL;
+
+        histogram_add (owner ? owner : DEFAULT_OWNER, duration);
+
+        if (threshold > 0 && duration >= (guint64) threshold * 1000) {
+                report_stall (owner ? owner : DEFAULT_OWNER, duration, frames, n_frames);
+        }
+
+        g_free (owner);
+}
+
+static gint
+watchdog_poll (GPollFD *fds,
+               guint    nfds,
+               gint     timeout)
+{
+        gint ret;
+
+        iteration_finished (g_get_monotonic_time ());
+
+        ret = real_poll (fds, nfds, timeout);
+
+        g_mutex_lock (&lock);
+        busy_since = g_get_monotonic_time ();
+        iteration++;
+        g_cond_signal (&cond);
+        g_mutex_unlock (&lock);
+
+        return ret;
+}
+
+static void
+sample_handler (int signum)
+{
+        sample_frames = backtrace (sample, MAX_FRAMES);
+        sample_iteration = iteration;
+}
+
+/* Sleeps while the main loop is idle, and interrupts the main thread once
+ * per iteration that outlasts SAMPLE_AFTER */
+static gpointer
+watchdog_thread (gpointer data)
+{
+        g_mutex_lock (&lock);
+
+        for (;;) {
+                gint64 deadline;
+                guint  current;
+
+                while (busy_since == 0 || sampled_iteration == iteration) {
+                        g_cond_wait (&cond, &lock);
+                }
+
+                current = iteration;
+                deadline = busy_since + SAMPLE_AFTER;
+
+                while (current == iteration && busy_since != 0 &&
+                       g_get_monotonic_time () < deadline) {
+                        g_cond_wait_until (&cond, &lock, deadline);
+                }
+
+                sampled_iteration = current;
+                if (current == iteration && busy_since != 0) {
+                        pthread_kill (main_thread, SIGRTMIN);
+                }
+        }
+
+        g_mutex_unlock (&lock);
+
+        return NULL;
+}
+
+void
+cinnamon_settings_watchdog_start (GMainContext *context)
+{
+        struct sigaction action;
+        void            *frames[1];
+
+        if (real_poll != NULL) {
+                return;
+        }
+
+        if (context == NULL) {
+                context = g_main_context_default ();
+        }
+
+        /* backtrace() may allocate the first time it is called, make sure
+         * that does not happen inside the signal handler */
+        backtrace (frames, 1);
+
+        memset (&action, 0, sizeof (action));
+        action.sa_handler = sample_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset (&action.sa_mask);
+        sigaction (SIGRTMIN, &action, NULL);
+
+        histograms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        main_thread = pthread_self ();
+
+        real_poll = g_main_context_get_poll_func (context);
+        g_main_context_set_poll_func (context, watchdog_poll);
+
+        g_thread_unref (g_thread_new ("csd-watchdog", watchdog_thread, NULL));
+}
+
+void
+cinnamon_settings_watchdog_set_threshold (guint threshold_ms)
+{
+        threshold = threshold_ms;
+}
+
+GVariant *
+cinnamon_settings_watchdog_get_stats (void)
+{
+        GVariantBuilder   builder;
+        GHashTableIter    iter;
+        const char       *owner;
+        LatencyHistogram *histogram;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE (CINNAMON_SETTINGS_WATCHDOG_STATS_TYPE));
+
+        if (histograms == NULL) {
+                return g_variant_builder_end (&builder);
+        }
+
+        g_hash_table_iter_init (&iter, histograms);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &owner, (gpointer *) &histogram)) {
+                GVariantBuilder buckets;
+                guint           i;
+
+                g_variant_builder_init (&buckets, G_VARIANT_TYPE ("a(tt)"));
+                for (i = 0; i < N_BUCKETS; i++) {
+                        if (histogram->buckets[i] > 0) {
+                                g_variant_builder_add (&buckets, "(tt)",
+                                                       bucket_upper_bound (i),
+                                                       histogram->buckets[i]);
+                        }
+                }
+
+                g_variant_builder_add (&builder, "(sttttta(tt))",
+                                       owner,
+                                       histogram->count,
+                                       histogram->total,
+                                       histogram->max,
+                                       histogram_percentile (histogram, 50),
+                                       histogram_percentile (histogram, 99),
+                                       &buckets);
+        }
+
+        return g_variant_builder_end (&builder);
+}
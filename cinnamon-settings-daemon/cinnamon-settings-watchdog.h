@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __CINNAMON_SETTINGS_WATCHDOG_H__
+#define __CINNAMON_SETTINGS_WATCHDOG_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Type of the value returned by cinnamon_settings_watchdog_get_stats():
+ * for each owner, the number of main loop iterations, their total, maximum, median
+ * and 99th percentile durations, and the non-empty histogram buckets as
+ * (upper bound, count). All times are in microseconds. */
+#define CINNAMON_SETTINGS_WATCHDOG_STATS_TYPE "a(sttttta(tt))"
+
+void             cinnamon_settings_watchdog_start           (GMainContext *context);
+void             cinnamon_settings_watchdog_set_threshold   (guint         threshold_ms);
+GVariant        *cinnamon_settings_watchdog_get_stats       (void);
+
+G_END_DECLS
+
+#endif  /* __CINNAMON_SETTINGS_WATCHDOG_H__ */
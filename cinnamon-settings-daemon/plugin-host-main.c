@@ -0,0 +1,187 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/* Runs a single settings plugin in its own process on behalf of
+ * cinnamon-settings-daemon, see cinnamon-settings-plugin-host.h */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#include <glib/gi18n.h>
+#include <glib-unix.h>
+#include <gtk/gtk.h>
+#include <libnotify/notify.h>
+
+#include "cinnamon-settings-module.h"
+#include "cinnamon-settings-plugin.h"
+#include "cinnamon-settings-plugin-host.h"
+
+static void
+send_line (const char *format,
+           ...) G_GNUC_PRINTF (1, 2);
+
+static void
+send_line (const char *format,
+           ...)
+{
+        va_list  args;
+        char    *line;
+        char    *str;
+
+        va_start (args, format);
+        line = g_strdup_vprintf (format, args);
+        va_end (args);
+
+        str = g_strconcat (line, "\n", NULL);
+        if (write (CINNAMON_SETTINGS_PLUGIN_HOST_FD, str, strlen (str)) < 0) {
+                g_debug ("Could not talk to the settings manager");
+        }
+
+        g_free (str);
+        g_free (line);
+}
+
+static void
+send_stats (void)
+{
+        struct rusage usage;
+        guint64       cpu_time;
+
+        if (getrusage (RUSAGE_SELF, &usage) != 0) {
+                return;
+        }
+
+        cpu_time = (guint64) usage.ru_utime.tv_sec * G_USEC_PER_SEC + usage.ru_utime.tv_usec +
+                   (guint64) usage.ru_stime.tv_sec * G_USEC_PER_SEC + usage.ru_stime.tv_usec;
+
+        send_line ("stats %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+                   (guint64) usage.ru_maxrss, cpu_time);
+}
+
+static gboolean
+command_cb (GIOChannel   *channel,
+            GIOCondition  condition,
+            gpointer      user_data)
+{
+        GIOStatus  status;
+        char      *line;
+
+        if (condition & G_IO_IN) {
+                while ((status = g_io_channel_read_line (channel, &line, NULL, NULL, NULL)) == G_IO_STATUS_NORMAL) {
+                        g_strchomp (line);
+
+                        if (g_strcmp0 (line, "ping") == 0) {
+                                send_stats ();
+                                send_line ("pong");
+                        } else if (g_strcmp0 (line, "stop") == 0) {
+                                g_free (line);
+                                gtk_main_quit ();
+                                return FALSE;
+                        }
+
+                        g_free (line);
+                }
+
+                if (status == G_IO_STATUS_AGAIN) {
+                        return TRUE;
+                }
+        }
+
+        /* The manager went away */
+        gtk_main_quit ();
+        return FALSE;
+}
+
+static gboolean
+on_term_signal (gpointer user_data)
+{
+        gtk_main_quit ();
+        return FALSE;
+}
+
+int
+main (int argc, char *argv[])
+{
+        CinnamonSettingsModule *module;
+        CinnamonSettingsPlugin *plugin;
+        GIOChannel             *channel;
+        char                   *name;
+
+        bindtextdomain (GETTEXT_PACKAGE, CINNAMON_SETTINGS_LOCALEDIR);
+        bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+        textdomain (GETTEXT_PACKAGE);
+        setlocale (LC_ALL, "");
+
+        if (argc != 2) {
+                g_printerr ("Usage: %s MODULE\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        name = g_path_get_basename (argv[1]);
+        g_set_prgname (name);
+        g_free (name);
+
+        g_setenv ("GDK_SCALE", "1", TRUE);
+        if (! gtk_init_check (NULL, NULL)) {
+                send_line ("error Unable to initialize GTK+");
+                return EXIT_FAILURE;
+        }
+        g_unsetenv ("GDK_SCALE");
+
+        notify_init ("cinnamon-settings-daemon");
+
+        module = cinnamon_settings_module_new (argv[1]);
+        if (module == NULL || !g_type_module_use (G_TYPE_MODULE (module))) {
+                send_line ("error Cannot load %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        plugin = CINNAMON_SETTINGS_PLUGIN (cinnamon_settings_module_new_object (module));
+        g_type_module_unuse (G_TYPE_MODULE (module));
+        if (plugin == NULL) {
+                send_line ("error No plugin in %s", argv[1]);
+                return EXIT_FAILURE;
+        }
+
+        channel = g_io_channel_unix_new (CINNAMON_SETTINGS_PLUGIN_HOST_FD);
+        g_io_channel_set_encoding (channel, NULL, NULL);
+        g_io_channel_set_flags (channel, G_IO_FLAG_NONBLOCK, NULL);
+        g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR, command_cb, NULL);
+
+        g_unix_signal_add (SIGTERM, on_term_signal, NULL);
+
+        cinnamon_settings_plugin_activate (plugin);
+        send_line ("ready");
+
+        gtk_main ();
+
+        cinnamon_settings_plugin_deactivate (plugin);
+        g_object_unref (plugin);
+        g_io_channel_unref (channel);
+
+        return EXIT_SUCCESS;
+}
@@ -102,6 +102,13 @@ typedef enum
   CSD_POWER_ACTION_NOTHING
 } CsdPowerActionType;
 
+typedef enum
+{
+  CSD_BACKLIGHT_TRANSITION_CURVE_LINEAR,
+  CSD_BACKLIGHT_TRANSITION_CURVE_EASE_OUT,
+  CSD_BACKLIGHT_TRANSITION_CURVE_EASE_IN_OUT
+} CsdBacklightTransitionCurve;
+
 typedef enum
 {
   CSD_UPDATE_TYPE_ALL,
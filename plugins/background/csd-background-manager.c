@@ -42,6 +42,7 @@
 #include <libcinnamon-desktop/gnome-bg.h>
 #include <X11/Xatom.h>
 
+#include "cinnamon-settings-bus.h"
 #include "cinnamon-settings-profile.h"
 #include "csd-background-manager.h"
 
@@ -56,6 +57,7 @@ struct CsdBackgroundManagerPrivate
 
         GDBusProxy  *proxy;
         guint        proxy_signal_id;
+        GCancellable *cancellable;
 };
 
 static void     csd_background_manager_class_init  (CsdBackgroundManagerClass *klass);
@@ -223,41 +225,26 @@ on_session_manager_signal (GDBusProxy   *proxy,
 }
 
 static void
-draw_background_after_session_loads (CsdBackgroundManager *manager)
+is_session_running_cb (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data)
 {
+        CsdBackgroundManager *manager = CSD_BACKGROUND_MANAGER (user_data);
         GError *error = NULL;
-        GDBusProxyFlags flags;
-        GVariant *var = NULL;
+        GVariant *var;
         gboolean running = FALSE;
 
-        flags = G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
-                G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START;
-        manager->priv->proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
-                                                              flags,
-                                                              NULL, /* GDBusInterfaceInfo */
-                                                              "org.gnome.SessionManager",
-                                                              "/org/gnome/SessionManager",
-                                                              "org.gnome.SessionManager",
-                                                              NULL, /* GCancellable */
-                                                              &error);
-        if (manager->priv->proxy == NULL) {
-                g_warning ("Could not listen to session manager: %s",
-                           error->message);
-                g_error_free (error);
-                return;
-        }
+        var = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (var == NULL) {
+                gboolean cancelled;
 
-        var = g_dbus_proxy_call_sync (manager->priv->proxy,
-                                      "IsSessionRunning",
-                                      NULL,
-                                      G_DBUS_CALL_FLAGS_NONE,
-                                      -1,
-                                      NULL,
-                                      NULL);
-
-        if (var != NULL) {
-            g_variant_get (var, "(b)", &running);
-            g_variant_unref (var);
+                cancelled = g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+                g_error_free (error);
+                if (cancelled)
+                        return;
+        } else {
+                g_variant_get (var, "(b)", &running);
+                g_variant_unref (var);
         }
 
         if (running) {
@@ -270,6 +257,50 @@ draw_background_after_session_loads (CsdBackgroundManager *manager)
         }
 }
 
+static void
+session_manager_proxy_ready_cb (GObject      *source_object,
+                                GAsyncResult *res,
+                                gpointer      user_data)
+{
+        CsdBackgroundManager *manager = CSD_BACKGROUND_MANAGER (user_data);
+        GDBusProxy *proxy;
+        GError *error = NULL;
+
+        proxy = cinnamon_settings_bus_get_proxy_finish (res, &error);
+        if (proxy == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Could not listen to session manager: %s",
+                                   error->message);
+                g_error_free (error);
+                return;
+        }
+        manager->priv->proxy = proxy;
+
+        g_dbus_proxy_call (manager->priv->proxy,
+                           "IsSessionRunning",
+                           NULL,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           manager->priv->cancellable,
+                           is_session_running_cb,
+                           manager);
+}
+
+static void
+draw_background_after_session_loads (CsdBackgroundManager *manager)
+{
+        manager->priv->cancellable = g_cancellable_new ();
+        cinnamon_settings_bus_get_proxy (G_BUS_TYPE_SESSION,
+                                         G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                         G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                         "org.gnome.SessionManager",
+                                         "/org/gnome/SessionManager",
+                                         "org.gnome.SessionManager",
+                                         manager->priv->cancellable,
+                                         session_manager_proxy_ready_cb,
+                                         manager);
+}
+
 
 static void
 disconnect_screen_signals (CsdBackgroundManager *manager)
@@ -339,9 +370,16 @@ csd_background_manager_stop (CsdBackgroundManager *manager)
 
         disconnect_screen_signals (manager);
 
+        if (p->cancellable != NULL) {
+                g_cancellable_cancel (p->cancellable);
+                g_object_unref (p->cancellable);
+                p->cancellable = NULL;
+        }
+
         if (manager->priv->proxy) {
                 disconnect_session_manager_listener (manager);
                 g_object_unref (manager->priv->proxy);
+                manager->priv->proxy = NULL;
         }
 
         g_signal_handlers_disconnect_by_func (manager->priv->settings,
@@ -49,9 +49,86 @@ static GdkModifierType csd_used_mods = 0;
 
 #define IN_RANGE(x, min, max) (x >= min && x <= max)
 
+/* The real modifiers and ignored-modifier combinations for a given
+ * binding state only change with the keymap, so compute them once per
+ * keymap generation */
+typedef struct {
+        guint   modifiers;
+        GArray *combos; /* XIGrabModifiers */
+} ModifierSet;
+
+static GHashTable *modifier_sets = NULL; /* key = state, value = ModifierSet */
+
+/* What we currently hold grabbed, so that re-grabbing an unchanged
+ * binding doesn't hit the server */
+typedef struct {
+        Window root;
+        guint  keycode;
+        guint  modifiers;
+} GrabEntry;
+
+static GHashTable *active_grabs = NULL; /* key = GrabEntry, value = synchronous + 1 */
+
+struct _CsdKeygrabBatch {
+        GHashTable *grabs;   /* key = GrabEntry, value = synchronous + 1 */
+        GHashTable *ungrabs; /* key = GrabEntry */
+        gboolean    refused; /* the server refused some of the grabs */
+};
+
+static void
+modifier_set_free (ModifierSet *set)
+{
+        g_array_free (set->combos, TRUE);
+        g_free (set);
+}
+
+static guint
+grab_entry_hash (gconstpointer v)
+{
+        const GrabEntry *entry = v;
+
+        return (guint) entry->root ^ (entry->keycode << 16) ^ entry->modifiers;
+}
+
+static gboolean
+grab_entry_equal (gconstpointer a,
+                  gconstpointer b)
+{
+        const GrabEntry *ea = a;
+        const GrabEntry *eb = b;
+
+        return ea->root == eb->root &&
+               ea->keycode == eb->keycode &&
+               ea->modifiers == eb->modifiers;
+}
+
+static GHashTable *
+grab_entry_table_new (void)
+{
+        return g_hash_table_new_full (grab_entry_hash, grab_entry_equal, g_free, NULL);
+}
+
+static void
+keymap_keys_changed (GdkKeymap *keymap,
+                     gpointer   user_data)
+{
+        /* NumLock may have moved, and virtual modifiers may map
+         * differently now */
+        csd_used_mods = 0;
+        csd_ignored_mods = 0;
+        g_hash_table_remove_all (modifier_sets);
+}
+
 static void
 setup_modifiers (void)
 {
+        if (modifier_sets == NULL) {
+                modifier_sets = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                       NULL, (GDestroyNotify) modifier_set_free);
+                g_signal_connect (gdk_keymap_get_default (), "keys-changed",
+                                  G_CALLBACK (keymap_keys_changed), NULL);
+        }
+
         if (csd_used_mods == 0 || csd_ignored_mods == 0) {
                 GdkModifierType dynmods;
 
@@ -72,121 +149,38 @@ setup_modifiers (void)
 	}
 }
 
-static void
-grab_key_real (guint      keycode,
-               GdkWindow *root,
-               gboolean   grab,
-               gboolean   synchronous,
-               XIGrabModifiers *mods,
-               int        num_mods)
-{
-	XIEventMask evmask;
-	unsigned char mask[(XI_LASTEVENT + 7)/8];
-
-	memset (mask, 0, sizeof (mask));
-	XISetMask (mask, XI_KeyPress);
-	XISetMask (mask, XI_KeyRelease);
-
-	evmask.deviceid = XIAllMasterDevices;
-	evmask.mask_len = sizeof (mask);
-	evmask.mask = mask;
-
-        if (grab) {
-                XIGrabKeycode (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
-                               XIAllMasterDevices,
-                               keycode,
-                               GDK_WINDOW_XID (root),
-                               GrabModeAsync,
-                               synchronous ? GrabModeSync : GrabModeAsync,
-                               False,
-                               &evmask,
-                               num_mods,
-                               mods);
-        } else {
-                XIUngrabKeycode (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
-                                 XIAllMasterDevices,
-                                 keycode,
-                                 GDK_WINDOW_XID (root),
-                                 num_mods,
-                                 mods);
-        }
-}
-
-/* Grab the key. In order to ignore CSD_IGNORED_MODS we need to grab
- * all combinations of the ignored modifiers and those actually used
- * for the binding (if any).
+/* In order to ignore CSD_IGNORED_MODS we need to grab all combinations
+ * of the ignored modifiers and those actually used for the binding (if
+ * any).
  *
  * inspired by all_combinations from gnome-panel/gnome-panel/global-keys.c
- *
- * This may generate X errors.  The correct way to use this is like:
- *
- *        gdk_error_trap_push ();
- *
- *        grab_key_unsafe (key, grab, screens);
- *
- *        gdk_flush ();
- *        if (gdk_error_trap_pop ())
- *                g_warning ("Grab failed, another application may already have access to key '%u'",
- *                           key->keycode);
- *
- * This is not done in the function itself, to allow doing multiple grab_key
- * operations with one flush only.
  */
 #define N_BITS 32
-static void
-grab_key_internal (Key             *key,
-                   gboolean         grab,
-                   CsdKeygrabFlags  flags,
-                   GSList          *screens)
+static ModifierSet *
+get_modifier_set (guint state)
 {
+        ModifierSet *set;
         int     indexes[N_BITS]; /* indexes of bits we need to flip */
         int     i;
         int     bit;
         int     bits_set_cnt;
         int     uppervalue;
-        guint   mask, modifiers;
-        GArray *all_mods;
-        GSList *l;
+        guint   mask;
 
         setup_modifiers ();
 
-        mask = csd_ignored_mods & ~key->state & GDK_MODIFIER_MASK;
+        set = g_hash_table_lookup (modifier_sets, GUINT_TO_POINTER (state));
+        if (set != NULL)
+                return set;
 
-        /* XGrabKey requires real modifiers, not virtual ones */
-        modifiers = key->state;
-        gdk_keymap_map_virtual_modifiers (gdk_keymap_get_default (), &modifiers);
-        modifiers &= ~(GDK_META_MASK | GDK_SUPER_MASK | GDK_HYPER_MASK);
+        set = g_new0 (ModifierSet, 1);
 
-        /* If key doesn't have a usable modifier, we don't want
-         * to grab it, since the user might lose a useful key.
-         *
-         * The exception is the XFree86 keys and the Function keys
-         * (which are useful to grab without a modifier).
-         */
-        if (!(flags & CSD_KEYGRAB_ALLOW_UNMODIFIED) &&
-            (modifiers & csd_used_mods) == 0 &&
-            !IN_RANGE(key->keysym, XF86KEYS_RANGE_MIN, XF86KEYS_RANGE_MAX) &&
-            !IN_RANGE(key->keysym, FKEYS_RANGE_MIN, FKEYS_RANGE_MAX) &&
-             key->keysym != GDK_KEY_Pause &&
-             key->keysym != GDK_KEY_Print &&
-             key->keysym != GDK_KEY_Menu) {
-                GString *keycodes;
-
-                keycodes = g_string_new ("");
-                if (key->keycodes != NULL) {
-                        guint *c;
-
-                        for (c = key->keycodes; *c; ++c) {
-                                g_string_printf (keycodes, " %u", *c);
-                        }
-                }
-                g_warning ("Key 0x%x (keycodes: %s)  with state 0x%x (resolved to 0x%x) "
-                           " has no usable modifiers (usable modifiers are 0x%x)",
-                           key->keysym, keycodes->str, key->state, modifiers, csd_used_mods);
-                g_string_free (keycodes, TRUE);
+        /* XGrabKey requires real modifiers, not virtual ones */
+        set->modifiers = state;
+        gdk_keymap_map_virtual_modifiers (gdk_keymap_get_default (), &set->modifiers);
+        set->modifiers &= ~(GDK_META_MASK | GDK_SUPER_MASK | GDK_HYPER_MASK);
 
-                return;
-        }
+        mask = csd_ignored_mods & ~state & GDK_MODIFIER_MASK;
 
         bit = 0;
         /* store the indexes of all set bits in mask in the array */
@@ -197,14 +191,15 @@ grab_key_internal (Key             *key,
         }
 
         bits_set_cnt = bit;
-
-	all_mods = g_array_new (FALSE, TRUE, sizeof(XIGrabModifiers));
         uppervalue = 1 << bits_set_cnt;
-        /* store all possible modifier combinations for our mask into all_mods */
+
+        set->combos = g_array_sized_new (FALSE, TRUE, sizeof (XIGrabModifiers), uppervalue);
+        g_array_set_size (set->combos, uppervalue);
+
+        /* store all possible modifier combinations for our mask */
         for (i = 0; i < uppervalue; ++i) {
                 int     j;
                 int     result = 0;
-                XIGrabModifiers *mod;
 
                 /* map bits in the counter to those in the mask */
                 for (j = 0; j < bits_set_cnt; ++j) {
@@ -213,27 +208,347 @@ grab_key_internal (Key             *key,
                         }
                 }
 
-                /* Grow the array by one, to fit our new XIGrabModifiers item */
-                g_array_set_size (all_mods, all_mods->len + 1);
-                mod = &g_array_index (all_mods, XIGrabModifiers, all_mods->len - 1);
-                mod->modifiers = result | modifiers;
+                g_array_index (set->combos, XIGrabModifiers, i).modifiers = result | set->modifiers;
+        }
+
+        g_hash_table_insert (modifier_sets, GUINT_TO_POINTER (state), set);
+
+        return set;
+}
+
+static gboolean
+key_is_grabbable (Key             *key,
+                  CsdKeygrabFlags  flags,
+                  guint            modifiers)
+{
+        GString *keycodes;
+
+        /* If key doesn't have a usable modifier, we don't want
+         * to grab it, since the user might lose a useful key.
+         *
+         * The exception is the XFree86 keys and the Function keys
+         * (which are useful to grab without a modifier).
+         */
+        if ((flags & CSD_KEYGRAB_ALLOW_UNMODIFIED) ||
+            (modifiers & csd_used_mods) != 0 ||
+            IN_RANGE(key->keysym, XF86KEYS_RANGE_MIN, XF86KEYS_RANGE_MAX) ||
+            IN_RANGE(key->keysym, FKEYS_RANGE_MIN, FKEYS_RANGE_MAX) ||
+            key->keysym == GDK_KEY_Pause ||
+            key->keysym == GDK_KEY_Print ||
+            key->keysym == GDK_KEY_Menu)
+                return TRUE;
+
+        keycodes = g_string_new ("");
+        if (key->keycodes != NULL) {
+                guint *c;
+
+                for (c = key->keycodes; *c; ++c) {
+                        g_string_append_printf (keycodes, " %u", *c);
+                }
         }
+        g_warning ("Key 0x%x (keycodes: %s)  with state 0x%x (resolved to 0x%x) "
+                   " has no usable modifiers (usable modifiers are 0x%x)",
+                   key->keysym, keycodes->str, key->state, modifiers, csd_used_mods);
+        g_string_free (keycodes, TRUE);
+
+        return FALSE;
+}
+
+CsdKeygrabBatch *
+keygrab_batch_new (void)
+{
+        CsdKeygrabBatch *batch;
+
+        batch = g_new0 (CsdKeygrabBatch, 1);
+        batch->grabs = grab_entry_table_new ();
+        batch->ungrabs = grab_entry_table_new ();
+
+        return batch;
+}
+
+void
+keygrab_batch_free (CsdKeygrabBatch *batch)
+{
+        if (batch == NULL)
+                return;
+        g_hash_table_destroy (batch->grabs);
+        g_hash_table_destroy (batch->ungrabs);
+        g_free (batch);
+}
+
+static void
+batch_add_key (CsdKeygrabBatch *batch,
+               Key             *key,
+               gboolean         grab,
+               CsdKeygrabFlags  flags,
+               GSList          *screens)
+{
+        ModifierSet *set;
+        GSList *l;
+
+        if (key->keycodes == NULL)
+                return;
+
+        set = get_modifier_set (key->state);
+
+        if (grab && !key_is_grabbable (key, flags, set->modifiers))
+                return;
 
-	/* Capture the actual keycodes with the modifier array */
         for (l = screens; l; l = l->next) {
                 GdkScreen *screen = l->data;
+                Window root = GDK_WINDOW_XID (gdk_screen_get_root_window (screen));
                 guint *code;
+                guint i;
 
                 for (code = key->keycodes; *code; ++code) {
-                        grab_key_real (*code,
-                                       gdk_screen_get_root_window (screen),
-                                       grab,
-                                       flags & CSD_KEYGRAB_SYNCHRONOUS,
-                                       (XIGrabModifiers *) all_mods->data,
-                                       all_mods->len);
+                        for (i = 0; i < set->combos->len; i++) {
+                                GrabEntry *entry;
+
+                                entry = g_new (GrabEntry, 1);
+                                entry->root = root;
+                                entry->keycode = *code;
+                                entry->modifiers = g_array_index (set->combos, XIGrabModifiers, i).modifiers;
+
+                                if (grab) {
+                                        g_hash_table_replace (batch->grabs, entry,
+                                                              GUINT_TO_POINTER ((flags & CSD_KEYGRAB_SYNCHRONOUS ? 1 : 0) + 1));
+                                } else {
+                                        g_hash_table_replace (batch->ungrabs, entry, NULL);
+                                }
+                        }
+                }
+        }
+}
+
+void
+keygrab_batch_grab (CsdKeygrabBatch *batch,
+                    Key             *key,
+                    CsdKeygrabFlags  flags,
+                    GSList          *screens)
+{
+        batch_add_key (batch, key, TRUE, flags, screens);
+}
+
+void
+keygrab_batch_ungrab (CsdKeygrabBatch *batch,
+                      Key             *key,
+                      GSList          *screens)
+{
+        batch_add_key (batch, key, FALSE, 0, screens);
+}
+
+/* Requests going to the same window and keycode share one
+ * XIGrabKeycode call with all their modifiers */
+typedef struct {
+        Window   root;
+        guint    keycode;
+        gboolean grab;
+        gboolean synchronous;
+        GArray  *mods;
+} GrabRequest;
+
+static void
+grab_request_free (GrabRequest *request)
+{
+        g_array_free (request->mods, TRUE);
+        g_free (request);
+}
+
+static void
+queue_request (GHashTable *requests,
+               GrabEntry  *entry,
+               gboolean    grab,
+               gboolean    synchronous)
+{
+        GrabRequest *request;
+        XIGrabModifiers mod;
+        char *id;
+
+        id = g_strdup_printf ("%lu:%u:%d:%d", (gulong) entry->root, entry->keycode, grab, synchronous);
+        request = g_hash_table_lookup (requests, id);
+        if (request == NULL) {
+                request = g_new0 (GrabRequest, 1);
+                request->root = entry->root;
+                request->keycode = entry->keycode;
+                request->grab = grab;
+                request->synchronous = synchronous;
+                request->mods = g_array_new (FALSE, TRUE, sizeof (XIGrabModifiers));
+                g_hash_table_insert (requests, id, request);
+        } else {
+                g_free (id);
+        }
+
+        memset (&mod, 0, sizeof (mod));
+        mod.modifiers = entry->modifiers;
+        g_array_append_val (request->mods, mod);
+}
+
+static void
+keygrab_batch_issue (CsdKeygrabBatch *batch)
+{
+        Display *dpy = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+        GHashTable *requests;
+        GHashTableIter iter;
+        gpointer key, value;
+        XIEventMask evmask;
+        unsigned char mask[(XI_LASTEVENT + 7)/8];
+
+        if (active_grabs == NULL)
+                active_grabs = grab_entry_table_new ();
+
+        requests = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, (GDestroyNotify) grab_request_free);
+
+        /* Ungrabs that are immediately re-grabbed are left to the grab,
+         * which replaces our own passive grab in place */
+        g_hash_table_iter_init (&iter, batch->ungrabs);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                GrabEntry *entry = key;
+
+                if (g_hash_table_contains (batch->grabs, entry) ||
+                    !g_hash_table_contains (active_grabs, entry))
+                        continue;
+
+                queue_request (requests, entry, FALSE, FALSE);
+                g_hash_table_remove (active_grabs, entry);
+        }
+
+        g_hash_table_iter_init (&iter, batch->grabs);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                GrabEntry *entry = key;
+
+                if (g_hash_table_lookup (active_grabs, entry) == value)
+                        continue;
+
+                /* only recorded once the server granted it */
+                queue_request (requests, entry, TRUE, GPOINTER_TO_UINT (value) - 1);
+        }
+
+        g_hash_table_remove_all (batch->grabs);
+        g_hash_table_remove_all (batch->ungrabs);
+
+	memset (mask, 0, sizeof (mask));
+	XISetMask (mask, XI_KeyPress);
+	XISetMask (mask, XI_KeyRelease);
+
+	evmask.deviceid = XIAllMasterDevices;
+	evmask.mask_len = sizeof (mask);
+	evmask.mask = mask;
+
+        g_hash_table_iter_init (&iter, requests);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                GrabRequest *request = value;
+
+                if (request->grab) {
+                        XIGrabModifiers *mods = (XIGrabModifiers *) request->mods->data;
+                        XIGrabModifiers *requested;
+                        GrabEntry entry;
+                        int failed;
+                        guint i;
+
+                        entry.root = request->root;
+                        entry.keycode = request->keycode;
+
+                        /* The server overwrites the array, so the
+                         * requested modifiers are kept and recorded first */
+                        requested = g_memdup (mods, request->mods->len * sizeof (XIGrabModifiers));
+                        for (i = 0; i < request->mods->len; i++) {
+                                entry.modifiers = requested[i].modifiers;
+                                g_hash_table_replace (active_grabs,
+                                                      g_memdup (&entry, sizeof (GrabEntry)),
+                                                      GUINT_TO_POINTER (request->synchronous + 1));
+                        }
+
+                        /* Conflicts with other clients' grabs are not
+                         * errors: the refused modifiers come back in the
+                         * first "failed" slots of the array */
+                        failed = XIGrabKeycode (dpy,
+                                                XIAllMasterDevices,
+                                                request->keycode,
+                                                request->root,
+                                                GrabModeAsync,
+                                                request->synchronous ? GrabModeSync : GrabModeAsync,
+                                                False,
+                                                &evmask,
+                                                request->mods->len,
+                                                mods);
+
+                        /* anything refused is tried again next time */
+                        if (failed < 0) {
+                                batch->refused = TRUE;
+                                for (i = 0; i < request->mods->len; i++) {
+                                        entry.modifiers = requested[i].modifiers;
+                                        g_hash_table_remove (active_grabs, &entry);
+                                }
+                        } else if (failed > 0) {
+                                batch->refused = TRUE;
+                                for (i = 0; i < (guint) failed && i < request->mods->len; i++) {
+                                        entry.modifiers = mods[i].modifiers;
+                                        g_hash_table_remove (active_grabs, &entry);
+                                }
+                        }
+                        g_free (requested);
+                } else {
+                        XIUngrabKeycode (dpy,
+                                         XIAllMasterDevices,
+                                         request->keycode,
+                                         request->root,
+                                         request->mods->len,
+                                         (XIGrabModifiers *) request->mods->data);
                 }
         }
-        g_array_free (all_mods, TRUE);
+
+        g_hash_table_destroy (requests);
+}
+
+/* Sends every queued grab and ungrab that changes what we hold, under
+ * one error trap. Each grab is still a round trip of its own, as the
+ * server replies with the modifiers it refused. Returns FALSE if the
+ * server rejected any of them. */
+gboolean
+keygrab_batch_commit (CsdKeygrabBatch *batch)
+{
+        gboolean refused;
+
+        gdk_error_trap_push ();
+
+        batch->refused = FALSE;
+        keygrab_batch_issue (batch);
+        refused = batch->refused;
+
+        gdk_flush ();
+        return gdk_error_trap_pop () == 0 && !refused;
+}
+
+/* Grab the key.
+ *
+ * This may generate X errors.  The correct way to use this is like:
+ *
+ *        gdk_error_trap_push ();
+ *
+ *        grab_key_unsafe (key, grab, screens);
+ *
+ *        gdk_flush ();
+ *        if (gdk_error_trap_pop ())
+ *                g_warning ("Grab failed, another application may already have access to key '%u'",
+ *                           key->keycode);
+ *
+ * This is not done in the function itself, to allow doing multiple grab_key
+ * operations with one flush only. keygrab_batch_commit() does all of
+ * this for a set of keys.
+ */
+static void
+grab_key_internal (Key             *key,
+                   gboolean         grab,
+                   CsdKeygrabFlags  flags,
+                   GSList          *screens)
+{
+        CsdKeygrabBatch *batch;
+
+        batch = keygrab_batch_new ();
+        batch_add_key (batch, key, grab, flags, screens);
+        keygrab_batch_issue (batch);
+        keygrab_batch_free (batch);
 }
 
 void
@@ -285,6 +600,122 @@ key_uses_keycode (const Key *key, guint keycode)
 	return FALSE;
 }
 
+/* Bindings indexed by keycode, so that an event filter only looks at
+ * the few bindings that can possibly match instead of all of them */
+#define KEY_MATCH_TABLE_SIZE 256
+
+struct _CsdKeyMatchTable {
+        GPtrArray *slots[KEY_MATCH_TABLE_SIZE]; /* index = keycode */
+        GPtrArray *unindexed; /* keys without keycodes */
+};
+
+CsdKeyMatchTable *
+key_match_table_new (void)
+{
+        return g_new0 (CsdKeyMatchTable, 1);
+}
+
+void
+key_match_table_clear (CsdKeyMatchTable *table)
+{
+        guint i;
+
+        for (i = 0; i < KEY_MATCH_TABLE_SIZE; i++) {
+                if (table->slots[i] != NULL) {
+                        g_ptr_array_free (table->slots[i], TRUE);
+                        table->slots[i] = NULL;
+                }
+        }
+        if (table->unindexed != NULL) {
+                g_ptr_array_free (table->unindexed, TRUE);
+                table->unindexed = NULL;
+        }
+}
+
+void
+key_match_table_free (CsdKeyMatchTable *table)
+{
+        if (table == NULL)
+                return;
+        key_match_table_clear (table);
+        g_free (table);
+}
+
+static void
+slot_add (GPtrArray **slot,
+          Key        *key)
+{
+        guint i;
+
+        if (*slot == NULL)
+                *slot = g_ptr_array_sized_new (1);
+
+        for (i = 0; i < (*slot)->len; i++) {
+                if (g_ptr_array_index (*slot, i) == key)
+                        return;
+        }
+        g_ptr_array_add (*slot, key);
+}
+
+/* The table keeps a pointer to @key; rebuild it whenever the bindings
+ * or their keycodes change, e.g. after the keymap changed */
+void
+key_match_table_add (CsdKeyMatchTable *table,
+                     Key              *key)
+{
+        guint *c;
+
+        if (key->keycodes == NULL || key->keycodes[0] == 0) {
+                slot_add (&table->unindexed, key);
+                return;
+        }
+
+        for (c = key->keycodes; *c; ++c) {
+                if (*c < KEY_MATCH_TABLE_SIZE)
+                        slot_add (&table->slots[*c], key);
+                else
+                        slot_add (&table->unindexed, key);
+        }
+}
+
+static Key *
+slot_lookup (GPtrArray       *slot,
+             CsdKeyMatchFunc  func,
+             gpointer         user_data)
+{
+        guint i;
+
+        if (slot == NULL)
+                return NULL;
+
+        for (i = 0; i < slot->len; i++) {
+                Key *key = g_ptr_array_index (slot, i);
+
+                if (func == NULL || func (key, user_data))
+                        return key;
+        }
+
+        return NULL;
+}
+
+/* Returns the first binding on @keycode accepted by @func, or any
+ * binding on @keycode if @func is %NULL */
+Key *
+key_match_table_lookup (CsdKeyMatchTable *table,
+                        guint             keycode,
+                        CsdKeyMatchFunc   func,
+                        gpointer          user_data)
+{
+        Key *key = NULL;
+
+        if (keycode < KEY_MATCH_TABLE_SIZE)
+                key = slot_lookup (table->slots[keycode], func, user_data);
+        if (key == NULL && func != NULL)
+                key = slot_lookup (table->unindexed, func, user_data);
+
+        return key;
+}
+
 /* Adapted from _gdk_x11_device_xi2_translate_state()
  * in gtk+/gdk/x11/gdkdevice-xi2.c */
 static guint
@@ -311,11 +742,12 @@ match_xi2_key (Key *key, XIDeviceEvent *event)
 	GdkModifierType consumed;
 	gint group;
 	guint keycode, state;
+	ModifierSet *set;
 
 	if (key == NULL)
 		return FALSE;
 
-	setup_modifiers ();
+	set = get_modifier_set (key->state);
 
 	state = device_xi2_translate_state (&event->mods, &event->group);
 
@@ -343,9 +775,7 @@ match_xi2_key (Key *key, XIDeviceEvent *event)
 
 		/* The Key structure contains virtual modifiers, whereas
 		 * the XEvent will be using the real modifier, so translate those */
-		mask = key->state;
-		gdk_keymap_map_virtual_modifiers (gdk_keymap_get_default (), &mask);
-                mask &= ~(GDK_META_MASK | GDK_SUPER_MASK | GDK_HYPER_MASK);
+		mask = set->modifiers;
 
 		gdk_keyval_convert_case (keyval, &lower, &upper);
 
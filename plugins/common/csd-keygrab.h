@@ -38,6 +38,12 @@ typedef enum {
         CSD_KEYGRAB_SYNCHRONOUS      = 1 << 1
 } CsdKeygrabFlags;
 
+typedef struct _CsdKeygrabBatch CsdKeygrabBatch;
+typedef struct _CsdKeyMatchTable CsdKeyMatchTable;
+
+typedef gboolean (*CsdKeyMatchFunc) (Key      *key,
+                                     gpointer  user_data);
+
 void	        grab_key_unsafe	(Key     *key,
 				 CsdKeygrabFlags flags,
 			         GSList  *screens);
@@ -45,12 +51,33 @@ void	        grab_key_unsafe	(Key     *key,
 void            ungrab_key_unsafe (Key     *key,
                                    GSList  *screens);
 
+CsdKeygrabBatch *keygrab_batch_new    (void);
+void             keygrab_batch_free   (CsdKeygrabBatch *batch);
+void             keygrab_batch_grab   (CsdKeygrabBatch *batch,
+                                       Key             *key,
+                                       CsdKeygrabFlags  flags,
+                                       GSList          *screens);
+void             keygrab_batch_ungrab (CsdKeygrabBatch *batch,
+                                       Key             *key,
+                                       GSList          *screens);
+gboolean         keygrab_batch_commit (CsdKeygrabBatch *batch);
+
 gboolean        match_xi2_key   (Key           *key,
                                  XIDeviceEvent *event);
 
 gboolean        key_uses_keycode (const Key *key,
                                   guint keycode);
 
+CsdKeyMatchTable *key_match_table_new    (void);
+void              key_match_table_free   (CsdKeyMatchTable *table);
+void              key_match_table_clear  (CsdKeyMatchTable *table);
+void              key_match_table_add    (CsdKeyMatchTable *table,
+                                          Key              *key);
+Key *             key_match_table_lookup (CsdKeyMatchTable *table,
+                                          guint             keycode,
+                                          CsdKeyMatchFunc   func,
+                                          gpointer          user_data);
+
 Key *           parse_key        (const char    *str);
 void            free_key         (Key           *key);
 
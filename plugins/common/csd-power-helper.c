@@ -20,6 +20,7 @@
 
 #include "config.h"
 
+#include "cinnamon-settings-bus.h"
 #include "csd-power-helper.h"
 
 #define LOGIND_DBUS_NAME                       "org.freedesktop.login1"
@@ -30,52 +31,35 @@
 #define CONSOLEKIT_DBUS_PATH_MANAGER            "/org/freedesktop/ConsoleKit/Manager"
 #define CONSOLEKIT_DBUS_INTERFACE_MANAGER       "org.freedesktop.ConsoleKit.Manager"
 
+static void
+logind_call (const gchar *method_name,
+             gboolean     interactive)
+{
+        cinnamon_settings_bus_call (G_BUS_TYPE_SYSTEM,
+                                    LOGIND_DBUS_NAME,
+                                    LOGIND_DBUS_PATH,
+                                    LOGIND_DBUS_INTERFACE,
+                                    method_name,
+                                    g_variant_new ("(b)", interactive),
+                                    0, G_MAXINT, NULL, NULL, NULL);
+}
+
 static void
 logind_stop (void)
 {
-        GDBusConnection *bus;
-
-        bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
-        g_dbus_connection_call (bus,
-                                LOGIND_DBUS_NAME,
-                                LOGIND_DBUS_PATH,
-                                LOGIND_DBUS_INTERFACE,
-                                "PowerOff",
-                                g_variant_new ("(b)", FALSE),
-                                NULL, 0, G_MAXINT, NULL, NULL, NULL);
-        g_object_unref (bus);
+        logind_call ("PowerOff", FALSE);
 }
 
 static void
 logind_suspend (void)
 {
-        GDBusConnection *bus;
-
-        bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
-        g_dbus_connection_call (bus,
-                                LOGIND_DBUS_NAME,
-                                LOGIND_DBUS_PATH,
-                                LOGIND_DBUS_INTERFACE,
-                                "Suspend",
-                                g_variant_new ("(b)", TRUE),
-                                NULL, 0, G_MAXINT, NULL, NULL, NULL);
-        g_object_unref (bus);
+        logind_call ("Suspend", TRUE);
 }
 
 static void
 logind_hibernate (void)
 {
-        GDBusConnection *bus;
-
-        bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
-        g_dbus_connection_call (bus,
-                                LOGIND_DBUS_NAME,
-                                LOGIND_DBUS_PATH,
-                                LOGIND_DBUS_INTERFACE,
-                                "Hibernate",
-                                g_variant_new ("(b)", TRUE),
-                                NULL, 0, G_MAXINT, NULL, NULL, NULL);
-        g_object_unref (bus);
+        logind_call ("Hibernate", TRUE);
 }
 
 static void
@@ -86,9 +70,7 @@ consolekit_stop_cb (GObject *source_object,
         GVariant *result;
         GError *error = NULL;
 
-        result = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object),
-                                           res,
-                                           &error);
+        result = cinnamon_settings_bus_call_finish (res, &error);
         if (result == NULL) {
                 g_warning ("couldn't stop using ConsoleKit: %s",
                            error->message);
@@ -101,31 +83,18 @@ consolekit_stop_cb (GObject *source_object,
 static void
 consolekit_stop (void)
 {
-        GError *error = NULL;
-        GDBusProxy *proxy;
-
         /* power down the machine in a safe way */
-        proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                               G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-                                               NULL,
-                                               CONSOLEKIT_DBUS_NAME,
-                                               CONSOLEKIT_DBUS_PATH_MANAGER,
-                                               CONSOLEKIT_DBUS_INTERFACE_MANAGER,
-                                               NULL, &error);
-        if (proxy == NULL) {
-                g_warning ("cannot connect to ConsoleKit: %s",
-                           error->message);
-                g_error_free (error);
-                return;
-        }
-        g_dbus_proxy_call (proxy,
-                           "Stop",
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1, NULL,
-                           consolekit_stop_cb, NULL);
-        g_object_unref (proxy);
+        cinnamon_settings_bus_call (G_BUS_TYPE_SYSTEM,
+                                    CONSOLEKIT_DBUS_NAME,
+                                    CONSOLEKIT_DBUS_PATH_MANAGER,
+                                    CONSOLEKIT_DBUS_INTERFACE_MANAGER,
+                                    "Stop",
+                                    NULL,
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    -1, NULL,
+                                    consolekit_stop_cb, NULL);
 }
+
 static void
 upower_sleep_cb (GObject *source_object,
                  GAsyncResult *res,
@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include <sys/statvfs.h>
+#include <errno.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -41,8 +42,27 @@
 
 #define GIGABYTE                   1024 * 1024 * 1024
 
+/* How often a volume that is already low on space is checked */
 #define CHECK_EVERY_X_SECONDS      60
 
+/* Other volumes are checked about halfway to the point where they
+ * would get low at the rate they are filling up, within these bounds */
+#define MIN_CHECK_INTERVAL         5
+#define MAX_CHECK_INTERVAL         (15 * 60)
+
+/* The slowest fill rate that is assumed. A large copy or download can
+ * start at any time, so an idle volume is scheduled as if one might be
+ * running; only volumes with plenty of headroom wait the longest. */
+#define MIN_FILL_RATE              (32 * 1024 * 1024) /* bytes per second */
+
+/* statvfs() on a hung mount never returns, so it runs in a worker.
+ * Each mount has at most one probe in flight, and mounts that keep
+ * timing out are only retried rarely. */
+#define PROBE_THREADS              4
+#define PROBE_TIMEOUT              5          /* seconds */
+#define QUARANTINE_TIMEOUTS        3          /* in a row */
+#define QUARANTINE_TIME            (60 * 60)  /* seconds */
+
 #define DISK_SPACE_ANALYZER        "baobab"
 
 #define SETTINGS_HOUSEKEEPING_DIR     "org.cinnamon.settings-daemon.plugins.housekeeping"
@@ -54,13 +74,44 @@
 
 typedef struct
 {
+        volatile gint ref_count;
+        gchar *path;
+        volatile gint started;  /* set by the worker */
+        gint64 start_time;      /* monotonic, set by the worker */
+        gint64 latency;         /* set by the worker */
+        struct statvfs buf;
+        gint error;
+        gboolean timed_out;     /* no longer waited for */
+} LdsmProbe;
+
+typedef struct
+{
+        gchar *path;
         GUnixMountEntry *mount;
         struct statvfs buf;
-        time_t notify_time;
+        gboolean sampled;
+        gboolean is_virtual;
+        gint64 sample_time;     /* monotonic */
+        gdouble fill_rate;      /* bytes per second, negative while emptying */
+        gint64 next_check;      /* monotonic */
+        LdsmProbe *probe;       /* in flight, possibly stuck */
+        guint probe_timeout_id;
+        guint timeouts;         /* in a row */
+        gint64 latency;         /* of the last probe */
+        gint64 max_latency;
 } LdsmMountInfo;
 
-static GHashTable        *ldsm_notified_hash = NULL;
+typedef struct
+{
+        gdouble free_space;
+        time_t notify_time;
+} LdsmNotifyInfo;
+
+static GHashTable        *ldsm_mounts = NULL;        /* key = mount path, value = LdsmMountInfo */
+static GHashTable        *ldsm_notified_hash = NULL; /* key = mount path, value = LdsmNotifyInfo */
 static unsigned int       ldsm_timeout_id = 0;
+static GThreadPool       *ldsm_probe_pool = NULL;
+static gboolean           ldsm_new_samples = FALSE;
 static GUnixMountMonitor *ldsm_monitor = NULL;
 static double             free_percent_notify = 0.05;
 static double             free_percent_notify_again = 0.01;
@@ -481,6 +532,18 @@ ldsm_mount_is_user_ignore (const gchar *path)
 }                
 
 
+static void
+ldsm_probe_unref (gpointer data)
+{
+        LdsmProbe *probe = data;
+
+        if (!g_atomic_int_dec_and_test (&probe->ref_count))
+                return;
+
+        g_free (probe->path);
+        g_free (probe);
+}
+
 static void
 ldsm_free_mount_info (gpointer data)
 {
@@ -488,213 +551,496 @@ ldsm_free_mount_info (gpointer data)
 
         g_return_if_fail (mount != NULL);
 
+        /* a stuck worker keeps its own reference */
+        if (mount->probe_timeout_id != 0)
+                g_source_remove (mount->probe_timeout_id);
+        if (mount->probe != NULL)
+                ldsm_probe_unref (mount->probe);
+
+        g_free (mount->path);
         g_unix_mount_free (mount->mount);
         g_free (mount);
 }
 
+/* Folds a new statvfs() sample into the fill rate */
+static void
+ldsm_mount_sample (LdsmMountInfo        *mount,
+                   const struct statvfs *buf,
+                   gint64                time)
+{
+        if (mount->sampled && time > mount->sample_time) {
+                gdouble used;
+                gdouble rate;
+
+                used = ((gdouble) mount->buf.f_bavail - (gdouble) buf->f_bavail) * buf->f_frsize;
+                rate = used / ((gdouble) (time - mount->sample_time) / G_USEC_PER_SEC);
+                mount->fill_rate = (mount->fill_rate + rate) / 2;
+        }
+
+        mount->buf = *buf;
+        mount->sampled = TRUE;
+        mount->sample_time = time;
+}
+
+static void
+ldsm_mount_schedule (LdsmMountInfo *mount,
+                     gint64         now)
+{
+        gdouble free_bytes, threshold, rate;
+        gdouble interval;
+
+        if (!mount->sampled) {
+                interval = MAX_CHECK_INTERVAL;
+        } else if (!ldsm_mount_has_space (mount)) {
+                interval = CHECK_EVERY_X_SECONDS;
+        } else {
+                /* the volume is low once both limits are crossed */
+                free_bytes = (gdouble) mount->buf.f_frsize * mount->buf.f_bavail;
+                threshold = MIN (free_percent_notify * mount->buf.f_frsize * mount->buf.f_blocks,
+                                 (gdouble) free_size_gb_no_notify * GIGABYTE);
+                rate = MAX (mount->fill_rate, MIN_FILL_RATE);
+
+                interval = (free_bytes - threshold) / rate / 2;
+                interval = CLAMP (interval, MIN_CHECK_INTERVAL, MAX_CHECK_INTERVAL);
+        }
+
+        mount->next_check = now + (gint64) interval * G_USEC_PER_SEC;
+}
+
+/* For mounts that didn't answer the last probe */
+static void
+ldsm_mount_back_off (LdsmMountInfo *mount,
+                     gint64         now)
+{
+        if (mount->timeouts >= QUARANTINE_TIMEOUTS)
+                mount->next_check = now + (gint64) QUARANTINE_TIME * G_USEC_PER_SEC;
+        else
+                mount->next_check = now + (gint64) CHECK_EVERY_X_SECONDS * G_USEC_PER_SEC;
+}
+
+static gboolean
+ldsm_mount_is_quarantined (LdsmMountInfo *mount)
+{
+        return mount->timeouts >= QUARANTINE_TIMEOUTS;
+}
+
+/* @mounts holds the paths of the volumes that are low on space */
 static void
 ldsm_maybe_warn_mounts (GList *mounts,
                         gboolean multiple_volumes,
                         gboolean other_usable_volumes)
 {
         GList *l;
-        gboolean done = FALSE;
 
         for (l = mounts; l != NULL; l = l->next) {
-                LdsmMountInfo *mount_info = l->data;
-                LdsmMountInfo *previous_mount_info;
+                LdsmMountInfo *mount_info;
+                LdsmNotifyInfo *notify_info;
                 gdouble free_space;
-                gdouble previous_free_space;
                 time_t curr_time;
-                const gchar *path;
                 gboolean show_notify;
 
-                if (done) {
-                        /* Don't show any more dialogs if the user took action with the last one. The user action
-                         * might free up space on multiple volumes, making the next dialog redundant.
-                         */
-                        ldsm_free_mount_info (mount_info);
+                /* The fallback dialog runs a main loop, and the mounts
+                 * might have changed, or we might have been stopped */
+                if (ldsm_mounts == NULL)
+                        break;
+                mount_info = g_hash_table_lookup (ldsm_mounts, l->data);
+                if (mount_info == NULL)
                         continue;
-                }
-
-                path = g_unix_mount_get_mount_path (mount_info->mount);
-
-                previous_mount_info = g_hash_table_lookup (ldsm_notified_hash, path);
-                if (previous_mount_info != NULL)
-                        previous_free_space = (gdouble) previous_mount_info->buf.f_bavail / (gdouble) previous_mount_info->buf.f_blocks;
 
+                notify_info = g_hash_table_lookup (ldsm_notified_hash, mount_info->path);
                 free_space = (gdouble) mount_info->buf.f_bavail / (gdouble) mount_info->buf.f_blocks;
 
-                if (previous_mount_info == NULL) {
+                if (notify_info == NULL) {
                         /* We haven't notified for this mount yet */
                         show_notify = TRUE;
-                        mount_info->notify_time = time (NULL);
-                        g_hash_table_replace (ldsm_notified_hash, g_strdup (path), mount_info);
-                } else if ((previous_free_space - free_space) > free_percent_notify_again) {
+                        notify_info = g_new0 (LdsmNotifyInfo, 1);
+                        notify_info->free_space = free_space;
+                        notify_info->notify_time = time (NULL);
+                        g_hash_table_replace (ldsm_notified_hash, g_strdup (mount_info->path), notify_info);
+                } else if ((notify_info->free_space - free_space) > free_percent_notify_again) {
                         /* We've notified for this mount before and free space has decreased sufficiently since last time to notify again */
                         curr_time = time (NULL);
-                        if (difftime (curr_time, previous_mount_info->notify_time) > (gdouble)(min_notify_period * 60)) {
+                        if (difftime (curr_time, notify_info->notify_time) > (gdouble)(min_notify_period * 60)) {
                                 show_notify = TRUE;
-                                mount_info->notify_time = curr_time;
+                                notify_info->notify_time = curr_time;
                         } else {
-                                /* It's too soon to show the dialog again. However, we still replace the LdsmMountInfo
-                                 * struct in the hash table, but give it the notfiy time from the previous dialog.
+                                /* It's too soon to show the dialog again. However, we still remember the
+                                 * new free space, but keep the notify time from the previous dialog.
                                  * This will stop the notification from reappearing unnecessarily as soon as the timeout expires.
                                  */
                                 show_notify = FALSE;
-                                mount_info->notify_time = previous_mount_info->notify_time;
                         }
-                        g_hash_table_replace (ldsm_notified_hash, g_strdup (path), mount_info);
+                        notify_info->free_space = free_space;
                 } else {
                         /* We've notified for this mount before, but the free space hasn't decreased sufficiently to notify again */
-                        ldsm_free_mount_info (mount_info);
                         show_notify = FALSE;
                 }
 
                 if (show_notify) {
+                        /* Don't show any more dialogs if the user took action with this one. The user action
+                         * might free up space on multiple volumes, making the next dialog redundant.
+                         */
                         if (ldsm_notify_for_mount (mount_info, multiple_volumes, other_usable_volumes))
-                                done = TRUE;
+                                break;
                 }
         }
 }
 
-static gboolean
-ldsm_check_all_mounts (gpointer data)
+static void ldsm_schedule_check (void);
+
+/* Looks at all the sampled volumes to decide what to warn about */
+static void
+ldsm_evaluate_mounts (void)
 {
-        GList *mounts;
-        GList *l;
-        GList *check_mounts = NULL;
+        GHashTableIter iter;
+        LdsmMountInfo *mount_info;
         GList *full_mounts = NULL;
-        guint number_of_mounts;
-        guint number_of_full_mounts;
+        guint number_of_mounts = 0;
+        guint number_of_full_mounts = 0;
         gboolean multiple_volumes = FALSE;
         gboolean other_usable_volumes = FALSE;
 
-        /* We iterate through the static mounts in /etc/fstab first, seeing if
-         * they're mounted by checking if the GUnixMountPoint has a corresponding GUnixMountEntry.
-         * Iterating through the static mounts means we automatically ignore dynamically mounted media.
-         */
-        mounts = g_unix_mount_points_get (time_read);
-
-        for (l = mounts; l != NULL; l = l->next) {
-                GUnixMountPoint *mount_point = l->data;
-                GUnixMountEntry *mount;
-                LdsmMountInfo *mount_info;
-                const gchar *path;
-
-                path = g_unix_mount_point_get_mount_path (mount_point);
-                mount = g_unix_mount_at (path, time_read);
-                g_unix_mount_point_free (mount_point);
-                if (mount == NULL) {
-                        /* The GUnixMountPoint is not mounted */
+        g_hash_table_iter_init (&iter, ldsm_mounts);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mount_info)) {
+                /* the last sample of a hung mount can't be trusted */
+                if (!mount_info->sampled || mount_info->is_virtual ||
+                    ldsm_mount_is_quarantined (mount_info))
                         continue;
+
+                number_of_mounts++;
+                if (!ldsm_mount_has_space (mount_info)) {
+                        full_mounts = g_list_prepend (full_mounts, g_strdup (mount_info->path));
+                        number_of_full_mounts++;
+                } else {
+                        g_hash_table_remove (ldsm_notified_hash, mount_info->path);
                 }
+        }
 
-                mount_info = g_new0 (LdsmMountInfo, 1);
-                mount_info->mount = mount;
+        if (number_of_mounts > 1)
+                multiple_volumes = TRUE;
+        if (number_of_mounts > number_of_full_mounts)
+                other_usable_volumes = TRUE;
 
-                path = g_unix_mount_get_mount_path (mount);
+        ldsm_maybe_warn_mounts (full_mounts, multiple_volumes,
+                                other_usable_volumes);
+        g_list_free_full (full_mounts, g_free);
+}
 
-                if (g_unix_mount_is_readonly (mount)) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+/* Called whenever a probe finished or gave up. Once no more answers
+ * are being waited for, the new samples are evaluated together, so
+ * that a slow mount doesn't make us warn about the others twice. */
+static void
+ldsm_probes_settled (void)
+{
+        GHashTableIter iter;
+        LdsmMountInfo *mount_info;
 
-                if (ldsm_mount_is_user_ignore (g_unix_mount_get_mount_path (mount))) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+        if (ldsm_mounts == NULL)
+                return;
 
-                if (csd_should_ignore_unix_mount (mount)) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+        g_hash_table_iter_init (&iter, ldsm_mounts);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mount_info)) {
+                if (mount_info->probe != NULL && !mount_info->probe->timed_out)
+                        return;
+        }
 
-                if (statvfs (path, &mount_info->buf) != 0) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+        if (ldsm_new_samples) {
+                ldsm_new_samples = FALSE;
+                ldsm_evaluate_mounts ();
+        }
 
-                if (ldsm_mount_is_virtual (mount_info)) {
-                        ldsm_free_mount_info (mount_info);
-                        continue;
-                }
+        /* a dialog might have run a main loop, and we got stopped */
+        if (ldsm_mounts != NULL)
+                ldsm_schedule_check ();
+}
 
-                check_mounts = g_list_prepend (check_mounts, mount_info);
+static gboolean
+ldsm_probe_done (gpointer data)
+{
+        LdsmProbe *probe = data;
+        LdsmMountInfo *mount_info;
+        gint64 now;
+
+        if (ldsm_mounts == NULL)
+                return FALSE;
+
+        /* the mount might have gone away meanwhile */
+        mount_info = g_hash_table_lookup (ldsm_mounts, probe->path);
+        if (mount_info == NULL || mount_info->probe != probe)
+                return FALSE;
+
+        if (mount_info->probe_timeout_id != 0) {
+                g_source_remove (mount_info->probe_timeout_id);
+                mount_info->probe_timeout_id = 0;
         }
+        mount_info->probe = NULL;
 
-        g_list_free (mounts);
+        mount_info->latency = probe->latency;
+        mount_info->max_latency = MAX (mount_info->max_latency, probe->latency);
 
-        number_of_mounts = g_list_length (check_mounts);
-        if (number_of_mounts > 1)
-                multiple_volumes = TRUE;
+        now = g_get_monotonic_time ();
 
-        for (l = check_mounts; l != NULL; l = l->next) {
-                LdsmMountInfo *mount_info = l->data;
+        if (probe->timed_out) {
+                /* alive, but too slow to trust yet; the schedule it got
+                 * when it timed out stays */
+                g_debug ("%s answered after %" G_GINT64_FORMAT " ms",
+                         probe->path, probe->latency / 1000);
+        } else {
+                mount_info->timeouts = 0;
+        }
 
-                if (!ldsm_mount_has_space (mount_info)) {
-                        full_mounts = g_list_prepend (full_mounts, mount_info);
-                } else {
-                        g_hash_table_remove (ldsm_notified_hash, g_unix_mount_get_mount_path (mount_info->mount));
-                        ldsm_free_mount_info (mount_info);
-                }
+        if (probe->error != 0) {
+                g_debug ("Failed to get the file system statistics of %s: %s",
+                         probe->path, g_strerror (probe->error));
+                if (!probe->timed_out)
+                        ldsm_mount_schedule (mount_info, now);
+        } else {
+                ldsm_mount_sample (mount_info, &probe->buf,
+                                   probe->start_time + probe->latency);
+                if (ldsm_mount_is_virtual (mount_info))
+                        mount_info->is_virtual = TRUE;
+                else if (!probe->timed_out)
+                        ldsm_mount_schedule (mount_info, now);
+                ldsm_new_samples = TRUE;
         }
 
-        number_of_full_mounts = g_list_length (full_mounts);
-        if (number_of_mounts > number_of_full_mounts)
-                other_usable_volumes = TRUE;
+        ldsm_probe_unref (probe);
+        ldsm_probes_settled ();
 
-        ldsm_maybe_warn_mounts (full_mounts, multiple_volumes,
-                                other_usable_volumes);
+        return FALSE;
+}
+
+static gboolean
+ldsm_probe_timeout (gpointer data)
+{
+        LdsmMountInfo *mount_info = data;
+        LdsmProbe *probe = mount_info->probe;
+
+        mount_info->probe_timeout_id = 0;
+
+        /* The probe stays in flight until the worker comes back, so a
+         * hung mount never holds more than one thread */
+        probe->timed_out = TRUE;
+
+        if (!g_atomic_int_get (&probe->started)) {
+                /* still queued behind other hung mounts, not its fault */
+                g_debug ("Probe of %s has not started after %d seconds",
+                         probe->path, PROBE_TIMEOUT);
+        } else {
+                mount_info->timeouts++;
+                if (mount_info->timeouts == QUARANTINE_TIMEOUTS)
+                        g_warning ("%s did not answer in %d seconds %d times in a row, "
+                                   "only checking it every %d minutes",
+                                   probe->path, PROBE_TIMEOUT, QUARANTINE_TIMEOUTS,
+                                   QUARANTINE_TIME / 60);
+                else
+                        g_debug ("%s did not answer in %d seconds",
+                                 probe->path, PROBE_TIMEOUT);
+        }
+
+        ldsm_mount_back_off (mount_info, g_get_monotonic_time ());
+        ldsm_probes_settled ();
+
+        return FALSE;
+}
+
+static void
+ldsm_probe_thread (gpointer data,
+                   gpointer user_data)
+{
+        LdsmProbe *probe = data;
 
-        g_list_free (check_mounts);
-        g_list_free (full_mounts);
+        probe->start_time = g_get_monotonic_time ();
+        g_atomic_int_set (&probe->started, 1);
 
-        return TRUE;
+        if (statvfs (probe->path, &probe->buf) != 0)
+                probe->error = errno;
+        probe->latency = g_get_monotonic_time () - probe->start_time;
+
+        /* hands our reference over */
+        g_idle_add_full (G_PRIORITY_DEFAULT, ldsm_probe_done,
+                         probe, ldsm_probe_unref);
+}
+
+static void
+ldsm_mount_probe (LdsmMountInfo *mount_info)
+{
+        LdsmProbe *probe;
+
+        probe = g_new0 (LdsmProbe, 1);
+        probe->ref_count = 2;
+        probe->path = g_strdup (mount_info->path);
+
+        mount_info->probe = probe;
+        mount_info->probe_timeout_id = g_timeout_add_seconds (PROBE_TIMEOUT,
+                                                              ldsm_probe_timeout,
+                                                              mount_info);
+
+        g_thread_pool_push (ldsm_probe_pool, probe, NULL);
+}
+
+/* Only probes the volumes that are due; what to warn about is decided
+ * once their answers are in */
+static void
+ldsm_check_all_mounts (void)
+{
+        GHashTableIter iter;
+        LdsmMountInfo *mount_info;
+        gint64 now;
+
+        /* probes answer asynchronously, possibly after we got stopped */
+        if (ldsm_mounts == NULL)
+                return;
+
+        now = g_get_monotonic_time ();
+
+        g_hash_table_iter_init (&iter, ldsm_mounts);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mount_info)) {
+                if (mount_info->is_virtual || mount_info->next_check > now)
+                        continue;
+
+                if (mount_info->probe != NULL) {
+                        /* still waiting for it, or it's stuck */
+                        if (mount_info->probe->timed_out)
+                                ldsm_mount_back_off (mount_info, now);
+                        continue;
+                }
+
+                ldsm_mount_probe (mount_info);
+        }
+
+        ldsm_probes_settled ();
 }
 
 static gboolean
-ldsm_is_hash_item_not_in_mounts (gpointer key,
-                                 gpointer value,
-                                 gpointer user_data)
+ldsm_check_timeout_cb (gpointer data)
 {
-        GList *l;
+        ldsm_timeout_id = 0;
+        ldsm_check_all_mounts ();
 
-        for (l = (GList *) user_data; l != NULL; l = l->next) {
-                GUnixMountEntry *mount = l->data;
-                const char *path;
+        return FALSE;
+}
 
-                path = g_unix_mount_get_mount_path (mount);
+static void
+ldsm_schedule_check (void)
+{
+        GHashTableIter iter;
+        LdsmMountInfo *mount_info;
+        gint64 next_check = G_MAXINT64;
+        gint64 now;
 
-                if (strcmp (path, key) == 0)
-                        return FALSE;
+        if (ldsm_timeout_id) {
+                g_source_remove (ldsm_timeout_id);
+                ldsm_timeout_id = 0;
         }
 
-        return TRUE;
+        if (ldsm_mounts == NULL)
+                return;
+
+        g_hash_table_iter_init (&iter, ldsm_mounts);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mount_info)) {
+                /* mounts we're waiting for get rescheduled on the answer */
+                if (mount_info->is_virtual ||
+                    (mount_info->probe != NULL && !mount_info->probe->timed_out))
+                        continue;
+                next_check = MIN (next_check, mount_info->next_check);
+        }
+
+        if (next_check == G_MAXINT64)
+                return;
+
+        now = g_get_monotonic_time ();
+        ldsm_timeout_id = g_timeout_add_seconds (MAX (next_check - now + G_USEC_PER_SEC - 1, 0) / G_USEC_PER_SEC,
+                                                 ldsm_check_timeout_cb, NULL);
+}
+
+static gboolean
+ldsm_is_mount_not_seen (gpointer key,
+                        gpointer value,
+                        gpointer user_data)
+{
+        return !g_hash_table_contains (user_data, key);
 }
 
+/* Brings the mount model in line with the mount table. We iterate
+ * through the static mounts in /etc/fstab, seeing if they're mounted.
+ * Iterating through the static mounts means we automatically ignore
+ * dynamically mounted media. Volumes we didn't know about yet get their
+ * first check at @first_check. */
 static void
-ldsm_mounts_changed (GObject  *monitor,
-                     gpointer  data)
+ldsm_update_mounts (gint64 first_check)
 {
-        GList *mounts;
+        GList *points, *entries, *l;
+        GHashTable *mounted;
+        GHashTable *seen;
+
+        points = g_unix_mount_points_get (time_read);
+        entries = g_unix_mounts_get (time_read);
+
+        /* the mount table is only read once */
+        mounted = g_hash_table_new (g_str_hash, g_str_equal);
+        for (l = entries; l != NULL; l = l->next)
+                g_hash_table_insert (mounted, (gpointer) g_unix_mount_get_mount_path (l->data), l);
+
+        seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+        for (l = points; l != NULL; l = l->next) {
+                GUnixMountPoint *mount_point = l->data;
+                GUnixMountEntry *mount;
+                LdsmMountInfo *mount_info;
+                GList *link;
+                const gchar *path;
+
+                path = g_unix_mount_point_get_mount_path (mount_point);
+                link = g_hash_table_lookup (mounted, path);
+                if (link == NULL || link->data == NULL) {
+                        /* The GUnixMountPoint is not mounted, or was seen already */
+                        continue;
+                }
+                mount = link->data;
+
+                if (g_unix_mount_is_readonly (mount) ||
+                    ldsm_mount_is_user_ignore (path) ||
+                    csd_should_ignore_unix_mount (mount))
+                        continue;
+
+                mount_info = g_hash_table_lookup (ldsm_mounts, path);
+                if (mount_info == NULL) {
+                        mount_info = g_new0 (LdsmMountInfo, 1);
+                        mount_info->path = g_strdup (path);
+                        mount_info->next_check = first_check;
+                        g_hash_table_insert (ldsm_mounts, mount_info->path, mount_info);
+                } else {
+                        g_unix_mount_free (mount_info->mount);
+                }
+                mount_info->mount = mount;
+                link->data = NULL;
+
+                g_hash_table_add (seen, mount_info->path);
+        }
 
         /* remove the saved data for mounts that got removed */
-        mounts = g_unix_mounts_get (time_read);
-        g_hash_table_foreach_remove (ldsm_notified_hash,
-                                     ldsm_is_hash_item_not_in_mounts, mounts);
-        g_list_free_full (mounts, (GDestroyNotify) g_unix_mount_free);
+        g_hash_table_foreach_remove (ldsm_mounts, ldsm_is_mount_not_seen, seen);
+        g_hash_table_foreach_remove (ldsm_notified_hash, ldsm_is_mount_not_seen, ldsm_mounts);
 
-        /* check the status now, for the new mounts */
-        ldsm_check_all_mounts (NULL);
+        g_hash_table_destroy (seen);
+        g_hash_table_destroy (mounted);
 
-        /* and reset the timeout */
-        if (ldsm_timeout_id) {
-            g_source_remove (ldsm_timeout_id);
-            ldsm_timeout_id = 0;
+        for (l = entries; l != NULL; l = l->next) {
+                if (l->data != NULL)
+                        g_unix_mount_free (l->data);
         }
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
+        g_list_free (entries);
+        g_list_free_full (points, (GDestroyNotify) g_unix_mount_point_free);
+}
+
+static void
+ldsm_mounts_changed (GObject  *monitor,
+                     gpointer  data)
+{
+        /* check the new mounts now, the others keep their schedule */
+        ldsm_update_mounts (g_get_monotonic_time ());
+        ldsm_check_all_mounts ();
 }
 
 static gboolean
@@ -755,7 +1101,55 @@ csd_ldsm_update_config (GSettings *settings,
                         const gchar *key,
                         gpointer user_data)
 {
+        GHashTableIter iter;
+        LdsmMountInfo *mount_info;
+        gint64 now;
+
         csd_ldsm_get_config ();
+
+        /* The thresholds moved, so every schedule is off */
+        now = g_get_monotonic_time ();
+        ldsm_update_mounts (now);
+        g_hash_table_iter_init (&iter, ldsm_mounts);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mount_info))
+                mount_info->next_check = now;
+        ldsm_check_all_mounts ();
+}
+
+/* Returns a floating (a(sttub)) with the path, last and worst probe
+ * latency in microseconds, timeouts in a row and whether the mount is
+ * quarantined, for each monitored mount */
+GVariant *
+csd_ldsm_get_probe_stats (void)
+{
+        GVariantBuilder builder;
+        GHashTableIter iter;
+        LdsmMountInfo *mount_info;
+        gint64 now;
+
+        now = g_get_monotonic_time ();
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sttub)"));
+        if (ldsm_mounts != NULL) {
+                g_hash_table_iter_init (&iter, ldsm_mounts);
+                while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mount_info)) {
+                        gint64 latency = mount_info->latency;
+
+                        /* a stuck probe is as slow as it has been so far */
+                        if (mount_info->probe != NULL &&
+                            g_atomic_int_get (&mount_info->probe->started))
+                                latency = MAX (latency, now - mount_info->probe->start_time);
+
+                        g_variant_builder_add (&builder, "(sttub)",
+                                               mount_info->path,
+                                               (guint64) latency,
+                                               (guint64) MAX (latency, mount_info->max_latency),
+                                               mount_info->timeouts,
+                                               ldsm_mount_is_quarantined (mount_info));
+                }
+        }
+
+        return g_variant_new ("(a(sttub))", &builder);
 }
 
 void
@@ -766,9 +1160,16 @@ csd_ldsm_setup (gboolean check_now)
                 return;
         }
 
+        ldsm_mounts = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             NULL,
+                                             ldsm_free_mount_info);
         ldsm_notified_hash = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                     g_free,
-                                                    ldsm_free_mount_info);
+                                                    g_free);
+
+        /* not exclusive, so this can't fail */
+        ldsm_probe_pool = g_thread_pool_new (ldsm_probe_thread, NULL,
+                                             PROBE_THREADS, FALSE, NULL);
 
         settings = g_settings_new (SETTINGS_HOUSEKEEPING_DIR);
         csd_ldsm_get_config ();
@@ -779,12 +1180,16 @@ csd_ldsm_setup (gboolean check_now)
         g_unix_mount_monitor_set_rate_limit (ldsm_monitor, 1000);
         g_signal_connect (ldsm_monitor, "mounts-changed",
                           G_CALLBACK (ldsm_mounts_changed), NULL);
+        g_signal_connect (ldsm_monitor, "mountpoints-changed",
+                          G_CALLBACK (ldsm_mounts_changed), NULL);
 
-        if (check_now)
-                ldsm_check_all_mounts (NULL);
-
-        ldsm_timeout_id = g_timeout_add_seconds (CHECK_EVERY_X_SECONDS,
-                                                 ldsm_check_all_mounts, NULL);
+        if (check_now) {
+                ldsm_update_mounts (g_get_monotonic_time ());
+                ldsm_check_all_mounts ();
+        } else {
+                ldsm_update_mounts (g_get_monotonic_time () + CHECK_EVERY_X_SECONDS * G_USEC_PER_SEC);
+                ldsm_schedule_check ();
+        }
 }
 
 void
@@ -799,6 +1204,18 @@ csd_ldsm_clean (void)
                 g_hash_table_destroy (ldsm_notified_hash);
         ldsm_notified_hash = NULL;
 
+        if (ldsm_mounts)
+                g_hash_table_destroy (ldsm_mounts);
+        ldsm_mounts = NULL;
+
+        /* Don't wait for the workers, they might never come back; their
+         * answers are dropped once they do. Queued probes still run, as
+         * only the worker drops their second reference. */
+        if (ldsm_probe_pool)
+                g_thread_pool_free (ldsm_probe_pool, FALSE, FALSE);
+        ldsm_probe_pool = NULL;
+        ldsm_new_samples = FALSE;
+
         if (ldsm_monitor)
                 g_object_unref (ldsm_monitor);
         ldsm_monitor = NULL;
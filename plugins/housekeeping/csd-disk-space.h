@@ -31,6 +31,8 @@ G_BEGIN_DECLS
 void csd_ldsm_setup (gboolean check_now);
 void csd_ldsm_clean (void);
 
+GVariant *csd_ldsm_get_probe_stats (void);
+
 /* for the test */
 void csd_ldsm_show_empty_trash (void);
 
@@ -20,12 +20,11 @@
 #include "config.h"
 
 #include <gio/gio.h>
-#include <glib/gstdio.h>
-#include <string.h>
 
 #include "cinnamon-settings-profile.h"
 #include "csd-housekeeping-manager.h"
 #include "csd-disk-space.h"
+#include "csd-thumbnail-cache.h"
 
 
 /* General */
@@ -38,10 +37,49 @@
 #define THUMB_AGE_KEY "maximum-age"
 #define THUMB_SIZE_KEY "maximum-size"
 
+#define CSD_DBUS_PATH "/org/cinnamon/SettingsDaemon"
+#define CSD_HOUSEKEEPING_DBUS_PATH CSD_DBUS_PATH "/Housekeeping"
+
+static const gchar introspection_xml[] =
+"<node>"
+"  <interface name='org.cinnamon.SettingsDaemon.Housekeeping'>"
+"    <method name='GetThumbnailCacheStats'>"
+"      <arg name='ready' direction='out' type='b'/>"
+"      <arg name='count' direction='out' type='t'/>"
+"      <arg name='size' direction='out' type='t'/>"
+"      <arg name='ages' direction='out' type='a(ttt)'/>"
+"    </method>"
+"    <method name='CompactThumbnailCache'>"
+"      <arg name='reclaimed' direction='out' type='t'/>"
+"      <arg name='migrated' direction='out' type='u'/>"
+"      <arg name='dropped' direction='out' type='u'/>"
+"      <arg name='linked' direction='out' type='u'/>"
+"    </method>"
+"    <method name='GetDiskSpaceProbes'>"
+"      <arg name='probes' direction='out' type='a(sttub)'/>"
+"    </method>"
+"  </interface>"
+"</node>";
+
 struct CsdHousekeepingManagerPrivate {
         GSettings *settings;
         guint long_term_cb;
         guint short_term_cb;
+        GCancellable *purge_cancellable;
+        CsdThumbnailIndex *thumb_index;
+
+        /* compaction runs first in each clean-up */
+        gboolean compacting;
+        gboolean compact_dedup;
+        CsdThumbnailCompactStats compact_stats;
+        GList *compact_invocations;
+        /* asked for while a clean-up without dedup was running */
+        GList *queued_invocations;
+
+        GDBusNodeInfo *introspection_data;
+        GDBusConnection *connection;
+        GCancellable *bus_cancellable;
+        guint registration_id;
 };
 
 
@@ -55,197 +93,121 @@ G_DEFINE_TYPE (CsdHousekeepingManager, csd_housekeeping_manager, G_TYPE_OBJECT)
 static gpointer manager_object = NULL;
 
 
-typedef struct {
-        glong now;
-        glong max_age;
-        goffset total_size;
-        goffset max_size;
-} PurgeData;
-
-
-typedef struct {
-        time_t  mtime;
-        char   *path;
-        glong   size;
-} ThumbData;
-
+static void purge_thumbnail_cache (CsdHousekeepingManager *manager,
+                                   gboolean                dedup);
 
 static void
-thumb_data_free (gpointer data)
+purge_thumbnail_cache_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
 {
-        ThumbData *info = data;
+        CsdHousekeepingManager *manager = user_data;
+        CsdHousekeepingManagerPrivate *p = manager->priv;
+        GError *error = NULL;
 
-        if (info) {
-                g_free (info->path);
-                g_free (info);
-        }
-}
+        if (!csd_thumbnail_cache_purge_finish (res, &error)) {
+                /* stopped, and no longer ours to clear */
+                g_error_free (error);
+        } else {
+                g_clear_object (&p->purge_cancellable);
 
-static GList *
-read_dir_for_purge (const char *path, GList *files)
-{
-        GFile           *read_path;
-        GFileEnumerator *enum_dir;
-
-        read_path = g_file_new_for_path (path);
-        enum_dir = g_file_enumerate_children (read_path,
-                                              G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                              G_FILE_ATTRIBUTE_TIME_MODIFIED ","
-                                              G_FILE_ATTRIBUTE_STANDARD_SIZE,
-                                              G_FILE_QUERY_INFO_NONE,
-                                              NULL,
-                                              NULL);
-
-        if (enum_dir != NULL) {
-                GFileInfo *info;
-                while ((info = g_file_enumerator_next_file (enum_dir, NULL, NULL)) != NULL) {
-                        const char *name;
-                        name = g_file_info_get_name (info);
-
-                        if (strlen (name) == 36 && strcmp (name + 32, ".png") == 0) {
-                                ThumbData *td;
-                                GFile     *entry;
-                                char      *entry_path;
-                                GTimeVal   mod_time;
-
-                                entry = g_file_get_child (read_path, name);
-                                entry_path = g_file_get_path (entry);
-                                g_object_unref (entry);
-
-                                g_file_info_get_modification_time (info, &mod_time);
-
-                                td = g_new0 (ThumbData, 1);
-                                td->path = entry_path;
-                                td->mtime = mod_time.tv_sec;
-                                td->size = g_file_info_get_size (info);
-
-                                files = g_list_prepend (files, td);
-                        }
-                        g_object_unref (info);
+                /* the compaction that was asked for meanwhile */
+                if (p->queued_invocations != NULL) {
+                        p->compact_invocations = p->queued_invocations;
+                        p->queued_invocations = NULL;
+                        purge_thumbnail_cache (manager, TRUE);
                 }
-                g_object_unref (enum_dir);
         }
-        g_object_unref (read_path);
 
-        return files;
+        g_object_unref (manager);
 }
 
 static void
-purge_old_thumbnails (ThumbData *info, PurgeData *purge_data)
+get_thumbnail_limits (CsdHousekeepingManager *manager,
+                      gint64                 *max_age,
+                      goffset                *max_size)
 {
-        if ((purge_data->now - info->mtime) > purge_data->max_age) {
-                g_unlink (info->path);
-                info->size = 0;
-        } else {
-                purge_data->total_size += info->size;
-        }
+        *max_age = (gint64) g_settings_get_int (manager->priv->settings, THUMB_AGE_KEY) * 24 * 60 * 60;
+        *max_size = (goffset) g_settings_get_int (manager->priv->settings, THUMB_SIZE_KEY) * 1024 * 1024;
 }
 
-static int
-sort_file_mtime (ThumbData *file1, ThumbData *file2)
+static GVariant *
+compact_stats_to_variant (const CsdThumbnailCompactStats *stats)
 {
-        return file1->mtime - file2->mtime;
+        return g_variant_new ("(tuuu)", stats->reclaimed, stats->migrated,
+                              stats->dropped, stats->linked);
 }
 
-static char **
-get_thumbnail_dirs (void)
+static void
+compact_thumbnail_cache_cb (GObject      *source_object,
+                            GAsyncResult *res,
+                            gpointer      user_data)
 {
-        GPtrArray *array;
-        char *path;
-
-        array = g_ptr_array_new ();
-
-        /* check new XDG cache */
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "normal",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "large",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_user_cache_dir (),
-                                 "thumbnails",
-                                 "fail",
-                                 "gnome-thumbnail-factory",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        /* cleanup obsolete locations too */
-        path = g_build_filename (g_get_home_dir (),
-                                 ".thumbnails",
-                                 "normal",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_home_dir (),
-                                 ".thumbnails",
-                                 "large",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        path = g_build_filename (g_get_home_dir (),
-                                 ".thumbnails",
-                                 "fail",
-                                 "gnome-thumbnail-factory",
-                                 NULL);
-        g_ptr_array_add (array, path);
-
-        g_ptr_array_add (array, NULL);
-
-        return (char **) g_ptr_array_free (array, FALSE);
+        CsdHousekeepingManager *manager = user_data;
+        CsdHousekeepingManagerPrivate *p;
+        CsdThumbnailCompactStats stats;
+        GError *error = NULL;
+        GList *l;
+        gint64  max_age;
+        goffset max_size;
+
+        if (!csd_thumbnail_cache_compact_finish (res, &stats, &error)) {
+                /* stopped, and no longer ours to clear */
+                g_error_free (error);
+                g_object_unref (manager);
+                return;
+        }
+
+        p = manager->priv;
+        p->compact_stats = stats;
+        p->compacting = FALSE;
+
+        for (l = p->compact_invocations; l != NULL; l = l->next)
+                g_dbus_method_invocation_return_value (l->data,
+                                                       compact_stats_to_variant (&p->compact_stats));
+        g_list_free (p->compact_invocations);
+        p->compact_invocations = NULL;
+
+        /* Then enforce the limits on what is left, with the same reference */
+        get_thumbnail_limits (manager, &max_age, &max_size);
+        csd_thumbnail_index_purge_async (p->thumb_index,
+                                         max_age, max_size,
+                                         p->purge_cancellable,
+                                         purge_thumbnail_cache_cb,
+                                         manager);
 }
 
+/* Duplicates are only linked when asked for over D-Bus, finding them
+ * means reading the cache */
 static void
-purge_thumbnail_cache (CsdHousekeepingManager *manager)
+purge_thumbnail_cache (CsdHousekeepingManager *manager,
+                       gboolean                dedup)
 {
+        gint64  max_age;
+        goffset max_size;
 
-        char     **paths;
-        GList     *files;
-        PurgeData  purge_data;
-        GTimeVal   current_time;
-        guint      i;
+        if (manager->priv->purge_cancellable != NULL) {
+                g_debug ("housekeeping: thumbnail cache is already being checked");
+                return;
+        }
 
         g_debug ("housekeeping: checking thumbnail cache size and freshness");
 
-        paths = get_thumbnail_dirs ();
-        files = NULL;
-        for (i = 0; paths[i] != NULL; i++)
-                files = read_dir_for_purge (paths[i], files);
-        g_strfreev (paths);
-
-        g_get_current_time (&current_time);
-
-        purge_data.now = current_time.tv_sec;
-        purge_data.max_age = g_settings_get_int (manager->priv->settings, THUMB_AGE_KEY) * 24 * 60 * 60;
-        purge_data.max_size = g_settings_get_int (manager->priv->settings, THUMB_SIZE_KEY) * 1024 * 1024;
-        purge_data.total_size = 0;
-
-        if (purge_data.max_age >= 0)
-                g_list_foreach (files, (GFunc) purge_old_thumbnails, &purge_data);
-
-        if ((purge_data.total_size > purge_data.max_size) && (purge_data.max_size >= 0)) {
-                GList *scan;
-                files = g_list_sort (files, (GCompareFunc) sort_file_mtime);
-                for (scan = files; scan && (purge_data.total_size > purge_data.max_size); scan = scan->next) {
-                        ThumbData *info = scan->data;
-                        g_unlink (info->path);
-                        purge_data.total_size -= info->size;
-                }
-        }
-
-        g_list_foreach (files, (GFunc) thumb_data_free, NULL);
-        g_list_free (files);
+        get_thumbnail_limits (manager, &max_age, &max_size);
+        manager->priv->purge_cancellable = g_cancellable_new ();
+        manager->priv->compacting = TRUE;
+        manager->priv->compact_dedup = dedup;
+        csd_thumbnail_cache_compact_async (max_age,
+                                           dedup,
+                                           manager->priv->purge_cancellable,
+                                           compact_thumbnail_cache_cb,
+                                           g_object_ref (manager));
 }
 
 static gboolean
 do_cleanup (CsdHousekeepingManager *manager)
 {
-        purge_thumbnail_cache (manager);
+        purge_thumbnail_cache (manager, FALSE);
         return TRUE;
 }
 
@@ -276,6 +238,93 @@ settings_changed_callback (GSettings              *settings,
         do_cleanup_soon (manager);
 }
 
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        CsdHousekeepingManager *manager = CSD_HOUSEKEEPING_MANAGER (user_data);
+
+        if (manager->priv->thumb_index == NULL) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.DBus.Error.Failed",
+                                                            "The housekeeping plugin is not running");
+                return;
+        }
+
+        g_debug ("Calling method '%s.%s' for Housekeeping",
+                 interface_name, method_name);
+
+        if (g_strcmp0 (method_name, "GetThumbnailCacheStats") == 0) {
+                /* Straight from the index, the cache itself isn't touched */
+                g_dbus_method_invocation_return_value (invocation,
+                                                       csd_thumbnail_index_get_stats (manager->priv->thumb_index));
+        } else if (g_strcmp0 (method_name, "CompactThumbnailCache") == 0) {
+                CsdHousekeepingManagerPrivate *p = manager->priv;
+
+                if (p->purge_cancellable != NULL && !p->compact_dedup) {
+                        /* the daily clean-up doesn't link duplicates,
+                         * a full pass follows it */
+                        p->queued_invocations = g_list_prepend (p->queued_invocations,
+                                                                invocation);
+                        return;
+                }
+
+                if (p->purge_cancellable != NULL && !p->compacting) {
+                        /* compacted just now, only purging left */
+                        g_dbus_method_invocation_return_value (invocation,
+                                                               compact_stats_to_variant (&p->compact_stats));
+                        return;
+                }
+
+                /* Replied to once the compaction is done */
+                p->compact_invocations = g_list_prepend (p->compact_invocations,
+                                                         invocation);
+                purge_thumbnail_cache (manager, TRUE);
+        } else if (g_strcmp0 (method_name, "GetDiskSpaceProbes") == 0) {
+                g_dbus_method_invocation_return_value (invocation,
+                                                       csd_ldsm_get_probe_stats ());
+        }
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+        handle_method_call,
+        NULL, /* GetProperty */
+        NULL, /* SetProperty */
+};
+
+static void
+on_bus_gotten (GObject                *source_object,
+               GAsyncResult           *res,
+               CsdHousekeepingManager *manager)
+{
+        GDBusConnection *connection;
+        GError *error = NULL;
+
+        connection = g_bus_get_finish (res, &error);
+        if (connection == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Could not get session bus: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+        manager->priv->connection = connection;
+
+        manager->priv->registration_id = g_dbus_connection_register_object (connection,
+                                                                            CSD_HOUSEKEEPING_DBUS_PATH,
+                                                                            manager->priv->introspection_data->interfaces[0],
+                                                                            &interface_vtable,
+                                                                            manager,
+                                                                            NULL,
+                                                                            NULL);
+}
+
 gboolean
 csd_housekeeping_manager_start (CsdHousekeepingManager *manager,
                                 GError                **error)
@@ -289,6 +338,16 @@ csd_housekeeping_manager_start (CsdHousekeepingManager *manager,
         g_signal_connect (G_OBJECT (manager->priv->settings), "changed",
                           G_CALLBACK (settings_changed_callback), manager);
 
+        manager->priv->thumb_index = csd_thumbnail_index_new ();
+
+        manager->priv->introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+        g_assert (manager->priv->introspection_data != NULL);
+        manager->priv->bus_cancellable = g_cancellable_new ();
+        g_bus_get (G_BUS_TYPE_SESSION,
+                   manager->priv->bus_cancellable,
+                   (GAsyncReadyCallback) on_bus_gotten,
+                   manager);
+
         /* Clean once, a few minutes after start-up */
         do_cleanup_soon (manager);
 
@@ -306,29 +365,81 @@ void
 csd_housekeeping_manager_stop (CsdHousekeepingManager *manager)
 {
         CsdHousekeepingManagerPrivate *p = manager->priv;
+        GList *l;
 
         g_debug ("Stopping housekeeping manager");
 
+        if (p->bus_cancellable != NULL) {
+                g_cancellable_cancel (p->bus_cancellable);
+                g_object_unref (p->bus_cancellable);
+                p->bus_cancellable = NULL;
+        }
+
+        if (p->connection != NULL) {
+                if (p->registration_id != 0) {
+                        g_dbus_connection_unregister_object (p->connection, p->registration_id);
+                        p->registration_id = 0;
+                }
+                g_object_unref (p->connection);
+                p->connection = NULL;
+        }
+
+        if (p->introspection_data != NULL) {
+                g_dbus_node_info_unref (p->introspection_data);
+                p->introspection_data = NULL;
+        }
+
         if (p->short_term_cb) {
                 g_source_remove (p->short_term_cb);
                 p->short_term_cb = 0;
         }
 
+        if (p->purge_cancellable != NULL) {
+                g_cancellable_cancel (p->purge_cancellable);
+                g_object_unref (p->purge_cancellable);
+                p->purge_cancellable = NULL;
+        }
+        p->compacting = FALSE;
+
+        for (l = p->compact_invocations; l != NULL; l = l->next)
+                g_dbus_method_invocation_return_dbus_error (l->data,
+                                                            "org.freedesktop.DBus.Error.Failed",
+                                                            "The housekeeping plugin was stopped");
+        g_list_free (p->compact_invocations);
+        p->compact_invocations = NULL;
+
+        for (l = p->queued_invocations; l != NULL; l = l->next)
+                g_dbus_method_invocation_return_dbus_error (l->data,
+                                                            "org.freedesktop.DBus.Error.Failed",
+                                                            "The housekeeping plugin was stopped");
+        g_list_free (p->queued_invocations);
+        p->queued_invocations = NULL;
+
         if (p->long_term_cb) {
                 g_source_remove (p->long_term_cb);
                 p->long_term_cb = 0;
 
                 /* Do a clean-up on shutdown if and only if the size or age
-                   limits have been set to paranoid levels (zero) */
+                   limits have been set to paranoid levels (zero). We are
+                   going away, so this one can't be left to a thread. */
                 if ((g_settings_get_int (p->settings, THUMB_AGE_KEY) == 0) ||
                     (g_settings_get_int (p->settings, THUMB_SIZE_KEY) == 0)) {
-                        do_cleanup (manager);
+                        gint64  max_age;
+                        goffset max_size;
+
+                        get_thumbnail_limits (manager, &max_age, &max_size);
+                        csd_thumbnail_cache_purge (max_age, max_size, NULL, NULL);
                 }
 
                 g_object_unref (p->settings);
                 p->settings = NULL;
         }
 
+        if (p->thumb_index != NULL) {
+                csd_thumbnail_index_free (p->thumb_index);
+                p->thumb_index = NULL;
+        }
+
         csd_ldsm_clean ();
 }
 
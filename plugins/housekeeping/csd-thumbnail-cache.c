@@ -0,0 +1,1719 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "csd-thumbnail-cache.h"
+
+/* Thumbnails are named after the MD5 of their URI */
+#define THUMB_NAME_LEN 36
+
+/* How many of the oldest thumbnails are remembered as candidates for
+ * the size limit. If that isn't enough to get under the limit, the
+ * cache is scanned again for the next oldest ones. */
+#define PURGE_CANDIDATES 4096
+
+/* How many thumbnails are deleted before giving the disk a break and
+ * checking whether we should stop */
+#define PURGE_BATCH_SIZE 256
+
+typedef struct {
+        gint64  mtime;
+        goffset size;
+        guint   dir;
+        char    name[THUMB_NAME_LEN + 1];
+} ThumbEntry;
+
+typedef struct {
+        char         **paths;
+        int           *fds;
+        guint          n_dirs;
+
+        gint64         now;
+        gint64         max_age;
+        goffset        max_size;
+        goffset        total_size;
+
+        /* max-heap on mtime, so the newest of the oldest is on top */
+        ThumbEntry    *candidates;
+        guint          n_candidates;
+
+        /* see csd_thumbnail_index_purge_async() */
+        CsdThumbnailIndex *thumb_index; /* NULL once it's gone */
+        GArray        *snapshot;    /* IndexEntry, copied from the index */
+        GArray        *victims;     /* ThumbEntry, picked from the snapshot */
+        GArray        *deleted;     /* ThumbEntry, what actually went */
+
+        ThumbEntry     batch[PURGE_BATCH_SIZE];
+        guint          batch_len;
+        guint          n_deleted;
+
+        GCancellable  *cancellable;
+} PurgeJob;
+
+static char **
+get_thumbnail_dirs (void)
+{
+        GPtrArray *array;
+        char *path;
+
+        array = g_ptr_array_new ();
+
+        /* check new XDG cache */
+        path = g_build_filename (g_get_user_cache_dir (),
+                                 "thumbnails",
+                                 "normal",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_user_cache_dir (),
+                                 "thumbnails",
+                                 "large",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_user_cache_dir (),
+                                 "thumbnails",
+                                 "fail",
+                                 "gnome-thumbnail-factory",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        /* cleanup obsolete locations too */
+        path = g_build_filename (g_get_home_dir (),
+                                 ".thumbnails",
+                                 "normal",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_home_dir (),
+                                 ".thumbnails",
+                                 "large",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        path = g_build_filename (g_get_home_dir (),
+                                 ".thumbnails",
+                                 "fail",
+                                 "gnome-thumbnail-factory",
+                                 NULL);
+        g_ptr_array_add (array, path);
+
+        g_ptr_array_add (array, NULL);
+
+        return (char **) g_ptr_array_free (array, FALSE);
+}
+
+static gboolean
+is_thumbnail_name (const char *name)
+{
+        return strlen (name) == THUMB_NAME_LEN &&
+               strcmp (name + THUMB_NAME_LEN - 4, ".png") == 0;
+}
+
+/* Hard links made by compaction share their size between their names,
+ * so that the cache adds up to what it takes on disk */
+static goffset
+thumbnail_size (const struct stat *st)
+{
+        return st->st_size / MAX (st->st_nlink, 1);
+}
+
+static void
+candidates_sift_down (PurgeJob *job,
+                      guint     i)
+{
+        ThumbEntry *heap = job->candidates;
+
+        for (;;) {
+                guint largest = i;
+                guint l = 2 * i + 1;
+                guint r = l + 1;
+                ThumbEntry tmp;
+
+                if (l < job->n_candidates && heap[l].mtime > heap[largest].mtime)
+                        largest = l;
+                if (r < job->n_candidates && heap[r].mtime > heap[largest].mtime)
+                        largest = r;
+                if (largest == i)
+                        return;
+
+                tmp = heap[i];
+                heap[i] = heap[largest];
+                heap[largest] = tmp;
+                i = largest;
+        }
+}
+
+/* Keeps the PURGE_CANDIDATES oldest thumbnails seen so far */
+static void
+candidates_add (PurgeJob         *job,
+                const ThumbEntry *entry)
+{
+        ThumbEntry *heap = job->candidates;
+        guint i;
+
+        if (job->n_candidates == PURGE_CANDIDATES) {
+                if (entry->mtime >= heap[0].mtime)
+                        return;
+                heap[0] = *entry;
+                candidates_sift_down (job, 0);
+                return;
+        }
+
+        i = job->n_candidates++;
+        heap[i] = *entry;
+        while (i > 0 && heap[(i - 1) / 2].mtime < heap[i].mtime) {
+                ThumbEntry tmp = heap[i];
+
+                heap[i] = heap[(i - 1) / 2];
+                heap[(i - 1) / 2] = tmp;
+                i = (i - 1) / 2;
+        }
+}
+
+static int
+compare_mtime (gconstpointer a,
+               gconstpointer b)
+{
+        const ThumbEntry *entry_a = a;
+        const ThumbEntry *entry_b = b;
+
+        if (entry_a->mtime < entry_b->mtime)
+                return -1;
+        return entry_a->mtime > entry_b->mtime;
+}
+
+static gboolean
+flush_batch (PurgeJob *job)
+{
+        guint i;
+
+        for (i = 0; i < job->batch_len; i++) {
+                const ThumbEntry *entry = &job->batch[i];
+
+                if (unlinkat (job->fds[entry->dir], entry->name, 0) == 0) {
+                        job->n_deleted++;
+                        if (job->deleted != NULL)
+                                g_array_append_val (job->deleted, *entry);
+                }
+        }
+        job->batch_len = 0;
+
+        g_thread_yield ();
+
+        return !g_cancellable_is_cancelled (job->cancellable);
+}
+
+static gboolean
+delete_thumbnail (PurgeJob         *job,
+                  const ThumbEntry *entry)
+{
+        job->batch[job->batch_len++] = *entry;
+        if (job->batch_len < PURGE_BATCH_SIZE)
+                return TRUE;
+        return flush_batch (job);
+}
+
+/* Deletes what is too old right away, and remembers the rest for the
+ * size limit. readdir() hands out entries from one large getdents()
+ * buffer, and nothing but the candidates is kept around. */
+static gboolean
+scan_dir (PurgeJob *job,
+          guint     dir)
+{
+        struct dirent *dent;
+        DIR *d;
+        int fd;
+
+        fd = dup (job->fds[dir]);
+        if (fd < 0)
+                return TRUE;
+        d = fdopendir (fd);
+        if (d == NULL) {
+                close (fd);
+                return TRUE;
+        }
+
+        while ((dent = readdir (d)) != NULL) {
+                ThumbEntry entry;
+                struct stat st;
+
+                if (dent->d_type != DT_REG && dent->d_type != DT_UNKNOWN)
+                        continue;
+                if (!is_thumbnail_name (dent->d_name))
+                        continue;
+                if (fstatat (job->fds[dir], dent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+                    !S_ISREG (st.st_mode))
+                        continue;
+
+                entry.mtime = st.st_mtime;
+                entry.size = thumbnail_size (&st);
+                entry.dir = dir;
+                memcpy (entry.name, dent->d_name, THUMB_NAME_LEN + 1);
+
+                if (job->max_age >= 0 && job->now - entry.mtime > job->max_age) {
+                        if (!delete_thumbnail (job, &entry)) {
+                                closedir (d);
+                                return FALSE;
+                        }
+                        continue;
+                }
+
+                job->total_size += entry.size;
+                if (job->max_size >= 0)
+                        candidates_add (job, &entry);
+        }
+
+        closedir (d);
+
+        return TRUE;
+}
+
+static void
+close_dirs (PurgeJob *job)
+{
+        guint i;
+
+        for (i = 0; i < job->n_dirs; i++) {
+                if (job->fds[i] >= 0)
+                        close (job->fds[i]);
+                job->fds[i] = -1;
+        }
+}
+
+/* One pass over the whole cache. Returns TRUE if another one is
+ * needed to get under the size limit. */
+static gboolean
+purge_pass (PurgeJob *job)
+{
+        guint n_deleted = job->n_deleted;
+        guint i;
+
+        job->total_size = 0;
+        job->n_candidates = 0;
+
+        for (i = 0; i < job->n_dirs; i++)
+                job->fds[i] = open (job->paths[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        for (i = 0; i < job->n_dirs; i++) {
+                if (job->fds[i] >= 0 && !scan_dir (job, i))
+                        goto out;
+        }
+        if (!flush_batch (job))
+                goto out;
+
+        if (job->max_size < 0 || job->total_size <= job->max_size)
+                goto out;
+
+        g_debug ("housekeeping: thumbnail cache is %" G_GOFFSET_FORMAT " bytes, "
+                 "limit is %" G_GOFFSET_FORMAT, job->total_size, job->max_size);
+
+        qsort (job->candidates, job->n_candidates, sizeof (ThumbEntry), compare_mtime);
+        for (i = 0; i < job->n_candidates && job->total_size > job->max_size; i++) {
+                if (!delete_thumbnail (job, &job->candidates[i]))
+                        goto out;
+                job->total_size -= job->candidates[i].size;
+        }
+        flush_batch (job);
+
+out:
+        close_dirs (job);
+
+        /* Only worth another look if every candidate went, and this
+         * pass got anywhere; with a read-only cache the same candidates
+         * would be found again forever */
+        return !g_cancellable_is_cancelled (job->cancellable) &&
+               job->max_size >= 0 &&
+               job->total_size > job->max_size &&
+               job->n_candidates == PURGE_CANDIDATES &&
+               job->n_deleted > n_deleted;
+}
+
+static PurgeJob *
+purge_job_new (gint64  max_age,
+               goffset max_size)
+{
+        PurgeJob *job;
+
+        job = g_new0 (PurgeJob, 1);
+        job->paths = get_thumbnail_dirs ();
+        job->n_dirs = g_strv_length (job->paths);
+        job->fds = g_new (int, job->n_dirs);
+        job->now = g_get_real_time () / G_USEC_PER_SEC;
+        job->max_age = max_age;
+        job->max_size = max_size;
+
+        return job;
+}
+
+static void
+purge_job_free (PurgeJob *job)
+{
+        if (job->snapshot != NULL)
+                g_array_free (job->snapshot, TRUE);
+        if (job->victims != NULL)
+                g_array_free (job->victims, TRUE);
+        if (job->deleted != NULL)
+                g_array_free (job->deleted, TRUE);
+        g_free (job->candidates);
+        g_free (job->fds);
+        g_strfreev (job->paths);
+        g_free (job);
+}
+
+gboolean
+csd_thumbnail_cache_purge (gint64         max_age,
+                           goffset        max_size,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+        PurgeJob *job;
+        gboolean ret;
+
+        job = purge_job_new (max_age, max_size);
+        job->candidates = g_new (ThumbEntry, PURGE_CANDIDATES);
+        job->cancellable = cancellable;
+
+        while (purge_pass (job))
+                ;
+
+        g_debug ("housekeeping: deleted %u thumbnails", job->n_deleted);
+
+        ret = !g_cancellable_set_error_if_cancelled (cancellable, error);
+        purge_job_free (job);
+
+        return ret;
+}
+
+typedef struct {
+        gint64  max_age;
+        goffset max_size;
+} PurgeParams;
+
+static void
+purge_thread (GTask        *task,
+              gpointer      source_object,
+              gpointer      task_data,
+              GCancellable *cancellable)
+{
+        PurgeParams *params = task_data;
+        GError *error = NULL;
+
+        if (csd_thumbnail_cache_purge (params->max_age, params->max_size,
+                                       cancellable, &error))
+                g_task_return_boolean (task, TRUE);
+        else
+                g_task_return_error (task, error);
+}
+
+/* Same as csd_thumbnail_cache_purge(), in a worker thread */
+void
+csd_thumbnail_cache_purge_async (gint64               max_age,
+                                 goffset              max_size,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+        PurgeParams *params;
+        GTask *task;
+
+        params = g_new (PurgeParams, 1);
+        params->max_age = max_age;
+        params->max_size = max_size;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_task_data (task, params, g_free);
+        g_task_run_in_thread (task, purge_thread);
+        g_object_unref (task);
+}
+
+gboolean
+csd_thumbnail_cache_purge_finish (GAsyncResult  *result,
+                                  GError       **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* The index keeps the size and mtime of every thumbnail in memory, and
+ * directory monitors keep it up to date, so the size of the cache is
+ * known without looking at it and a purge only touches what it deletes.
+ * It is saved along with the mtime of each directory, and on the next
+ * start only the directories that changed since then are read again. */
+
+#define INDEX_MAGIC "CSDTHMB1"
+#define INDEX_MAGIC_LEN 8
+
+#define INDEX_SAVE_DELAY 60 /* seconds */
+
+/* A directory that changed this recently might still have monitor
+ * events on the way, so it isn't trusted on the next start */
+#define INDEX_SETTLE_TIME 5 /* seconds */
+
+#define SECONDS_PER_DAY (24 * 60 * 60)
+
+typedef struct {
+        guint8  hash[16];
+        guint8  dir;
+        guint8  padding[3];
+        guint32 size;
+        gint64  mtime;
+} IndexEntry;
+
+G_STATIC_ASSERT (sizeof (IndexEntry) == 32);
+
+struct _CsdThumbnailIndex {
+        char         **paths;
+        guint          n_dirs;
+        GFileMonitor **monitors;
+
+        GHashTable    *entries;     /* set of IndexEntry, NULL until loaded */
+        goffset        total_size;
+        GArray        *pending;     /* ThumbEntry, changes seen while loading */
+        GCancellable  *cancellable;
+
+        guint          save_id;
+        gboolean       dirty;
+
+        GSList        *purges;      /* PurgeJob in flight */
+};
+
+typedef struct {
+        char       **paths;
+        guint        n_dirs;
+        GHashTable  *entries;
+        goffset      total_size;
+} LoadJob;
+
+typedef struct {
+        GByteArray *data;
+        guint64     serial;
+} SaveJob;
+
+static GMutex  save_lock;
+static guint64 save_serial = 0;
+static guint64 saved_serial = 0;
+
+static guint
+index_entry_hash (gconstpointer key)
+{
+        const IndexEntry *entry = key;
+        guint32 hash;
+
+        memcpy (&hash, entry->hash, sizeof (hash));
+        return hash ^ entry->dir;
+}
+
+static gboolean
+index_entry_equal (gconstpointer a,
+                   gconstpointer b)
+{
+        const IndexEntry *entry_a = a;
+        const IndexEntry *entry_b = b;
+
+        return entry_a->dir == entry_b->dir &&
+               memcmp (entry_a->hash, entry_b->hash, sizeof (entry_a->hash)) == 0;
+}
+
+static GHashTable *
+index_entries_new (void)
+{
+        return g_hash_table_new_full (index_entry_hash, index_entry_equal, g_free, NULL);
+}
+
+static gboolean
+parse_thumbnail_name (const char *name,
+                      guint8      hash[16])
+{
+        guint i;
+
+        if (!is_thumbnail_name (name))
+                return FALSE;
+
+        for (i = 0; i < 16; i++) {
+                int hi = g_ascii_xdigit_value (name[2 * i]);
+                int lo = g_ascii_xdigit_value (name[2 * i + 1]);
+
+                if (hi < 0 || lo < 0)
+                        return FALSE;
+                hash[i] = (hi << 4) | lo;
+        }
+
+        return TRUE;
+}
+
+static void
+format_thumbnail_name (const guint8 hash[16],
+                       char         name[THUMB_NAME_LEN + 1])
+{
+        static const char digits[] = "0123456789abcdef";
+        guint i;
+
+        for (i = 0; i < 16; i++) {
+                name[2 * i] = digits[hash[i] >> 4];
+                name[2 * i + 1] = digits[hash[i] & 0xf];
+        }
+        strcpy (name + 32, ".png");
+}
+
+static char *
+get_index_filename (void)
+{
+        return g_build_filename (g_get_user_cache_dir (),
+                                 "cinnamon-settings-daemon",
+                                 "thumbnail-index",
+                                 NULL);
+}
+
+static gint64
+get_dir_mtime (const char *path)
+{
+        struct stat st;
+
+        if (stat (path, &st) < 0)
+                return -1;
+        return (gint64) st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_mtim.tv_nsec;
+}
+
+static void
+load_job_free (LoadJob *job)
+{
+        if (job->entries != NULL)
+                g_hash_table_destroy (job->entries);
+        g_strfreev (job->paths);
+        g_free (job);
+}
+
+static void
+load_job_add (LoadJob          *job,
+              const IndexEntry *entry)
+{
+        g_hash_table_add (job->entries, g_memdup (entry, sizeof (IndexEntry)));
+        job->total_size += entry->size;
+}
+
+static void
+load_job_scan_dir (LoadJob *job,
+                   guint    dir)
+{
+        struct dirent *dent;
+        DIR *d;
+        int fd;
+
+        fd = open (job->paths[dir], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+                return;
+        d = fdopendir (fd);
+        if (d == NULL) {
+                close (fd);
+                return;
+        }
+
+        while ((dent = readdir (d)) != NULL) {
+                IndexEntry entry;
+                struct stat st;
+
+                if (dent->d_type != DT_REG && dent->d_type != DT_UNKNOWN)
+                        continue;
+                if (!parse_thumbnail_name (dent->d_name, entry.hash))
+                        continue;
+                if (fstatat (fd, dent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+                    !S_ISREG (st.st_mode))
+                        continue;
+
+                entry.dir = dir;
+                memset (entry.padding, 0, sizeof (entry.padding));
+                entry.size = MIN (thumbnail_size (&st), G_MAXUINT32);
+                entry.mtime = st.st_mtime;
+                load_job_add (job, &entry);
+        }
+
+        closedir (d);
+}
+
+static void
+load_thread (GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data,
+             GCancellable *cancellable)
+{
+        LoadJob *job = task_data;
+        gboolean *trusted;
+        char *filename;
+        char *contents = NULL;
+        gsize length = 0;
+        gsize header_len;
+        guint i;
+
+        job->entries = index_entries_new ();
+        trusted = g_new0 (gboolean, job->n_dirs);
+
+        filename = get_index_filename ();
+        header_len = INDEX_MAGIC_LEN + sizeof (guint32) + job->n_dirs * sizeof (gint64);
+
+        if (g_file_get_contents (filename, &contents, &length, NULL) &&
+            length >= header_len &&
+            (length - header_len) % sizeof (IndexEntry) == 0 &&
+            memcmp (contents, INDEX_MAGIC, INDEX_MAGIC_LEN) == 0 &&
+            *(guint32 *) (contents + INDEX_MAGIC_LEN) == job->n_dirs) {
+                const char *p = contents + INDEX_MAGIC_LEN + sizeof (guint32);
+
+                for (i = 0; i < job->n_dirs; i++) {
+                        gint64 mtime;
+
+                        memcpy (&mtime, p + i * sizeof (gint64), sizeof (gint64));
+                        trusted[i] = (mtime != 0 && mtime == get_dir_mtime (job->paths[i]));
+                }
+
+                for (p = contents + header_len; p < contents + length; p += sizeof (IndexEntry)) {
+                        IndexEntry entry;
+
+                        memcpy (&entry, p, sizeof (IndexEntry));
+                        if (entry.dir < job->n_dirs && trusted[entry.dir])
+                                load_job_add (job, &entry);
+                }
+        }
+        g_free (contents);
+        g_free (filename);
+
+        for (i = 0; i < job->n_dirs; i++) {
+                if (g_cancellable_is_cancelled (cancellable))
+                        break;
+                if (trusted[i])
+                        continue;
+                g_debug ("housekeeping: indexing %s", job->paths[i]);
+                load_job_scan_dir (job, i);
+        }
+        g_free (trusted);
+
+        if (!g_task_return_error_if_cancelled (task))
+                g_task_return_boolean (task, TRUE);
+}
+
+static void
+save_thread (GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data,
+             GCancellable *cancellable)
+{
+        SaveJob *job = task_data;
+        char *filename;
+        char *dirname;
+        GError *error = NULL;
+
+        filename = get_index_filename ();
+        dirname = g_path_get_dirname (filename);
+
+        /* Don't let an older snapshot overwrite a newer one */
+        g_mutex_lock (&save_lock);
+        if (job->serial > saved_serial) {
+                g_mkdir_with_parents (dirname, 0700);
+                if (g_file_set_contents (filename, (const char *) job->data->data,
+                                         job->data->len, &error))
+                        saved_serial = job->serial;
+                else {
+                        g_debug ("housekeeping: could not save the thumbnail index: %s",
+                                 error->message);
+                        g_error_free (error);
+                }
+        }
+        g_mutex_unlock (&save_lock);
+
+        g_free (dirname);
+        g_free (filename);
+}
+
+static void
+save_job_free (SaveJob *job)
+{
+        g_byte_array_free (job->data, TRUE);
+        g_free (job);
+}
+
+static SaveJob *
+index_snapshot (CsdThumbnailIndex *thumb_index)
+{
+        SaveJob *job;
+        GHashTableIter iter;
+        gpointer entry;
+        guint32 n_dirs = thumb_index->n_dirs;
+        gint64 settled;
+        guint i;
+
+        job = g_new0 (SaveJob, 1);
+        job->serial = ++save_serial;
+        job->data = g_byte_array_sized_new (INDEX_MAGIC_LEN + sizeof (guint32) +
+                                            n_dirs * sizeof (gint64) +
+                                            g_hash_table_size (thumb_index->entries) * sizeof (IndexEntry));
+
+        g_byte_array_append (job->data, (const guint8 *) INDEX_MAGIC, INDEX_MAGIC_LEN);
+        g_byte_array_append (job->data, (const guint8 *) &n_dirs, sizeof (n_dirs));
+
+        settled = (g_get_real_time () / G_USEC_PER_SEC - INDEX_SETTLE_TIME) * G_GINT64_CONSTANT (1000000000);
+        for (i = 0; i < n_dirs; i++) {
+                gint64 mtime;
+
+                /* a running purge deletes things the index doesn't
+                 * know about yet */
+                mtime = get_dir_mtime (thumb_index->paths[i]);
+                if (mtime > settled || thumb_index->purges != NULL)
+                        mtime = 0;
+                g_byte_array_append (job->data, (const guint8 *) &mtime, sizeof (mtime));
+        }
+
+        g_hash_table_iter_init (&iter, thumb_index->entries);
+        while (g_hash_table_iter_next (&iter, &entry, NULL))
+                g_byte_array_append (job->data, entry, sizeof (IndexEntry));
+
+        thumb_index->dirty = FALSE;
+
+        return job;
+}
+
+static gboolean
+index_save_cb (CsdThumbnailIndex *thumb_index)
+{
+        GTask *task;
+
+        thumb_index->save_id = 0;
+
+        task = g_task_new (NULL, NULL, NULL, NULL);
+        g_task_set_task_data (task, index_snapshot (thumb_index), (GDestroyNotify) save_job_free);
+        g_task_run_in_thread (task, save_thread);
+        g_object_unref (task);
+
+        return FALSE;
+}
+
+static void
+index_changed (CsdThumbnailIndex *thumb_index)
+{
+        thumb_index->dirty = TRUE;
+        if (thumb_index->save_id == 0)
+                thumb_index->save_id = g_timeout_add_seconds (INDEX_SAVE_DELAY,
+                                                              (GSourceFunc) index_save_cb,
+                                                              thumb_index);
+}
+
+static void
+index_update (CsdThumbnailIndex *thumb_index,
+              guint              dir,
+              const char        *name)
+{
+        IndexEntry key;
+        IndexEntry *entry;
+        struct stat st;
+        char *path;
+
+        if (!parse_thumbnail_name (name, key.hash))
+                return;
+        key.dir = dir;
+
+        if (thumb_index->entries == NULL) {
+                ThumbEntry pending;
+
+                pending.dir = dir;
+                memcpy (pending.name, name, THUMB_NAME_LEN + 1);
+                g_array_append_val (thumb_index->pending, pending);
+                return;
+        }
+
+        entry = g_hash_table_lookup (thumb_index->entries, &key);
+        if (entry != NULL) {
+                thumb_index->total_size -= entry->size;
+                g_hash_table_remove (thumb_index->entries, entry);
+        }
+
+        path = g_build_filename (thumb_index->paths[dir], name, NULL);
+        if (lstat (path, &st) == 0 && S_ISREG (st.st_mode)) {
+                entry = g_new0 (IndexEntry, 1);
+                memcpy (entry->hash, key.hash, sizeof (key.hash));
+                entry->dir = dir;
+                entry->size = MIN (thumbnail_size (&st), G_MAXUINT32);
+                entry->mtime = st.st_mtime;
+                g_hash_table_add (thumb_index->entries, entry);
+                thumb_index->total_size += entry->size;
+        }
+        g_free (path);
+
+        index_changed (thumb_index);
+}
+
+static void
+index_monitor_changed_cb (GFileMonitor      *monitor,
+                          GFile             *file,
+                          GFile             *other_file,
+                          GFileMonitorEvent  event_type,
+                          CsdThumbnailIndex *thumb_index)
+{
+        char *name;
+        guint dir;
+
+        for (dir = 0; dir < thumb_index->n_dirs; dir++) {
+                if (thumb_index->monitors[dir] == monitor)
+                        break;
+        }
+        if (dir == thumb_index->n_dirs)
+                return;
+
+        /* Whatever happened, the file is looked at again */
+        name = g_file_get_basename (file);
+        index_update (thumb_index, dir, name);
+        g_free (name);
+
+        if (other_file != NULL) {
+                name = g_file_get_basename (other_file);
+                index_update (thumb_index, dir, name);
+                g_free (name);
+        }
+}
+
+static void
+index_loaded_cb (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+        CsdThumbnailIndex *thumb_index = user_data;
+        LoadJob *job;
+        GError *error = NULL;
+        guint i;
+
+        if (!g_task_propagate_boolean (G_TASK (res), &error)) {
+                /* the index is gone already */
+                g_error_free (error);
+                return;
+        }
+
+        job = g_task_get_task_data (G_TASK (res));
+        thumb_index->entries = job->entries;
+        thumb_index->total_size = job->total_size;
+        job->entries = NULL;
+
+        for (i = 0; i < thumb_index->pending->len; i++) {
+                ThumbEntry *pending = &g_array_index (thumb_index->pending, ThumbEntry, i);
+
+                index_update (thumb_index, pending->dir, pending->name);
+        }
+        g_array_set_size (thumb_index->pending, 0);
+
+        g_debug ("housekeeping: thumbnail index has %u thumbnails, %" G_GOFFSET_FORMAT " bytes",
+                 g_hash_table_size (thumb_index->entries), thumb_index->total_size);
+
+        index_changed (thumb_index);
+}
+
+CsdThumbnailIndex *
+csd_thumbnail_index_new (void)
+{
+        CsdThumbnailIndex *thumb_index;
+        LoadJob *job;
+        GTask *task;
+        guint i;
+
+        thumb_index = g_new0 (CsdThumbnailIndex, 1);
+        thumb_index->paths = get_thumbnail_dirs ();
+        thumb_index->n_dirs = g_strv_length (thumb_index->paths);
+        thumb_index->pending = g_array_new (FALSE, FALSE, sizeof (ThumbEntry));
+        thumb_index->cancellable = g_cancellable_new ();
+
+        /* Watch first, so that nothing is missed while loading */
+        thumb_index->monitors = g_new0 (GFileMonitor *, thumb_index->n_dirs);
+        for (i = 0; i < thumb_index->n_dirs; i++) {
+                GFile *file;
+                GError *error = NULL;
+
+                file = g_file_new_for_path (thumb_index->paths[i]);
+                thumb_index->monitors[i] = g_file_monitor_directory (file, G_FILE_MONITOR_NONE,
+                                                                     NULL, &error);
+                if (thumb_index->monitors[i] == NULL) {
+                        g_debug ("housekeeping: can't monitor %s: %s",
+                                 thumb_index->paths[i], error->message);
+                        g_error_free (error);
+                } else {
+                        g_signal_connect (thumb_index->monitors[i], "changed",
+                                          G_CALLBACK (index_monitor_changed_cb), thumb_index);
+                }
+                g_object_unref (file);
+        }
+
+        job = g_new0 (LoadJob, 1);
+        job->paths = g_strdupv (thumb_index->paths);
+        job->n_dirs = thumb_index->n_dirs;
+
+        task = g_task_new (NULL, thumb_index->cancellable, index_loaded_cb, thumb_index);
+        g_task_set_task_data (task, job, (GDestroyNotify) load_job_free);
+        g_task_run_in_thread (task, load_thread);
+        g_object_unref (task);
+
+        return thumb_index;
+}
+
+void
+csd_thumbnail_index_free (CsdThumbnailIndex *thumb_index)
+{
+        GSList *l;
+        guint i;
+
+        g_cancellable_cancel (thumb_index->cancellable);
+        g_object_unref (thumb_index->cancellable);
+
+        for (i = 0; i < thumb_index->n_dirs; i++) {
+                if (thumb_index->monitors[i] == NULL)
+                        continue;
+                g_signal_handlers_disconnect_by_func (thumb_index->monitors[i],
+                                                      index_monitor_changed_cb,
+                                                      thumb_index);
+                g_file_monitor_cancel (thumb_index->monitors[i]);
+                g_object_unref (thumb_index->monitors[i]);
+        }
+        g_free (thumb_index->monitors);
+
+        if (thumb_index->save_id != 0)
+                g_source_remove (thumb_index->save_id);
+
+        /* While a purge is running the snapshot doesn't trust any
+         * directory, see index_snapshot() */
+        if (thumb_index->entries != NULL) {
+                if (thumb_index->dirty || thumb_index->purges != NULL) {
+                        SaveJob *job = index_snapshot (thumb_index);
+
+                        save_thread (NULL, NULL, job, NULL);
+                        save_job_free (job);
+                }
+                g_hash_table_destroy (thumb_index->entries);
+        }
+
+        for (l = thumb_index->purges; l != NULL; l = l->next)
+                ((PurgeJob *) l->data)->thumb_index = NULL;
+        g_slist_free (thumb_index->purges);
+
+        g_array_free (thumb_index->pending, TRUE);
+        g_strfreev (thumb_index->paths);
+        g_free (thumb_index);
+}
+
+/* Returns (ready, count, size, [(max_age, count, size)]), with the
+ * thumbnails bucketed by age in seconds */
+GVariant *
+csd_thumbnail_index_get_stats (CsdThumbnailIndex *thumb_index)
+{
+        static const guint64 ages[] = {
+                SECONDS_PER_DAY,
+                7 * SECONDS_PER_DAY,
+                30 * SECONDS_PER_DAY,
+                90 * SECONDS_PER_DAY,
+                365 * SECONDS_PER_DAY,
+                G_MAXUINT64
+        };
+        guint64 counts[G_N_ELEMENTS (ages)] = { 0, };
+        guint64 sizes[G_N_ELEMENTS (ages)] = { 0, };
+        GVariantBuilder builder;
+        guint i;
+
+        if (thumb_index->entries != NULL) {
+                GHashTableIter iter;
+                IndexEntry *entry;
+                gint64 now;
+
+                now = g_get_real_time () / G_USEC_PER_SEC;
+                g_hash_table_iter_init (&iter, thumb_index->entries);
+                while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL)) {
+                        guint64 age = MAX (now - entry->mtime, 0);
+
+                        for (i = 0; i < G_N_ELEMENTS (ages) - 1 && age >= ages[i]; i++)
+                                ;
+                        counts[i]++;
+                        sizes[i] += entry->size;
+                }
+        }
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ttt)"));
+        for (i = 0; i < G_N_ELEMENTS (ages); i++)
+                g_variant_builder_add (&builder, "(ttt)", ages[i], counts[i], sizes[i]);
+
+        return g_variant_new ("(btta(ttt))",
+                              thumb_index->entries != NULL,
+                              (guint64) (thumb_index->entries ? g_hash_table_size (thumb_index->entries) : 0),
+                              (guint64) thumb_index->total_size,
+                              &builder);
+}
+
+static void
+add_victim (PurgeJob         *job,
+            const IndexEntry *entry)
+{
+        ThumbEntry victim;
+
+        victim.mtime = entry->mtime;
+        victim.size = entry->size;
+        victim.dir = entry->dir;
+        format_thumbnail_name (entry->hash, victim.name);
+        g_array_append_val (job->victims, victim);
+}
+
+static int
+compare_index_mtime (gconstpointer a,
+                     gconstpointer b)
+{
+        const IndexEntry *entry_a = a;
+        const IndexEntry *entry_b = b;
+
+        if (entry_a->mtime < entry_b->mtime)
+                return -1;
+        return entry_a->mtime > entry_b->mtime;
+}
+
+/* Picks the victims from the snapshot, oldest first, then deletes them */
+static void
+index_purge_thread (GTask        *task,
+                    gpointer      source_object,
+                    gpointer      task_data,
+                    GCancellable *cancellable)
+{
+        PurgeJob *job = task_data;
+        guint i;
+
+        job->cancellable = cancellable;
+
+        g_array_sort (job->snapshot, compare_index_mtime);
+        for (i = 0; i < job->snapshot->len; i++) {
+                IndexEntry *entry = &g_array_index (job->snapshot, IndexEntry, i);
+                gboolean too_old, too_big;
+
+                /* sorted, so whatever is too old comes first */
+                too_old = job->max_age >= 0 && job->now - entry->mtime > job->max_age;
+                too_big = job->max_size >= 0 && job->total_size > job->max_size;
+                if (!too_old && !too_big)
+                        break;
+
+                add_victim (job, entry);
+                job->total_size -= entry->size;
+        }
+
+        g_debug ("housekeeping: thumbnail cache will be %" G_GOFFSET_FORMAT " bytes, "
+                 "deleting %u thumbnails", job->total_size, job->victims->len);
+
+        for (i = 0; i < job->n_dirs; i++)
+                job->fds[i] = open (job->paths[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        for (i = 0; i < job->victims->len; i++) {
+                ThumbEntry *entry = &g_array_index (job->victims, ThumbEntry, i);
+
+                if (job->fds[entry->dir] >= 0 && !delete_thumbnail (job, entry))
+                        break;
+        }
+        if (i == job->victims->len)
+                flush_batch (job);
+
+        close_dirs (job);
+
+        g_debug ("housekeeping: deleted %u thumbnails", job->n_deleted);
+
+        if (!g_task_return_error_if_cancelled (task))
+                g_task_return_boolean (task, TRUE);
+}
+
+/* Back in the main thread, drops what was deleted from the index.
+ * Something that changed since is left to the monitors. */
+static void
+index_purge_done (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+        GTask *task = user_data;
+        PurgeJob *job;
+        CsdThumbnailIndex *thumb_index;
+        GError *error = NULL;
+        guint i;
+
+        job = g_task_get_task_data (G_TASK (res));
+        thumb_index = job->thumb_index;
+
+        if (thumb_index != NULL) {
+                thumb_index->purges = g_slist_remove (thumb_index->purges, job);
+
+                for (i = 0; i < job->deleted->len; i++) {
+                        ThumbEntry *deleted = &g_array_index (job->deleted, ThumbEntry, i);
+                        IndexEntry key;
+                        IndexEntry *entry;
+
+                        if (!parse_thumbnail_name (deleted->name, key.hash))
+                                continue;
+                        key.dir = deleted->dir;
+
+                        entry = g_hash_table_lookup (thumb_index->entries, &key);
+                        if (entry == NULL || entry->mtime != deleted->mtime)
+                                continue;
+                        thumb_index->total_size -= entry->size;
+                        g_hash_table_remove (thumb_index->entries, entry);
+                }
+
+                /* saved again anyway, the last snapshot trusted nothing */
+                index_changed (thumb_index);
+        }
+
+        if (g_task_propagate_boolean (G_TASK (res), &error))
+                g_task_return_boolean (task, TRUE);
+        else
+                g_task_return_error (task, error);
+        g_object_unref (task);
+}
+
+/* Like csd_thumbnail_cache_purge_async(), but picks what to delete from
+ * the index instead of reading the whole cache. Falls back to reading
+ * it while the index is still loading. Finish with
+ * csd_thumbnail_cache_purge_finish(). */
+void
+csd_thumbnail_index_purge_async (CsdThumbnailIndex   *thumb_index,
+                                 gint64               max_age,
+                                 goffset              max_size,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+        PurgeJob *job;
+        GHashTableIter iter;
+        IndexEntry *entry;
+        GTask *task;
+        GTask *purge_task;
+
+        if (thumb_index->entries == NULL) {
+                g_debug ("housekeeping: thumbnail index not loaded yet");
+                csd_thumbnail_cache_purge_async (max_age, max_size, cancellable,
+                                                 callback, user_data);
+                return;
+        }
+
+        job = purge_job_new (max_age, max_size);
+        job->thumb_index = thumb_index;
+        job->total_size = thumb_index->total_size;
+        job->victims = g_array_new (FALSE, FALSE, sizeof (ThumbEntry));
+        job->deleted = g_array_new (FALSE, FALSE, sizeof (ThumbEntry));
+
+        /* The entries are small and flat, copying them is cheap; picking
+         * from them is left to the worker */
+        job->snapshot = g_array_sized_new (FALSE, FALSE, sizeof (IndexEntry),
+                                           g_hash_table_size (thumb_index->entries));
+        g_hash_table_iter_init (&iter, thumb_index->entries);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL))
+                g_array_append_val (job->snapshot, *entry);
+
+        thumb_index->purges = g_slist_prepend (thumb_index->purges, job);
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+
+        purge_task = g_task_new (NULL, cancellable, index_purge_done, task);
+        g_task_set_task_data (purge_task, job, (GDestroyNotify) purge_job_free);
+        g_task_run_in_thread (purge_task, index_purge_thread);
+        g_object_unref (purge_task);
+}
+
+/* Compaction folds the obsolete ~/.thumbnails tree into the XDG cache,
+ * drops failure entries for files that have a thumbnail now, and turns
+ * thumbnails with identical contents into hard links. Thumbnailers
+ * replace thumbnails by renaming a new file over them, so a linked
+ * thumbnail never changes under the other names. */
+
+/* get_thumbnail_dirs() lists the current directories first, then the
+ * obsolete ones in the same order */
+#define N_CURRENT_DIRS 3
+#define FAIL_DIR       2
+
+/* Finding duplicates means reading thumbnails, so it only runs when
+ * asked for, and it gives up after this much */
+#define DEDUP_MAX_ENTRIES (64 * 1024)
+#define DEDUP_MAX_READ    (64 * 1024 * 1024) /* bytes */
+
+typedef struct {
+        goffset size;
+        ino_t   ino;
+        guint64 hash;
+        guint   dir;
+        char    name[THUMB_NAME_LEN + 1];
+} CompactEntry;
+
+typedef struct {
+        char                     **paths;
+        int                       *fds;
+        guint                      n_dirs;
+        gint64                     now;
+        gint64                     max_age;
+        gboolean                   dedup;
+        gboolean                   cross_device;
+        guint                      since_yield;
+        GArray                    *entries; /* CompactEntry, for finding duplicates */
+        goffset                    bytes_read;
+        CsdThumbnailCompactStats   stats;
+        GCancellable              *cancellable;
+} CompactJob;
+
+static gboolean
+compact_checkpoint (CompactJob *job)
+{
+        if (++job->since_yield % PURGE_BATCH_SIZE == 0)
+                g_thread_yield ();
+        return !g_cancellable_is_cancelled (job->cancellable);
+}
+
+static gboolean
+thumbnail_exists_at (int         fd,
+                     const char *name)
+{
+        struct stat st;
+
+        return fd >= 0 && fstatat (fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+static void
+compact_drop (CompactJob *job,
+              guint       dir,
+              const char *name,
+              goffset     size)
+{
+        if (unlinkat (job->fds[dir], name, 0) == 0) {
+                job->stats.dropped++;
+                job->stats.reclaimed += size;
+        }
+}
+
+/* Calls @func for each thumbnail in @dir, until it returns FALSE */
+static gboolean
+compact_foreach (CompactJob  *job,
+                 guint        dir,
+                 gboolean   (*func) (CompactJob        *job,
+                                     guint              dir,
+                                     const char        *name,
+                                     const struct stat *st))
+{
+        struct dirent *dent;
+        gboolean ret = TRUE;
+        DIR *d;
+        int fd;
+
+        if (job->fds[dir] < 0)
+                return TRUE;
+        fd = dup (job->fds[dir]);
+        if (fd < 0)
+                return TRUE;
+        d = fdopendir (fd);
+        if (d == NULL) {
+                close (fd);
+                return TRUE;
+        }
+
+        while (ret && (dent = readdir (d)) != NULL) {
+                struct stat st;
+
+                if (dent->d_type != DT_REG && dent->d_type != DT_UNKNOWN)
+                        continue;
+                if (!is_thumbnail_name (dent->d_name))
+                        continue;
+                if (fstatat (job->fds[dir], dent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+                    !S_ISREG (st.st_mode))
+                        continue;
+
+                ret = func (job, dir, dent->d_name, &st);
+        }
+
+        closedir (d);
+
+        return ret;
+}
+
+static gboolean
+migrate_thumbnail (CompactJob        *job,
+                   guint              dir,
+                   const char        *name,
+                   const struct stat *st)
+{
+        guint target = dir - N_CURRENT_DIRS;
+
+        if (job->max_age >= 0 && job->now - st->st_mtime > job->max_age) {
+                /* would only be purged right after */
+                compact_drop (job, dir, name, st->st_size);
+        } else if (thumbnail_exists_at (job->fds[target], name)) {
+                /* the current one is what gets updated */
+                compact_drop (job, dir, name, st->st_size);
+        } else if (job->cross_device) {
+                /* left for the purge */
+        } else if (renameat (job->fds[dir], name, job->fds[target], name) == 0) {
+                job->stats.migrated++;
+        } else if (errno == EXDEV) {
+                g_debug ("housekeeping: %s and %s are on different file systems, "
+                         "not moving thumbnails over",
+                         job->paths[dir], job->paths[target]);
+                job->cross_device = TRUE;
+        }
+
+        return compact_checkpoint (job);
+}
+
+static gboolean
+drop_stale_failure (CompactJob        *job,
+                    guint              dir,
+                    const char        *name,
+                    const struct stat *st)
+{
+        guint i;
+
+        for (i = 0; i < FAIL_DIR; i++) {
+                if (thumbnail_exists_at (job->fds[i], name)) {
+                        compact_drop (job, dir, name, st->st_size);
+                        break;
+                }
+        }
+
+        return compact_checkpoint (job);
+}
+
+static gboolean
+collect_thumbnail (CompactJob        *job,
+                   guint              dir,
+                   const char        *name,
+                   const struct stat *st)
+{
+        CompactEntry entry;
+
+        if (job->entries->len == DEDUP_MAX_ENTRIES)
+                return FALSE;
+
+        entry.size = st->st_size;
+        entry.ino = st->st_ino;
+        entry.hash = 0;
+        entry.dir = dir;
+        memcpy (entry.name, name, THUMB_NAME_LEN + 1);
+        g_array_append_val (job->entries, entry);
+
+        return compact_checkpoint (job);
+}
+
+static int
+compare_size_ino (gconstpointer a,
+                  gconstpointer b)
+{
+        const CompactEntry *entry_a = a;
+        const CompactEntry *entry_b = b;
+
+        if (entry_a->size != entry_b->size)
+                return entry_a->size < entry_b->size ? -1 : 1;
+        if (entry_a->ino != entry_b->ino)
+                return entry_a->ino < entry_b->ino ? -1 : 1;
+        return 0;
+}
+
+static int
+compare_hash_dir (gconstpointer a,
+                  gconstpointer b)
+{
+        const CompactEntry *entry_a = a;
+        const CompactEntry *entry_b = b;
+
+        if (entry_a->hash != entry_b->hash)
+                return entry_a->hash < entry_b->hash ? -1 : 1;
+        if (entry_a->dir != entry_b->dir)
+                return entry_a->dir < entry_b->dir ? -1 : 1;
+        return 0;
+}
+
+static guint8 *
+read_thumbnail (CompactJob         *job,
+                const CompactEntry *entry)
+{
+        guint8 *data;
+        gsize done = 0;
+        int fd;
+
+        fd = openat (job->fds[entry->dir], entry->name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0)
+                return NULL;
+
+        job->bytes_read += entry->size;
+        data = g_malloc (MAX (entry->size, 1));
+        while (done < (gsize) entry->size) {
+                ssize_t n = read (fd, data + done, entry->size - done);
+
+                if (n < 0 && errno == EINTR)
+                        continue;
+                if (n <= 0)
+                        break;
+                done += n;
+        }
+        close (fd);
+
+        if (done != (gsize) entry->size) {
+                g_free (data);
+                return NULL;
+        }
+
+        return data;
+}
+
+/* FNV-1a, cheap and good enough to sort candidates, which are compared
+ * byte for byte before anything gets linked */
+static guint64
+hash_contents (const guint8 *data,
+               gsize         len)
+{
+        guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+        gsize i;
+
+        for (i = 0; i < len; i++) {
+                hash ^= data[i];
+                hash *= G_GUINT64_CONSTANT (1099511628211);
+        }
+
+        return hash;
+}
+
+static gboolean
+same_contents (CompactJob         *job,
+               const CompactEntry *a,
+               const CompactEntry *b)
+{
+        guint8 *data_a, *data_b;
+        gboolean ret;
+
+        data_a = read_thumbnail (job, a);
+        data_b = read_thumbnail (job, b);
+        ret = data_a != NULL && data_b != NULL && memcmp (data_a, data_b, a->size) == 0;
+        g_free (data_a);
+        g_free (data_b);
+
+        return ret;
+}
+
+/* Replaces @dup with a hard link to @keeper, atomically */
+static void
+link_duplicate (CompactJob         *job,
+                const CompactEntry *keeper,
+                const CompactEntry *dup)
+{
+        char *tmp;
+
+        tmp = g_strdup_printf (".%s.csd-link", dup->name);
+        if (linkat (job->fds[keeper->dir], keeper->name, job->fds[dup->dir], tmp, 0) == 0) {
+                if (renameat (job->fds[dup->dir], tmp, job->fds[dup->dir], dup->name) == 0) {
+                        job->stats.linked++;
+                        job->stats.reclaimed += dup->size;
+                } else {
+                        unlinkat (job->fds[dup->dir], tmp, 0);
+                }
+        }
+        g_free (tmp);
+}
+
+/* @run holds thumbnails of the same size, sorted by inode */
+static gboolean
+dedup_run (CompactJob   *job,
+           CompactEntry *run,
+           guint         len)
+{
+        guint i, j;
+
+        for (i = 0; i < len; i++) {
+                guint8 *data;
+
+                /* already links to the same file */
+                if (i > 0 && run[i].ino == run[i - 1].ino) {
+                        run[i].hash = run[i - 1].hash;
+                        continue;
+                }
+
+                data = read_thumbnail (job, &run[i]);
+                if (data == NULL) {
+                        /* gone, or unreadable; never matches anything */
+                        run[i].hash = G_MAXUINT64 - i;
+                        continue;
+                }
+                run[i].hash = hash_contents (data, run[i].size);
+                g_free (data);
+
+                if (!compact_checkpoint (job) || job->bytes_read > DEDUP_MAX_READ)
+                        return FALSE;
+        }
+
+        qsort (run, len, sizeof (CompactEntry), compare_hash_dir);
+
+        for (i = 0; i < len; i = j) {
+                for (j = i + 1; j < len && run[j].hash == run[i].hash; j++) {
+                        if (run[j].ino == run[i].ino)
+                                continue;
+                        if (same_contents (job, &run[i], &run[j]))
+                                link_duplicate (job, &run[i], &run[j]);
+                        if (!compact_checkpoint (job) || job->bytes_read > DEDUP_MAX_READ)
+                                return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+static gboolean
+dedup_thumbnails (CompactJob *job)
+{
+        CompactEntry *entries;
+        guint i, j, len;
+
+        /* With too many thumbnails, only the first ones are looked at */
+        job->entries = g_array_new (FALSE, FALSE, sizeof (CompactEntry));
+        for (i = 0; i < job->n_dirs; i++) {
+                if (!compact_foreach (job, i, collect_thumbnail))
+                        break;
+        }
+        if (g_cancellable_is_cancelled (job->cancellable))
+                return FALSE;
+
+        /* Only thumbnails of the same size can be the same, which saves
+         * reading most of them */
+        g_array_sort (job->entries, compare_size_ino);
+        entries = (CompactEntry *) job->entries->data;
+        len = job->entries->len;
+
+        for (i = 0; i < len; i = j) {
+                for (j = i + 1; j < len && entries[j].size == entries[i].size; j++)
+                        ;
+                if (j - i > 1 && !dedup_run (job, entries + i, j - i))
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void
+compact_thread (GTask        *task,
+                gpointer      source_object,
+                gpointer      task_data,
+                GCancellable *cancellable)
+{
+        CompactJob *job = task_data;
+        guint i;
+
+        job->cancellable = cancellable;
+
+        for (i = 0; i < job->n_dirs; i++)
+                job->fds[i] = open (job->paths[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        /* Move the obsolete tree over */
+        for (i = N_CURRENT_DIRS; i < job->n_dirs; i++) {
+                guint target = i - N_CURRENT_DIRS;
+
+                if (job->fds[i] < 0)
+                        continue;
+                if (job->fds[target] < 0) {
+                        g_mkdir_with_parents (job->paths[target], 0700);
+                        job->fds[target] = open (job->paths[target], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                        if (job->fds[target] < 0)
+                                continue;
+                }
+                if (!compact_foreach (job, i, migrate_thumbnail))
+                        goto out;
+        }
+
+        if (!compact_foreach (job, FAIL_DIR, drop_stale_failure))
+                goto out;
+
+        if (job->dedup)
+                dedup_thumbnails (job);
+
+out:
+        for (i = 0; i < job->n_dirs; i++) {
+                if (job->fds[i] >= 0)
+                        close (job->fds[i]);
+                job->fds[i] = -1;
+        }
+
+        g_debug ("housekeeping: compacted thumbnail cache, %u migrated, %u dropped, "
+                 "%u linked, %" G_GUINT64_FORMAT " bytes reclaimed",
+                 job->stats.migrated, job->stats.dropped,
+                 job->stats.linked, job->stats.reclaimed);
+
+        if (!g_task_return_error_if_cancelled (task))
+                g_task_return_boolean (task, TRUE);
+}
+
+static void
+compact_job_free (CompactJob *job)
+{
+        if (job->entries != NULL)
+                g_array_free (job->entries, TRUE);
+        g_free (job->fds);
+        g_strfreev (job->paths);
+        g_free (job);
+}
+
+/* Compacts the thumbnail cache in a worker thread. Thumbnails in the
+ * obsolete location that are older than @max_age seconds are dropped
+ * rather than moved, -1 moves everything. Duplicates are only linked
+ * with @dedup, which reads through the cache. */
+void
+csd_thumbnail_cache_compact_async (gint64               max_age,
+                                   gboolean             dedup,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+        CompactJob *job;
+        GTask *task;
+
+        job = g_new0 (CompactJob, 1);
+        job->paths = get_thumbnail_dirs ();
+        job->n_dirs = g_strv_length (job->paths);
+        job->fds = g_new (int, job->n_dirs);
+        job->now = g_get_real_time () / G_USEC_PER_SEC;
+        job->max_age = max_age;
+        job->dedup = dedup;
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_task_data (task, job, (GDestroyNotify) compact_job_free);
+        g_task_run_in_thread (task, compact_thread);
+        g_object_unref (task);
+}
+
+gboolean
+csd_thumbnail_cache_compact_finish (GAsyncResult              *result,
+                                    CsdThumbnailCompactStats  *stats,
+                                    GError                   **error)
+{
+        CompactJob *job;
+
+        g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+        if (!g_task_propagate_boolean (G_TASK (result), error))
+                return FALSE;
+
+        job = g_task_get_task_data (G_TASK (result));
+        if (stats != NULL)
+                *stats = job->stats;
+
+        return TRUE;
+}
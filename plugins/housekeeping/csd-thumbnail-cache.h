@@ -0,0 +1,71 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Linux Mint
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __CSD_THUMBNAIL_CACHE_H
+#define __CSD_THUMBNAIL_CACHE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* @max_age is in seconds and @max_size in bytes, -1 disables either limit */
+gboolean csd_thumbnail_cache_purge        (gint64                max_age,
+                                           goffset               max_size,
+                                           GCancellable         *cancellable,
+                                           GError              **error);
+void     csd_thumbnail_cache_purge_async  (gint64                max_age,
+                                           goffset               max_size,
+                                           GCancellable         *cancellable,
+                                           GAsyncReadyCallback   callback,
+                                           gpointer              user_data);
+gboolean csd_thumbnail_cache_purge_finish (GAsyncResult         *result,
+                                           GError              **error);
+
+typedef struct {
+        guint64 reclaimed;  /* bytes */
+        guint   migrated;
+        guint   dropped;
+        guint   linked;
+} CsdThumbnailCompactStats;
+
+void     csd_thumbnail_cache_compact_async  (gint64                     max_age,
+                                             gboolean                   dedup,
+                                             GCancellable              *cancellable,
+                                             GAsyncReadyCallback        callback,
+                                             gpointer                   user_data);
+gboolean csd_thumbnail_cache_compact_finish (GAsyncResult              *result,
+                                             CsdThumbnailCompactStats  *stats,
+                                             GError                   **error);
+
+typedef struct _CsdThumbnailIndex CsdThumbnailIndex;
+
+CsdThumbnailIndex *csd_thumbnail_index_new         (void);
+void               csd_thumbnail_index_free        (CsdThumbnailIndex    *thumb_index);
+GVariant          *csd_thumbnail_index_get_stats   (CsdThumbnailIndex    *thumb_index);
+void               csd_thumbnail_index_purge_async (CsdThumbnailIndex    *thumb_index,
+                                                    gint64                max_age,
+                                                    goffset               max_size,
+                                                    GCancellable         *cancellable,
+                                                    GAsyncReadyCallback   callback,
+                                                    gpointer              user_data);
+
+G_END_DECLS
+
+#endif /* __CSD_THUMBNAIL_CACHE_H */
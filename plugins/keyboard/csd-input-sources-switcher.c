@@ -39,6 +39,7 @@ static GSettings *input_sources_settings;
 
 static Key *the_keys = NULL;
 static guint n_keys = 0;
+static CsdKeyMatchTable *key_table = NULL;
 
 static guint master_keyboard_id = 0;
 
@@ -320,6 +321,9 @@ free_keys (void)
 {
   gint i;
 
+  key_match_table_free (key_table);
+  key_table = NULL;
+
   for (i = 0; i < n_keys; ++i)
     g_free (the_keys[i].keycodes);
 
@@ -385,15 +389,19 @@ match_modifier (const Key *key,
 }
 
 static gboolean
-matches_key (XIEvent *xiev)
+match_modifier_cb (Key      *key,
+                   gpointer  user_data)
 {
-  gint i;
-
-  for (i = 0; i < n_keys; ++i)
-    if (match_modifier (&the_keys[i], xiev))
-      return TRUE;
+  return match_modifier (key, (XIEvent *) user_data);
+}
 
-  return FALSE;
+static gboolean
+matches_key (XIEvent *xiev)
+{
+  return key_match_table_lookup (key_table,
+                                 ((XIDeviceEvent *) xiev)->detail,
+                                 match_modifier_cb,
+                                 xiev) != NULL;
 }
 
 /* Owen magic, ported to XI2 */
@@ -493,9 +501,9 @@ filter (XEvent   *xevent,
 }
 
 static void
-grab_key (Key        *key,
-          GdkDisplay *display,
-          GSList     *screens)
+grab_key (CsdKeygrabBatch *batch,
+          Key             *key,
+          GSList          *screens)
 {
   GdkKeymapKey *keys;
   gboolean has_entries;
@@ -515,11 +523,7 @@ grab_key (Key        *key,
 
   key->keycodes = (guint *) g_array_free (keycodes, FALSE);
 
-  gdk_x11_display_error_trap_push (display);
-
-  grab_key_unsafe (key, CSD_KEYGRAB_ALLOW_UNMODIFIED | CSD_KEYGRAB_SYNCHRONOUS, screens);
-
-  gdk_x11_display_error_trap_pop_ignored (display);
+  keygrab_batch_grab (batch, key, CSD_KEYGRAB_ALLOW_UNMODIFIED | CSD_KEYGRAB_SYNCHRONOUS, screens);
 
   g_free (keys);
 }
@@ -548,6 +552,7 @@ static void
 set_input_sources_switcher (void)
 {
   GdkDisplay *display;
+  CsdKeygrabBatch *batch;
   gint n_screens;
   GSList *screens, *l;
   gint i;
@@ -558,8 +563,15 @@ set_input_sources_switcher (void)
   for (i = 0; i < n_screens; ++i)
     screens = g_slist_prepend (screens, gdk_display_get_screen (display, i));
 
+  batch = keygrab_batch_new ();
+  for (i = 0; i < n_keys; ++i)
+    grab_key (batch, &the_keys[i], screens);
+  keygrab_batch_commit (batch);
+  keygrab_batch_free (batch);
+
+  key_table = key_match_table_new ();
   for (i = 0; i < n_keys; ++i)
-    grab_key (&the_keys[i], display, screens);
+    key_match_table_add (key_table, &the_keys[i]);
 
   for (l = screens; l; l = l->next)
     {
@@ -46,6 +46,7 @@
 #endif
 
 #include "mpris-controller.h"
+#include "cinnamon-settings-bus.h"
 #include "cinnamon-settings-profile.h"
 #include "csd-marshal.h"
 #include "csd-media-keys-manager.h"
@@ -112,6 +113,12 @@ static const gchar kb_introspection_xml[] =
 "    <method name='HandleKeybinding'>"
 "      <arg name='type' direction='in' type='u'/>"
 "    </method>"
+"    <method name='GetActionLatency'>"
+"      <arg name='latency' direction='out' type='a(usttttta(tt))'/>"
+"    </method>"
+"    <method name='GetMediaPlayerLatency'>"
+"      <arg name='latency' direction='out' type='a(sbttt)'/>"
+"    </method>"
 "  </interface>"
 "</node>";
 
@@ -129,6 +136,13 @@ static const gchar kb_introspection_xml[] =
 #define LOGIND_DBUS_PATH                       "/org/freedesktop/login1"
 #define LOGIND_DBUS_INTERFACE                  "org.freedesktop.login1.Manager"
 
+/* Latency budgets, in microseconds. Volume and brightness keys should
+ * react within one frame, everything else within a tenth of a second. */
+#define ACTION_BUDGET_FRAME    16667
+#define ACTION_BUDGET_DEFAULT  100000
+
+#define ACTION_LATENCY_BUCKETS 24 /* powers of two, up to ~8s */
+
 #define CSD_MEDIA_KEYS_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CSD_TYPE_MEDIA_KEYS_MANAGER, CsdMediaKeysManagerPrivate))
 
 typedef struct {
@@ -138,6 +152,19 @@ typedef struct {
         guint   watch_id;
 } MediaPlayer;
 
+typedef struct {
+        guint64 count;
+        guint64 total;
+        guint64 max;
+        guint64 over_budget;
+        guint64 buckets[ACTION_LATENCY_BUCKETS];
+} ActionLatency;
+
+typedef struct {
+        ActionLatency effect; /* key press to the action taking effect */
+        ActionLatency osd;    /* key press to the OSD being requested */
+} ActionStats;
+
 struct CsdMediaKeysManagerPrivate
 {
         /* Volume bits */
@@ -147,8 +174,14 @@ struct CsdMediaKeysManagerPrivate
         ca_context      *ca;
 
 #ifdef HAVE_GUDEV
-        GHashTable      *streams; /* key = X device ID, value = stream id */
+        GHashTable      *device_parents; /* key = X device ID, value = USB parent sysfs path, "" if none */
+        GHashTable      *usb_sinks;      /* key = USB parent sysfs path, value = stream id */
+        GHashTable      *usb_sources;    /* key = USB parent sysfs path, value = stream id */
+        GHashTable      *stream_parents; /* key = stream id, value = StreamParent */
         GUdevClient     *udev_client;
+        GdkDeviceManager *device_manager;
+        gulong           device_added_id;
+        gulong           device_removed_id;
 #endif /* HAVE_GUDEV */
 
         GtkWidget       *dialog;
@@ -192,6 +225,20 @@ struct CsdMediaKeysManagerPrivate
 
         MprisController *mpris_controller;
 
+        /* Launcher caches */
+        GSettings       *terminal_settings;
+        char            *term_exec;
+        char           **term_argv;
+        char           **launch_env;
+        GHashTable      *launch_templates; /* key = command, value = argv */
+        guint            keyring_watch_id;
+
+        /* Action latency */
+        ActionStats      action_stats[C_DESKTOP_MEDIA_KEY_SEPARATOR];
+        gint             current_action;
+        gint64           current_action_started;
+        GSettings       *sound_settings;
+
         /* Ubuntu notifications */
         NotifyNotification *volume_notification;
         NotifyNotification *brightness_notification;
@@ -219,9 +266,148 @@ typedef struct {
         CsdMediaKeysManager *manager;
         CDesktopMediaKeyType type;
         guint old_percentage;
-
+        gint64 started;
 } CsdBrightnessActionData;
 
+static gint64
+action_budget (CDesktopMediaKeyType type)
+{
+        switch (type) {
+        case C_DESKTOP_MEDIA_KEY_MUTE:
+        case C_DESKTOP_MEDIA_KEY_VOLUME_DOWN:
+        case C_DESKTOP_MEDIA_KEY_VOLUME_UP:
+        case C_DESKTOP_MEDIA_KEY_MIC_MUTE:
+        case C_DESKTOP_MEDIA_KEY_MUTE_QUIET:
+        case C_DESKTOP_MEDIA_KEY_VOLUME_DOWN_QUIET:
+        case C_DESKTOP_MEDIA_KEY_VOLUME_UP_QUIET:
+        case C_DESKTOP_MEDIA_KEY_SCREEN_BRIGHTNESS_UP:
+        case C_DESKTOP_MEDIA_KEY_SCREEN_BRIGHTNESS_DOWN:
+        case C_DESKTOP_MEDIA_KEY_KEYBOARD_BRIGHTNESS_UP:
+        case C_DESKTOP_MEDIA_KEY_KEYBOARD_BRIGHTNESS_DOWN:
+        case C_DESKTOP_MEDIA_KEY_KEYBOARD_BRIGHTNESS_TOGGLE:
+                return ACTION_BUDGET_FRAME;
+        default:
+                return ACTION_BUDGET_DEFAULT;
+        }
+}
+
+/* Actions whose effect is only known once a D-Bus reply comes back;
+ * their callbacks record the effect latency themselves. */
+static gboolean
+action_is_async (CDesktopMediaKeyType type)
+{
+        switch (type) {
+        case C_DESKTOP_MEDIA_KEY_SCREEN_BRIGHTNESS_UP:
+        case C_DESKTOP_MEDIA_KEY_SCREEN_BRIGHTNESS_DOWN:
+        case C_DESKTOP_MEDIA_KEY_KEYBOARD_BRIGHTNESS_UP:
+        case C_DESKTOP_MEDIA_KEY_KEYBOARD_BRIGHTNESS_DOWN:
+        case C_DESKTOP_MEDIA_KEY_KEYBOARD_BRIGHTNESS_TOGGLE:
+                return TRUE;
+        default:
+                return FALSE;
+        }
+}
+
+static gboolean
+action_latency_add (ActionLatency *latency,
+                    gint64         elapsed,
+                    gint64         budget)
+{
+        guint index;
+
+        elapsed = MAX (elapsed, 0);
+        index = MIN (g_bit_storage (elapsed), ACTION_LATENCY_BUCKETS - 1);
+
+        latency->count++;
+        latency->total += elapsed;
+        latency->max = MAX (latency->max, (guint64) elapsed);
+        latency->buckets[index]++;
+
+        if (elapsed <= budget)
+                return FALSE;
+
+        latency->over_budget++;
+        return TRUE;
+}
+
+static void
+action_trace_effect (CsdMediaKeysManager *manager,
+                     CDesktopMediaKeyType type,
+                     gint64               started)
+{
+        gint64 elapsed, budget;
+
+        if (started == 0 || type >= C_DESKTOP_MEDIA_KEY_SEPARATOR)
+                return;
+
+        elapsed = g_get_monotonic_time () - started;
+        budget = action_budget (type);
+        if (action_latency_add (&manager->priv->action_stats[type].effect, elapsed, budget))
+                g_debug ("Action for key type '%d' took %" G_GINT64_FORMAT "us, over its %" G_GINT64_FORMAT "us budget",
+                         type, elapsed, budget);
+}
+
+static void
+action_trace_osd (CsdMediaKeysManager *manager,
+                  CDesktopMediaKeyType type,
+                  gint64               started)
+{
+        if (started == 0 || type >= C_DESKTOP_MEDIA_KEY_SEPARATOR)
+                return;
+
+        action_latency_add (&manager->priv->action_stats[type].osd,
+                            g_get_monotonic_time () - started,
+                            action_budget (type));
+}
+
+static void
+action_latency_add_to_builder (GVariantBuilder     *builder,
+                               CDesktopMediaKeyType type,
+                               const char          *kind,
+                               ActionLatency       *latency)
+{
+        GVariantBuilder buckets;
+        guint i;
+
+        if (latency->count == 0)
+                return;
+
+        g_variant_builder_init (&buckets, G_VARIANT_TYPE ("a(tt)"));
+        for (i = 0; i < ACTION_LATENCY_BUCKETS; i++) {
+                if (latency->buckets[i] > 0)
+                        g_variant_builder_add (&buckets, "(tt)",
+                                               (G_GUINT64_CONSTANT (1) << i) - 1,
+                                               latency->buckets[i]);
+        }
+
+        g_variant_builder_add (builder, "(usttttta(tt))",
+                               type,
+                               kind,
+                               latency->count,
+                               latency->total,
+                               latency->max,
+                               (guint64) action_budget (type),
+                               latency->over_budget,
+                               &buckets);
+}
+
+static GVariant *
+action_latency_get_stats (CsdMediaKeysManager *manager)
+{
+        GVariantBuilder builder;
+        guint i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(usttttta(tt))"));
+        for (i = 0; i < C_DESKTOP_MEDIA_KEY_SEPARATOR; i++) {
+                action_latency_add_to_builder (&builder, i, "effect",
+                                               &manager->priv->action_stats[i].effect);
+                action_latency_add_to_builder (&builder, i, "osd",
+                                               &manager->priv->action_stats[i].osd);
+        }
+
+        return g_variant_builder_end (&builder);
+}
+
 static void
 init_screens (CsdMediaKeysManager *manager)
 {
@@ -242,55 +428,73 @@ init_screens (CsdMediaKeysManager *manager)
         manager->priv->current_screen = manager->priv->screens->data;
 }
 
-static char *
-get_term_command (CsdMediaKeysManager *manager)
+static void
+launch_templates_clear (CsdMediaKeysManager *manager)
 {
-        char *cmd_term, *cmd_args;;
-        char *cmd = NULL;
-        GSettings *settings;
+        if (manager->priv->launch_templates != NULL)
+                g_hash_table_remove_all (manager->priv->launch_templates);
+}
+
+static void
+update_terminal_settings (GSettings           *settings,
+                          const char          *key,
+                          CsdMediaKeysManager *manager)
+{
+        CsdMediaKeysManagerPrivate *priv = manager->priv;
+        char *cmd_term, *cmd_args;
+        char *cmd;
 
-        settings = g_settings_new ("org.cinnamon.desktop.default-applications.terminal");
         cmd_term = g_settings_get_string (settings, "exec");
-        if (cmd_term[0] == '\0')
+        if (cmd_term[0] == '\0') {
+                g_free (cmd_term);
                 cmd_term = g_strdup ("gnome-terminal");
-
+        }
         cmd_args = g_settings_get_string (settings, "exec-arg");
-        if (strcmp (cmd_term, "") != 0) {
+
+        if (cmd_args[0] != '\0')
                 cmd = g_strdup_printf ("%s %s -e", cmd_term, cmd_args);
-        } else {
+        else
                 cmd = g_strdup_printf ("%s -e", cmd_term);
-        }
+
+        g_free (priv->term_exec);
+        priv->term_exec = cmd_term;
+
+        g_strfreev (priv->term_argv);
+        priv->term_argv = NULL;
+        if (!g_shell_parse_argv (cmd, NULL, &priv->term_argv, NULL))
+                g_warning ("Couldn't parse terminal command: %s", cmd);
+
+        /* Templates may have been built around the old terminal */
+        launch_templates_clear (manager);
 
         g_free (cmd_args);
-        g_free (cmd_term);
-        g_object_unref (settings);
+        g_free (cmd);
+}
 
-        return cmd;
+static void
+launch_env_set (CsdMediaKeysManager *manager,
+                char               **envp)
+{
+        g_strfreev (manager->priv->launch_env);
+        manager->priv->launch_env = envp;
 }
 
-static char **
-get_keyring_env (CsdMediaKeysManager *manager)
+static void
+keyring_get_environment_cb (GObject             *source_object,
+                            GAsyncResult        *res,
+                            CsdMediaKeysManager *manager)
 {
 	GError *error = NULL;
 	GVariant *variant, *item;
 	GVariantIter *iter;
 	char **envp;
 
-	variant = g_dbus_connection_call_sync (manager->priv->connection,
-					       GNOME_KEYRING_DBUS_NAME,
-					       GNOME_KEYRING_DBUS_PATH,
-					       GNOME_KEYRING_DBUS_INTERFACE,
-					       "GetEnvironment",
-					       NULL,
-					       NULL,
-					       G_DBUS_CALL_FLAGS_NONE,
-					       -1,
-					       NULL,
-					       &error);
+	variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
 	if (variant == NULL) {
-		g_warning ("Failed to call GetEnvironment on keyring daemon: %s", error->message);
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Failed to call GetEnvironment on keyring daemon: %s", error->message);
 		g_error_free (error);
-		return NULL;
+		return;
 	}
 
 	envp = g_get_environ ();
@@ -316,56 +520,149 @@ get_keyring_env (CsdMediaKeysManager *manager)
 	g_variant_iter_free (iter);
 	g_variant_unref (variant);
 
-	return envp;
+	g_debug ("Refreshed keyring launch environment");
+	launch_env_set (manager, envp);
 }
 
+/* The keyring only hands out a new environment when it (re)starts, so
+ * fetch it once per name owner instead of on every key press. */
 static void
-execute (CsdMediaKeysManager *manager,
-         char                *cmd,
-         gboolean             need_term)
+keyring_appeared_cb (GDBusConnection     *connection,
+                     const gchar         *name,
+                     const gchar         *name_owner,
+                     CsdMediaKeysManager *manager)
+{
+        g_dbus_connection_call (connection,
+                                name_owner,
+                                GNOME_KEYRING_DBUS_PATH,
+                                GNOME_KEYRING_DBUS_INTERFACE,
+                                "GetEnvironment",
+                                NULL,
+                                G_VARIANT_TYPE ("(a{ss})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                manager->priv->bus_cancellable,
+                                (GAsyncReadyCallback) keyring_get_environment_cb,
+                                manager);
+}
+
+static void
+keyring_vanished_cb (GDBusConnection     *connection,
+                     const gchar         *name,
+                     CsdMediaKeysManager *manager)
 {
-        gboolean retval;
-        char   **argv;
-        int      argc;
-        char    *exec;
-        char    *term = NULL;
-        GError  *error = NULL;
+        launch_env_set (manager, NULL);
+}
 
-        retval = FALSE;
+static char **
+get_launch_template (CsdMediaKeysManager *manager,
+                     const char          *cmd)
+{
+        char **argv;
+        GError *error = NULL;
 
-        if (need_term)
-                term = get_term_command (manager);
+        argv = g_hash_table_lookup (manager->priv->launch_templates, cmd);
+        if (argv != NULL)
+                return argv;
 
-        if (term) {
-                exec = g_strdup_printf ("%s %s", term, cmd);
-                g_free (term);
-        } else {
-                exec = g_strdup (cmd);
+        if (!g_shell_parse_argv (cmd, NULL, &argv, &error)) {
+                g_warning ("Couldn't parse command: %s: %s", cmd, error->message);
+                g_error_free (error);
+                return NULL;
         }
 
-        if (g_shell_parse_argv (exec, &argc, &argv, NULL)) {
-		char   **envp;
+        g_hash_table_insert (manager->priv->launch_templates, g_strdup (cmd), argv);
+        return argv;
+}
+
+typedef struct {
+        char **argv;
+        char **envp;
+} LaunchData;
 
-		envp = get_keyring_env (manager);
+static void
+launch_data_free (LaunchData *data)
+{
+        g_strfreev (data->argv);
+        g_strfreev (data->envp);
+        g_free (data);
+}
 
-                retval = g_spawn_async (g_get_home_dir (),
-                                        argv,
-                                        envp,
-                                        G_SPAWN_SEARCH_PATH,
-                                        NULL,
-                                        NULL,
-                                        NULL,
-                                        &error);
+static void
+launch_thread (GTask        *task,
+               gpointer      source_object,
+               LaunchData   *data,
+               GCancellable *cancellable)
+{
+        GError *error = NULL;
 
-                g_strfreev (argv);
-                g_strfreev (envp);
+        if (!g_spawn_async (g_get_home_dir (),
+                            data->argv,
+                            data->envp,
+                            G_SPAWN_SEARCH_PATH,
+                            NULL,
+                            NULL,
+                            NULL,
+                            &error)) {
+                g_task_return_error (task, error);
+                return;
         }
 
-        if (retval == FALSE && error != NULL) {
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+launch_done (GObject      *source_object,
+             GAsyncResult *res,
+             gpointer      user_data)
+{
+        LaunchData *data;
+        GError *error = NULL;
+
+        if (!g_task_propagate_boolean (G_TASK (res), &error)) {
+                char *exec;
+
+                data = g_task_get_task_data (G_TASK (res));
+                exec = g_strjoinv (" ", data->argv);
                 g_warning ("Couldn't execute command: %s: %s", exec, error->message);
+                g_free (exec);
                 g_error_free (error);
         }
-        g_free (exec);
+}
+
+static void
+execute (CsdMediaKeysManager *manager,
+         const char          *cmd,
+         gboolean             need_term)
+{
+        CsdMediaKeysManagerPrivate *priv = manager->priv;
+        LaunchData *data;
+        GTask *task;
+        char **argv;
+        guint term_len, cmd_len, i;
+
+        argv = get_launch_template (manager, cmd);
+        if (argv == NULL)
+                return;
+
+        term_len = (need_term && priv->term_argv != NULL) ? g_strv_length (priv->term_argv) : 0;
+        cmd_len = g_strv_length (argv);
+
+        data = g_new0 (LaunchData, 1);
+        data->argv = g_new (char *, term_len + cmd_len + 1);
+        for (i = 0; i < term_len; i++)
+                data->argv[i] = g_strdup (priv->term_argv[i]);
+        for (i = 0; i < cmd_len; i++)
+                data->argv[term_len + i] = g_strdup (argv[i]);
+        data->argv[term_len + cmd_len] = NULL;
+        data->envp = g_strdupv (priv->launch_env);
+
+        /* Forking a large process can take a while; keep it off the
+         * key-press path */
+        task = g_task_new (NULL, NULL, launch_done, NULL);
+        g_task_set_task_data (task, data, (GDestroyNotify) launch_data_free);
+        g_task_run_in_thread (task, (GTaskThreadFunc) launch_thread);
+        g_object_unref (task);
 }
 
 static void 
@@ -416,6 +713,11 @@ show_osd (CsdMediaKeysManager *manager,
                                        "monitor", g_variant_new_int32 (monitor));
         g_variant_builder_close (&builder);
 
+        if (manager->priv->current_action >= 0)
+                action_trace_osd (manager,
+                                  manager->priv->current_action,
+                                  manager->priv->current_action_started);
+
         ensure_cancellable (&manager->priv->cinnamon_cancellable);
 
         g_dbus_proxy_call (manager->priv->cinnamon_proxy,
@@ -509,42 +811,19 @@ do_media_action (CsdMediaKeysManager *manager,
 static void
 do_terminal_action (CsdMediaKeysManager *manager)
 {
-        GSettings *settings;
-        char *term;
-
-        settings = g_settings_new ("org.cinnamon.desktop.default-applications.terminal");
-        term = g_settings_get_string (settings, "exec");
-
-        if (term)
-        execute (manager, term, FALSE);
-
-        g_free (term);
-        g_object_unref (settings);
+        if (manager->priv->term_exec)
+                execute (manager, manager->priv->term_exec, FALSE);
 }
 
 static void
-cinnamon_session_shutdown (CsdMediaKeysManager *manager)
+cinnamon_session_shutdown_cb (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
 {
 	GError *error = NULL;
 	GVariant *variant;
 
-	/* Shouldn't happen, but you never know */
-	if (manager->priv->connection == NULL) {
-		execute (manager, "cinnamon-session-quit --logout", FALSE);
-		return;
-	}
-
-	variant = g_dbus_connection_call_sync (manager->priv->connection,
-					       GNOME_SESSION_DBUS_NAME,
-					       GNOME_SESSION_DBUS_PATH,
-					       GNOME_SESSION_DBUS_INTERFACE,
-					       "Shutdown",
-					       NULL,
-					       NULL,
-					       G_DBUS_CALL_FLAGS_NONE,
-					       -1,
-					       NULL,
-					       &error);
+	variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
 	if (variant == NULL) {
 		g_warning ("Failed to call Shutdown on session manager: %s", error->message);
 		g_error_free (error);
@@ -553,6 +832,29 @@ cinnamon_session_shutdown (CsdMediaKeysManager *manager)
 	g_variant_unref (variant);
 }
 
+static void
+cinnamon_session_shutdown (CsdMediaKeysManager *manager)
+{
+	/* Shouldn't happen, but you never know */
+	if (manager->priv->connection == NULL) {
+		execute (manager, "cinnamon-session-quit --logout", FALSE);
+		return;
+	}
+
+	g_dbus_connection_call (manager->priv->connection,
+				GNOME_SESSION_DBUS_NAME,
+				GNOME_SESSION_DBUS_PATH,
+				GNOME_SESSION_DBUS_INTERFACE,
+				"Shutdown",
+				NULL,
+				NULL,
+				G_DBUS_CALL_FLAGS_NONE,
+				-1,
+				NULL,
+				cinnamon_session_shutdown_cb,
+				NULL);
+}
+
 static void
 do_logout_action (CsdMediaKeysManager *manager)
 {
@@ -702,124 +1004,306 @@ update_dialog (CsdMediaKeysManager *manager,
     icon = get_icon_name_for_volume (muted, vol);
     show_osd (manager, icon, vol, OSD_ALL_OUTPUTS);
     if (quiet == FALSE && sound_changed != FALSE && muted == FALSE) {
-        GSettings *settings = g_settings_new ("org.cinnamon.desktop.sound");
-        gboolean enabled = g_settings_get_boolean (settings, "volume-sound-enabled");
-        char *sound = g_settings_get_string (settings, "volume-sound-file");
-        if (enabled) {
+        GSettings *settings = manager->priv->sound_settings;
+        if (g_settings_get_boolean (settings, "volume-sound-enabled")) {
+            char *sound = g_settings_get_string (settings, "volume-sound-file");
             ca_context_change_device (manager->priv->ca, gvc_mixer_stream_get_name (stream));
             ca_context_play (manager->priv->ca, 1, CA_PROP_MEDIA_FILENAME, sound, NULL);
+            g_free (sound);
         }
-        g_free(sound);
-        g_object_unref (settings);
     }
 }
 
 #ifdef HAVE_GUDEV
+/* Which USB device a mixer stream or an input device hangs off is a
+ * property of the udev topology, so it is resolved once per stream and
+ * per device, when they appear, rather than when a key gets pressed */
+typedef struct {
+        char     *parent;
+        gboolean  is_source;
+} StreamParent;
+
+static void
+stream_parent_free (StreamParent *sp)
+{
+        g_free (sp->parent);
+        g_free (sp);
+}
+
 /* PulseAudio gives us /devices/... paths, when udev
  * expects /sys/devices/... paths. */
-static GUdevDevice *
-get_udev_device_for_sysfs_path (CsdMediaKeysManager *manager,
-				const char *sysfs_path)
+static char *
+get_usb_parent_for_sysfs_path (CsdMediaKeysManager *manager,
+                               const char          *sysfs_path)
 {
-	char *path;
-	GUdevDevice *dev;
+	char *path, *res;
+	GUdevDevice *dev, *parent;
+
+	if (sysfs_path == NULL)
+		return NULL;
 
 	path = g_strdup_printf ("/sys%s", sysfs_path);
 	dev = g_udev_client_query_by_sysfs_path (manager->priv->udev_client, path);
 	g_free (path);
+	if (dev == NULL)
+		return NULL;
 
-	return dev;
+	parent = g_udev_device_get_parent_with_subsystem (dev, "usb", "usb_device");
+	g_object_unref (dev);
+	if (parent == NULL)
+		return NULL;
+
+	res = g_strdup (g_udev_device_get_sysfs_path (parent));
+	g_object_unref (parent);
+
+	return res;
 }
 
-static GvcMixerStream *
-get_stream_for_device_id (CsdMediaKeysManager *manager,
-			  guint                deviceid,
-			  gboolean             is_source_stream)
+static GHashTable *
+usb_streams_for_kind (CsdMediaKeysManager *manager,
+                      gboolean             is_source)
+{
+        return is_source ? manager->priv->usb_sources : manager->priv->usb_sinks;
+}
+
+static void
+usb_streams_insert (CsdMediaKeysManager *manager,
+                    const char          *parent,
+                    gboolean             is_source,
+                    guint                id)
+{
+        GHashTable *table = usb_streams_for_kind (manager, is_source);
+
+        /* The first stream found on a device wins, as it always has */
+        if (!g_hash_table_lookup_extended (table, parent, NULL, NULL))
+                g_hash_table_insert (table, g_strdup (parent), GUINT_TO_POINTER (id));
+}
+
+static void
+index_stream (CsdMediaKeysManager *manager,
+              GvcMixerStream      *stream,
+              gboolean             is_source)
+{
+        StreamParent *sp;
+        char *parent;
+        guint id;
+
+        id = gvc_mixer_stream_get_id (stream);
+        if (g_hash_table_lookup (manager->priv->stream_parents, GUINT_TO_POINTER (id)) != NULL)
+                return;
+
+        parent = get_usb_parent_for_sysfs_path (manager, gvc_mixer_stream_get_sysfs_path (stream));
+        if (parent == NULL)
+                return;
+
+        sp = g_new0 (StreamParent, 1);
+        sp->parent = parent;
+        sp->is_source = is_source;
+        g_hash_table_insert (manager->priv->stream_parents, GUINT_TO_POINTER (id), sp);
+
+        usb_streams_insert (manager, parent, is_source, id);
+}
+
+static void
+unindex_stream (CsdMediaKeysManager *manager,
+                guint                id)
+{
+        GHashTable *table;
+        GHashTableIter iter;
+        StreamParent *sp;
+        gpointer other_id, value;
+        gpointer current;
+
+        sp = g_hash_table_lookup (manager->priv->stream_parents, GUINT_TO_POINTER (id));
+        if (sp == NULL)
+                return;
+
+        table = usb_streams_for_kind (manager, sp->is_source);
+        if (g_hash_table_lookup_extended (table, sp->parent, NULL, &current) &&
+            GPOINTER_TO_UINT (current) == id) {
+                g_hash_table_remove (table, sp->parent);
+
+                /* Fall back to another stream of the same kind on that device */
+                g_hash_table_iter_init (&iter, manager->priv->stream_parents);
+                while (g_hash_table_iter_next (&iter, &other_id, &value)) {
+                        StreamParent *other = value;
+
+                        if (GPOINTER_TO_UINT (other_id) != id &&
+                            other->is_source == sp->is_source &&
+                            g_str_equal (other->parent, sp->parent)) {
+                                usb_streams_insert (manager, other->parent,
+                                                    other->is_source,
+                                                    GPOINTER_TO_UINT (other_id));
+                                break;
+                        }
+                }
+        }
+
+        g_hash_table_remove (manager->priv->stream_parents, GUINT_TO_POINTER (id));
+}
+
+static void
+rebuild_stream_index (CsdMediaKeysManager *manager)
+{
+        GSList *streams, *l;
+
+        g_hash_table_remove_all (manager->priv->usb_sinks);
+        g_hash_table_remove_all (manager->priv->usb_sources);
+        g_hash_table_remove_all (manager->priv->stream_parents);
+
+        streams = gvc_mixer_control_get_sinks (manager->priv->volume);
+        for (l = streams; l; l = l->next)
+                index_stream (manager, l->data, FALSE);
+        g_slist_free (streams);
+
+        streams = gvc_mixer_control_get_sources (manager->priv->volume);
+        for (l = streams; l; l = l->next)
+                index_stream (manager, l->data, TRUE);
+        g_slist_free (streams);
+}
+
+static void
+on_control_stream_added (GvcMixerControl     *control,
+                         guint                id,
+                         CsdMediaKeysManager *manager)
+{
+        GvcMixerStream *stream;
+        GSList *sinks;
+        gboolean is_source;
+
+        stream = gvc_mixer_control_lookup_stream_id (control, id);
+        if (stream == NULL)
+                return;
+
+        sinks = gvc_mixer_control_get_sinks (control);
+        is_source = (g_slist_find (sinks, stream) == NULL);
+        g_slist_free (sinks);
+
+        index_stream (manager, stream, is_source);
+}
+
+/* Returns the sysfs path of the USB device an XInput device belongs
+ * to, or NULL if it isn't a USB device */
+static const char *
+resolve_device_parent (CsdMediaKeysManager *manager,
+                       guint                deviceid)
 {
 	char *devnode;
-	gpointer id_ptr;
-	GvcMixerStream *res;
+	char *res = NULL;
 	GUdevDevice *dev, *parent;
-	GSList *streams, *l;
-
-	id_ptr = g_hash_table_lookup (manager->priv->streams, GUINT_TO_POINTER (deviceid));
-	if (id_ptr != NULL) {
-		if (GPOINTER_TO_UINT (id_ptr) == (guint) -1)
-			return NULL;
-		else
-			return gvc_mixer_control_lookup_stream_id (manager->priv->volume, GPOINTER_TO_UINT (id_ptr));
-	}
 
 	devnode = xdevice_get_device_node (deviceid);
 	if (devnode == NULL) {
 		g_debug ("Could not find device node for XInput device %d", deviceid);
-		return NULL;
+		goto out;
 	}
 
 	dev = g_udev_client_query_by_device_file (manager->priv->udev_client, devnode);
 	if (dev == NULL) {
 		g_debug ("Could not find udev device for device path '%s'", devnode);
 		g_free (devnode);
-		return NULL;
+		goto out;
 	}
 	g_free (devnode);
 
 	if (g_strcmp0 (g_udev_device_get_property (dev, "ID_BUS"), "usb") != 0) {
 		g_debug ("Not handling XInput device %d, not USB", deviceid);
-		g_hash_table_insert (manager->priv->streams,
-				     GUINT_TO_POINTER (deviceid),
-				     GUINT_TO_POINTER ((guint) -1));
 		g_object_unref (dev);
-		return NULL;
+		goto out;
 	}
 
 	parent = g_udev_device_get_parent_with_subsystem (dev, "usb", "usb_device");
+	g_object_unref (dev);
 	if (parent == NULL) {
 		g_warning ("No USB device parent for XInput device %d even though it's USB", deviceid);
-		g_object_unref (dev);
-		return NULL;
+		goto out;
 	}
 
-	res = NULL;
-	if (is_source_stream) {
-		streams = gvc_mixer_control_get_sinks (manager->priv->volume);
-	} else {
-		streams = gvc_mixer_control_get_sources (manager->priv->volume);
-	}
-	for (l = streams; l; l = l->next) {
-		GvcMixerStream *stream = l->data;
-		const char *sysfs_path;
-		GUdevDevice *stream_dev, *stream_parent;
-
-		sysfs_path = gvc_mixer_stream_get_sysfs_path (stream);
-		stream_dev = get_udev_device_for_sysfs_path (manager, sysfs_path);
-		if (stream_dev == NULL)
-			continue;
-		stream_parent = g_udev_device_get_parent_with_subsystem (stream_dev, "usb", "usb_device");
-		g_object_unref (stream_dev);
-		if (stream_parent == NULL)
-			continue;
-
-		if (g_strcmp0 (g_udev_device_get_sysfs_path (stream_parent),
-			       g_udev_device_get_sysfs_path (parent)) == 0) {
-			res = stream;
-		}
-		g_object_unref (stream_parent);
-		if (res != NULL)
-			break;
-	}
+	res = g_strdup (g_udev_device_get_sysfs_path (parent));
+	g_object_unref (parent);
 
-	if (res)
-		g_hash_table_insert (manager->priv->streams,
-				     GUINT_TO_POINTER (deviceid),
-				     GUINT_TO_POINTER (gvc_mixer_stream_get_id (res)));
-	else
-		g_hash_table_insert (manager->priv->streams,
-				     GUINT_TO_POINTER (deviceid),
-				     GUINT_TO_POINTER ((guint) -1));
+out:
+	/* Remember misses too, as the empty string */
+	g_hash_table_insert (manager->priv->device_parents,
+			     GUINT_TO_POINTER (deviceid),
+			     res ? res : g_strdup (""));
 
 	return res;
 }
+
+static const char *
+get_device_parent (CsdMediaKeysManager *manager,
+                   guint                deviceid)
+{
+	const char *parent;
+
+	if (!g_hash_table_lookup_extended (manager->priv->device_parents,
+					   GUINT_TO_POINTER (deviceid),
+					   NULL, (gpointer *) &parent))
+		return resolve_device_parent (manager, deviceid);
+
+	return parent[0] != '\0' ? parent : NULL;
+}
+
+static void
+on_device_added (GdkDeviceManager    *device_manager,
+                 GdkDevice           *device,
+                 CsdMediaKeysManager *manager)
+{
+	if (gdk_device_get_device_type (device) != GDK_DEVICE_TYPE_SLAVE ||
+	    gdk_device_get_source (device) != GDK_SOURCE_KEYBOARD)
+		return;
+
+	resolve_device_parent (manager, gdk_x11_device_get_id (device));
+}
+
+static void
+on_device_removed (GdkDeviceManager    *device_manager,
+                   GdkDevice           *device,
+                   CsdMediaKeysManager *manager)
+{
+	/* XInput device IDs get reused */
+	g_hash_table_remove (manager->priv->device_parents,
+			     GUINT_TO_POINTER (gdk_x11_device_get_id (device)));
+}
+
+static void
+index_input_devices (CsdMediaKeysManager *manager)
+{
+	GdkDeviceManager *device_manager;
+	GList *devices, *l;
+
+	device_manager = gdk_display_get_device_manager (gdk_display_get_default ());
+	manager->priv->device_manager = device_manager;
+	manager->priv->device_added_id = g_signal_connect (device_manager, "device-added",
+							   G_CALLBACK (on_device_added), manager);
+	manager->priv->device_removed_id = g_signal_connect (device_manager, "device-removed",
+							     G_CALLBACK (on_device_removed), manager);
+
+	devices = gdk_device_manager_list_devices (device_manager, GDK_DEVICE_TYPE_SLAVE);
+	for (l = devices; l; l = l->next)
+		on_device_added (device_manager, l->data, manager);
+	g_list_free (devices);
+}
+
+static GvcMixerStream *
+get_stream_for_device_id (CsdMediaKeysManager *manager,
+			  guint                deviceid,
+			  gboolean             is_source_stream)
+{
+	const char *parent;
+	gpointer id;
+
+	parent = get_device_parent (manager, deviceid);
+	if (parent == NULL)
+		return NULL;
+
+	if (!g_hash_table_lookup_extended (usb_streams_for_kind (manager, is_source_stream),
+					   parent, NULL, &id))
+		return NULL;
+
+	return gvc_mixer_control_lookup_stream_id (manager->priv->volume, GPOINTER_TO_UINT (id));
+}
 #endif /* HAVE_GUDEV */
 
 static void
@@ -952,6 +1436,11 @@ on_control_state_changed (GvcMixerControl     *control,
 {
         update_default_sink (manager);
         update_default_source (manager);
+
+#ifdef HAVE_GUDEV
+        if (new_state == GVC_STATE_READY)
+                rebuild_stream_index (manager);
+#endif /* HAVE_GUDEV */
 }
 
 static void
@@ -970,18 +1459,6 @@ on_control_default_source_changed (GvcMixerControl     *control,
         update_default_source (manager);
 }
 
-#ifdef HAVE_GUDEV
-static gboolean
-remove_stream (gpointer key,
-	       gpointer value,
-	       gpointer id)
-{
-	if (GPOINTER_TO_UINT (value) == GPOINTER_TO_UINT (id))
-		return TRUE;
-	return FALSE;
-}
-#endif /* HAVE_GUDEV */
-
 static void
 on_control_stream_removed (GvcMixerControl     *control,
                            guint                id,
@@ -1001,7 +1478,7 @@ on_control_stream_removed (GvcMixerControl     *control,
         }
 
 #ifdef HAVE_GUDEV
-	g_hash_table_foreach_remove (manager->priv->streams, (GHRFunc) remove_stream, GUINT_TO_POINTER (id));
+	unindex_stream (manager, id);
 #endif
 }
 
@@ -1227,8 +1704,23 @@ handle_method_call (GDBusConnection       *connection,
         } else if (g_strcmp0 (method_name, "HandleKeybinding") == 0) {
                 CDesktopMediaKeyType action;
                 g_variant_get (parameters, "(u)", &action);
-                csd_media_keys_manager_handle_cinnamon_keybinding (manager, 0, action, CurrentTime);
+                /* Don't make the shell wait on the action itself */
                 g_dbus_method_invocation_return_value (invocation, NULL);
+                if (action < C_DESKTOP_MEDIA_KEY_SEPARATOR)
+                        csd_media_keys_manager_handle_cinnamon_keybinding (manager, 0, action, CurrentTime);
+        } else if (g_strcmp0 (method_name, "GetActionLatency") == 0) {
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(@a(usttttta(tt)))",
+                                                                      action_latency_get_stats (manager)));
+        } else if (g_strcmp0 (method_name, "GetMediaPlayerLatency") == 0) {
+                if (manager->priv->mpris_controller == NULL) {
+                        g_dbus_method_invocation_return_value (invocation,
+                                                               g_variant_new ("(a(sbttt))", NULL));
+                        return;
+                }
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(@a(sbttt))",
+                                                                      mpris_controller_get_stats (manager->priv->mpris_controller)));
         }
 }
 
@@ -1464,7 +1956,8 @@ update_screen_cb (GObject             *source_object,
         guint percentage;
         int output_id;
         GVariant *variant;
-        CsdMediaKeysManager *manager = CSD_MEDIA_KEYS_MANAGER (user_data);
+        CsdBrightnessActionData *data = (CsdBrightnessActionData *) user_data;
+        CsdMediaKeysManager *manager = data->manager;
 
         variant = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object),
                                             res, &error);
@@ -1472,13 +1965,17 @@ update_screen_cb (GObject             *source_object,
                 g_warning ("Failed to set new screen percentage: %s",
                            error->message);
                 g_error_free (error);
+                g_free (data);
                 return;
         }
+        action_trace_effect (manager, data->type, data->started);
 
         /* update the dialog with the new value */
         g_variant_get (variant, "(ui)", &percentage, &output_id);
         show_osd (manager, "display-brightness-symbolic", percentage, output_id);
+        action_trace_osd (manager, data->type, data->started);
         g_variant_unref (variant);
+        g_free (data);
 }
 
 static void
@@ -1509,7 +2006,7 @@ do_screen_brightness_action_real (GObject       *source_object,
                            -1,
                            NULL,
                            update_screen_cb,
-                           manager);
+                           data);
 
         g_variant_unref (old_percentage);
 }
@@ -1527,6 +2024,7 @@ do_screen_brightness_action (CsdMediaKeysManager *manager,
         CsdBrightnessActionData *data = g_new0 (CsdBrightnessActionData, 1);
         data->manager = manager;
         data->type = type;
+        data->started = manager->priv->current_action_started;
 
         g_dbus_proxy_call (manager->priv->power_screen_proxy,
                            "GetPercentage",
@@ -1546,7 +2044,8 @@ update_keyboard_cb (GObject             *source_object,
         GError *error = NULL;
         guint percentage;
         GVariant *new_percentage;
-        CsdMediaKeysManager *manager = CSD_MEDIA_KEYS_MANAGER (user_data);
+        CsdBrightnessActionData *data = (CsdBrightnessActionData *) user_data;
+        CsdMediaKeysManager *manager = data->manager;
 
         new_percentage = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object),
                                                    res, &error);
@@ -1554,19 +2053,24 @@ update_keyboard_cb (GObject             *source_object,
                 g_warning ("Failed to set new keyboard percentage: %s",
                            error->message);
                 g_error_free (error);
+                g_free (data);
                 return;
         }
+        action_trace_effect (manager, data->type, data->started);
 
         /* update the dialog with the new value */
         g_variant_get (new_percentage, "(u)", &percentage);
         show_osd (manager, "keyboard-brightness-symbolic", percentage, OSD_ALL_OUTPUTS);
+        action_trace_osd (manager, data->type, data->started);
         g_variant_unref (new_percentage);
+        g_free (data);
 }
 
 static void
 do_keyboard_brightness_action (CsdMediaKeysManager   *manager,
                                CDesktopMediaKeyType   type)
 {
+        CsdBrightnessActionData *data;
         const char *cmd;
 
         if (manager->priv->connection == NULL ||
@@ -1589,6 +2093,11 @@ do_keyboard_brightness_action (CsdMediaKeysManager   *manager,
                 g_assert_not_reached ();
         }
 
+        data = g_new0 (CsdBrightnessActionData, 1);
+        data->manager = manager;
+        data->type = type;
+        data->started = manager->priv->current_action_started;
+
         /* call into the power plugin */
         g_dbus_proxy_call (manager->priv->power_keyboard_proxy,
                            cmd,
@@ -1597,14 +2106,14 @@ do_keyboard_brightness_action (CsdMediaKeysManager   *manager,
                            -1,
                            NULL,
                            update_keyboard_cb,
-                           manager);
+                           data);
 }
 
 static gboolean
-do_action (CsdMediaKeysManager *manager,
-           guint                deviceid,
-           CDesktopMediaKeyType type,
-           gint64               timestamp)
+dispatch_action (CsdMediaKeysManager *manager,
+                 guint                deviceid,
+                 CDesktopMediaKeyType type,
+                 gint64               timestamp)
 {
         char *cmd;
 
@@ -1765,6 +2274,31 @@ do_action (CsdMediaKeysManager *manager,
         return FALSE;
 }
 
+static gboolean
+do_action (CsdMediaKeysManager *manager,
+           guint                deviceid,
+           CDesktopMediaKeyType type,
+           gint64               timestamp)
+{
+        CsdMediaKeysManagerPrivate *priv = manager->priv;
+        gint64 started;
+        gboolean ret;
+
+        started = g_get_monotonic_time ();
+        priv->current_action = type;
+        priv->current_action_started = started;
+
+        ret = dispatch_action (manager, deviceid, type, timestamp);
+
+        priv->current_action = -1;
+        priv->current_action_started = 0;
+
+        if (!action_is_async (type))
+                action_trace_effect (manager, type, started);
+
+        return ret;
+}
+
 static void
 update_theme_settings (GSettings           *settings,
 		       const char          *key,
@@ -1807,6 +2341,8 @@ start_media_keys_idle_cb (CsdMediaKeysManager *manager)
         /* for the power plugin interface code */
         manager->priv->power_settings = g_settings_new (SETTINGS_POWER_DIR);
 
+        manager->priv->sound_settings = g_settings_new ("org.cinnamon.desktop.sound");
+
         /* Logic from http://git.gnome.org/browse/gnome-shell/tree/js/ui/status/accessibility.js#n163 */
         manager->priv->interface_settings = g_settings_new (SETTINGS_INTERFACE_DIR);
         g_signal_connect (G_OBJECT (manager->priv->interface_settings), "changed::gtk-theme",
@@ -1820,8 +2356,19 @@ start_media_keys_idle_cb (CsdMediaKeysManager *manager)
 	}
 	manager->priv->icon_theme = g_settings_get_string (manager->priv->interface_settings, "icon-theme");
 
+        manager->priv->launch_templates = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                 g_free, (GDestroyNotify) g_strfreev);
+        manager->priv->terminal_settings = g_settings_new ("org.cinnamon.desktop.default-applications.terminal");
+        g_signal_connect (G_OBJECT (manager->priv->terminal_settings), "changed",
+                          G_CALLBACK (update_terminal_settings), manager);
+        update_terminal_settings (manager->priv->terminal_settings, NULL, manager);
+
         init_screens (manager);
 
+#ifdef HAVE_GUDEV
+        index_input_devices (manager);
+#endif /* HAVE_GUDEV */
+
         g_debug ("Starting mpris controller");
         manager->priv->mpris_controller = mpris_controller_new ();
 
@@ -1841,7 +2388,11 @@ csd_media_keys_manager_start (CsdMediaKeysManager *manager,
         cinnamon_settings_profile_start (NULL);
 
 #ifdef HAVE_GUDEV
-        manager->priv->streams = g_hash_table_new (g_direct_hash, g_direct_equal);
+        manager->priv->device_parents = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+        manager->priv->usb_sinks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        manager->priv->usb_sources = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        manager->priv->stream_parents = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                               NULL, (GDestroyNotify) stream_parent_free);
         manager->priv->udev_client = g_udev_client_new (subsystems);
 #endif
 
@@ -1871,6 +2422,12 @@ csd_media_keys_manager_start (CsdMediaKeysManager *manager,
                           "stream-removed",
                           G_CALLBACK (on_control_stream_removed),
                           manager);
+#ifdef HAVE_GUDEV
+        g_signal_connect (manager->priv->volume,
+                          "stream-added",
+                          G_CALLBACK (on_control_stream_added),
+                          manager);
+#endif /* HAVE_GUDEV */
 
         cinnamon_settings_profile_end ("gvc_mixer_control_new");
 
@@ -1903,9 +2460,26 @@ csd_media_keys_manager_stop (CsdMediaKeysManager *manager)
         }
 
 #ifdef HAVE_GUDEV
-        if (priv->streams) {
-                g_hash_table_destroy (priv->streams);
-                priv->streams = NULL;
+        if (priv->device_manager) {
+                g_signal_handler_disconnect (priv->device_manager, priv->device_added_id);
+                g_signal_handler_disconnect (priv->device_manager, priv->device_removed_id);
+                priv->device_manager = NULL;
+        }
+        if (priv->device_parents) {
+                g_hash_table_destroy (priv->device_parents);
+                priv->device_parents = NULL;
+        }
+        if (priv->usb_sinks) {
+                g_hash_table_destroy (priv->usb_sinks);
+                priv->usb_sinks = NULL;
+        }
+        if (priv->usb_sources) {
+                g_hash_table_destroy (priv->usb_sources);
+                priv->usb_sources = NULL;
+        }
+        if (priv->stream_parents) {
+                g_hash_table_destroy (priv->stream_parents);
+                priv->stream_parents = NULL;
         }
         if (priv->udev_client) {
                 g_object_unref (priv->udev_client);
@@ -1923,6 +2497,11 @@ csd_media_keys_manager_stop (CsdMediaKeysManager *manager)
                 priv->power_settings = NULL;
         }
 
+        if (priv->sound_settings) {
+                g_object_unref (priv->sound_settings);
+                priv->sound_settings = NULL;
+        }
+
         if (priv->power_screen_proxy) {
                 g_object_unref (priv->power_screen_proxy);
                 priv->power_screen_proxy = NULL;
@@ -1948,6 +2527,28 @@ csd_media_keys_manager_stop (CsdMediaKeysManager *manager)
             priv->cinnamon_proxy = NULL;
         }
 
+        if (priv->keyring_watch_id != 0) {
+                g_bus_unwatch_name (priv->keyring_watch_id);
+                priv->keyring_watch_id = 0;
+        }
+
+        if (priv->terminal_settings) {
+                g_object_unref (priv->terminal_settings);
+                priv->terminal_settings = NULL;
+        }
+
+        if (priv->launch_templates) {
+                g_hash_table_destroy (priv->launch_templates);
+                priv->launch_templates = NULL;
+        }
+
+        g_free (priv->term_exec);
+        priv->term_exec = NULL;
+        g_strfreev (priv->term_argv);
+        priv->term_argv = NULL;
+        g_strfreev (priv->launch_env);
+        priv->launch_env = NULL;
+
         if (priv->cancellable != NULL) {
                 g_cancellable_cancel (priv->cancellable);
                 g_object_unref (priv->cancellable);
@@ -2079,42 +2680,22 @@ inhibit_done (GObject      *source,
 }
 
 static void
-csd_media_keys_manager_init (CsdMediaKeysManager *manager)
+logind_proxy_ready (GObject      *source,
+                    GAsyncResult *result,
+                    gpointer      user_data)
 {
-        GError *error;
-        GDBusConnection *bus;
-
-        error = NULL;
-        manager->priv = CSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
-
-        bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-        if (bus == NULL) {
-                g_warning ("Failed to connect to system bus: %s",
-                           error->message);
-                g_error_free (error);
-                return;
-        }
-
-        manager->priv->logind_proxy =
-                g_dbus_proxy_new_sync (bus,
-                                       0,
-                                       NULL,
-                                       LOGIND_DBUS_NAME,
-                                       LOGIND_DBUS_PATH,
-                                       LOGIND_DBUS_INTERFACE,
-                                       NULL,
-                                       &error);
+        CsdMediaKeysManager *manager = CSD_MEDIA_KEYS_MANAGER (user_data);
+        GError *error = NULL;
 
+        manager->priv->logind_proxy = cinnamon_settings_bus_get_proxy_finish (result, &error);
         if (manager->priv->logind_proxy == NULL) {
                 g_warning ("Failed to connect to logind: %s",
                            error->message);
                 g_error_free (error);
+                return;
         }
 
-        g_object_unref (bus);
-
         g_debug ("Adding system inhibitors for power keys");
-        manager->priv->inhibit_keys_fd = -1;
         g_dbus_proxy_call_with_unix_fd_list (manager->priv->logind_proxy,
                                              "Inhibit",
                                              g_variant_new ("(ssss)",
@@ -2128,7 +2709,23 @@ csd_media_keys_manager_init (CsdMediaKeysManager *manager)
                                              NULL,
                                              inhibit_done,
                                              manager);
+}
 
+static void
+csd_media_keys_manager_init (CsdMediaKeysManager *manager)
+{
+        manager->priv = CSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        manager->priv->current_action = -1;
+        manager->priv->inhibit_keys_fd = -1;
+
+        cinnamon_settings_bus_get_proxy (G_BUS_TYPE_SYSTEM,
+                                         G_DBUS_PROXY_FLAGS_NONE,
+                                         LOGIND_DBUS_NAME,
+                                         LOGIND_DBUS_PATH,
+                                         LOGIND_DBUS_INTERFACE,
+                                         NULL,
+                                         logind_proxy_ready,
+                                         manager);
 }
 
 static void
@@ -2264,6 +2861,15 @@ on_bus_gotten (GObject             *source_object,
                                            NULL,
                                            NULL);
 
+        manager->priv->keyring_watch_id =
+                g_bus_watch_name_on_connection (connection,
+                                                GNOME_KEYRING_DBUS_NAME,
+                                                G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                (GBusNameAppearedCallback) keyring_appeared_cb,
+                                                (GBusNameVanishedCallback) keyring_vanished_cb,
+                                                manager,
+                                                NULL);
+
         g_dbus_proxy_new (manager->priv->connection,
                           G_DBUS_PROXY_FLAGS_NONE,
                           NULL,
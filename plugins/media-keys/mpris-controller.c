@@ -28,20 +28,57 @@ G_DEFINE_TYPE (MprisController, mpris_controller, G_TYPE_OBJECT)
 struct _MprisControllerPrivate
 {
   GCancellable *cancellable;
-  GDBusProxy *mpris_client_proxy;
   guint namespace_watcher_id;
-  GSList *other_players;
-  gboolean connecting;
+  GHashTable *players; /* key = bus name, value = MprisPlayer */
+  MprisPlayer *target;
 };
 
+/* Everything we know about a player. The proxy keeps PlaybackStatus and
+ * the Can* properties up to date from PropertiesChanged, so choosing a
+ * player when a key comes in doesn't need to ask anybody anything. */
+struct _MprisPlayer
+{
+  MprisController *controller;
+  gchar *name;
+  GDBusProxy *proxy;
+  GCancellable *cancellable;
+  gint64 last_active;
+
+  /* Dispatch latency, in microseconds */
+  guint64 calls;
+  guint64 total;
+  guint64 max;
+};
+
+typedef struct
+{
+  MprisController *controller;
+  gchar *name;
+  gint64 started;
+} MprisCall;
+
+static void
+mpris_player_free (MprisPlayer *player)
+{
+  g_cancellable_cancel (player->cancellable);
+  g_object_unref (player->cancellable);
+  if (player->proxy)
+    g_signal_handlers_disconnect_by_data (player->proxy, player);
+  g_clear_object (&player->proxy);
+  g_free (player->name);
+  g_free (player);
+}
 
 static void
 mpris_controller_dispose (GObject *object)
 {
   MprisControllerPrivate *priv = MPRIS_CONTROLLER (object)->priv;
 
-  g_clear_object (&priv->cancellable);
-  g_clear_object (&priv->mpris_client_proxy);
+  if (priv->cancellable)
+    {
+      g_cancellable_cancel (priv->cancellable);
+      g_clear_object (&priv->cancellable);
+    }
 
   if (priv->namespace_watcher_id)
     {
@@ -49,86 +86,232 @@ mpris_controller_dispose (GObject *object)
       priv->namespace_watcher_id = 0;
     }
 
-  if (priv->other_players)
+  priv->target = NULL;
+  if (priv->players)
     {
-      g_slist_free_full (priv->other_players, g_free);
-      priv->other_players = NULL;
+      g_hash_table_destroy (priv->players);
+      priv->players = NULL;
     }
 
   G_OBJECT_CLASS (mpris_controller_parent_class)->dispose (object);
 }
 
+static gboolean
+mpris_player_get_boolean (MprisPlayer *player,
+                          const gchar *property,
+                          gboolean     fallback)
+{
+  GVariant *value;
+  gboolean res;
+
+  value = g_dbus_proxy_get_cached_property (player->proxy, property);
+  if (value == NULL)
+    return fallback;
+
+  res = g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN) ?
+    g_variant_get_boolean (value) : fallback;
+  g_variant_unref (value);
+
+  return res;
+}
+
+static gint
+mpris_player_get_rank (MprisPlayer *player)
+{
+  GVariant *value;
+  const gchar *status;
+  gint rank = 0;
+
+  if (player->proxy == NULL)
+    return -1;
+
+  if (!mpris_player_get_boolean (player, "CanControl", TRUE))
+    return -1;
+
+  value = g_dbus_proxy_get_cached_property (player->proxy, "PlaybackStatus");
+  if (value == NULL)
+    return 0;
+
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
+    {
+      status = g_variant_get_string (value, NULL);
+      if (g_strcmp0 (status, "Playing") == 0)
+        rank = 2;
+      else if (g_strcmp0 (status, "Paused") == 0)
+        rank = 1;
+    }
+  g_variant_unref (value);
+
+  return rank;
+}
+
+/* Pick the player media keys should go to: one that is playing, then
+ * one that is paused, then anything else, the most recently active
+ * first in each case. */
+static void
+mpris_controller_update_target (MprisController *self)
+{
+  MprisControllerPrivate *priv = self->priv;
+  GHashTableIter iter;
+  gpointer value;
+  MprisPlayer *best = NULL;
+  gint best_rank = -1;
+
+  g_hash_table_iter_init (&iter, priv->players);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      MprisPlayer *player = value;
+      gint rank;
+
+      rank = mpris_player_get_rank (player);
+      if (rank < 0)
+        continue;
+
+      if (best == NULL ||
+          rank > best_rank ||
+          (rank == best_rank && player->last_active > best->last_active))
+        {
+          best = player;
+          best_rank = rank;
+        }
+    }
+
+  if (best != priv->target)
+    g_debug ("media keys now go to mpris client %s", best ? best->name : "(none)");
+
+  priv->target = best;
+}
+
 static void
 mpris_proxy_call_done (GObject      *object,
                        GAsyncResult *res,
                        gpointer      user_data)
 {
+  MprisCall *call = user_data;
+  MprisPlayer *player = NULL;
   GError *error = NULL;
   GVariant *ret;
 
   if (!(ret = g_dbus_proxy_call_finish (G_DBUS_PROXY (object), res, &error)))
     {
-      g_warning ("Error calling method %s", error->message);
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Error calling method %s", error->message);
       g_clear_error (&error);
-      return;
+      goto out;
     }
   g_variant_unref (ret);
+
+  /* The player may have gone away in the meantime */
+  if (call->controller->priv->players != NULL)
+    player = g_hash_table_lookup (call->controller->priv->players, call->name);
+  if (player != NULL)
+    {
+      guint64 elapsed = g_get_monotonic_time () - call->started;
+
+      player->calls++;
+      player->total += elapsed;
+      player->max = MAX (player->max, elapsed);
+    }
+
+out:
+  g_object_unref (call->controller);
+  g_free (call->name);
+  g_free (call);
 }
 
 gboolean
 mpris_controller_key (MprisController *self, const gchar *key)
 {
   MprisControllerPrivate *priv = MPRIS_CONTROLLER (self)->priv;
+  MprisPlayer *player = priv->target;
+  MprisCall *call;
 
-  if (!priv->mpris_client_proxy)
+  if (player == NULL)
     return FALSE;
 
   if (g_strcmp0 (key, "Play") == 0)
     key = "PlayPause";
 
-  g_debug ("calling %s over dbus to mpris client %s",
-           key, g_dbus_proxy_get_name (priv->mpris_client_proxy));
-  g_dbus_proxy_call (priv->mpris_client_proxy,
+  player->last_active = g_get_monotonic_time ();
+
+  call = g_new0 (MprisCall, 1);
+  call->controller = g_object_ref (self);
+  call->name = g_strdup (player->name);
+  call->started = player->last_active;
+
+  g_debug ("calling %s over dbus to mpris client %s", key, player->name);
+  g_dbus_proxy_call (player->proxy,
                      key, NULL, 0, -1, priv->cancellable,
                      mpris_proxy_call_done,
-                     NULL);
+                     call);
   return TRUE;
 }
 
-static void
-mpris_proxy_ready_cb (GObject      *object,
-                      GAsyncResult *res,
-                      gpointer      user_data)
+GVariant *
+mpris_controller_get_stats (MprisController *self)
 {
-  MprisControllerPrivate *priv = MPRIS_CONTROLLER (user_data)->priv;
-  GError *error = NULL;
+  MprisControllerPrivate *priv = MPRIS_CONTROLLER (self)->priv;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sbttt)"));
+
+  g_hash_table_iter_init (&iter, priv->players);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      MprisPlayer *player = value;
+
+      g_variant_builder_add (&builder, "(sbttt)",
+                             player->name,
+                             player == priv->target,
+                             player->calls,
+                             player->total,
+                             player->max);
+    }
 
-  priv->mpris_client_proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
+  return g_variant_builder_end (&builder);
+}
 
-  if (!priv->mpris_client_proxy)
-    g_warning ("Error connecting to mpris interface %s", error->message);
+static void
+mpris_player_properties_changed (GDBusProxy  *proxy,
+                                 GVariant    *changed_properties,
+                                 GStrv        invalidated_properties,
+                                 MprisPlayer *player)
+{
+  const gchar *status;
 
-  priv->connecting = FALSE;
+  if (g_variant_lookup (changed_properties, "PlaybackStatus", "&s", &status) &&
+      g_strcmp0 (status, "Playing") == 0)
+    player->last_active = g_get_monotonic_time ();
 
-  g_clear_error (&error);
+  mpris_controller_update_target (player->controller);
 }
 
 static void
-start_mpris_proxy (MprisController *self, const gchar *name)
+mpris_proxy_ready_cb (GObject      *object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
 {
-  MprisControllerPrivate *priv = MPRIS_CONTROLLER (self)->priv;
+  MprisPlayer *player = user_data;
+  GDBusProxy *proxy;
+  GError *error = NULL;
 
-  g_debug ("Creating proxy for for %s", name);
-  g_dbus_proxy_new_for_bus (G_BUS_TYPE_SESSION,
-                            0,
-                            NULL,
-                            name,
-                            "/org/mpris/MediaPlayer2",
-                            "org.mpris.MediaPlayer2.Player",
-                            priv->cancellable,
-                            mpris_proxy_ready_cb,
-                            self);
-  priv->connecting = TRUE;
+  proxy = g_dbus_proxy_new_finish (res, &error);
+  if (!proxy)
+    {
+      /* Cancelled when the player goes away, don't touch it then */
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Error connecting to mpris interface %s", error->message);
+      g_clear_error (&error);
+      return;
+    }
+
+  player->proxy = proxy;
+  g_signal_connect (proxy, "g-properties-changed",
+                    G_CALLBACK (mpris_player_properties_changed), player);
+
+  mpris_controller_update_target (player->controller);
 }
 
 static void
@@ -139,11 +322,28 @@ mpris_player_appeared (GDBusConnection *connection,
 {
   MprisController *self = user_data;
   MprisControllerPrivate *priv = MPRIS_CONTROLLER (self)->priv;
+  MprisPlayer *player;
+
+  if (g_hash_table_lookup (priv->players, name) != NULL)
+    return;
+
+  player = g_new0 (MprisPlayer, 1);
+  player->controller = self;
+  player->name = g_strdup (name);
+  player->cancellable = g_cancellable_new ();
+  player->last_active = g_get_monotonic_time ();
+  g_hash_table_insert (priv->players, player->name, player);
 
-  if (priv->mpris_client_proxy == NULL && !priv->connecting)
-    start_mpris_proxy (self, name);
-  else
-    self->priv->other_players = g_slist_prepend (self->priv->other_players, g_strdup (name));
+  g_debug ("Creating proxy for for %s", name);
+  g_dbus_proxy_new (connection,
+                    G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                    NULL,
+                    name,
+                    "/org/mpris/MediaPlayer2",
+                    "org.mpris.MediaPlayer2.Player",
+                    player->cancellable,
+                    mpris_proxy_ready_cb,
+                    player);
 }
 
 static void
@@ -153,28 +353,17 @@ mpris_player_vanished (GDBusConnection *connection,
 {
   MprisController *self = user_data;
   MprisControllerPrivate *priv = MPRIS_CONTROLLER (self)->priv;
+  MprisPlayer *player;
 
-  if (priv->mpris_client_proxy &&
-      g_strcmp0 (name, g_dbus_proxy_get_name (priv->mpris_client_proxy)) == 0)
-    {
-      g_clear_object (&priv->mpris_client_proxy);
-
-      /* take the next one if there's one */
-      if (self->priv->other_players && !priv->connecting)
-        {
-          GSList *first;
-          gchar *name;
-
-          first = self->priv->other_players;
-          name = first->data;
+  player = g_hash_table_lookup (priv->players, name);
+  if (player == NULL)
+    return;
 
-          start_mpris_proxy (self, name);
+  if (player == priv->target)
+    priv->target = NULL;
+  g_hash_table_remove (priv->players, name);
 
-          self->priv->other_players = self->priv->other_players->next;
-          g_free (name);
-          g_slist_free_1 (first);
-        }
-    }
+  mpris_controller_update_target (self);
 }
 
 static void
@@ -205,6 +394,9 @@ static void
 mpris_controller_init (MprisController *self)
 {
   self->priv = CONTROLLER_PRIVATE (self);
+  self->priv->cancellable = g_cancellable_new ();
+  self->priv->players = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               NULL, (GDestroyNotify) mpris_player_free);
 }
 
 MprisController *
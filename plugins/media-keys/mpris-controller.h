@@ -33,6 +33,7 @@ G_BEGIN_DECLS
 typedef struct _MprisController MprisController;
 typedef struct _MprisControllerClass MprisControllerClass;
 typedef struct _MprisControllerPrivate MprisControllerPrivate;
+typedef struct _MprisPlayer MprisPlayer;
 
 struct _MprisController
 {
@@ -50,6 +51,7 @@ GType mpris_controller_get_type (void) G_GNUC_CONST;
 
 MprisController *mpris_controller_new (void);
 gboolean         mpris_controller_key (MprisController *self, const gchar *key);
+GVariant        *mpris_controller_get_stats (MprisController *self);
 
 G_END_DECLS
 
@@ -22,6 +22,8 @@
 #include "config.h"
 
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <glib-object.h>
 #include <locale.h>
 #include <sys/types.h>
@@ -120,6 +122,109 @@ out:
 	return ret;
 }
 
+static gboolean
+csd_backlight_helper_read (gint fd, gint *value, GError **error)
+{
+	gchar text[32];
+	gchar *endptr = NULL;
+	gssize len;
+
+	len = pread (fd, text, sizeof (text) - 1, 0);
+	if (len <= 0) {
+		g_set_error (error, 1, 0, "failed to read brightness");
+		return FALSE;
+	}
+	text[len] = '\0';
+
+	*value = g_ascii_strtoll (text, &endptr, 10);
+	if (endptr == text) {
+		g_set_error (error, 1, 0, "failed to parse value: %s", text);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Serves requests on stdin until the session daemon closes it, so that
+ * only one process and one authorization are needed per session.
+ *
+ * Each request is a single line, "get-brightness", "get-max-brightness"
+ * or "set-brightness <value>", and is answered with either "ok <value>"
+ * or "error <message>". "ok <max> <device>" is sent once the device is
+ * open, with the name of the device in /sys/class/backlight.
+ */
+static guint
+csd_backlight_helper_serve (const gchar *filename)
+{
+	gchar *filename_file;
+	gchar *contents = NULL;
+	gchar *name;
+	gchar line[64];
+	GError *error = NULL;
+	gint max_brightness;
+	gint value;
+	gint fd;
+	gboolean can_write;
+
+	filename_file = g_build_filename (filename, "max_brightness", NULL);
+	if (!g_file_get_contents (filename_file, &contents, NULL, &error)) {
+		g_print ("error %s\n", error->message);
+		g_error_free (error);
+		g_free (filename_file);
+		return CSD_BACKLIGHT_HELPER_EXIT_CODE_FAILED;
+	}
+	max_brightness = atoi (contents);
+	g_free (contents);
+	g_free (filename_file);
+
+	/* keep the device open, sysfs attributes can be re-read with pread() */
+	filename_file = g_build_filename (filename, "brightness", NULL);
+	can_write = (getuid () == 0 && geteuid () == 0);
+	fd = open (filename_file, can_write ? O_RDWR : O_RDONLY);
+	g_free (filename_file);
+	if (fd < 0) {
+		g_print ("error failed to open %s\n", filename);
+		return CSD_BACKLIGHT_HELPER_EXIT_CODE_FAILED;
+	}
+
+	setvbuf (stdout, NULL, _IOLBF, 0);
+	name = g_path_get_basename (filename);
+	g_print ("ok %i %s\n", max_brightness, name);
+	g_free (name);
+
+	while (fgets (line, sizeof (line), stdin) != NULL) {
+		g_strchomp (line);
+
+		if (g_strcmp0 (line, "get-max-brightness") == 0) {
+			g_print ("ok %i\n", max_brightness);
+		} else if (g_strcmp0 (line, "get-brightness") == 0) {
+			if (csd_backlight_helper_read (fd, &value, &error)) {
+				g_print ("ok %i\n", value);
+			} else {
+				g_print ("error %s\n", error->message);
+				g_clear_error (&error);
+			}
+		} else if (g_str_has_prefix (line, "set-brightness ")) {
+			if (!can_write) {
+				g_print ("error %s\n",
+					 "This program can only be used by the root user");
+				continue;
+			}
+			value = CLAMP (atoi (line + strlen ("set-brightness ")), 0, max_brightness);
+			g_snprintf (line, sizeof (line), "%i", value);
+			if (pwrite (fd, line, strlen (line), 0) == (gssize) strlen (line))
+				g_print ("ok %i\n", value);
+			else
+				g_print ("error writing '%s' to %s failed\n", line, filename);
+		} else {
+			g_print ("error %s\n", "No valid option was specified");
+		}
+	}
+
+	close (fd);
+	return CSD_BACKLIGHT_HELPER_EXIT_CODE_SUCCESS;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -132,6 +237,7 @@ main (int argc, char *argv[])
 	gint set_brightness = -1;
 	gboolean get_brightness = FALSE;
 	gboolean get_max_brightness = FALSE;
+	gboolean daemon = FALSE;
 	gchar *filename = NULL;
 	gchar *filename_file = NULL;
 	gchar *contents = NULL;
@@ -147,6 +253,9 @@ main (int argc, char *argv[])
 		{ "get-max-brightness", '\0', 0, G_OPTION_ARG_NONE, &get_max_brightness,
 		   /* command line argument */
 		  "Get the number of brightness levels supported", NULL },
+		{ "daemon", '\0', 0, G_OPTION_ARG_NONE, &daemon,
+		   /* command line argument */
+		  "Keep running and serve requests from stdin", NULL },
         { "backlight-preference", 'b', 0, G_OPTION_ARG_STRING_ARRAY,
           &backlight_preference_order,
 		   /* command line argument */
@@ -170,7 +279,7 @@ main (int argc, char *argv[])
 #endif
 
 	/* no input */
-	if (set_brightness == -1 && !get_brightness && !get_max_brightness) {
+	if (set_brightness == -1 && !get_brightness && !get_max_brightness && !daemon) {
 		g_print ("%s\n", "No valid option was specified");
 		retval = CSD_BACKLIGHT_HELPER_EXIT_CODE_ARGUMENTS_INVALID;
 		goto out;
@@ -187,6 +296,12 @@ main (int argc, char *argv[])
 		goto out;
 	}
 
+	/* serve requests until the session goes away */
+	if (daemon) {
+		retval = csd_backlight_helper_serve (filename);
+		goto out;
+	}
+
 	/* GetBrightness */
 	if (get_brightness) {
 		filename_file = g_build_filename (filename, "brightness", NULL);
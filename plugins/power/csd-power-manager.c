@@ -26,6 +26,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
 #include <glib/gi18n.h>
 #include <gdk/gdkx.h>
 #include <gtk/gtk.h>
@@ -33,6 +36,9 @@
 #include <libnotify/notify.h>
 #include <canberra-gtk.h>
 #include <gio/gunixfdlist.h>
+#ifdef HAVE_GUDEV
+#include <gudev/gudev.h>
+#endif
 
 #include <X11/extensions/dpms.h>
 
@@ -42,6 +48,7 @@
 #include "gpm-common.h"
 #include "gpm-phone.h"
 #include "gpm-idletime.h"
+#include "cinnamon-settings-bus.h"
 #include "cinnamon-settings-profile.h"
 #include "cinnamon-settings-session.h"
 #include "csd-enums.h"
@@ -53,6 +60,7 @@
 #define GNOME_SESSION_DBUS_PATH_PRESENCE        "/org/gnome/SessionManager/Presence"
 #define GNOME_SESSION_DBUS_INTERFACE            "org.gnome.SessionManager"
 #define GNOME_SESSION_DBUS_INTERFACE_PRESENCE   "org.gnome.SessionManager.Presence"
+#define GNOME_SESSION_DBUS_INTERFACE_INHIBITOR  "org.gnome.SessionManager.Inhibitor"
 
 #define UPOWER_DBUS_NAME                        "org.freedesktop.UPower"
 #define UPOWER_DBUS_PATH                        "/org/freedesktop/UPower"
@@ -91,6 +99,12 @@
 
 #define XSCREENSAVER_WATCHDOG_TIMEOUT                   120 /* seconds */
 
+/* number of flags in the session inhibitor mask that are tracked */
+#define SESSION_INHIBIT_BITS                            8
+
+/* caps the rate of writes to the X server or sysfs while fading */
+#define BACKLIGHT_TRANSITION_INTERVAL                   33 /* ms */
+
 enum {
         CSD_POWER_IDLETIME_NULL_ID,
         CSD_POWER_IDLETIME_DIM_ID,
@@ -170,6 +184,73 @@ abs_to_percentage (int min, int max, int value)
 
 #define CSD_POWER_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CSD_TYPE_POWER_MANAGER, CsdPowerManagerPrivate))
 
+/* what the engine last read from a device, so that a change to one
+ * device does not need all the others to be read again */
+typedef struct {
+        CsdPowerManager         *manager;
+        UpDeviceKind             kind;
+        UpDeviceState            state;
+        gboolean                 is_present;
+        gdouble                  percentage;
+        gdouble                  energy;
+        gdouble                  energy_full;
+        gdouble                  energy_rate;
+        gint64                   time_to_empty;
+        gint64                   time_to_full;
+        gchar                   *summary;
+        guint                    refresh_id;
+} EngineDeviceInfo;
+
+/* totals over all the devices of one kind */
+typedef struct {
+        gint                     devices;
+        gint                     charging;
+        gint                     discharging;
+        gint                     not_fully_charged;
+        gdouble                  energy;
+        gdouble                  energy_full;
+        gdouble                  energy_rate;
+} EngineKindTotals;
+
+typedef enum {
+        BACKLIGHT_INTERFACE_NONE,
+        BACKLIGHT_INTERFACE_XRANDR,
+        BACKLIGHT_INTERFACE_HELPER
+} BacklightInterface;
+
+/* what is known about the panel backlight, refreshed on RandR and udev changes */
+typedef struct {
+        BacklightInterface       interface;
+        GnomeRROutput           *output;
+        gint                     min;
+        gint                     max;
+        gint                     step;
+        gint                     now;
+} BacklightDevice;
+
+typedef void (*BacklightHelperFunc) (CsdPowerManager *manager,
+                                     gint64 value,
+                                     const gchar *name,
+                                     const GError *error,
+                                     gpointer user_data);
+
+typedef struct {
+        CsdPowerManager         *manager;
+        BacklightHelperFunc      func;
+        gpointer                 user_data;
+} BacklightHelperRequest;
+
+/* a csd-backlight-helper --daemon, talked to over a socketpair */
+typedef struct {
+        CsdPowerManager         *manager;
+        gboolean                 privileged;
+        gint                     fd;
+        GIOChannel              *channel;
+        guint                    watch_id;
+        GString                 *buffer;
+        GQueue                  *requests;      /* one per reply still to come */
+} BacklightHelper;
+
 typedef enum {
         CSD_POWER_IDLE_MODE_NORMAL,
         CSD_POWER_IDLE_MODE_DIM,
@@ -194,6 +275,25 @@ struct CsdPowerManagerPrivate
         GDBusProxy              *upower_kdb_proxy;
         gboolean				backlight_helper_force;
         gchar*                  backlight_helper_preference_args;
+        BacklightHelper          backlight_reader;      /* unprivileged */
+        BacklightHelper          backlight_writer;      /* through pkexec */
+        gboolean                 backlight_set_in_flight;
+        gint                     backlight_set_pending;
+        BacklightDevice          backlight;
+        gboolean                 backlight_probed;
+        guint                    backlight_probe_serial;
+        gint                     backlight_probe_max;
+        gchar                   *backlight_sysfs_name;  /* picked by the helper */
+#ifdef HAVE_GUDEV
+        GUdevClient             *backlight_udev;
+#endif
+        guint                    backlight_transition_id;
+        guint                    backlight_transition_duration; /* ms */
+        CsdBacklightTransitionCurve backlight_transition_curve;
+        gint                     backlight_transition_from;
+        gint                     backlight_transition_to;
+        gint                     backlight_transition_now;
+        gint64                   backlight_transition_started;
         gint                     kbd_brightness_now;
         gint                     kbd_brightness_max;
         gint                     kbd_brightness_old;
@@ -220,6 +320,9 @@ struct CsdPowerManagerPrivate
         GDBusProxy              *screensaver_proxy;
         GDBusProxy              *session_proxy;
         GDBusProxy              *session_presence_proxy;
+        GHashTable              *session_inhibitors;
+        GCancellable            *session_inhibitors_cancellable;
+        gint                     session_inhibit_counts[SESSION_INHIBIT_BITS];
         GpmIdletime             *idletime;
         CsdPowerIdleMode         current_idle_mode;
         guint                    lid_close_safety_timer_id;
@@ -256,6 +359,9 @@ static void      inhibit_lid_switch (CsdPowerManager *manager);
 static void      uninhibit_lid_switch (CsdPowerManager *manager);
 static void      lock_screensaver (CsdPowerManager *manager);
 static void      kill_lid_close_safety_timer (CsdPowerManager *manager);
+static void      backlight_helpers_stop (CsdPowerManager *manager);
+static void      backlight_emit_changed (CsdPowerManager *manager);
+static void      backlight_invalidate (CsdPowerManager *manager);
 
 int             backlight_get_output_id (CsdPowerManager *manager);
 
@@ -468,6 +574,123 @@ engine_emit_changed (CsdPowerManager *manager,
                 g_variant_unref (props_changed);
 }
 
+static void
+engine_device_info_free (gpointer data)
+{
+        EngineDeviceInfo *info = data;
+
+        if (info->refresh_id != 0)
+                g_source_remove (info->refresh_id);
+        g_free (info->summary);
+        g_free (info);
+}
+
+/* re-reads one device; @changed is set if anything the engine shows
+ * differs from before */
+static EngineDeviceInfo *
+engine_device_info_update (CsdPowerManager *manager,
+                           UpDevice *device,
+                           gboolean *changed)
+{
+        EngineDeviceInfo *info;
+        EngineDeviceInfo old;
+        gboolean is_new = FALSE;
+        gchar *summary;
+
+        info = g_object_get_data (G_OBJECT (device), "engine-info");
+        if (info == NULL) {
+                info = g_new0 (EngineDeviceInfo, 1);
+                info->manager = manager;
+                g_object_set_data_full (G_OBJECT (device), "engine-info",
+                                        info, engine_device_info_free);
+                is_new = TRUE;
+        }
+
+        old = *info;
+        g_object_get (device,
+                      "kind", &info->kind,
+                      "state", &info->state,
+                      "is-present", &info->is_present,
+                      "percentage", &info->percentage,
+                      "energy", &info->energy,
+                      "energy-full", &info->energy_full,
+                      "energy-rate", &info->energy_rate,
+                      "time-to-empty", &info->time_to_empty,
+                      "time-to-full", &info->time_to_full,
+                      NULL);
+        summary = gpm_upower_get_device_summary (device);
+
+        if (changed != NULL)
+                *changed = is_new ||
+                           info->kind != old.kind ||
+                           info->state != old.state ||
+                           info->is_present != old.is_present ||
+                           info->percentage != old.percentage ||
+                           info->energy != old.energy ||
+                           info->energy_full != old.energy_full ||
+                           info->energy_rate != old.energy_rate ||
+                           info->time_to_empty != old.time_to_empty ||
+                           info->time_to_full != old.time_to_full ||
+                           g_strcmp0 (info->summary, summary) != 0;
+
+        g_free (info->summary);
+        info->summary = summary;
+        return info;
+}
+
+static EngineDeviceInfo *
+engine_get_device_info (CsdPowerManager *manager, UpDevice *device)
+{
+        EngineDeviceInfo *info;
+
+        info = g_object_get_data (G_OBJECT (device), "engine-info");
+        if (info == NULL)
+                info = engine_device_info_update (manager, device, NULL);
+        return info;
+}
+
+static void
+engine_device_info_remove (CsdPowerManager *manager, UpDevice *device)
+{
+#if UP_CHECK_VERSION(0,99,0)
+        g_signal_handlers_disconnect_by_func (device, device_properties_changed_cb, manager);
+#endif
+        /* also drops a pending refresh */
+        g_object_set_data (G_OBJECT (device), "engine-info", NULL);
+}
+
+/* summed afresh from the cached info each time, as running sums would
+ * drift and leave a tiny rate behind once the batteries stop */
+static void
+engine_get_kind_totals (CsdPowerManager *manager,
+                        UpDeviceKind kind,
+                        EngineKindTotals *totals)
+{
+        EngineDeviceInfo *info;
+        GPtrArray *array;
+        guint i;
+
+        memset (totals, 0, sizeof (EngineKindTotals));
+
+        array = manager->priv->devices_array;
+        for (i = 0; i < array->len; i++) {
+                info = engine_get_device_info (manager, g_ptr_array_index (array, i));
+                if (info->kind != kind)
+                        continue;
+
+                totals->devices++;
+                if (info->state == UP_DEVICE_STATE_CHARGING)
+                        totals->charging++;
+                if (info->state == UP_DEVICE_STATE_DISCHARGING)
+                        totals->discharging++;
+                if (info->state != UP_DEVICE_STATE_FULLY_CHARGED)
+                        totals->not_fully_charged++;
+                totals->energy += info->energy;
+                totals->energy_full += info->energy_full;
+                totals->energy_rate += info->energy_rate;
+        }
+}
+
 static CsdPowerManagerWarning
 engine_get_warning_csr (CsdPowerManager *manager, UpDevice *device)
 {
@@ -592,12 +815,8 @@ engine_get_summary (CsdPowerManager *manager)
 {
         guint i;
         GPtrArray *array;
-        UpDevice *device;
-        UpDeviceState state;
+        EngineDeviceInfo *info;
         GString *tooltip = NULL;
-        gchar *part;
-        gboolean is_present;
-
 
         /* need to get AC state */
         tooltip = g_string_new ("");
@@ -605,19 +824,13 @@ engine_get_summary (CsdPowerManager *manager)
         /* do we have specific device types? */
         array = manager->priv->devices_array;
         for (i=0;i<array->len;i++) {
-                device = g_ptr_array_index (array, i);
-                g_object_get (device,
-                              "is-present", &is_present,
-                              "state", &state,
-                              NULL);
-                if (!is_present)
+                info = engine_get_device_info (manager, g_ptr_array_index (array, i));
+                if (!info->is_present)
                         continue;
-                if (state == UP_DEVICE_STATE_EMPTY)
+                if (info->state == UP_DEVICE_STATE_EMPTY)
                         continue;
-                part = gpm_upower_get_device_summary (device);
-                if (part != NULL)
-                        g_string_append_printf (tooltip, "%s\n", part);
-                g_free (part);
+                if (info->summary != NULL)
+                        g_string_append_printf (tooltip, "%s\n", info->summary);
         }
 
         /* remove the last \n */
@@ -637,6 +850,7 @@ engine_get_icon_priv (CsdPowerManager *manager,
         guint i;
         GPtrArray *array;
         UpDevice *device;
+        EngineDeviceInfo *info;
         CsdPowerManagerWarning warning_temp;
         UpDeviceKind kind;
         UpDeviceState state;
@@ -648,11 +862,10 @@ engine_get_icon_priv (CsdPowerManager *manager,
                 device = g_ptr_array_index (array, i);
 
                 /* get device properties */
-                g_object_get (device,
-                              "kind", &kind,
-                              "state", &state,
-                              "is-present", &is_present,
-                              NULL);
+                info = engine_get_device_info (manager, device);
+                kind = info->kind;
+                state = info->state;
+                is_present = info->is_present;
 
                 /* if battery then use composite device to cope with multiple batteries */
                 if (kind == UP_DEVICE_KIND_BATTERY)
@@ -828,138 +1041,68 @@ static UpDevice *
 engine_get_composite_device (CsdPowerManager *manager,
                              UpDevice *original_device)
 {
-        guint battery_devices = 0;
-        GPtrArray *array;
-        UpDevice *device;
-        UpDeviceKind kind;
-        UpDeviceKind original_kind;
-        guint i;
-
-        /* get the type of the original device */
-        g_object_get (original_device,
-                      "kind", &original_kind,
-                      NULL);
-
-        /* find out how many batteries in the system */
-        array = manager->priv->devices_array;
-        for (i=0;i<array->len;i++) {
-                device = g_ptr_array_index (array, i);
-                g_object_get (device,
-                              "kind", &kind,
-                              NULL);
-                if (kind == original_kind)
-                        battery_devices++;
-        }
+        EngineDeviceInfo *info;
+        EngineKindTotals totals;
 
         /* just use the original device if only one primary battery */
-        if (battery_devices <= 1) {
+        info = engine_get_device_info (manager, original_device);
+        engine_get_kind_totals (manager, info->kind, &totals);
+        if (totals.devices <= 1) {
                 g_debug ("using original device as only one primary battery");
-                device = original_device;
-                goto out;
+                return original_device;
         }
 
         /* use the composite device */
-        device = manager->priv->device_composite;
-out:
-        /* return composite device or original device */
-        return device;
+        return manager->priv->device_composite;
 }
 
+/* call engine_device_info_update() on @original_device first */
 static UpDevice *
 engine_update_composite_device (CsdPowerManager *manager,
                                 UpDevice *original_device)
 {
-        guint i;
         gdouble percentage = 0.0;
-        gdouble energy = 0.0;
-        gdouble energy_full = 0.0;
-        gdouble energy_rate = 0.0;
-        gdouble energy_total = 0.0;
-        gdouble energy_full_total = 0.0;
-        gdouble energy_rate_total = 0.0;
         gint64 time_to_empty = 0;
         gint64 time_to_full = 0;
-        guint battery_devices = 0;
-        gboolean is_charging = FALSE;
-        gboolean is_discharging = FALSE;
-        gboolean is_fully_charged = TRUE;
-        GPtrArray *array;
+        EngineDeviceInfo *info;
+        EngineKindTotals totals;
         UpDevice *device;
         UpDeviceState state;
-        UpDeviceKind kind;
-        UpDeviceKind original_kind;
-
-        /* get the type of the original device */
-        g_object_get (original_device,
-                      "kind", &original_kind,
-                      NULL);
-
-        /* update the composite device */
-        array = manager->priv->devices_array;
-        for (i=0;i<array->len;i++) {
-                device = g_ptr_array_index (array, i);
-                g_object_get (device,
-                              "kind", &kind,
-                              "state", &state,
-                              "energy", &energy,
-                              "energy-full", &energy_full,
-                              "energy-rate", &energy_rate,
-                              NULL);
-                if (kind != original_kind)
-                        continue;
-
-                /* one of these will be charging or discharging */
-                if (state == UP_DEVICE_STATE_CHARGING)
-                        is_charging = TRUE;
-                if (state == UP_DEVICE_STATE_DISCHARGING)
-                        is_discharging = TRUE;
-                if (state != UP_DEVICE_STATE_FULLY_CHARGED)
-                        is_fully_charged = FALSE;
-
-                /* sum up composite */
-                energy_total += energy;
-                energy_full_total += energy_full;
-                energy_rate_total += energy_rate;
-                battery_devices++;
-        }
 
-        /* just use the original device if only one primary battery */
-        if (battery_devices == 1) {
-                g_debug ("using original device as only one primary battery");
-                device = original_device;
+        device = engine_get_composite_device (manager, original_device);
+        if (device == original_device)
                 goto out;
-        }
+
+        info = engine_get_device_info (manager, original_device);
+        engine_get_kind_totals (manager, info->kind, &totals);
 
         /* use percentage weighted for each battery capacity */
-        if (energy_full_total > 0.0)
-                percentage = 100.0 * energy_total / energy_full_total;
+        if (totals.energy_full > 0.0)
+                percentage = 100.0 * totals.energy / totals.energy_full;
 
         /* set composite state */
-        if (is_charging)
+        if (totals.charging > 0)
                 state = UP_DEVICE_STATE_CHARGING;
-        else if (is_discharging)
+        else if (totals.discharging > 0)
                 state = UP_DEVICE_STATE_DISCHARGING;
-        else if (is_fully_charged)
+        else if (totals.not_fully_charged == 0)
                 state = UP_DEVICE_STATE_FULLY_CHARGED;
         else
                 state = UP_DEVICE_STATE_UNKNOWN;
 
         /* calculate a quick and dirty time remaining value */
-        if (energy_rate_total > 0) {
+        if (totals.energy_rate > 0) {
                 if (state == UP_DEVICE_STATE_DISCHARGING)
-                        time_to_empty = 3600 * (energy_total / energy_rate_total);
+                        time_to_empty = 3600 * (totals.energy / totals.energy_rate);
                 else if (state == UP_DEVICE_STATE_CHARGING)
-                        time_to_full = 3600 * ((energy_full_total - energy_total) / energy_rate_total);
+                        time_to_full = 3600 * ((totals.energy_full - totals.energy) / totals.energy_rate);
         }
 
-        /* okay, we can use the composite device */
-        device = manager->priv->device_composite;
-
         g_debug ("printing composite device");
         g_object_set (device,
-                      "energy", energy,
-                      "energy-full", energy_full,
-                      "energy-rate", energy_rate,
+                      "energy", totals.energy,
+                      "energy-full", totals.energy_full,
+                      "energy-rate", totals.energy_rate,
                       "time-to-empty", time_to_empty,
                       "time-to-full", time_to_full,
                       "percentage", percentage,
@@ -974,13 +1117,33 @@ out:
         return device;
 }
 
+#if UP_CHECK_VERSION(0,99,0)
+/* everything the cached device info and the warnings are read from */
+static const gchar *engine_device_notifies[] = {
+        "notify::kind",
+        "notify::state",
+        "notify::is-present",
+        "notify::percentage",
+        "notify::energy",
+        "notify::energy-full",
+        "notify::energy-rate",
+        "notify::time-to-empty",
+        "notify::time-to-full",
+        "notify::warning-level"
+};
+#endif
+
 static void
 engine_device_add (CsdPowerManager *manager, UpDevice *device)
 {
         CsdPowerManagerWarning warning;
+        EngineDeviceInfo *info;
         UpDeviceState state;
         UpDeviceKind kind;
         UpDevice *composite;
+#if UP_CHECK_VERSION(0,99,0)
+        guint i;
+#endif
 
         /* assign warning */
         warning = engine_get_warning (manager, device);
@@ -989,10 +1152,9 @@ engine_device_add (CsdPowerManager *manager, UpDevice *device)
                            GUINT_TO_POINTER(warning));
 
         /* get device properties */
-        g_object_get (device,
-                      "kind", &kind,
-                      "state", &state,
-                      NULL);
+        info = engine_device_info_update (manager, device, NULL);
+        kind = info->kind;
+        state = info->state;
 
         /* add old state for transitions */
         g_debug ("adding %s with state %s",
@@ -1001,6 +1163,11 @@ engine_device_add (CsdPowerManager *manager, UpDevice *device)
                            "engine-state-old",
                            GUINT_TO_POINTER(state));
 
+#if UP_CHECK_VERSION(0,99,0)
+        /* the composite totals are summed over the array */
+        g_ptr_array_add (manager->priv->devices_array, g_object_ref(device));
+#endif
+
         if (kind == UP_DEVICE_KIND_BATTERY) {
                 g_debug ("updating because we added a device");
                 composite = engine_update_composite_device (manager, device);
@@ -1017,12 +1184,9 @@ engine_device_add (CsdPowerManager *manager, UpDevice *device)
         }
 
 #if UP_CHECK_VERSION(0,99,0)
-        g_ptr_array_add (manager->priv->devices_array, g_object_ref(device));
-
-        g_signal_connect (device, "notify::state",
-                          G_CALLBACK (device_properties_changed_cb), manager);
-        g_signal_connect (device, "notify::warning-level",
-                          G_CALLBACK (device_properties_changed_cb), manager);
+        for (i = 0; i < G_N_ELEMENTS (engine_device_notifies); i++)
+                g_signal_connect (device, engine_device_notifies[i],
+                                  G_CALLBACK (device_properties_changed_cb), manager);
 #endif
 
 }
@@ -1071,6 +1235,7 @@ engine_device_added_cb (UpClient *client, UpDevice *device, CsdPowerManager *man
 {
         /* add to list */
         g_ptr_array_add (manager->priv->devices_array, g_object_ref (device));
+        engine_device_info_update (manager, device, NULL);
         engine_recalculate_state (manager);
 }
 
@@ -1084,6 +1249,7 @@ engine_device_removed_cb (UpClient *client, const char *object_path, CsdPowerMan
                 UpDevice *device = g_ptr_array_index (manager->priv->devices_array, i);
 
                 if (g_strcmp0 (object_path, up_device_get_object_path (device)) == 0) {
+                        engine_device_info_remove (manager, device);
                         g_ptr_array_remove_index (manager->priv->devices_array, i);
                         break;
                 }
@@ -1092,6 +1258,7 @@ engine_device_removed_cb (UpClient *client, const char *object_path, CsdPowerMan
 engine_device_removed_cb (UpClient *client, UpDevice *device, CsdPowerManager *manager)
 {
         gboolean ret;
+        engine_device_info_remove (manager, device);
         ret = g_ptr_array_remove (manager->priv->devices_array, device);
         if (!ret)
                 return;
@@ -1747,22 +1914,23 @@ out:
 }
 
 static void
-#if UP_CHECK_VERSION(0,99,0)
-device_properties_changed_cb (UpDevice *device, GParamSpec *pspec, CsdPowerManager *manager)
-#else
-engine_device_changed_cb (UpClient *client, UpDevice *device, CsdPowerManager *manager)
-#endif
+engine_device_refresh (CsdPowerManager *manager, UpDevice *device)
 {
         UpDeviceKind kind;
         UpDeviceState state;
         UpDeviceState state_old;
         CsdPowerManagerWarning warning_old;
         CsdPowerManagerWarning warning;
+        gboolean changed;
 
-        /* get device properties */
-        g_object_get (device,
-                      "kind", &kind,
-                      NULL);
+        /* only this device needs to be read again */
+        kind = engine_device_info_update (manager, device, &changed)->kind;
+
+        /* nothing the icon, the summary or the warnings depend on */
+        if (!changed) {
+                g_debug ("%s: no change", up_device_get_object_path (device));
+                return;
+        }
 
         /* if battery then use composite device to cope with multiple batteries */
         if (kind == UP_DEVICE_KIND_BATTERY) {
@@ -1815,6 +1983,38 @@ engine_device_changed_cb (UpClient *client, UpDevice *device, CsdPowerManager *m
         engine_recalculate_state (manager);
 }
 
+#if UP_CHECK_VERSION(0,99,0)
+static gboolean
+engine_device_refresh_idle_cb (gpointer user_data)
+{
+        UpDevice *device = UP_DEVICE (user_data);
+        EngineDeviceInfo *info;
+
+        info = g_object_get_data (G_OBJECT (device), "engine-info");
+        info->refresh_id = 0;
+        engine_device_refresh (info->manager, device);
+        return FALSE;
+}
+
+/* one UPower update notifies several properties; they are handled in
+ * one go once it has been applied */
+static void
+device_properties_changed_cb (UpDevice *device, GParamSpec *pspec, CsdPowerManager *manager)
+{
+        EngineDeviceInfo *info;
+
+        info = engine_get_device_info (manager, device);
+        if (info->refresh_id == 0)
+                info->refresh_id = g_idle_add (engine_device_refresh_idle_cb, device);
+}
+#else
+static void
+engine_device_changed_cb (UpClient *client, UpDevice *device, CsdPowerManager *manager)
+{
+        engine_device_refresh (manager, device);
+}
+#endif
+
 static UpDevice *
 engine_get_primary_device (CsdPowerManager *manager)
 {
@@ -2233,6 +2433,14 @@ on_randr_event (GnomeRRScreen *screen, gpointer user_data)
 {
         CsdPowerManager *manager = CSD_POWER_MANAGER (user_data);
 
+        /* the outputs may have been replaced; a sysfs backlight is not
+         * affected, and this also follows our own XRandR writes */
+        if (manager->priv->backlight.interface == BACKLIGHT_INTERFACE_XRANDR) {
+                manager->priv->backlight.interface = BACKLIGHT_INTERFACE_NONE;
+                manager->priv->backlight.output = NULL;
+                backlight_invalidate (manager);
+        }
+
         if (suspend_on_lid_close (manager)) {
                 restart_inhibit_lid_switch_timer (manager);
                 return;
@@ -2553,6 +2761,12 @@ backlight_override_settings_refresh (CsdPowerManager *manager)
 
         tmp2 = manager->priv->backlight_helper_preference_args;
         manager->priv->backlight_helper_preference_args = tmp1;
+
+        /* the running helper has already picked a device */
+        if (g_strcmp0 (tmp1, tmp2) != 0)
+                backlight_helpers_stop (manager);
+        backlight_invalidate (manager);
+
         g_free(tmp2);
         tmp2 = NULL;
 
@@ -2560,148 +2774,393 @@ backlight_override_settings_refresh (CsdPowerManager *manager)
         backlight_preference_order = NULL;
 }
 
-/**
- * backlight_helper_get_value:
- *
- * Gets a brightness value from the PolicyKit helper.
- *
- * Return value: the signed integer value from the helper, or -1
- * for failure. If -1 then @error is set.
- **/
-static gint64
-backlight_helper_get_value (const gchar *argument, CsdPowerManager* manager,
-                GError **error)
+static void
+backlight_helper_child_watch_cb (GPid pid, gint status, gpointer user_data)
 {
-        gboolean ret;
-        gchar *stdout_data = NULL;
-        gint exit_status = 0;
-        gint64 value = -1;
-        gchar *command = NULL;
-        gchar *endptr = NULL;
+        g_debug ("csd-backlight-helper exited with status %i", status);
+        g_spawn_close_pid (pid);
+}
 
-#ifndef __linux__
-        /* non-Linux platforms won't have /sys/class/backlight */
-        g_set_error_literal (error,
-                             CSD_POWER_MANAGER_ERROR,
-                             CSD_POWER_MANAGER_ERROR_FAILED,
-                             "The sysfs backlight helper is only for Linux");
-        goto out;
-#endif
+static void
+backlight_helper_child_setup (gpointer user_data)
+{
+        gint fd = GPOINTER_TO_INT (user_data);
 
-        /* get the data */
-        command = g_strdup_printf (LIBEXECDIR "/csd-backlight-helper --%s %s",
-                                   argument,
-                                   manager->priv->backlight_helper_preference_args);
-        ret = g_spawn_command_line_sync (command,
-                                         &stdout_data,
-                                         NULL,
-                                         &exit_status,
-                                         error);
-        g_debug ("executed %s retval: %i", command, exit_status);
+        dup2 (fd, STDIN_FILENO);
+        dup2 (fd, STDOUT_FILENO);
+}
 
-        if (!ret)
-                goto out;
+static void
+backlight_helper_reply (BacklightHelperRequest *request,
+                        gint64 value,
+                        const gchar *name,
+                        const GError *error)
+{
+        if (request->func != NULL)
+                request->func (request->manager, value, name, error, request->user_data);
+        g_free (request);
+}
+
+static void
+backlight_helper_stop (BacklightHelper *helper)
+{
+        GQueue *requests;
+        GError *error;
+
+        if (helper->fd < 0)
+                return;
+
+        if (helper->watch_id != 0)
+                g_source_remove (helper->watch_id);
+        helper->watch_id = 0;
+        g_io_channel_unref (helper->channel);
+        helper->channel = NULL;
+        g_string_free (helper->buffer, TRUE);
+        helper->buffer = NULL;
+
+        /* the helper exits when it sees the end of its input */
+        close (helper->fd);
+        helper->fd = -1;
+
+        /* the callbacks may start it again */
+        requests = helper->requests;
+        helper->requests = NULL;
+        error = g_error_new_literal (CSD_POWER_MANAGER_ERROR,
+                                     CSD_POWER_MANAGER_ERROR_FAILED,
+                                     "csd-backlight-helper exited");
+        while (!g_queue_is_empty (requests))
+                backlight_helper_reply (g_queue_pop_head (requests), -1, NULL, error);
+        g_queue_free (requests);
+        g_error_free (error);
+}
+
+/* handles one "ok <value> [<name>]" or "error <message>" line */
+static void
+backlight_helper_handle_line (BacklightHelper *helper, const gchar *line)
+{
+        BacklightHelperRequest *request;
+        GError *error = NULL;
+        gchar *endptr = NULL;
+        gint64 value = -1;
+
+        request = g_queue_pop_head (helper->requests);
+        if (request == NULL) {
+                g_debug ("unexpected reply from csd-backlight-helper: %s", line);
+                return;
+        }
 
-        if (WEXITSTATUS (exit_status) != 0) {
-                 g_set_error (error,
+        if (!g_str_has_prefix (line, "ok ")) {
+                g_set_error (&error,
                              CSD_POWER_MANAGER_ERROR,
                              CSD_POWER_MANAGER_ERROR_FAILED,
                              "csd-backlight-helper failed: %s",
-                             stdout_data ? stdout_data : "No reason");
-                goto out;
+                             g_str_has_prefix (line, "error ") ? line + 6 : line);
+        } else {
+                value = g_ascii_strtoll (line + 3, &endptr, 10);
+                if (endptr == line + 3 || value < 0 || value > G_MAXINT) {
+                        value = -1;
+                        g_set_error (&error,
+                                     CSD_POWER_MANAGER_ERROR,
+                                     CSD_POWER_MANAGER_ERROR_FAILED,
+                                     "failed to parse value: %s",
+                                     line);
+                }
         }
 
-        /* parse */
-        value = g_ascii_strtoll (stdout_data, &endptr, 10);
+        backlight_helper_reply (request, value,
+                                endptr != NULL && *endptr == ' ' ? endptr + 1 : NULL,
+                                error);
+        if (error != NULL)
+                g_error_free (error);
+}
 
-        /* parsing error */
-        if (endptr == stdout_data) {
-                value = -1;
-                g_set_error (error,
-                             CSD_POWER_MANAGER_ERROR,
-                             CSD_POWER_MANAGER_ERROR_FAILED,
-                             "failed to parse value: %s",
-                             stdout_data);
-                goto out;
-        }
+static gboolean
+backlight_helper_io_cb (GIOChannel *source,
+                        GIOCondition condition,
+                        gpointer user_data)
+{
+        BacklightHelper *helper = user_data;
+        gchar data[256];
+        gssize len;
+        gchar *eol;
 
-        /* out of range */
-        if (value > G_MAXINT) {
-                value = -1;
-                g_set_error (error,
-                             CSD_POWER_MANAGER_ERROR,
-                             CSD_POWER_MANAGER_ERROR_FAILED,
-                             "value out of range: %s",
-                             stdout_data);
-                goto out;
+        len = recv (helper->fd, data, sizeof (data), MSG_DONTWAIT);
+        if (len < 0 && (errno == EINTR || errno == EAGAIN))
+                return TRUE;
+        if (len <= 0) {
+                helper->watch_id = 0;
+                backlight_helper_stop (helper);
+                return FALSE;
         }
+        g_string_append_len (helper->buffer, data, len);
 
-        /* Fetching the value failed, for some other reason */
-        if (value < 0) {
-                g_set_error (error,
-                             CSD_POWER_MANAGER_ERROR,
-                             CSD_POWER_MANAGER_ERROR_FAILED,
-                             "value negative, but helper did not fail: %s",
-                             stdout_data);
-                goto out;
+        while (helper->fd >= 0 &&
+               (eol = memchr (helper->buffer->str, '\n', helper->buffer->len)) != NULL) {
+                gchar *line;
+
+                line = g_strndup (helper->buffer->str, eol - helper->buffer->str);
+                g_string_erase (helper->buffer, 0, eol - helper->buffer->str + 1);
+                backlight_helper_handle_line (helper, line);
+                g_free (line);
         }
 
-out:
-        g_free (command);
-        g_free (stdout_data);
-        return value;
+        /* a reply callback might have stopped it */
+        return helper->fd >= 0;
 }
 
 /**
- * backlight_helper_set_value:
+ * backlight_helper_start:
  *
- * Sets a brightness value using the PolicyKit helper.
+ * Starts a helper in daemon mode. The privileged one is authorized once
+ * and then kept running for the rest of the session. Nothing waits for
+ * it, requests are queued on the socket while it starts up, and @func
+ * gets the "ok <max> <device>" it sends once the device is open.
  *
  * Return value: Success. If FALSE then @error is set.
  **/
 static gboolean
-backlight_helper_set_value (const gchar *argument,
-                            gint value,
-                            CsdPowerManager* manager,
-                            GError **error)
-{
-        gboolean ret;
-        gint exit_status = 0;
-        gchar *command = NULL;
+backlight_helper_start (BacklightHelper *helper,
+                        BacklightHelperFunc func,
+                        gpointer user_data,
+                        GError **error)
+{
+        CsdPowerManager *manager = helper->manager;
+        BacklightHelperRequest *request;
+        gchar **preference = NULL;
+        GPtrArray *argv;
+        gint fds[2];
+        GPid pid;
+        gboolean ret = FALSE;
+        guint i;
 
-#ifndef __linux__
-        /* non-Linux platforms won't have /sys/class/backlight */
-        g_set_error_literal (error,
+        if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+                g_set_error (error,
                              CSD_POWER_MANAGER_ERROR,
                              CSD_POWER_MANAGER_ERROR_FAILED,
-                             "The sysfs backlight helper is only for Linux");
-        goto out;
-#endif
+                             "failed to create socket: %s",
+                             g_strerror (errno));
+                return FALSE;
+        }
 
-        /* get the data */
-        command = g_strdup_printf ("pkexec " LIBEXECDIR "/csd-backlight-helper --%s %i %s",
-                                   argument, value,
-                                   manager->priv->backlight_helper_preference_args);
-        ret = g_spawn_command_line_sync (command,
-                                         NULL,
-                                         NULL,
-                                         &exit_status,
-                                         error);
+        argv = g_ptr_array_new ();
+        if (helper->privileged)
+                g_ptr_array_add (argv, "pkexec");
+        g_ptr_array_add (argv, LIBEXECDIR "/csd-backlight-helper");
+        g_ptr_array_add (argv, "--daemon");
+        if (manager->priv->backlight_helper_preference_args != NULL &&
+            g_shell_parse_argv (manager->priv->backlight_helper_preference_args,
+                                NULL, &preference, NULL)) {
+                for (i = 0; preference[i] != NULL; i++)
+                        g_ptr_array_add (argv, preference[i]);
+        }
+        g_ptr_array_add (argv, NULL);
+
+        ret = g_spawn_async (NULL,
+                             (gchar **) argv->pdata,
+                             NULL,
+                             G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                             backlight_helper_child_setup,
+                             GINT_TO_POINTER (fds[1]),
+                             &pid,
+                             error);
+        close (fds[1]);
+        g_ptr_array_free (argv, TRUE);
+        g_strfreev (preference);
+
+        if (!ret) {
+                close (fds[0]);
+                return FALSE;
+        }
 
-        g_debug ("executed %s retval: %i", command, exit_status);
+        g_child_watch_add (pid, backlight_helper_child_watch_cb, NULL);
+        g_debug ("started %scsd-backlight-helper as pid %i",
+                 helper->privileged ? "privileged " : "", pid);
 
-        if (!ret || WEXITSTATUS (exit_status) != 0)
-                goto out;
+        helper->fd = fds[0];
+        helper->buffer = g_string_new (NULL);
+        helper->requests = g_queue_new ();
+        helper->channel = g_io_channel_unix_new (helper->fd);
+        helper->watch_id = g_io_add_watch (helper->channel,
+                                           G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                           backlight_helper_io_cb,
+                                           helper);
 
-out:
-        g_free (command);
-        return ret;
+        request = g_new0 (BacklightHelperRequest, 1);
+        request->manager = manager;
+        request->func = func;
+        request->user_data = user_data;
+        g_queue_push_tail (helper->requests, request);
+
+        return TRUE;
 }
 
-int
-backlight_get_output_id (CsdPowerManager *manager)
+/**
+ * backlight_helper_request:
+ *
+ * Sends a request to a running helper. @func gets the reply, or an
+ * error if the helper goes away first.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+static gboolean
+backlight_helper_request (BacklightHelper *helper,
+                          const gchar *request,
+                          BacklightHelperFunc func,
+                          gpointer user_data,
+                          GError **error)
 {
-        GnomeRROutput *output = NULL;
+        BacklightHelperRequest *pending;
+        gchar *line;
+        gssize len;
+        gssize ret;
+
+        if (helper->fd < 0) {
+                g_set_error_literal (error,
+                                     CSD_POWER_MANAGER_ERROR,
+                                     CSD_POWER_MANAGER_ERROR_FAILED,
+                                     "csd-backlight-helper is not running");
+                return FALSE;
+        }
+
+        /* requests are tiny and one at a time, so this never blocks */
+        line = g_strdup_printf ("%s\n", request);
+        len = strlen (line);
+        ret = send (helper->fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        g_free (line);
+
+        if (ret != len) {
+                g_set_error (error,
+                             CSD_POWER_MANAGER_ERROR,
+                             CSD_POWER_MANAGER_ERROR_FAILED,
+                             "failed to send request to csd-backlight-helper: %s",
+                             g_strerror (errno));
+                backlight_helper_stop (helper);
+                return FALSE;
+        }
+
+        pending = g_new0 (BacklightHelperRequest, 1);
+        pending->manager = helper->manager;
+        pending->func = func;
+        pending->user_data = user_data;
+        g_queue_push_tail (helper->requests, pending);
+
+        return TRUE;
+}
+
+static void
+backlight_helpers_stop (CsdPowerManager *manager)
+{
+        BacklightHelper *writer = &manager->priv->backlight_writer;
+
+        /* still send the level that was waiting for the last write */
+        if (writer->fd >= 0 && manager->priv->backlight_set_pending >= 0) {
+                gchar *request;
+
+                request = g_strdup_printf ("set-brightness %i",
+                                           manager->priv->backlight_set_pending);
+                backlight_helper_request (writer, request, NULL, NULL, NULL);
+                g_free (request);
+        }
+        manager->priv->backlight_set_pending = -1;
+        manager->priv->backlight_set_in_flight = FALSE;
+
+        /* a new one might pick another device */
+        g_free (manager->priv->backlight_sysfs_name);
+        manager->priv->backlight_sysfs_name = NULL;
+
+        backlight_helper_stop (&manager->priv->backlight_reader);
+        backlight_helper_stop (writer);
+}
+
+static void backlight_helper_set_cb (CsdPowerManager *manager,
+                                     gint64 value,
+                                     const gchar *name,
+                                     const GError *error,
+                                     gpointer user_data);
+
+static gboolean
+backlight_helper_send_set (CsdPowerManager *manager, gint value, GError **error)
+{
+        BacklightHelper *writer = &manager->priv->backlight_writer;
+        gchar *request;
+        gboolean ret;
+
+        if (writer->fd < 0 &&
+            !backlight_helper_start (writer, NULL, NULL, error))
+                return FALSE;
+
+        request = g_strdup_printf ("set-brightness %i", value);
+        ret = backlight_helper_request (writer, request,
+                                        backlight_helper_set_cb, NULL,
+                                        error);
+        g_free (request);
+
+        manager->priv->backlight_set_in_flight = ret;
+        return ret;
+}
+
+static void
+backlight_helper_set_cb (CsdPowerManager *manager,
+                         gint64 value,
+                         const gchar *name,
+                         const GError *error,
+                         gpointer user_data)
+{
+        GError *send_error = NULL;
+        gint pending;
+
+        manager->priv->backlight_set_in_flight = FALSE;
+        pending = manager->priv->backlight_set_pending;
+        manager->priv->backlight_set_pending = -1;
+
+        if (error != NULL) {
+                g_warning ("failed to set brightness: %s", error->message);
+                /* the cached level is wrong now */
+                backlight_invalidate (manager);
+                return;
+        }
+
+        if (pending >= 0 && !backlight_helper_send_set (manager, pending, &send_error)) {
+                g_warning ("failed to set brightness: %s", send_error->message);
+                g_error_free (send_error);
+                backlight_invalidate (manager);
+        }
+}
+
+/**
+ * backlight_helper_set_value:
+ *
+ * Sets a brightness value using the PolicyKit helper, without waiting
+ * for it. While a write is in flight only the latest level is kept,
+ * so a fade never queues up behind a slow helper.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+static gboolean
+backlight_helper_set_value (CsdPowerManager *manager,
+                            gint value,
+                            GError **error)
+{
+#ifndef __linux__
+        /* non-Linux platforms won't have /sys/class/backlight */
+        g_set_error_literal (error,
+                             CSD_POWER_MANAGER_ERROR,
+                             CSD_POWER_MANAGER_ERROR_FAILED,
+                             "The sysfs backlight helper is only for Linux");
+        return FALSE;
+#endif
+
+        if (manager->priv->backlight_set_in_flight) {
+                manager->priv->backlight_set_pending = value;
+                return TRUE;
+        }
+        return backlight_helper_send_set (manager, value, error);
+}
+
+int
+backlight_get_output_id (CsdPowerManager *manager)
+{
+        GnomeRROutput *output = NULL;
         GnomeRROutput **outputs;
         GnomeRRCrtc *crtc;
         GdkScreen *gdk_screen;
@@ -2733,10 +3192,126 @@ backlight_get_output_id (CsdPowerManager *manager)
         return gdk_screen_get_monitor_at_point (gdk_screen, x, y);
 }
 
+/* while fading, report the brightness that is being faded to */
 static gint
-backlight_get_abs (CsdPowerManager *manager, GError **error)
+backlight_transition_target (CsdPowerManager *manager, gint now)
+{
+        if (manager->priv->backlight_transition_id != 0)
+                return manager->priv->backlight_transition_to;
+        return now;
+}
+
+/* probes again on the next use; the current model keeps being served
+ * until the helper has answered */
+static void
+backlight_invalidate (CsdPowerManager *manager)
+{
+        /* drops the answers to a probe still running */
+        manager->priv->backlight_probe_serial++;
+        manager->priv->backlight_probed = FALSE;
+}
+
+static void
+backlight_probe_done (CsdPowerManager *manager)
+{
+        BacklightDevice *device = &manager->priv->backlight;
+
+        if (device->max <= device->min)
+                device->interface = BACKLIGHT_INTERFACE_NONE;
+        if (device->interface == BACKLIGHT_INTERFACE_NONE)
+                return;
+
+        device->step = BRIGHTNESS_STEP_AMOUNT (device->max - device->min + 1);
+        device->now = CLAMP (device->now, device->min, device->max);
+        g_debug ("backlight uses %s, range %i-%i, step %i, now %i",
+                 device->interface == BACKLIGHT_INTERFACE_XRANDR ? "xrandr" : "helper",
+                 device->min, device->max, device->step, device->now);
+}
+
+static void
+backlight_probe_now_cb (CsdPowerManager *manager,
+                        gint64 value,
+                        const gchar *name,
+                        const GError *error,
+                        gpointer user_data)
+{
+        BacklightDevice *device = &manager->priv->backlight;
+
+        /* invalidated meanwhile */
+        if (GPOINTER_TO_UINT (user_data) != manager->priv->backlight_probe_serial)
+                return;
+
+        if (error != NULL) {
+                g_debug ("failed to probe backlight: %s", error->message);
+                return;
+        }
+
+        device->interface = BACKLIGHT_INTERFACE_HELPER;
+        device->output = NULL;
+        device->min = 0;
+        device->max = manager->priv->backlight_probe_max;
+        device->now = value;
+        backlight_probe_done (manager);
+
+        /* what was asked before now gets an answer */
+        if (device->interface != BACKLIGHT_INTERFACE_NONE)
+                backlight_emit_changed (manager);
+}
+
+static void
+backlight_probe_max_cb (CsdPowerManager *manager,
+                        gint64 value,
+                        const gchar *name,
+                        const GError *error,
+                        gpointer user_data)
 {
+        GError *local_error = NULL;
+
+        if (GPOINTER_TO_UINT (user_data) != manager->priv->backlight_probe_serial)
+                return;
+
+        if (error != NULL) {
+                g_debug ("failed to probe backlight: %s", error->message);
+                return;
+        }
+
+        /* only the first reply of a new helper names the device */
+        if (name != NULL) {
+                g_free (manager->priv->backlight_sysfs_name);
+                manager->priv->backlight_sysfs_name = g_strdup (name);
+        }
+
+        manager->priv->backlight_probe_max = value;
+        if (!backlight_helper_request (&manager->priv->backlight_reader,
+                                       "get-brightness",
+                                       backlight_probe_now_cb,
+                                       user_data,
+                                       &local_error)) {
+                g_debug ("failed to probe backlight: %s", local_error->message);
+                g_error_free (local_error);
+        }
+}
+
+/**
+ * backlight_probe:
+ *
+ * Finds out how the backlight is controlled. XRandR answers right
+ * away. The sysfs fallback is read by an unprivileged helper, and the
+ * model is only replaced once it answered; Changed is emitted then.
+ * Until then a previous sysfs model is still used.
+ **/
+static void
+backlight_probe (CsdPowerManager *manager)
+{
+        BacklightDevice *device = &manager->priv->backlight;
+        BacklightHelper *reader = &manager->priv->backlight_reader;
         GnomeRROutput *output;
+        GError *error = NULL;
+        gpointer serial;
+        gboolean ret;
+
+        manager->priv->backlight_probed = TRUE;
+        serial = GUINT_TO_POINTER (++manager->priv->backlight_probe_serial);
 
         /* prioritize user override settings */
         if (!manager->priv->backlight_helper_force)
@@ -2744,98 +3319,172 @@ backlight_get_abs (CsdPowerManager *manager, GError **error)
                 /* prefer xbacklight */
                 output = get_primary_output (manager);
                 if (output != NULL) {
-                        return gnome_rr_output_get_backlight (output,
-                                                              error);
+                        device->interface = BACKLIGHT_INTERFACE_XRANDR;
+                        device->output = output;
+                        device->min = gnome_rr_output_get_backlight_min (output);
+                        device->max = gnome_rr_output_get_backlight_max (output);
+                        device->now = gnome_rr_output_get_backlight (output, &error);
+                        if (error != NULL) {
+                                g_debug ("failed to probe backlight: %s", error->message);
+                                g_error_free (error);
+                        }
+                        backlight_probe_done (manager);
+                        return;
                 }
         }
 
-        /* fall back to the polkit helper */
-        return backlight_helper_get_value ("get-brightness", manager, error);
+        /* only a sysfs model can still be right */
+        if (device->interface != BACKLIGHT_INTERFACE_HELPER) {
+                device->interface = BACKLIGHT_INTERFACE_NONE;
+                device->output = NULL;
+        }
+
+#ifndef __linux__
+        /* non-Linux platforms won't have /sys/class/backlight */
+        return;
+#endif
+
+        /* fall back to sysfs; the helper sends the maximum once it's ready */
+        if (reader->fd < 0)
+                ret = backlight_helper_start (reader, backlight_probe_max_cb, serial, &error);
+        else
+                ret = backlight_helper_request (reader, "get-max-brightness",
+                                                backlight_probe_max_cb, serial, &error);
+        if (!ret) {
+                g_debug ("failed to probe backlight: %s", error->message);
+                g_error_free (error);
+        }
 }
 
-static gint
-backlight_get_percentage (CsdPowerManager *manager, GError **error)
+/**
+ * backlight_get_device:
+ *
+ * Gets the cached backlight model, probing the hardware the first time
+ * after startup or after a RandR or udev change.
+ *
+ * Return value: the device, or %NULL if there is no backlight control.
+ * If %NULL then @error is set.
+ **/
+static BacklightDevice *
+backlight_get_device (CsdPowerManager *manager, GError **error)
 {
-        GnomeRROutput *output;
-        gint now;
-        gint value = -1;
-        gint min = 0;
-        gint max;
+        if (!manager->priv->backlight_probed)
+                backlight_probe (manager);
 
-        /* prioritize user override settings */
-        if (!manager->priv->backlight_helper_force)
-        {
-                /* prefer xbacklight */
-                output = get_primary_output (manager);
-                if (output != NULL) {
+        if (manager->priv->backlight.interface == BACKLIGHT_INTERFACE_NONE) {
+                g_set_error_literal (error,
+                                     CSD_POWER_MANAGER_ERROR,
+                                     CSD_POWER_MANAGER_ERROR_FAILED,
+                                     "no backlight control available");
+                return NULL;
+        }
+        return &manager->priv->backlight;
+}
 
-                        min = gnome_rr_output_get_backlight_min (output);
-                        max = gnome_rr_output_get_backlight_max (output);
-                        now = gnome_rr_output_get_backlight (output, error);
-                        if (now < 0)
-                                goto out;
-                        value = ABS_TO_PERCENTAGE (min, max, now);
-                        goto out;
-                }
+#ifdef HAVE_GUDEV
+static void
+backlight_uevent_cb (GUdevClient *client,
+                     const gchar *action,
+                     GUdevDevice *device,
+                     CsdPowerManager *manager)
+{
+        BacklightDevice *backlight = &manager->priv->backlight;
+        gint value;
+
+        g_debug ("backlight %s: %s", action, g_udev_device_get_sysfs_path (device));
+
+        /* a new or removed interface may change the one the helper picks */
+        if (g_strcmp0 (action, "change") != 0) {
+                backlight_helpers_stop (manager);
+                backlight_invalidate (manager);
+                return;
         }
 
-        /* fall back to the polkit helper */
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0)
-                goto out;
-        now = backlight_helper_get_value ("get-brightness", manager, error);
+        /* Every brightness write ends up here, each step of a fade
+         * too. Only the level changed, so it is taken over instead of
+         * probing again, and our own writes are accounted for already. */
+        if (backlight->interface == BACKLIGHT_INTERFACE_NONE ||
+            manager->priv->backlight_transition_id != 0 ||
+            manager->priv->backlight_set_in_flight)
+                return;
+
+        /* only the device we control; XRandR might be backed by another
+         * one, or scale it differently */
+        if (backlight->interface == BACKLIGHT_INTERFACE_HELPER) {
+                if (g_strcmp0 (g_udev_device_get_name (device),
+                               manager->priv->backlight_sysfs_name) != 0)
+                        return;
+        } else if (g_udev_device_get_sysfs_attr_as_int (device, "max_brightness") != backlight->max) {
+                return;
+        }
+
+        value = CLAMP (g_udev_device_get_sysfs_attr_as_int (device, "brightness"),
+                       backlight->min, backlight->max);
+        if (value == backlight->now)
+                return;
+
+        /* changed behind our back, by the firmware for example */
+        backlight->now = value;
+        backlight_emit_changed (manager);
+}
+#endif
+
+static gint
+backlight_read_abs (CsdPowerManager *manager, GError **error)
+{
+        BacklightDevice *device;
+
+        device = backlight_get_device (manager, error);
+        if (device == NULL)
+                return -1;
+        return device->now;
+}
+
+static gint
+backlight_get_abs (CsdPowerManager *manager, GError **error)
+{
+        gint now;
+
+        now = backlight_read_abs (manager, error);
         if (now < 0)
-                goto out;
-        value = ABS_TO_PERCENTAGE (min, max, now);
-out:
-        return value;
+                return -1;
+        return backlight_transition_target (manager, now);
 }
 
 static gint
-backlight_get_min (CsdPowerManager *manager)
+backlight_get_percentage (CsdPowerManager *manager, GError **error)
 {
-        /* if we have no xbacklight device, then hardcode zero as sysfs
-        * offsets everything to 0 as min */
+        BacklightDevice *device;
 
-        /* user override means we will be using sysfs */
-        if (manager->priv->backlight_helper_force)
-                return 0;
+        device = backlight_get_device (manager, error);
+        if (device == NULL)
+                return -1;
+        return ABS_TO_PERCENTAGE (device->min, device->max,
+                                  backlight_transition_target (manager, device->now));
+}
 
-        GnomeRROutput *output;
+static gint
+backlight_get_min (CsdPowerManager *manager)
+{
+        BacklightDevice *device;
 
-        output = get_primary_output (manager);
-        if (output == NULL)
+        /* if we have no backlight device, then hardcode zero as sysfs
+         * offsets everything to 0 as min */
+        device = backlight_get_device (manager, NULL);
+        if (device == NULL)
                 return 0;
-
-        /* get xbacklight value, which maybe non-zero */
-        return gnome_rr_output_get_backlight_min (output);
+        return device->min;
 }
 
 static gint
 backlight_get_max (CsdPowerManager *manager, GError **error)
 {
-        gint value;
-        GnomeRROutput *output;
+        BacklightDevice *device;
 
-        /* prioritize user override settings */
-        if (!manager->priv->backlight_helper_force)
-        {
-                /* prefer xbacklight */
-                output = get_primary_output (manager);
-                if (output != NULL) {
-                        value = gnome_rr_output_get_backlight_max (output);
-                        if (value < 0) {
-                                g_set_error (error,
-                                             CSD_POWER_MANAGER_ERROR,
-                                             CSD_POWER_MANAGER_ERROR_FAILED,
-                                             "failed to get backlight max");
-                        }
-                        return value;
-                }
-        }
-
-        /* fall back to the polkit helper */
-        return  backlight_helper_get_value ("get-max-brightness", manager, error);
+        device = backlight_get_device (manager, error);
+        if (device == NULL)
+                return -1;
+        return device->max;
 }
 
 static void
@@ -2860,46 +3509,168 @@ backlight_emit_changed (CsdPowerManager *manager)
         }
 }
 
+static gboolean
+backlight_write_abs (CsdPowerManager *manager,
+                     gint value,
+                     GError **error)
+{
+        BacklightDevice *device;
+        gboolean ret;
+
+        device = backlight_get_device (manager, error);
+        if (device == NULL)
+                return FALSE;
+
+        if (device->interface == BACKLIGHT_INTERFACE_XRANDR) {
+                ret = gnome_rr_output_set_backlight (device->output,
+                                                     value,
+                                                     error);
+        } else {
+                ret = backlight_helper_set_value (manager,
+                                                  value,
+                                                  error);
+        }
+
+        if (ret)
+                device->now = value;
+        return ret;
+}
+
+static gdouble
+backlight_transition_ease (CsdBacklightTransitionCurve curve, gdouble t)
+{
+        switch (curve) {
+        case CSD_BACKLIGHT_TRANSITION_CURVE_EASE_OUT:
+                return 1.0 - (1.0 - t) * (1.0 - t) * (1.0 - t);
+        case CSD_BACKLIGHT_TRANSITION_CURVE_EASE_IN_OUT:
+                if (t < 0.5)
+                        return 4.0 * t * t * t;
+                return 1.0 - 4.0 * (1.0 - t) * (1.0 - t) * (1.0 - t);
+        case CSD_BACKLIGHT_TRANSITION_CURVE_LINEAR:
+        default:
+                return t;
+        }
+}
+
+static void
+backlight_transition_stop (CsdPowerManager *manager)
+{
+        if (manager->priv->backlight_transition_id != 0) {
+                g_source_remove (manager->priv->backlight_transition_id);
+                manager->priv->backlight_transition_id = 0;
+        }
+}
+
+static gboolean
+backlight_transition_tick_cb (gpointer user_data)
+{
+        CsdPowerManager *manager = CSD_POWER_MANAGER (user_data);
+        CsdPowerManagerPrivate *priv = manager->priv;
+        GError *error = NULL;
+        gdouble progress;
+        gdouble delta;
+        gint value;
+
+        progress = (gdouble) (g_get_monotonic_time () - priv->backlight_transition_started) /
+                   (priv->backlight_transition_duration * 1000.0);
+        progress = CLAMP (progress, 0.0, 1.0);
+
+        delta = (priv->backlight_transition_to - priv->backlight_transition_from) *
+                backlight_transition_ease (priv->backlight_transition_curve, progress);
+        value = priv->backlight_transition_from + (gint) (delta + (delta < 0 ? -0.5 : 0.5));
+
+        /* only write when the hardware level actually changes */
+        if (value != priv->backlight_transition_now) {
+                if (!backlight_write_abs (manager, value, &error)) {
+                        g_warning ("failed to fade backlight to %i: %s",
+                                   value, error->message);
+                        g_error_free (error);
+                        priv->backlight_transition_id = 0;
+                        return FALSE;
+                }
+                priv->backlight_transition_now = value;
+        }
+
+        if (progress >= 1.0) {
+                priv->backlight_transition_id = 0;
+                return FALSE;
+        }
+        return TRUE;
+}
+
+/**
+ * backlight_transition_start:
+ *
+ * Fades the backlight to @value. A fade that is already running is
+ * retargeted from its current level, so that repeated requests, such as
+ * a held brightness key, coalesce into a single moving target.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+static gboolean
+backlight_transition_start (CsdPowerManager *manager,
+                            gint value,
+                            GError **error)
+{
+        CsdPowerManagerPrivate *priv = manager->priv;
+        gint now;
+
+        if (priv->backlight_transition_duration == 0) {
+                backlight_transition_stop (manager);
+                return backlight_write_abs (manager, value, error);
+        }
+
+        if (priv->backlight_transition_id != 0) {
+                now = priv->backlight_transition_now;
+        } else {
+                now = backlight_read_abs (manager, NULL);
+                if (now < 0)
+                        return backlight_write_abs (manager, value, error);
+        }
+
+        if (now == value) {
+                backlight_transition_stop (manager);
+                return TRUE;
+        }
+
+        priv->backlight_transition_from = now;
+        priv->backlight_transition_now = now;
+        priv->backlight_transition_to = value;
+        priv->backlight_transition_started = g_get_monotonic_time ();
+        if (priv->backlight_transition_id == 0) {
+                priv->backlight_transition_id = g_timeout_add (BACKLIGHT_TRANSITION_INTERVAL,
+                                                               backlight_transition_tick_cb,
+                                                               manager);
+        }
+        return TRUE;
+}
+
+static void
+backlight_transition_settings_refresh (CsdPowerManager *manager)
+{
+        manager->priv->backlight_transition_duration =
+                MAX (g_settings_get_int (manager->priv->settings, "backlight-transition-duration"), 0);
+        manager->priv->backlight_transition_curve =
+                g_settings_get_enum (manager->priv->settings, "backlight-transition-curve");
+}
+
 static gboolean
 backlight_set_percentage (CsdPowerManager *manager,
                           guint value,
                           gboolean emit_changed,
                           GError **error)
 {
-        GnomeRROutput *output;
+        BacklightDevice *device;
         gboolean ret = FALSE;
-        gint min = 0;
-        gint max;
         guint discrete;
 
-        /* prioritize user override settings */
-        if (!manager->priv->backlight_helper_force)
-        {
-                /* prefer xbacklight */
-                output = get_primary_output (manager);
-                if (output != NULL) {
-                        min = gnome_rr_output_get_backlight_min (output);
-                        max = gnome_rr_output_get_backlight_max (output);
-                        if (min < 0 || max < 0) {
-                                g_warning ("no xrandr backlight capability");
-                                goto out;
-                        }
-                        discrete = PERCENTAGE_TO_ABS (min, max, value);
-                        ret = gnome_rr_output_set_backlight (output,
-                                                             discrete,
-                                                             error);
-                        goto out;
-                }
-        }
-
-        /* fall back to the polkit helper */
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0)
+        device = backlight_get_device (manager, error);
+        if (device == NULL)
                 goto out;
-        discrete = PERCENTAGE_TO_ABS (min, max, value);
-        ret = backlight_helper_set_value ("set-brightness",
+
+        discrete = PERCENTAGE_TO_ABS (device->min, device->max, value);
+        ret = backlight_transition_start (manager,
                                           discrete,
-                                          manager,
                                           error);
 out:
         if (ret && emit_changed)
@@ -2908,65 +3679,36 @@ out:
 }
 
 static gint
-backlight_step_up (CsdPowerManager *manager, GError **error)
+backlight_step (CsdPowerManager *manager, gint direction, GError **error)
 {
-        GnomeRROutput *output;
+        BacklightDevice *device;
         gboolean ret = FALSE;
         gint percentage_value = -1;
-        gint min = 0;
-        gint max;
         gint now;
-        gint step;
         guint discrete;
-        GnomeRRCrtc *crtc;
 
-        /* prioritize user override settings */
-        if (!manager->priv->backlight_helper_force)
-        {
-                /* prefer xbacklight */
-                output = get_primary_output (manager);
-                if (output != NULL) {
+        device = backlight_get_device (manager, error);
+        if (device == NULL)
+                goto out;
 
-                        crtc = gnome_rr_output_get_crtc (output);
-                        if (crtc == NULL) {
-                                g_set_error (error,
-                                             CSD_POWER_MANAGER_ERROR,
-                                             CSD_POWER_MANAGER_ERROR_FAILED,
-                                             "no crtc for %s",
-                                             gnome_rr_output_get_name (output));
-                                goto out;
-                        }
-                        min = gnome_rr_output_get_backlight_min (output);
-                        max = gnome_rr_output_get_backlight_max (output);
-                        now = gnome_rr_output_get_backlight (output, error);
-                        if (now < 0)
-                               goto out;
-                        step = BRIGHTNESS_STEP_AMOUNT (max - min + 1);
-                        discrete = MIN (now + step, max);
-                        ret = gnome_rr_output_set_backlight (output,
-                                                             discrete,
-                                                             error);
-                        if (ret)
-                                percentage_value = ABS_TO_PERCENTAGE (min, max, discrete);
-                        goto out;
-                }
+        if (device->interface == BACKLIGHT_INTERFACE_XRANDR &&
+            gnome_rr_output_get_crtc (device->output) == NULL) {
+                g_set_error (error,
+                             CSD_POWER_MANAGER_ERROR,
+                             CSD_POWER_MANAGER_ERROR_FAILED,
+                             "no crtc for %s",
+                             gnome_rr_output_get_name (device->output));
+                goto out;
         }
 
-        /* fall back to the polkit helper */
-        now = backlight_helper_get_value ("get-brightness", manager, error);
-        if (now < 0)
-                goto out;
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0)
-                goto out;
-        step = BRIGHTNESS_STEP_AMOUNT (max - min + 1);
-        discrete = MIN (now + step, max);
-        ret = backlight_helper_set_value ("set-brightness",
+        /* step from where a running fade is heading to */
+        now = backlight_transition_target (manager, device->now);
+        discrete = CLAMP (now + direction * device->step, device->min, device->max);
+        ret = backlight_transition_start (manager,
                                           discrete,
-                                          manager,
                                           error);
         if (ret)
-                percentage_value = ABS_TO_PERCENTAGE (min, max, discrete);
+                percentage_value = ABS_TO_PERCENTAGE (device->min, device->max, discrete);
 out:
         if (ret)
                 backlight_emit_changed (manager);
@@ -2974,69 +3716,15 @@ out:
 }
 
 static gint
-backlight_step_down (CsdPowerManager *manager, GError **error)
+backlight_step_up (CsdPowerManager *manager, GError **error)
 {
-        GnomeRROutput *output;
-        gboolean ret = FALSE;
-        gint percentage_value = -1;
-        gint min = 0;
-        gint max;
-        gint now;
-        gint step;
-        guint discrete;
-        GnomeRRCrtc *crtc;
-
-        /* prioritize user override settings */
-        if (!manager->priv->backlight_helper_force)
-        {
-                /* prefer xbacklight */
-                output = get_primary_output (manager);
-                if (output != NULL) {
-
-                        crtc = gnome_rr_output_get_crtc (output);
-                        if (crtc == NULL) {
-                                g_set_error (error,
-                                             CSD_POWER_MANAGER_ERROR,
-                                             CSD_POWER_MANAGER_ERROR_FAILED,
-                                             "no crtc for %s",
-                                             gnome_rr_output_get_name (output));
-                                goto out;
-                        }
-                        min = gnome_rr_output_get_backlight_min (output);
-                        max = gnome_rr_output_get_backlight_max (output);
-                        now = gnome_rr_output_get_backlight (output, error);
-                        if (now < 0)
-                               goto out;
-                        step = BRIGHTNESS_STEP_AMOUNT (max - min + 1);
-                        discrete = MAX (now - step, 0);
-                        ret = gnome_rr_output_set_backlight (output,
-                                                             discrete,
-                                                             error);
-                        if (ret)
-                                percentage_value = ABS_TO_PERCENTAGE (min, max, discrete);
-                        goto out;
-                }
-        }
+        return backlight_step (manager, 1, error);
+}
 
-        /* fall back to the polkit helper */
-        now = backlight_helper_get_value ("get-brightness", manager, error);
-        if (now < 0)
-                goto out;
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0)
-                goto out;
-        step = BRIGHTNESS_STEP_AMOUNT (max - min + 1);
-        discrete = MAX (now - step, 0);
-        ret = backlight_helper_set_value ("set-brightness",
-                                          discrete,
-                                          manager,
-                                          error);
-        if (ret)
-                percentage_value = ABS_TO_PERCENTAGE (min, max, discrete);
-out:
-        if (ret)
-                backlight_emit_changed (manager);
-        return percentage_value;
+static gint
+backlight_step_down (CsdPowerManager *manager, GError **error)
+{
+        return backlight_step (manager, -1, error);
 }
 
 static gint
@@ -3045,27 +3733,9 @@ backlight_set_abs (CsdPowerManager *manager,
                    gboolean emit_changed,
                    GError **error)
 {
-        GnomeRROutput *output;
-        gboolean ret = FALSE;
+        gboolean ret;
 
-        /* prioritize user override settings */
-        if (!manager->priv->backlight_helper_force)
-        {
-                /* prefer xbacklight */
-                output = get_primary_output (manager);
-                if (output != NULL) {
-                        ret = gnome_rr_output_set_backlight (output,
-                                                             value,
-                                                             error);
-                        goto out;
-                }
-        }
-        /* fall back to the polkit helper */
-        ret = backlight_helper_set_value ("set-brightness",
-                                          value,
-                                          manager,
-                                          error);
-out:
+        ret = backlight_transition_start (manager, value, error);
         if (ret && emit_changed)
                 backlight_emit_changed (manager);
         return ret;
@@ -3313,34 +3983,20 @@ idle_set_mode (CsdPowerManager *manager, CsdPowerIdleMode mode)
 static gboolean
 idle_is_session_inhibited (CsdPowerManager *manager, guint mask)
 {
-        gboolean ret;
-        GVariant *retval = NULL;
-        GError *error = NULL;
+        guint i;
 
         /* not yet connected to cinnamon-session */
-        if (manager->priv->session_proxy == NULL) {
-                g_warning ("session inhibition not available, cinnamon-session is not available");
+        if (manager->priv->session_inhibitors == NULL) {
+                g_debug ("session inhibition not available, cinnamon-session is not available");
                 return FALSE;
         }
 
-        retval = g_dbus_proxy_call_sync (manager->priv->session_proxy,
-                                         "IsInhibited",
-                                         g_variant_new ("(u)",
-                                                        mask),
-                                         G_DBUS_CALL_FLAGS_NONE,
-                                         -1, NULL,
-                                         &error);
-        if (retval == NULL) {
-                /* abort as the DBUS method failed */
-                g_warning ("IsInhibited failed: %s", error->message);
-                g_error_free (error);
-                return FALSE;
+        for (i = 0; i < SESSION_INHIBIT_BITS; i++) {
+                if ((mask & (1 << i)) != 0 &&
+                    manager->priv->session_inhibit_counts[i] > 0)
+                        return TRUE;
         }
-
-        g_variant_get (retval, "(b)", &ret);
-        g_variant_unref (retval);
-
-        return ret;
+        return FALSE;
 }
 
 /**
@@ -3544,6 +4200,191 @@ sleep_cb_screensaver_proxy_ready_cb (GObject *source_object,
 
 }
 
+/* an inhibitor whose flags are still being fetched is in the table
+ * with SESSION_INHIBITOR_PENDING */
+#define SESSION_INHIBITOR_PENDING G_MAXUINT
+
+typedef struct {
+        CsdPowerManager *manager;
+        gchar           *path;
+} SessionInhibitorCall;
+
+static void
+session_inhibitor_count (CsdPowerManager *manager, guint flags, gint sign)
+{
+        guint i;
+
+        if (flags == SESSION_INHIBITOR_PENDING)
+                return;
+        for (i = 0; i < SESSION_INHIBIT_BITS; i++) {
+                if ((flags & (1 << i)) != 0)
+                        manager->priv->session_inhibit_counts[i] += sign;
+        }
+}
+
+static void
+session_inhibitor_get_flags_cb (GObject *source_object,
+                                GAsyncResult *res,
+                                gpointer user_data)
+{
+        SessionInhibitorCall *call = user_data;
+        CsdPowerManager *manager = call->manager;
+        GVariant *retval;
+        GError *error = NULL;
+        gpointer value;
+        guint flags;
+
+        retval = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (retval == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_debug ("failed to get flags of inhibitor %s: %s",
+                                 call->path, error->message);
+                        /* it was most likely removed in the meantime */
+                        g_hash_table_remove (manager->priv->session_inhibitors, call->path);
+                }
+                g_error_free (error);
+                goto out;
+        }
+        g_variant_get (retval, "(u)", &flags);
+        g_variant_unref (retval);
+
+        /* removed while we were asking */
+        if (!g_hash_table_lookup_extended (manager->priv->session_inhibitors,
+                                           call->path, NULL, &value) ||
+            GPOINTER_TO_UINT (value) != SESSION_INHIBITOR_PENDING)
+                goto out;
+
+        g_debug ("inhibitor %s has flags %u", call->path, flags);
+        g_hash_table_insert (manager->priv->session_inhibitors,
+                             g_strdup (call->path), GUINT_TO_POINTER (flags));
+        session_inhibitor_count (manager, flags, 1);
+
+        if ((flags & (SESSION_INHIBIT_MASK_IDLE | SESSION_INHIBIT_MASK_SUSPEND)) != 0)
+                idle_configure (manager);
+out:
+        g_free (call->path);
+        g_free (call);
+}
+
+static void
+session_inhibitor_add (CsdPowerManager *manager, const gchar *path)
+{
+        SessionInhibitorCall *call;
+
+        if (g_hash_table_contains (manager->priv->session_inhibitors, path))
+                return;
+        g_hash_table_insert (manager->priv->session_inhibitors,
+                             g_strdup (path),
+                             GUINT_TO_POINTER (SESSION_INHIBITOR_PENDING));
+
+        call = g_new0 (SessionInhibitorCall, 1);
+        call->manager = manager;
+        call->path = g_strdup (path);
+        g_dbus_connection_call (g_dbus_proxy_get_connection (manager->priv->session_proxy),
+                                GNOME_SESSION_DBUS_NAME,
+                                path,
+                                GNOME_SESSION_DBUS_INTERFACE_INHIBITOR,
+                                "GetFlags",
+                                NULL,
+                                G_VARIANT_TYPE ("(u)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                manager->priv->session_inhibitors_cancellable,
+                                session_inhibitor_get_flags_cb,
+                                call);
+}
+
+static void
+session_inhibitor_remove (CsdPowerManager *manager, const gchar *path)
+{
+        gpointer value;
+
+        if (!g_hash_table_lookup_extended (manager->priv->session_inhibitors,
+                                           path, NULL, &value))
+                return;
+        session_inhibitor_count (manager, GPOINTER_TO_UINT (value), -1);
+        g_hash_table_remove (manager->priv->session_inhibitors, path);
+}
+
+static void
+session_get_inhibitors_cb (GObject *source_object,
+                           GAsyncResult *res,
+                           gpointer user_data)
+{
+        CsdPowerManager *manager = user_data;
+        GVariant *retval;
+        GVariantIter *iter;
+        GError *error = NULL;
+        const gchar *path;
+
+        retval = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (retval == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("GetInhibitors failed: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        g_variant_get (retval, "(ao)", &iter);
+        while (g_variant_iter_loop (iter, "&o", &path))
+                session_inhibitor_add (manager, path);
+        g_variant_iter_free (iter);
+        g_variant_unref (retval);
+}
+
+static void
+session_inhibitors_clear (CsdPowerManager *manager)
+{
+        if (manager->priv->session_inhibitors_cancellable != NULL) {
+                g_cancellable_cancel (manager->priv->session_inhibitors_cancellable);
+                g_object_unref (manager->priv->session_inhibitors_cancellable);
+                manager->priv->session_inhibitors_cancellable = NULL;
+        }
+        if (manager->priv->session_inhibitors != NULL) {
+                g_hash_table_destroy (manager->priv->session_inhibitors);
+                manager->priv->session_inhibitors = NULL;
+        }
+        memset (manager->priv->session_inhibit_counts, 0,
+                sizeof (manager->priv->session_inhibit_counts));
+}
+
+/* mirrors the inhibitors of cinnamon-session, so that checking them
+ * never has to wait for another process */
+static void
+session_inhibitors_sync (CsdPowerManager *manager)
+{
+        gchar *owner;
+
+        session_inhibitors_clear (manager);
+
+        owner = g_dbus_proxy_get_name_owner (manager->priv->session_proxy);
+        if (owner == NULL)
+                return;
+        g_free (owner);
+
+        manager->priv->session_inhibitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                   g_free, NULL);
+        manager->priv->session_inhibitors_cancellable = g_cancellable_new ();
+        g_dbus_proxy_call (manager->priv->session_proxy,
+                           "GetInhibitors",
+                           NULL,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           manager->priv->session_inhibitors_cancellable,
+                           session_get_inhibitors_cb,
+                           manager);
+}
+
+static void
+session_name_owner_changed_cb (GDBusProxy *proxy,
+                               GParamSpec *pspec,
+                               CsdPowerManager *manager)
+{
+        g_debug ("cinnamon-session owner changed, refreshing inhibitors");
+        session_inhibitors_sync (manager);
+        idle_configure (manager);
+}
+
 static void
 idle_dbus_signal_cb (GDBusProxy *proxy,
                      const gchar *sender_name,
@@ -3553,9 +4394,22 @@ idle_dbus_signal_cb (GDBusProxy *proxy,
 {
         CsdPowerManager *manager = CSD_POWER_MANAGER (user_data);
 
-        if (g_strcmp0 (signal_name, "InhibitorAdded") == 0 ||
-            g_strcmp0 (signal_name, "InhibitorRemoved") == 0) {
-                g_debug ("Received gnome session inhibitor change");
+        if (g_strcmp0 (signal_name, "InhibitorAdded") == 0 &&
+            manager->priv->session_inhibitors != NULL) {
+                const gchar *path;
+
+                /* idle_configure() runs once the flags are known */
+                g_variant_get (parameters, "(&o)", &path);
+                g_debug ("Received gnome session inhibitor %s", path);
+                session_inhibitor_add (manager, path);
+        }
+        if (g_strcmp0 (signal_name, "InhibitorRemoved") == 0 &&
+            manager->priv->session_inhibitors != NULL) {
+                const gchar *path;
+
+                g_variant_get (parameters, "(&o)", &path);
+                g_debug ("Received gnome session inhibitor %s removal", path);
+                session_inhibitor_remove (manager, path);
                 idle_configure (manager);
         }
         if (g_strcmp0 (signal_name, "StatusChanged") == 0) {
@@ -3585,6 +4439,9 @@ session_proxy_ready_cb (GObject *source_object,
         } else {
                 g_signal_connect (manager->priv->session_proxy, "g-signal",
                                   G_CALLBACK (idle_dbus_signal_cb), manager);
+                g_signal_connect (manager->priv->session_proxy, "notify::g-name-owner",
+                                  G_CALLBACK (session_name_owner_changed_cb), manager);
+                session_inhibitors_sync (manager);
         }
 
         idle_configure (manager);
@@ -3776,6 +4633,11 @@ engine_settings_key_changed_cb (GSettings *settings,
                 backlight_override_settings_refresh (manager);
                 return;
         }
+
+        if (g_str_has_prefix (key, "backlight-transition")) {
+                backlight_transition_settings_refresh (manager);
+                return;
+        }
 }
 
 static void
@@ -4096,55 +4958,53 @@ logind_proxy_signal_cb (GDBusProxy  *proxy,
         }
 }
 
-static gboolean
-is_hardware_a_virtual_machine (void)
+static void
+systemd_proxy_ready_cb (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
 {
-        const gchar *str;
-        gboolean ret = FALSE;
+        CsdPowerManager *manager = CSD_POWER_MANAGER (user_data);
+        GDBusProxy *proxy;
         GError *error = NULL;
-        GVariant *inner;
-        GVariant *variant = NULL;
-        GDBusConnection *connection;
+        GVariant *variant;
+        const gchar *str;
 
-        connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM,
-                                     NULL,
-                                     &error);
-        if (connection == NULL) {
+        proxy = cinnamon_settings_bus_get_proxy_finish (res, &error);
+        if (proxy == NULL) {
                 g_warning ("system bus not available: %s", error->message);
                 g_error_free (error);
                 goto out;
         }
-        variant = g_dbus_connection_call_sync (connection,
-                                               "org.freedesktop.systemd1",
-                                               "/org/freedesktop/systemd1",
-                                               "org.freedesktop.DBus.Properties",
-                                               "Get",
-                                               g_variant_new ("(ss)",
-                                                              "org.freedesktop.systemd1.Manager",
-                                                              "Virtualization"),
-                                               NULL,
-                                               G_DBUS_CALL_FLAGS_NONE,
-                                               -1,
-                                               NULL,
-                                               &error);
+
+        variant = g_dbus_proxy_get_cached_property (proxy, "Virtualization");
+        g_object_unref (proxy);
         if (variant == NULL) {
-                g_debug ("Failed to get property '%s': %s", "Virtualization", error->message);
-                g_error_free (error);
+                g_debug ("Failed to get property '%s'", "Virtualization");
                 goto out;
         }
 
         /* on bare-metal hardware this is the empty string,
          * otherwise an identifier such as "kvm", "vmware", etc. */
-        g_variant_get (variant, "(v)", &inner);
-        str = g_variant_get_string (inner, NULL);
+        str = g_variant_get_string (variant, NULL);
         if (str != NULL && str[0] != '\0')
-                ret = TRUE;
+                manager->priv->is_virtual_machine = TRUE;
+        g_variant_unref (variant);
 out:
-        if (connection != NULL)
-                g_object_unref (connection);
-        if (variant != NULL)
-                g_variant_unref (variant);
-        return ret;
+        g_object_unref (manager);
+}
+
+static void
+detect_virtual_machine (CsdPowerManager *manager)
+{
+        manager->priv->is_virtual_machine = FALSE;
+        cinnamon_settings_bus_get_proxy (G_BUS_TYPE_SYSTEM,
+                                         G_DBUS_PROXY_FLAGS_NONE,
+                                         "org.freedesktop.systemd1",
+                                         "/org/freedesktop/systemd1",
+                                         "org.freedesktop.systemd1.Manager",
+                                         NULL,
+                                         systemd_proxy_ready_cb,
+                                         g_object_ref (manager));
 }
 
 gboolean
@@ -4296,6 +5156,7 @@ csd_power_manager_start (CsdPowerManager *manager,
         /* get backlight setting overrides */
         manager->priv->backlight_helper_preference_args = NULL;
         backlight_override_settings_refresh (manager);
+        backlight_transition_settings_refresh (manager);
 
         /* get percentage policy */
         manager->priv->low_percentage = g_settings_get_int (manager->priv->settings,
@@ -4328,6 +5189,18 @@ csd_power_manager_start (CsdPowerManager *manager,
         g_signal_connect (manager->priv->x11_screen, "changed", G_CALLBACK (on_randr_event), manager);
         on_randr_event (manager->priv->x11_screen, manager);
 
+        /* find out how the backlight is controlled before it is needed */
+#ifdef HAVE_GUDEV
+        {
+                const gchar *subsystems[] = { "backlight", NULL };
+
+                manager->priv->backlight_udev = g_udev_client_new (subsystems);
+                g_signal_connect (manager->priv->backlight_udev, "uevent",
+                                  G_CALLBACK (backlight_uevent_cb), manager);
+        }
+#endif
+        backlight_probe (manager);
+
         /* ensure the default dpms timeouts are cleared */
         ret = gnome_rr_screen_set_dpms_mode (manager->priv->x11_screen,
                                              GNOME_RR_DPMS_ON,
@@ -4355,7 +5228,7 @@ csd_power_manager_start (CsdPowerManager *manager,
                                                                                disable_builtin_screensaver,
                                                                                NULL);
         /* don't blank inside a VM */
-        manager->priv->is_virtual_machine = is_hardware_a_virtual_machine ();
+        detect_virtual_machine (manager);
 
         cinnamon_settings_profile_end (NULL);
         return TRUE;
@@ -4364,6 +5237,8 @@ csd_power_manager_start (CsdPowerManager *manager,
 void
 csd_power_manager_stop (CsdPowerManager *manager)
 {
+        guint i;
+
         g_debug ("Stopping power manager");
 
         if (manager->priv->bus_cancellable != NULL) {
@@ -4432,6 +5307,18 @@ csd_power_manager_stop (CsdPowerManager *manager)
                 manager->priv->logind_proxy = NULL;
         }
 
+        /* don't leave the panel half way through a fade */
+        if (manager->priv->backlight_transition_id != 0) {
+                backlight_transition_stop (manager);
+                backlight_write_abs (manager, manager->priv->backlight_transition_to, NULL);
+        }
+        backlight_helpers_stop (manager);
+        backlight_invalidate (manager);
+        manager->priv->backlight.interface = BACKLIGHT_INTERFACE_NONE;
+        manager->priv->backlight.output = NULL;
+#ifdef HAVE_GUDEV
+        g_clear_object (&manager->priv->backlight_udev);
+#endif
         g_free (manager->priv->backlight_helper_preference_args);
         manager->priv->backlight_helper_preference_args = NULL;
 
@@ -4440,6 +5327,8 @@ csd_power_manager_stop (CsdPowerManager *manager)
                 manager->priv->x11_screen = NULL;
         }
 
+        for (i = 0; i < manager->priv->devices_array->len; i++)
+                engine_device_info_remove (manager, g_ptr_array_index (manager->priv->devices_array, i));
         g_ptr_array_unref (manager->priv->devices_array);
         manager->priv->devices_array = NULL;
 
@@ -4466,7 +5355,10 @@ csd_power_manager_stop (CsdPowerManager *manager)
                 manager->priv->upower_proxy = NULL;
         }
 
+        session_inhibitors_clear (manager);
+
         if (manager->priv->session_proxy != NULL) {
+                g_signal_handlers_disconnect_by_data (manager->priv->session_proxy, manager);
                 g_object_unref (manager->priv->session_proxy);
                 manager->priv->session_proxy = NULL;
         }
@@ -4509,6 +5401,12 @@ csd_power_manager_init (CsdPowerManager *manager)
         manager->priv = CSD_POWER_MANAGER_GET_PRIVATE (manager);
         manager->priv->inhibit_lid_switch_fd = -1;
         manager->priv->inhibit_suspend_fd = -1;
+        manager->priv->backlight_reader.manager = manager;
+        manager->priv->backlight_reader.fd = -1;
+        manager->priv->backlight_writer.manager = manager;
+        manager->priv->backlight_writer.privileged = TRUE;
+        manager->priv->backlight_writer.fd = -1;
+        manager->priv->backlight_set_pending = -1;
 }
 
 static void
@@ -34,6 +34,7 @@
 #include <glib/gi18n.h>
 #include <gdk/gdk.h>
 
+#include "cinnamon-settings-bus.h"
 #include "cinnamon-settings-session.h"
 #include "cinnamon-settings-profile.h"
 #include "csd-screensaver-proxy-manager.h"
@@ -132,17 +133,41 @@ static const gchar introspection_xml2[] =
 
 #define GSM_INHIBITOR_FLAG_IDLE 1 << 3
 
+/* An uninhibit is only passed on to the session after this delay, so that
+ * an application dropping and taking back the same inhibitor, as video
+ * players do between clips, does not cost two session calls */
+#define UNINHIBIT_DELAY 500 /* ms */
+
 struct CsdScreensaverProxyManagerPrivate
 {
-        GDBusProxy              *session;
         GDBusConnection         *connection;
         GCancellable            *bus_cancellable;
         GDBusNodeInfo           *introspection_data;
         GDBusNodeInfo           *introspection_data2;
         guint                    name_id;
 
-        GHashTable              *watch_ht;  /* key = sender, value = name watch id */
-        GHashTable              *cookie_ht; /* key = cookie, value = sender */
+        GHashTable              *senders;   /* key = sender, value = ProxySender */
+        guint                    next_cookie;
+};
+
+typedef struct ProxySender ProxySender;
+
+typedef struct {
+        ProxySender             *proxy_sender;   /* only valid until released */
+        guint                    cookie;         /* the one handed to the client */
+        guint                    session_cookie; /* 0 until the session replied */
+        gchar                   *app_id;
+        gchar                   *reason;
+        GDBusMethodInvocation   *invocation;     /* Inhibit call waiting for the session */
+        gboolean                 released;       /* no longer wanted once the session replies */
+        guint                    release_id;
+} ProxyInhibitor;
+
+struct ProxySender {
+        CsdScreensaverProxyManager *manager;
+        guint                    watch_id;
+        GHashTable              *inhibitors;     /* key = cookie, value = ProxyInhibitor */
+        GList                   *releasing;      /* ProxyInhibitors waiting for UNINHIBIT_DELAY */
 };
 
 static void     csd_screensaver_proxy_manager_class_init  (CsdScreensaverProxyManagerClass *klass);
@@ -157,32 +182,68 @@ static gpointer manager_object = NULL;
 #define GNOME_SESSION_DBUS_OBJECT    "/org/gnome/SessionManager"
 #define GNOME_SESSION_DBUS_INTERFACE "org.gnome.SessionManager"
 
-static GDBusProxy *
-cinnamon_settings_session_get_session_proxy (void)
+static void
+proxy_inhibitor_free (ProxyInhibitor *inhibitor)
 {
-        static GDBusProxy *session_proxy;
-        GError *error =  NULL;
+        g_free (inhibitor->app_id);
+        g_free (inhibitor->reason);
+        g_free (inhibitor);
+}
 
-        if (session_proxy != NULL) {
-                g_object_ref (session_proxy);
-        } else {
-                session_proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
-                                                               G_DBUS_PROXY_FLAGS_NONE,
-                                                               NULL,
-                                                               GNOME_SESSION_DBUS_NAME,
-                                                               GNOME_SESSION_DBUS_OBJECT,
-                                                               GNOME_SESSION_DBUS_INTERFACE,
-                                                               NULL,
-                                                               &error);
-                if (error) {
-                        g_warning ("Failed to connect to the session manager: %s", error->message);
-                        g_error_free (error);
-                } else {
-                        g_object_add_weak_pointer (G_OBJECT (session_proxy), (gpointer*)&session_proxy);
-                }
+static void
+session_uninhibit (guint session_cookie)
+{
+        g_debug ("Releasing session cookie %u", session_cookie);
+        cinnamon_settings_bus_call (G_BUS_TYPE_SESSION,
+                                    GNOME_SESSION_DBUS_NAME,
+                                    GNOME_SESSION_DBUS_OBJECT,
+                                    GNOME_SESSION_DBUS_INTERFACE,
+                                    "Uninhibit",
+                                    g_variant_new ("(u)", session_cookie),
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    -1, NULL, NULL, NULL);
+}
+
+/* Drops an inhibitor that is no longer in any table, now or, if the
+ * session has not replied yet, as soon as it does */
+static void
+proxy_inhibitor_release (CsdScreensaverProxyManager *manager,
+                         ProxyInhibitor             *inhibitor)
+{
+        if (inhibitor->release_id != 0) {
+                g_source_remove (inhibitor->release_id);
+                inhibitor->release_id = 0;
+        }
+
+        /* the session has not replied yet */
+        if (inhibitor->invocation != NULL) {
+                inhibitor->released = TRUE;
+                return;
         }
 
-        return session_proxy;
+        if (inhibitor->session_cookie != 0)
+                session_uninhibit (inhibitor->session_cookie);
+        proxy_inhibitor_free (inhibitor);
+}
+
+static void
+proxy_sender_free (CsdScreensaverProxyManager *manager,
+                   ProxySender                *proxy_sender)
+{
+        GHashTableIter iter;
+        ProxyInhibitor *inhibitor;
+        GList *l;
+
+        g_hash_table_iter_init (&iter, proxy_sender->inhibitors);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &inhibitor))
+                proxy_inhibitor_release (manager, inhibitor);
+        for (l = proxy_sender->releasing; l != NULL; l = l->next)
+                proxy_inhibitor_release (manager, l->data);
+
+        g_list_free (proxy_sender->releasing);
+        g_hash_table_destroy (proxy_sender->inhibitors);
+        g_bus_unwatch_name (proxy_sender->watch_id);
+        g_free (proxy_sender);
 }
 
 static void
@@ -190,29 +251,185 @@ name_vanished_cb (GDBusConnection            *connection,
                   const gchar                *name,
                   CsdScreensaverProxyManager *manager)
 {
-        GHashTableIter iter;
-        gpointer cookie_ptr;
-        const char *sender;
-
-        /* Look for all the cookies under that name,
-         * and call uninhibit for them */
-        g_hash_table_iter_init (&iter, manager->priv->cookie_ht);
-        while (g_hash_table_iter_next (&iter, &cookie_ptr, (gpointer *) &sender)) {
-                if (g_strcmp0 (sender, name) == 0) {
-                        guint cookie = GPOINTER_TO_UINT (cookie_ptr);
-
-                        g_dbus_proxy_call_sync (manager->priv->session,
-                                                "Uninhibit",
-                                                g_variant_new ("(u)", cookie),
-                                                G_DBUS_CALL_FLAGS_NONE,
-                                                -1, NULL, NULL);
-                        g_debug ("Removing cookie %u for sender %s",
-                                 cookie, sender);
-                        g_hash_table_iter_remove (&iter);
+        ProxySender *proxy_sender;
+
+        /* all of the inhibitors of that name go at once */
+        proxy_sender = g_hash_table_lookup (manager->priv->senders, name);
+        if (proxy_sender == NULL)
+                return;
+
+        g_debug ("Removing %u cookies for vanished sender %s",
+                 g_hash_table_size (proxy_sender->inhibitors), name);
+        g_hash_table_remove (manager->priv->senders, name);
+        proxy_sender_free (manager, proxy_sender);
+}
+
+static ProxySender *
+proxy_sender_get (CsdScreensaverProxyManager *manager,
+                  const gchar                *sender)
+{
+        ProxySender *proxy_sender;
+
+        proxy_sender = g_hash_table_lookup (manager->priv->senders, sender);
+        if (proxy_sender != NULL)
+                return proxy_sender;
+
+        proxy_sender = g_new0 (ProxySender, 1);
+        proxy_sender->manager = manager;
+        proxy_sender->inhibitors = g_hash_table_new (g_direct_hash, g_direct_equal);
+        proxy_sender->watch_id = g_bus_watch_name_on_connection (manager->priv->connection,
+                                                                 sender,
+                                                                 G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                                 NULL,
+                                                                 (GBusNameVanishedCallback) name_vanished_cb,
+                                                                 manager,
+                                                                 NULL);
+        g_hash_table_insert (manager->priv->senders, g_strdup (sender), proxy_sender);
+        return proxy_sender;
+}
+
+static guint
+proxy_next_cookie (CsdScreensaverProxyManager *manager)
+{
+        if (++manager->priv->next_cookie == 0)
+                ++manager->priv->next_cookie;
+        return manager->priv->next_cookie;
+}
+
+static void
+session_inhibit_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+        ProxyInhibitor *inhibitor = user_data;
+        GDBusMethodInvocation *invocation;
+        GVariant *ret;
+        GError *error = NULL;
+
+        invocation = inhibitor->invocation;
+        inhibitor->invocation = NULL;
+
+        ret = cinnamon_settings_bus_call_finish (res, &error);
+        if (ret == NULL) {
+                g_warning ("Failed to inhibit the session: %s", error->message);
+                g_dbus_method_invocation_return_gerror (invocation, error);
+                g_error_free (error);
+
+                if (!inhibitor->released)
+                        g_hash_table_remove (inhibitor->proxy_sender->inhibitors,
+                                             GUINT_TO_POINTER (inhibitor->cookie));
+                proxy_inhibitor_free (inhibitor);
+                return;
+        }
+
+        g_variant_get (ret, "(u)", &inhibitor->session_cookie);
+        g_variant_unref (ret);
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(u)", inhibitor->cookie));
+
+        /* released before the session even replied */
+        if (inhibitor->released) {
+                session_uninhibit (inhibitor->session_cookie);
+                proxy_inhibitor_free (inhibitor);
+        }
+}
+
+static gboolean
+proxy_inhibitor_release_cb (gpointer user_data)
+{
+        ProxyInhibitor *inhibitor = user_data;
+        ProxySender *proxy_sender = inhibitor->proxy_sender;
+
+        inhibitor->release_id = 0;
+        proxy_sender->releasing = g_list_remove (proxy_sender->releasing, inhibitor);
+        proxy_inhibitor_release (proxy_sender->manager, inhibitor);
+
+        return FALSE;
+}
+
+static void
+handle_inhibit (CsdScreensaverProxyManager *manager,
+                const gchar                *sender,
+                const gchar                *app_id,
+                const gchar                *reason,
+                GDBusMethodInvocation      *invocation)
+{
+        ProxySender *proxy_sender;
+        ProxyInhibitor *inhibitor;
+        GList *l;
+
+        proxy_sender = proxy_sender_get (manager, sender);
+
+        /* take back an inhibitor that was only just released */
+        for (l = proxy_sender->releasing; l != NULL; l = l->next) {
+                inhibitor = l->data;
+                if (g_strcmp0 (inhibitor->app_id, app_id) == 0 &&
+                    g_strcmp0 (inhibitor->reason, reason) == 0) {
+                        g_source_remove (inhibitor->release_id);
+                        inhibitor->release_id = 0;
+                        proxy_sender->releasing = g_list_delete_link (proxy_sender->releasing, l);
+
+                        inhibitor->cookie = proxy_next_cookie (manager);
+                        g_hash_table_insert (proxy_sender->inhibitors,
+                                             GUINT_TO_POINTER (inhibitor->cookie),
+                                             inhibitor);
+                        g_debug ("Reusing session cookie %u for %s",
+                                 inhibitor->session_cookie, sender);
+                        g_dbus_method_invocation_return_value (invocation,
+                                                               g_variant_new ("(u)", inhibitor->cookie));
+                        return;
                 }
         }
 
-        g_hash_table_remove (manager->priv->watch_ht, sender);
+        inhibitor = g_new0 (ProxyInhibitor, 1);
+        inhibitor->proxy_sender = proxy_sender;
+        inhibitor->cookie = proxy_next_cookie (manager);
+        inhibitor->app_id = g_strdup (app_id);
+        inhibitor->reason = g_strdup (reason);
+        inhibitor->invocation = invocation;
+        g_hash_table_insert (proxy_sender->inhibitors,
+                             GUINT_TO_POINTER (inhibitor->cookie),
+                             inhibitor);
+
+        cinnamon_settings_bus_call (G_BUS_TYPE_SESSION,
+                                    GNOME_SESSION_DBUS_NAME,
+                                    GNOME_SESSION_DBUS_OBJECT,
+                                    GNOME_SESSION_DBUS_INTERFACE,
+                                    "Inhibit",
+                                    g_variant_new ("(susu)",
+                                                   app_id, 0, reason, GSM_INHIBITOR_FLAG_IDLE),
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    -1, NULL,
+                                    session_inhibit_cb,
+                                    inhibitor);
+}
+
+static void
+handle_uninhibit (CsdScreensaverProxyManager *manager,
+                  const gchar                *sender,
+                  guint                       cookie)
+{
+        ProxySender *proxy_sender;
+        ProxyInhibitor *inhibitor;
+
+        proxy_sender = g_hash_table_lookup (manager->priv->senders, sender);
+        if (proxy_sender == NULL)
+                return;
+        inhibitor = g_hash_table_lookup (proxy_sender->inhibitors, GUINT_TO_POINTER (cookie));
+        if (inhibitor == NULL)
+                return;
+        g_hash_table_remove (proxy_sender->inhibitors, GUINT_TO_POINTER (cookie));
+
+        /* still waiting for the session */
+        if (inhibitor->invocation != NULL) {
+                inhibitor->released = TRUE;
+                return;
+        }
+
+        proxy_sender->releasing = g_list_prepend (proxy_sender->releasing, inhibitor);
+        inhibitor->release_id = g_timeout_add (UNINHIBIT_DELAY,
+                                               proxy_inhibitor_release_cb,
+                                               inhibitor);
 }
 
 static void
@@ -227,9 +444,12 @@ handle_method_call (GDBusConnection       *connection,
 {
         CsdScreensaverProxyManager *manager = CSD_SCREENSAVER_PROXY_MANAGER (user_data);
 
-        /* Check session pointer as a proxy for whether the manager is in the
-           start or stop state */
-        if (manager->priv->session == NULL) {
+        /* Check the senders table as a proxy for whether the manager is in
+           the start or stop state */
+        if (manager->priv->senders == NULL) {
+                g_dbus_method_invocation_return_dbus_error (invocation,
+                                                            "org.freedesktop.DBus.Error.Failed",
+                                                            "The session manager is not available");
                 return;
         }
 
@@ -237,48 +457,17 @@ handle_method_call (GDBusConnection       *connection,
                  interface_name, method_name);
 
         if (g_strcmp0 (method_name, "Inhibit") == 0) {
-                GVariant *ret;
                 const char *app_id;
                 const char *reason;
-                guint cookie;
 
                 g_variant_get (parameters,
-                               "(ss)", &app_id, &reason);
-
-                ret = g_dbus_proxy_call_sync (manager->priv->session,
-                                              "Inhibit",
-                                              g_variant_new ("(susu)",
-                                                             app_id, 0, reason, GSM_INHIBITOR_FLAG_IDLE),
-                                              G_DBUS_CALL_FLAGS_NONE,
-                                              -1, NULL, NULL);
-                g_variant_get (ret, "(u)", &cookie);
-                g_hash_table_insert (manager->priv->cookie_ht,
-                                     GUINT_TO_POINTER (cookie),
-                                     g_strdup (sender));
-                if (g_hash_table_lookup (manager->priv->watch_ht, sender) == NULL) {
-                        guint watch_id;
-
-                        watch_id = g_bus_watch_name_on_connection (manager->priv->connection,
-                                                                   sender,
-                                                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
-                                                                   NULL,
-                                                                   (GBusNameVanishedCallback) name_vanished_cb,
-                                                                   manager,
-                                                                   NULL);
-                        g_hash_table_insert (manager->priv->watch_ht,
-                                             g_strdup (sender),
-                                             GUINT_TO_POINTER (watch_id));
-                }
-                g_dbus_method_invocation_return_value (invocation, ret);
+                               "(&s&s)", &app_id, &reason);
+                handle_inhibit (manager, sender, app_id, reason, invocation);
         } else if (g_strcmp0 (method_name, "UnInhibit") == 0) {
                 guint cookie;
 
                 g_variant_get (parameters, "(u)", &cookie);
-                g_dbus_proxy_call_sync (manager->priv->session,
-                                        "Uninhibit",
-                                        parameters,
-                                        G_DBUS_CALL_FLAGS_NONE,
-                                        -1, NULL, NULL);
+                handle_uninhibit (manager, sender, cookie);
                 g_dbus_method_invocation_return_value (invocation, NULL);
         } else if (g_strcmp0 (method_name, "Throttle") == 0) {
                 g_dbus_method_invocation_return_value (invocation, NULL);
@@ -382,16 +571,10 @@ csd_screensaver_proxy_manager_start (CsdScreensaverProxyManager *manager,
 {
         g_debug ("Starting screensaver-proxy manager");
         cinnamon_settings_profile_start (NULL);
-        manager->priv->session =
-                cinnamon_settings_session_get_session_proxy ();
-        manager->priv->watch_ht = g_hash_table_new_full (g_str_hash,
-                                                         g_str_equal,
-                                                         (GDestroyNotify) g_free,
-                                                         (GDestroyNotify) g_bus_unwatch_name);
-        manager->priv->cookie_ht = g_hash_table_new_full (g_direct_hash,
-                                                          g_direct_equal,
-                                                          NULL,
-                                                          (GDestroyNotify) g_free);
+        manager->priv->senders = g_hash_table_new_full (g_str_hash,
+                                                        g_str_equal,
+                                                        (GDestroyNotify) g_free,
+                                                        NULL);
         cinnamon_settings_profile_end (NULL);
         return TRUE;
 }
@@ -401,19 +584,17 @@ csd_screensaver_proxy_manager_stop (CsdScreensaverProxyManager *manager)
 {
         g_debug ("Stopping screensaver_proxy manager");
 
-        if (manager->priv->session != NULL) {
-                g_object_unref (manager->priv->session);
-                manager->priv->session = NULL;
-        }
-
-        if (manager->priv->watch_ht != NULL) {
-                g_hash_table_destroy (manager->priv->watch_ht);
-                manager->priv->watch_ht = NULL;
-        }
+        if (manager->priv->senders != NULL) {
+                GHashTableIter iter;
+                ProxySender *proxy_sender;
 
-        if (manager->priv->cookie_ht != NULL) {
-                g_hash_table_destroy (manager->priv->cookie_ht);
-                manager->priv->cookie_ht = NULL;
+                g_hash_table_iter_init (&iter, manager->priv->senders);
+                while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &proxy_sender)) {
+                        g_hash_table_iter_steal (&iter);
+                        proxy_sender_free (manager, proxy_sender);
+                }
+                g_hash_table_destroy (manager->priv->senders);
+                manager->priv->senders = NULL;
         }
 }
 
@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <gudev/gudev.h>
 
@@ -78,14 +79,208 @@ get_led_sysfs_path (GUdevDevice *device,
 	return filename;
 }
 
+/* Finds the USB interface carrying the LEDs of the tablet at @path */
+static GUdevDevice *
+get_led_device (GUdevClient *client,
+		const char  *path)
+{
+	GUdevDevice *device, *parent;
+
+	device = g_udev_client_query_by_device_file (client, path);
+	if (device == NULL) {
+		g_debug ("Could not find device '%s' in udev database", path);
+		return NULL;
+	}
+
+	if (g_udev_device_get_property_as_boolean (device, "ID_INPUT_TABLET") == FALSE &&
+	    g_udev_device_get_property_as_boolean (device, "ID_INPUT_TOUCHPAD") == FALSE) {
+		g_debug ("Device '%s' is not a Wacom tablet", path);
+		g_object_unref (device);
+		return NULL;
+	}
+
+	if (g_strcmp0 (g_udev_device_get_property (device, "ID_BUS"), "usb") != 0) {
+		/* FIXME handle Bluetooth LEDs too */
+		g_debug ("Non-USB LEDs setting is not supported");
+		g_object_unref (device);
+		return NULL;
+	}
+
+	parent = g_udev_device_get_parent_with_subsystem (device, "usb", "usb_interface");
+	if (parent == NULL)
+		g_debug ("Could not find parent USB device for '%s'", path);
+	g_object_unref (device);
+
+	return parent;
+}
+
+/* Server mode: started once per session by the settings daemon, with
+ * the daemon's end of a socket as stdin. Each line is an LED update,
+ * "<group> <led> <device path>". Updates are collected until the input
+ * is drained and only the last one for each LED group gets written. */
+
+typedef struct {
+	GUdevClient *client;
+	GMainLoop   *loop;
+	GHashTable  *devices;  /* key = device path, value = usb_interface sysfs path, or "" */
+	GHashTable  *pending;  /* key = LED sysfs file, value = led + 1 */
+	guint        flush_id;
+} LedServer;
+
+static const char *
+server_get_sysfs_path (LedServer  *server,
+		       const char *path)
+{
+	GUdevDevice *device;
+	char *sysfs_path;
+
+	sysfs_path = g_hash_table_lookup (server->devices, path);
+	if (sysfs_path != NULL)
+		return sysfs_path[0] != '\0' ? sysfs_path : NULL;
+
+	device = get_led_device (server->client, path);
+	if (device != NULL) {
+		sysfs_path = g_strdup (g_udev_device_get_sysfs_path (device));
+		g_object_unref (device);
+	} else {
+		sysfs_path = g_strdup ("");
+	}
+	g_hash_table_insert (server->devices, g_strdup (path), sysfs_path);
+
+	return sysfs_path[0] != '\0' ? sysfs_path : NULL;
+}
+
+static gboolean
+server_flush (LedServer *server)
+{
+	GHashTableIter iter;
+	gpointer filename, value;
+	GError *error = NULL;
+
+	server->flush_id = 0;
+
+	g_hash_table_iter_init (&iter, server->pending);
+	while (g_hash_table_iter_next (&iter, &filename, &value)) {
+		gint led = GPOINTER_TO_INT (value) - 1;
+
+		if (csd_wacom_led_helper_write (filename, led, &error) == FALSE) {
+			g_debug ("Could not set LED status: %s", error->message);
+			g_clear_error (&error);
+			continue;
+		}
+
+		g_debug ("Successfully set %s to %d", (char *) filename, led);
+	}
+	g_hash_table_remove_all (server->pending);
+
+	/* Device nodes get reused when tablets are plugged in and out,
+	 * so the lookups are only good for one batch */
+	g_hash_table_remove_all (server->devices);
+
+	return FALSE;
+}
+
+static void
+server_handle_line (LedServer  *server,
+		    const char *line)
+{
+	const char *sysfs_path;
+	char *device_path;
+	char *filename;
+	char *status;
+	int group, led, offset;
+
+	if (sscanf (line, "%d %d %n", &group, &led, &offset) != 2 ||
+	    group < 0 || led < 0) {
+		g_debug ("Ignoring malformed request '%s'", line);
+		return;
+	}
+
+	device_path = g_strchomp (g_strdup (line + offset));
+	sysfs_path = server_get_sysfs_path (server, device_path);
+	g_free (device_path);
+	if (sysfs_path == NULL)
+		return;
+
+	status = g_strdup_printf ("status_led%d_select", group);
+	filename = g_build_filename (sysfs_path, "wacom_led", status, NULL);
+	g_free (status);
+
+	g_hash_table_insert (server->pending, filename, GINT_TO_POINTER (led + 1));
+}
+
+static gboolean
+server_input_cb (GIOChannel   *channel,
+		 GIOCondition  condition,
+		 LedServer    *server)
+{
+	GIOStatus status;
+	char *line;
+
+	do {
+		status = g_io_channel_read_line (channel, &line, NULL, NULL, NULL);
+		if (status != G_IO_STATUS_NORMAL)
+			break;
+		server_handle_line (server, line);
+		g_free (line);
+	} while (g_io_channel_get_buffer_condition (channel) & G_IO_IN);
+
+	/* Written once everything that is already queued has been read */
+	if (server->flush_id == 0 && g_hash_table_size (server->pending) > 0)
+		server->flush_id = g_idle_add ((GSourceFunc) server_flush, server);
+
+	if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR) {
+		g_debug ("Settings daemon went away, exiting");
+		g_main_loop_quit (server->loop);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int
+run_server (GUdevClient *client)
+{
+	LedServer server;
+	GIOChannel *channel;
+
+	server.client = client;
+	server.loop = g_main_loop_new (NULL, FALSE);
+	server.devices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	server.pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	server.flush_id = 0;
+
+	channel = g_io_channel_unix_new (STDIN_FILENO);
+	g_io_channel_set_encoding (channel, NULL, NULL);
+	g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+			(GIOFunc) server_input_cb, &server);
+
+	g_main_loop_run (server.loop);
+
+	/* Don't lose the last update */
+	if (server.flush_id != 0) {
+		g_source_remove (server.flush_id);
+		server_flush (&server);
+	}
+
+	g_io_channel_unref (channel);
+	g_hash_table_destroy (server.devices);
+	g_hash_table_destroy (server.pending);
+	g_main_loop_unref (server.loop);
+
+	return 0;
+}
+
 static char *path = NULL;
 static int group_num = -1;
 static int led_num = -1;
+static gboolean server_mode = FALSE;
 
 const GOptionEntry options[] = {
 	{ "path", '\0', 0, G_OPTION_ARG_FILENAME, &path, "Device path for the Wacom device", NULL },
 	{ "group", '\0', 0, G_OPTION_ARG_INT, &group_num, "Which LED group to set", NULL },
 	{ "led", '\0', 0, G_OPTION_ARG_INT, &led_num, "Which LED to set", NULL },
+	{ "server", '\0', 0, G_OPTION_ARG_NONE, &server_mode, "Read LED updates from stdin until it is closed", NULL },
 	{ NULL}
 };
 
@@ -94,8 +289,9 @@ int main (int argc, char **argv)
 {
 	GOptionContext *context;
 	GUdevClient *client;
-	GUdevDevice *device, *parent;
+	GUdevDevice *device;
 	int uid, euid;
+	int ret;
 	char *filename;
 	GError *error = NULL;
         const char * const subsystems[] = { "input", NULL };
@@ -113,9 +309,10 @@ int main (int argc, char **argv)
 	g_option_context_add_main_entries (context, options, NULL);
 	g_option_context_parse (context, &argc, &argv, NULL);
 
-	if (path == NULL ||
-	    group_num < 0 ||
-	    led_num < 0) {
+	if (!server_mode &&
+	    (path == NULL ||
+	     group_num < 0 ||
+	     led_num < 0)) {
 		char *txt;
 
 		txt = g_option_context_get_help (context, FALSE, NULL);
@@ -129,31 +326,16 @@ int main (int argc, char **argv)
 	g_option_context_free (context);
 
 	client = g_udev_client_new (subsystems);
-	device = g_udev_client_query_by_device_file (client, path);
-	if (device == NULL) {
-		g_debug ("Could not find device '%s' in udev database", path);
-		goto bail;
-	}
 
-	if (g_udev_device_get_property_as_boolean (device, "ID_INPUT_TABLET") == FALSE &&
-	    g_udev_device_get_property_as_boolean (device, "ID_INPUT_TOUCHPAD") == FALSE) {
-		g_debug ("Device '%s' is not a Wacom tablet", path);
-		goto bail;
-	}
-
-	if (g_strcmp0 (g_udev_device_get_property (device, "ID_BUS"), "usb") != 0) {
-		/* FIXME handle Bluetooth LEDs too */
-		g_debug ("Non-USB LEDs setting is not supported");
-		goto bail;
+	if (server_mode) {
+		ret = run_server (client);
+		g_object_unref (client);
+		return ret;
 	}
 
-	parent = g_udev_device_get_parent_with_subsystem (device, "usb", "usb_interface");
-	if (parent == NULL) {
-		g_debug ("Could not find parent USB device for '%s'", path);
+	device = get_led_device (client, path);
+	if (device == NULL)
 		goto bail;
-	}
-	g_object_unref (device);
-	device = parent;
 
 	filename = get_led_sysfs_path (device, group_num);
 	if (csd_wacom_led_helper_write (filename, led_num, &error) == FALSE) {
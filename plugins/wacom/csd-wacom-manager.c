@@ -28,10 +28,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
 
 #include <locale.h>
 
 #include <glib.h>
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
 #include <X11/Xatom.h>
@@ -72,6 +75,13 @@
 /* See "Wacom Pressure Threshold" */
 #define DEFAULT_PRESSURE_THRESHOLD 27
 
+/* LED updates are held back this long, so that cycling through the
+ * modes of a ring or strip only writes the mode it ends up in */
+#define LED_FLUSH_DELAY 50 /* ms */
+/* A helper that exits sooner than this after being started most likely
+ * was not authorized, so it isn't started again */
+#define LED_HELPER_MIN_LIFETIME 5 /* seconds */
+
 struct CsdWacomManagerPrivate
 {
         guint start_idle_id;
@@ -87,6 +97,17 @@ struct CsdWacomManagerPrivate
 
         /* Help OSD window */
         GtkWidget *osd_window;
+
+        /* LED helper */
+        GPid led_helper_pid;
+        int led_helper_fd;
+        gint64 led_helper_started;
+        gboolean led_helper_disabled;
+        guint led_helper_watch_id;
+        guint led_helper_write_id;
+        GString *led_buffer;
+        GHashTable *pending_leds; /* key = "<group> <path>", value = led + 1 */
+        guint led_flush_id;
 };
 
 static void     csd_wacom_manager_class_init  (CsdWacomManagerClass *klass);
@@ -545,15 +566,193 @@ apply_stylus_settings (CsdWacomDevice *device)
 }
 
 static void
-set_led (CsdWacomDevice       *device,
+led_helper_reap_cb (GPid     pid,
+                    gint     status,
+                    gpointer user_data)
+{
+        g_spawn_close_pid (pid);
+}
+
+static void
+led_helper_stop (CsdWacomManager *manager)
+{
+        CsdWacomManagerPrivate *p = manager->priv;
+
+        if (p->led_helper_write_id != 0) {
+                g_source_remove (p->led_helper_write_id);
+                p->led_helper_write_id = 0;
+        }
+        if (p->led_buffer != NULL)
+                g_string_truncate (p->led_buffer, 0);
+
+        if (p->led_helper_fd >= 0) {
+                /* The helper exits once it has read everything */
+                close (p->led_helper_fd);
+                p->led_helper_fd = -1;
+        }
+
+        if (p->led_helper_pid != 0) {
+                g_source_remove (p->led_helper_watch_id);
+                g_child_watch_add (p->led_helper_pid, led_helper_reap_cb, NULL);
+                p->led_helper_watch_id = 0;
+                p->led_helper_pid = 0;
+        }
+}
+
+static void
+led_helper_exited_cb (GPid             pid,
+                      gint             status,
+                      CsdWacomManager *manager)
+{
+        CsdWacomManagerPrivate *p = manager->priv;
+
+        g_spawn_close_pid (pid);
+        p->led_helper_watch_id = 0;
+        p->led_helper_pid = 0;
+
+        if (g_get_monotonic_time () - p->led_helper_started < LED_HELPER_MIN_LIFETIME * G_USEC_PER_SEC) {
+                g_warning ("The LED helper exited right away, not setting tablet LEDs anymore");
+                p->led_helper_disabled = TRUE;
+        } else {
+                g_debug ("The LED helper exited, it will be restarted when needed");
+        }
+
+        led_helper_stop (manager);
+}
+
+static void
+led_helper_child_setup (gpointer user_data)
+{
+        dup2 (GPOINTER_TO_INT (user_data), STDIN_FILENO);
+}
+
+/* Starts the helper once for the session, through pkexec, so that
+ * authorization only happens once. The helper reads updates from its
+ * end of a socket, and exits when we close ours. */
+static gboolean
+led_helper_start (CsdWacomManager *manager)
+{
+        CsdWacomManagerPrivate *p = manager->priv;
+        char *argv[] = { "pkexec", LIBEXECDIR "/csd-wacom-led-helper", "--server", NULL };
+        GError *error = NULL;
+        int fds[2];
+        gboolean ret;
+
+        if (p->led_helper_pid != 0)
+                return TRUE;
+        if (p->led_helper_disabled)
+                return FALSE;
+
+        if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+                g_warning ("Failed to create the LED helper socket: %s", g_strerror (errno));
+                return FALSE;
+        }
+
+        ret = g_spawn_async (NULL, argv, NULL,
+                             G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                             led_helper_child_setup, GINT_TO_POINTER (fds[1]),
+                             &p->led_helper_pid,
+                             &error);
+        close (fds[1]);
+
+        if (ret == FALSE) {
+                g_warning ("Failed to launch the LED helper: %s", error->message);
+                g_error_free (error);
+                close (fds[0]);
+                p->led_helper_pid = 0;
+                p->led_helper_disabled = TRUE;
+                return FALSE;
+        }
+
+        fcntl (fds[0], F_SETFL, fcntl (fds[0], F_GETFL) | O_NONBLOCK);
+        p->led_helper_fd = fds[0];
+        p->led_helper_started = g_get_monotonic_time ();
+        p->led_helper_watch_id = g_child_watch_add (p->led_helper_pid,
+                                                    (GChildWatchFunc) led_helper_exited_cb,
+                                                    manager);
+
+        return TRUE;
+}
+
+static gboolean flush_leds (CsdWacomManager *manager);
+
+static gboolean
+led_helper_write_cb (gint             fd,
+                     GIOCondition     condition,
+                     CsdWacomManager *manager)
+{
+        CsdWacomManagerPrivate *p = manager->priv;
+        ssize_t written;
+
+        written = send (fd, p->led_buffer->str, p->led_buffer->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                        return TRUE;
+
+                g_debug ("Failed to talk to the LED helper: %s", g_strerror (errno));
+                p->led_helper_write_id = 0;
+                led_helper_stop (manager);
+                return FALSE;
+        }
+
+        g_string_erase (p->led_buffer, 0, written);
+        if (p->led_buffer->len > 0)
+                return TRUE;
+
+        p->led_helper_write_id = 0;
+        if (p->led_flush_id == 0 && g_hash_table_size (p->pending_leds) > 0)
+                p->led_flush_id = g_idle_add ((GSourceFunc) flush_leds, manager);
+
+        return FALSE;
+}
+
+static gboolean
+flush_leds (CsdWacomManager *manager)
+{
+        CsdWacomManagerPrivate *p = manager->priv;
+        GHashTableIter iter;
+        gpointer key, value;
+
+        p->led_flush_id = 0;
+
+        /* Still busy with the previous batch, everything that comes in
+         * meanwhile gets folded into the next one */
+        if (p->led_helper_write_id != 0)
+                return FALSE;
+
+        if (!led_helper_start (manager)) {
+                g_hash_table_remove_all (p->pending_leds);
+                return FALSE;
+        }
+
+        g_hash_table_iter_init (&iter, p->pending_leds);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                const char *path;
+                int group;
+
+                group = atoi (key);
+                path = strchr (key, ' ') + 1;
+                g_string_append_printf (p->led_buffer, "%d %d %s\n",
+                                        group, GPOINTER_TO_INT (value) - 1, path);
+        }
+        g_hash_table_remove_all (p->pending_leds);
+
+        if (led_helper_write_cb (p->led_helper_fd, G_IO_OUT, manager))
+                p->led_helper_write_id = g_unix_fd_add (p->led_helper_fd, G_IO_OUT,
+                                                        (GUnixFDSourceFunc) led_helper_write_cb,
+                                                        manager);
+
+        return FALSE;
+}
+
+static void
+set_led (CsdWacomManager      *manager,
+	 CsdWacomDevice       *device,
 	 CsdWacomTabletButton *button,
 	 int                   index)
 {
-	GError *error = NULL;
 	const char *path;
-	char *command;
 	gint status_led;
-	gboolean ret;
 
 #ifndef HAVE_GUDEV
 	/* Not implemented on non-Linux systems */
@@ -571,20 +770,15 @@ set_led (CsdWacomDevice       *device,
 	}
 	g_debug ("Switching group ID %d to index %d for device %s", button->group_id, index, path);
 
-	command = g_strdup_printf ("pkexec " LIBEXECDIR "/csd-wacom-led-helper --path %s --group %d --led %d",
-				   path, status_led, index - 1);
-	ret = g_spawn_command_line_sync (command,
-					 NULL,
-					 NULL,
-					 NULL,
-					 &error);
-
-	if (ret == FALSE) {
-		g_debug ("Failed to launch '%s': %s", command, error->message);
-		g_error_free (error);
-	}
+	/* Only the last mode for each LED group gets sent */
+	g_hash_table_insert (manager->priv->pending_leds,
+			     g_strdup_printf ("%d %s", status_led, path),
+			     GINT_TO_POINTER (index));
 
-	g_free (command);
+	if (manager->priv->led_flush_id == 0)
+		manager->priv->led_flush_id = g_timeout_add (LED_FLUSH_DELAY,
+							     (GSourceFunc) flush_leds,
+							     manager);
 }
 
 struct DefaultButtons {
@@ -652,7 +846,8 @@ reset_touch_buttons (XDevice               *xdev,
 }
 
 static void
-reset_pad_buttons (CsdWacomDevice *device)
+reset_pad_buttons (CsdWacomManager *manager,
+                   CsdWacomDevice  *device)
 {
 	XDevice *xdev;
 	int nmap;
@@ -697,7 +892,7 @@ reset_pad_buttons (CsdWacomDevice *device)
 		CsdWacomTabletButton *button = l->data;
                 if (button->type == WACOM_TABLET_BUTTON_TYPE_HARDCODED &&
                     button->status_led != CSD_WACOM_NO_LED) {
-                        set_led (device, button, 1);
+                        set_led (manager, device, button, 1);
                 }
         }
         g_list_free (buttons);
@@ -744,7 +939,7 @@ set_wacom_settings (CsdWacomManager *manager,
 		int id;
 
 		id = get_device_id (device);
-		reset_pad_buttons (device);
+		reset_pad_buttons (manager, device);
 		grab_button (id, TRUE, manager->priv->screens);
 		return;
 	}
@@ -1279,7 +1474,7 @@ filter_button_events (XEvent          *xevent,
 			csd_wacom_osd_window_set_mode (CSD_WACOM_OSD_WINDOW(manager->priv->osd_window), wbutton->group_id, new_mode);
 			osd_window_update_viewable (manager, wbutton, dir, xiev);
                 }
-		set_led (device, wbutton, new_mode);
+		set_led (manager, device, wbutton, new_mode);
 		return GDK_FILTER_REMOVE;
 	}
 
@@ -1333,6 +1528,9 @@ static void
 csd_wacom_manager_init (CsdWacomManager *manager)
 {
         manager->priv = CSD_WACOM_MANAGER_GET_PRIVATE (manager);
+        manager->priv->led_helper_fd = -1;
+        manager->priv->led_buffer = g_string_new (NULL);
+        manager->priv->pending_leds = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static gboolean
@@ -1510,6 +1708,13 @@ csd_wacom_manager_stop (CsdWacomManager *manager)
 		g_signal_handlers_disconnect_by_func (l->data, on_screen_changed_cb, manager);
 
         g_clear_pointer (&p->osd_window, gtk_widget_destroy);
+
+        if (p->led_flush_id != 0) {
+                g_source_remove (p->led_flush_id);
+                p->led_flush_id = 0;
+        }
+        g_hash_table_remove_all (p->pending_leds);
+        led_helper_stop (manager);
 }
 
 static void
@@ -1544,6 +1749,9 @@ csd_wacom_manager_finalize (GObject *object)
             wacom_manager->priv->start_idle_id = 0;
         }
 
+        g_hash_table_destroy (wacom_manager->priv->pending_leds);
+        g_string_free (wacom_manager->priv->led_buffer, TRUE);
+
         G_OBJECT_CLASS (csd_wacom_manager_parent_class)->finalize (object);
 }
 